@@ -28,7 +28,7 @@ int main(int argc, char** argv)
     Bld_Cmd libraries = {0};
     bld_command_append(&libraries, "-Ldependencies/GLFW/lib");
     bld_command_append(&libraries, "-l:libglfw3.a", "-lvulkan");
-    bld_command_append(&libraries, "-lm");
+    bld_command_append(&libraries, "-lm", "-lpthread");
     if(!bld_link_program(&mainProgram, libraries, "main")) return 1;
 
     bld_end();
@@ -1,5 +1,8 @@
 #include "filesystem.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -29,3 +32,42 @@ bool file_read_all(const char* filepath, char** data, size_t* size)
     (*data)[*size] = '\0';
     return true;
 }
+
+bool file_map(const char* filepath, const uint8_t** data, size_t* size)
+{
+    int file = open(filepath, O_RDONLY);
+    if(file < 0)
+    {
+        printf("[ERROR] File map open: %s\n", filepath);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(file, &st) != 0 || st.st_size == 0)
+    {
+        printf("[ERROR] File map empty: %s\n", filepath);
+        close(file);
+        return false;
+    }
+
+    *size = (size_t) st.st_size;
+    void* map = mmap(NULL, *size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+
+    if(map == MAP_FAILED)
+    {
+        printf("[ERROR] File map: %s\n", filepath);
+        return false;
+    }
+
+    // Read front to back by the parsers, the kernel reads ahead
+    madvise(map, *size, MADV_SEQUENTIAL);
+
+    *data = (const uint8_t*) map;
+    return true;
+}
+
+void file_unmap(const uint8_t* data, size_t size)
+{
+    munmap((void*) data, size);
+}
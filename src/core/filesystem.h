@@ -3,9 +3,15 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 bool file_exists(const char* filepath);
 
 bool file_read_all(const char* filepath, char** data, size_t* size);
 
+// Read only shared map of the whole file, the pages are read on first touch instead of copied up front
+bool file_map(const char* filepath, const uint8_t** data, size_t* size);
+
+void file_unmap(const uint8_t* data, size_t size);
+
 #endif // FILESYSTEM_H_
@@ -0,0 +1,708 @@
+#include "jobs.h"
+
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <math.h>
+
+// Jobs made by a thread without a malloc, a slot still in use falls back to one
+#define JOBS_RING_SIZE 1024
+
+// Failed searches for a job before an idle worker goes to sleep
+#define JOBS_SPIN_COUNT 64
+
+#define JOBS_CACHE_LINE 64
+
+typedef struct Job {
+    JobFunction      function;
+    JobRangeFunction range;
+    void*            data;
+    uint32_t         begin, end, grain;
+
+    JobCounter*  counter;
+    struct Job*  next; // In the waiters of a counter
+    bool         heap;
+    atomic_bool  busy; // Ring slot in use
+} Job;
+
+// Chase-Lev deque, the owner pushes and pops at the bottom, the thieves take from the top
+typedef struct {
+    _Alignas(JOBS_CACHE_LINE) atomic_llong top;
+    _Alignas(JOBS_CACHE_LINE) atomic_llong bottom;
+    _Alignas(JOBS_CACHE_LINE) _Atomic(Job*) items[JOBS_DEQUE_SIZE];
+} JobDeque;
+
+typedef struct {
+    JobDeque  deque;
+    Job       ring[JOBS_RING_SIZE];
+    uint32_t  ringNext;
+    uint32_t  random;
+    pthread_t thread;
+    bool      started;
+} JobWorker;
+
+// Worker 0 is the thread of jobs_init
+static JobWorker* jobWorkers = NULL;
+static uint32_t   jobThreadCount = 0;
+
+static _Thread_local JobWorker* jobWorker = NULL;
+
+static atomic_uint jobPending;  // Pushed and not taken yet
+static atomic_uint jobSleeping;
+static atomic_uint jobStolen;
+static atomic_bool jobStop;
+
+static pthread_mutex_t jobMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  jobWake  = PTHREAD_COND_INITIALIZER;
+
+static bool jobs_deque_push(JobDeque* deque, Job* job)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long long top    = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if(bottom - top >= JOBS_DEQUE_SIZE)
+        return false;
+
+    atomic_store_explicit(&deque->items[bottom & (JOBS_DEQUE_SIZE - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+static Job* jobs_deque_pop(JobDeque* deque)
+{
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if(top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Job* job = atomic_load_explicit(&deque->items[bottom & (JOBS_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if(top == bottom)
+    {
+        // Last job, raced against the thieves for it
+        if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+            job = NULL;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return job;
+}
+
+static Job* jobs_deque_steal(JobDeque* deque)
+{
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if(top >= bottom)
+        return NULL;
+
+    Job* job = atomic_load_explicit(&deque->items[top & (JOBS_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+        memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return job;
+}
+
+static Job* jobs_alloc()
+{
+    // Only the owner takes slots of its ring, any thread gives them back
+    if(jobWorker != NULL)
+    {
+        Job* job = &jobWorker->ring[jobWorker->ringNext++ & (JOBS_RING_SIZE - 1)];
+        if(!atomic_load_explicit(&job->busy, memory_order_acquire))
+        {
+            atomic_store_explicit(&job->busy, true, memory_order_relaxed);
+            job->heap = false;
+            return job;
+        }
+    }
+
+    Job* job = (Job*) malloc(sizeof(Job));
+    if(job == NULL)
+        return NULL;
+
+    job->heap = true;
+    atomic_init(&job->busy, true);
+    return job;
+}
+
+static void jobs_free(Job* job)
+{
+    if(job->heap)
+        free(job);
+    else
+        atomic_store_explicit(&job->busy, false, memory_order_release);
+}
+
+static void jobs_execute(Job* job);
+
+static void jobs_push(Job* job)
+{
+    if(jobWorker == NULL || !jobs_deque_push(&jobWorker->deque, job))
+    {
+        jobs_execute(job);
+        return;
+    }
+
+    atomic_fetch_add(&jobPending, 1);
+    if(atomic_load(&jobSleeping) > 0)
+    {
+        pthread_mutex_lock(&jobMutex);
+        pthread_cond_signal(&jobWake);
+        pthread_mutex_unlock(&jobMutex);
+    }
+}
+
+// Own jobs first, then the oldest job of every other thread starting from a random one
+static Job* jobs_find(JobWorker* worker)
+{
+    Job* job = jobs_deque_pop(&worker->deque);
+    if(job == NULL)
+    {
+        worker->random ^= worker->random << 13;
+        worker->random ^= worker->random >> 17;
+        worker->random ^= worker->random << 5;
+
+        uint32_t first = worker->random % jobThreadCount;
+        for(uint32_t i = 0; i < jobThreadCount && job == NULL; ++i)
+        {
+            JobWorker* victim = &jobWorkers[(first + i) % jobThreadCount];
+            if(victim != worker)
+                job = jobs_deque_steal(&victim->deque);
+        }
+
+        if(job != NULL)
+            atomic_fetch_add_explicit(&jobStolen, 1, memory_order_relaxed);
+    }
+
+    if(job != NULL)
+        atomic_fetch_sub(&jobPending, 1);
+    return job;
+}
+
+// Queues the waiters of a counter down to zero, both its last job and jobs_run_after come here
+static void jobs_flush_waiters(JobCounter* counter)
+{
+    Job* job = atomic_exchange(&counter->waiters, NULL);
+    while(job != NULL)
+    {
+        Job* next = job->next;
+        jobs_push(job);
+        job = next;
+    }
+}
+
+static void jobs_finish(JobCounter* counter)
+{
+    atomic_fetch_add(&counter->active, 1);
+    if(atomic_fetch_sub(&counter->count, 1) == 1)
+        jobs_flush_waiters(counter);
+    atomic_fetch_sub(&counter->active, 1);
+}
+
+static void jobs_execute(Job* job)
+{
+    if(job->range != NULL)
+    {
+        // The right halves go to the deque for the thieves, the left one stays here
+        uint32_t begin = job->begin, end = job->end;
+        while(end - begin > job->grain)
+        {
+            uint32_t middle = begin + (end - begin) / 2;
+
+            Job* half = jobs_alloc();
+            if(half == NULL)
+                break;
+
+            half->function = NULL;
+            half->range    = job->range;
+            half->data     = job->data;
+            half->begin    = middle;
+            half->end      = end;
+            half->grain    = job->grain;
+            half->counter  = job->counter;
+            atomic_fetch_add(&job->counter->count, 1);
+            jobs_push(half);
+
+            end = middle;
+        }
+
+        job->range(begin, end, job->data);
+    }
+    else
+        job->function(job->data);
+
+    JobCounter* counter = job->counter;
+    jobs_free(job);
+
+    if(counter != NULL)
+        jobs_finish(counter);
+}
+
+static void* jobs_worker_run(void* arg)
+{
+    JobWorker* worker = (JobWorker*) arg;
+    jobWorker = worker;
+
+    uint32_t idle = 0;
+    for(;;)
+    {
+        Job* job = jobs_find(worker);
+        if(job != NULL)
+        {
+            jobs_execute(job);
+            idle = 0;
+            continue;
+        }
+
+        if(atomic_load(&jobStop))
+            break;
+
+        if(++idle < JOBS_SPIN_COUNT)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // A push after the sleeping count went up signals, one before it is seen in jobPending
+        pthread_mutex_lock(&jobMutex);
+        atomic_fetch_add(&jobSleeping, 1);
+        while(atomic_load(&jobPending) == 0 && !atomic_load(&jobStop))
+            pthread_cond_wait(&jobWake, &jobMutex);
+        atomic_fetch_sub(&jobSleeping, 1);
+        pthread_mutex_unlock(&jobMutex);
+
+        idle = 0;
+    }
+
+    jobWorker = NULL;
+    return NULL;
+}
+
+bool jobs_init(uint32_t threadCount)
+{
+    ASSERT(jobWorkers == NULL);
+
+    if(threadCount == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cores > 0 ? (uint32_t) cores : 1;
+    }
+
+    if(threadCount > JOBS_MAX_THREADS)
+        threadCount = JOBS_MAX_THREADS;
+
+    void* workers;
+    if(posix_memalign(&workers, JOBS_CACHE_LINE, threadCount * sizeof(JobWorker)) != 0)
+        return false;
+
+    jobWorkers = (JobWorker*) workers;
+    memset(jobWorkers, 0, threadCount * sizeof(JobWorker));
+    jobThreadCount = threadCount;
+
+    atomic_store(&jobPending, 0);
+    atomic_store(&jobSleeping, 0);
+    atomic_store(&jobStolen, 0);
+    atomic_store(&jobStop, false);
+
+    for(uint32_t i = 0; i < threadCount; ++i)
+        jobWorkers[i].random = 0x9E3779B9u * (i + 1);
+
+    jobWorker = &jobWorkers[0];
+
+    for(uint32_t i = 1; i < threadCount; ++i)
+    {
+        jobWorkers[i].started = pthread_create(&jobWorkers[i].thread, NULL, jobs_worker_run, &jobWorkers[i]) == 0;
+        if(!jobWorkers[i].started)
+        {
+            log_error("Jobs failed to start worker %u", i);
+            jobs_destroy();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void jobs_destroy()
+{
+    if(jobWorkers == NULL)
+        return;
+
+    // Helps with the jobs left, the workers stop once they find none
+    Job* job;
+    while(atomic_load(&jobPending) > 0)
+        if((job = jobs_find(jobWorker)) != NULL)
+            jobs_execute(job);
+
+    pthread_mutex_lock(&jobMutex);
+    atomic_store(&jobStop, true);
+    pthread_cond_broadcast(&jobWake);
+    pthread_mutex_unlock(&jobMutex);
+
+    for(uint32_t i = 1; i < jobThreadCount; ++i)
+        if(jobWorkers[i].started)
+            pthread_join(jobWorkers[i].thread, NULL);
+
+    // Pushed by jobs still running when the workers stopped
+    while((job = jobs_find(jobWorker)) != NULL)
+        jobs_execute(job);
+
+    jobWorker = NULL;
+
+    free(jobWorkers);
+    jobWorkers = NULL;
+    jobThreadCount = 0;
+}
+
+uint32_t jobs_thread_count()
+{
+    return jobThreadCount > 0 ? jobThreadCount : 1;
+}
+
+void jobs_run(JobFunction function, void* data, JobCounter* counter)
+{
+    if(counter != NULL)
+        atomic_fetch_add(&counter->count, 1);
+
+    Job* job = jobs_alloc();
+    if(job == NULL)
+    {
+        Job direct = { .function = function, .data = data, .counter = counter };
+        jobs_execute(&direct);
+        return;
+    }
+
+    job->function = function;
+    job->range    = NULL;
+    job->data     = data;
+    job->counter  = counter;
+    jobs_push(job);
+}
+
+void jobs_run_after(JobFunction function, void* data, JobCounter* counter, JobCounter* dependency)
+{
+    if(counter != NULL)
+        atomic_fetch_add(&counter->count, 1);
+
+    Job* job = jobs_alloc();
+    if(job == NULL)
+    {
+        jobs_wait(dependency);
+
+        Job direct = { .function = function, .data = data, .counter = counter };
+        jobs_execute(&direct);
+        return;
+    }
+
+    job->function = function;
+    job->range    = NULL;
+    job->data     = data;
+    job->counter  = counter;
+
+    atomic_fetch_add(&dependency->active, 1);
+
+    job->next = atomic_load(&dependency->waiters);
+    while(!atomic_compare_exchange_weak(&dependency->waiters, &job->next, job));
+
+    // Its last job may have flushed the waiters before this one got in
+    if(atomic_load(&dependency->count) == 0)
+        jobs_flush_waiters(dependency);
+
+    atomic_fetch_sub(&dependency->active, 1);
+}
+
+void jobs_wait(JobCounter* counter)
+{
+    while(atomic_load(&counter->count) > 0 || atomic_load(&counter->active) > 0)
+    {
+        Job* job = jobWorker != NULL ? jobs_find(jobWorker) : NULL;
+        if(job != NULL)
+            jobs_execute(job);
+        else
+            sched_yield();
+    }
+}
+
+void jobs_parallel_for(uint32_t count, uint32_t grain, JobRangeFunction function, void* data)
+{
+    if(count == 0)
+        return;
+
+    if(jobWorker == NULL)
+    {
+        function(0, count, data);
+        return;
+    }
+
+    if(grain == 0)
+        grain = count / (jobs_thread_count() * 8);
+    if(grain == 0)
+        grain = 1;
+
+    JobCounter counter = {0};
+    atomic_store(&counter.count, 1);
+
+    Job job = {
+        .range   = function,
+        .data    = data,
+        .begin   = 0,
+        .end     = count,
+        .grain   = grain,
+        .counter = &counter,
+    };
+    jobs_execute(&job);
+    jobs_wait(&counter);
+}
+
+typedef struct {
+    atomic_uint* hits;
+    atomic_uint  count;
+} JobsStress;
+
+typedef struct {
+    JobsStress* stress;
+    JobCounter* counter;
+    uint32_t    depth;
+} JobsTreeNode;
+
+typedef struct {
+    atomic_uint* done;      // Jobs done in every stage
+    uint32_t     stage;
+    uint32_t     stageJobs;
+    atomic_uint* violations;
+} JobsStage;
+
+typedef struct {
+    float* results;
+    uint32_t iterations;
+} JobsWork;
+
+static void jobs_stress_hit(void* data)
+{
+    atomic_fetch_add_explicit((atomic_uint*) data, 1, memory_order_relaxed);
+}
+
+static void jobs_stress_range(uint32_t begin, uint32_t end, void* data)
+{
+    JobsStress* stress = (JobsStress*) data;
+    for(uint32_t i = begin; i < end; ++i)
+        atomic_fetch_add_explicit(&stress->hits[i], 1, memory_order_relaxed);
+}
+
+// Binary tree of jobs, every node spawns its two children
+static void jobs_stress_tree(void* data)
+{
+    JobsTreeNode* node = (JobsTreeNode*) data;
+    atomic_fetch_add_explicit(&node->stress->count, 1, memory_order_relaxed);
+
+    if(node->depth == 0)
+    {
+        free(node);
+        return;
+    }
+
+    for(uint32_t i = 0; i < 2; ++i)
+    {
+        JobsTreeNode* child = (JobsTreeNode*) malloc(sizeof(JobsTreeNode));
+        if(child == NULL)
+            continue;
+
+        *child = (JobsTreeNode) { node->stress, node->counter, node->depth - 1 };
+        jobs_run(jobs_stress_tree, child, node->counter);
+    }
+
+    free(node);
+}
+
+// Every job of a stage has to see the whole previous stage done
+static void jobs_stress_stage(void* data)
+{
+    JobsStage* stage = (JobsStage*) data;
+    if(stage->stage > 0 && atomic_load(&stage->done[stage->stage - 1]) != stage->stageJobs)
+        atomic_fetch_add(stage->violations, 1);
+
+    atomic_fetch_add(&stage->done[stage->stage], 1);
+}
+
+static void jobs_work_range(uint32_t begin, uint32_t end, void* data)
+{
+    JobsWork* work = (JobsWork*) data;
+    for(uint32_t i = begin; i < end; ++i)
+    {
+        float v = (float) i;
+        for(uint32_t j = 0; j < work->iterations; ++j)
+            v = sinf(v) * 0.5f + cosf(v * 1.3f + (float) j);
+        work->results[i] = v;
+    }
+}
+
+// Indices hit other than once
+static uint32_t jobs_stress_misses(atomic_uint* hits, uint32_t count)
+{
+    uint32_t misses = 0;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        misses += atomic_load(&hits[i]) != 1;
+        atomic_store(&hits[i], 0);
+    }
+    return misses;
+}
+
+static uint32_t jobs_stress(uint32_t rounds)
+{
+    const uint32_t jobCount = 1 << 16, treeDepth = 14, stageCount = 16, stageJobs = 256;
+    const uint32_t forCounts[] = { 1, 3, 1000, 1 << 18 };
+    const uint32_t forGrains[] = { 0, 1, 7, 4096 };
+
+    uint32_t failures = 0;
+
+    atomic_uint* hits = (atomic_uint*) calloc(1 << 18, sizeof(atomic_uint));
+    JobsStage* stages = (JobsStage*) malloc(stageCount * stageJobs * sizeof(JobsStage));
+    if(hits == NULL || stages == NULL)
+    {
+        free(hits);
+        free(stages);
+        return 1;
+    }
+
+    JobsStress stress = { .hits = hits };
+
+    for(uint32_t round = 0; round < rounds; ++round)
+    {
+        // Far more jobs than a deque holds, the overflow runs inline
+        JobCounter counter = {0};
+        for(uint32_t i = 0; i < jobCount; ++i)
+            jobs_run(jobs_stress_hit, &hits[i], &counter);
+        jobs_wait(&counter);
+        failures += jobs_stress_misses(hits, jobCount);
+
+        // Jobs spawning jobs on the same counter
+        atomic_store(&stress.count, 0);
+        JobsTreeNode* root = (JobsTreeNode*) malloc(sizeof(JobsTreeNode));
+        if(root != NULL)
+        {
+            *root = (JobsTreeNode) { &stress, &counter, treeDepth };
+            jobs_run(jobs_stress_tree, root, &counter);
+            jobs_wait(&counter);
+        }
+        failures += atomic_load(&stress.count) != (2u << treeDepth) - 1;
+
+        // Chained stages, each one after the counter of the previous
+        JobCounter stageCounters[16] = {0};
+        atomic_uint done[16] = {0};
+        atomic_uint violations = 0;
+        for(uint32_t s = 0; s < stageCount; ++s)
+            for(uint32_t i = 0; i < stageJobs; ++i)
+            {
+                JobsStage* stage = &stages[s * stageJobs + i];
+                *stage = (JobsStage) { done, s, stageJobs, &violations };
+
+                if(s == 0)
+                    jobs_run(jobs_stress_stage, stage, &stageCounters[s]);
+                else
+                    jobs_run_after(jobs_stress_stage, stage, &stageCounters[s], &stageCounters[s - 1]);
+            }
+        for(uint32_t s = 0; s < stageCount; ++s)
+            jobs_wait(&stageCounters[s]);
+        failures += atomic_load(&violations) + (atomic_load(&done[stageCount - 1]) != stageJobs);
+
+        for(uint32_t c = 0; c < ARRAYLEN(forCounts); ++c)
+        {
+            jobs_parallel_for(forCounts[c], forGrains[(round + c) % ARRAYLEN(forGrains)], jobs_stress_range, &stress);
+            failures += jobs_stress_misses(hits, forCounts[c]);
+        }
+    }
+
+    free(stages);
+    free(hits);
+    return failures;
+}
+
+bool jobs_benchmark()
+{
+    char timeStr[64];
+    Timer t;
+
+    bool pooled = jobWorkers != NULL;
+    uint32_t poolThreads = jobs_thread_count();
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t maxThreads = cores > 0 ? (uint32_t) cores : 1;
+    if(maxThreads > JOBS_MAX_THREADS)
+        maxThreads = JOBS_MAX_THREADS;
+
+    log_info("Jobs benchmark, %u threads:", maxThreads);
+
+    bool result = true;
+
+    JobsWork work = { .iterations = 256 };
+    const uint32_t itemCount = 1 << 14;
+    float* reference = (float*) malloc(itemCount * sizeof(float));
+    work.results     = (float*) malloc(itemCount * sizeof(float));
+    if(reference == NULL || work.results == NULL)
+    {
+        free(reference);
+        free(work.results);
+        return false;
+    }
+
+    double singleNs = 0.0;
+    for(uint32_t threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads)
+    {
+        jobs_destroy();
+        if(!jobs_init(threads))
+        {
+            result = false;
+            break;
+        }
+
+        timer_start(&t);
+        uint32_t failures = jobs_stress(8);
+        timer_stop(&t);
+        time_to_str(timeStr, timer_get_ns(&t));
+        log_info("    %2u threads stress   %s, %u failures", threads, timeStr, failures);
+        result = result && failures == 0;
+
+        atomic_store(&jobStolen, 0);
+        timer_start(&t);
+        jobs_parallel_for(itemCount, 0, jobs_work_range, &work);
+        timer_stop(&t);
+
+        double ns = timer_get_ns(&t);
+        if(threads == 1)
+        {
+            singleNs = ns;
+            memcpy(reference, work.results, itemCount * sizeof(float));
+        }
+
+        uint32_t mismatches = (uint32_t) (memcmp(reference, work.results, itemCount * sizeof(float)) != 0);
+        result = result && mismatches == 0;
+
+        time_to_str(timeStr, ns);
+        log_info("    %2u threads parallel %s, %.2fx, %u steals, %u mismatches", threads, timeStr, singleNs / ns,
+            atomic_load(&jobStolen), mismatches);
+
+        if(threads == maxThreads)
+            break;
+    }
+
+    free(reference);
+    free(work.results);
+
+    jobs_destroy();
+    return (!pooled || jobs_init(poolThreads)) && result;
+}
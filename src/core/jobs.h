@@ -0,0 +1,71 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Work stealing thread pool shared by the engine. Every worker and the thread that called
+ *  jobs_init own a Chase-Lev deque: they push and pop their own jobs at the bottom, LIFO
+ *  so the data they just touched stays in cache, the idle ones steal the oldest, largest
+ *  jobs from the top of a random victim. Idle workers spin for a while then sleep until
+ *  jobs are pushed again.
+ *
+ *  Completion is tracked through counters: jobs_run adds one to its counter, the job takes
+ *  it back once its function returned. jobs_run_after queues a job only once another counter
+ *  is down to zero, chaining counters makes dependency graphs. jobs_wait runs jobs on the
+ *  waiting thread until its counter is down to zero, the calling thread works instead of
+ *  blocking. jobs_parallel_for splits an index range in halves until they reach the grain,
+ *  the halves left behind are the ones stolen.
+ *
+ *  Threads outside the pool, and every thread before jobs_init, run their jobs inline.
+ */
+
+#define JOBS_MAX_THREADS 32
+
+// Per thread, jobs past it run inline
+#define JOBS_DEQUE_SIZE 4096
+
+typedef void (*JobFunction)(void* data);
+
+// Indices [begin, end) of a jobs_parallel_for
+typedef void (*JobRangeFunction)(uint32_t begin, uint32_t end, void* data);
+
+struct Job;
+
+// Zero initialized counters are ready to use
+typedef struct {
+    atomic_uint          count;   // Jobs not done yet
+    atomic_uint          active;  // Threads still touching the counter after their job, jobs_wait waits for them
+    _Atomic(struct Job*) waiters; // Jobs queued by jobs_run_after until count is down to zero
+} JobCounter;
+
+// threadCount includes the calling thread, 0 for one per core
+bool jobs_init(uint32_t threadCount);
+
+// Waits for the jobs left and stops the workers
+void jobs_destroy();
+
+// Workers and the thread that called jobs_init, 1 without the pool
+uint32_t jobs_thread_count();
+
+// counter can be NULL for jobs nobody waits on
+void jobs_run(JobFunction function, void* data, JobCounter* counter);
+
+// Queued once dependency is down to zero, counter counts it from now on. dependency has to outlive the call
+// to jobs_wait on it or on the counters of its waiters
+void jobs_run_after(JobFunction function, void* data, JobCounter* counter, JobCounter* dependency);
+
+// Runs jobs until counter is down to zero
+void jobs_wait(JobCounter* counter);
+
+// Calls function over [0, count) in ranges of at most grain indices, 0 for about 8 ranges per thread.
+// Returns once every range is done
+void jobs_parallel_for(uint32_t count, uint32_t grain, JobRangeFunction function, void* data);
+
+// Stress tests of the deques, counters, dependencies and parallel for, then parallel for scaling over 1 to
+// every thread. Restarts the pool at every thread count, the calling thread must be the one of jobs_init
+bool jobs_benchmark();
+
+#endif // JOBS_H_
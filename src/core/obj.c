@@ -0,0 +1,839 @@
+#include "obj.h"
+
+#include "core/filesystem.h"
+#include "core/jobs.h"
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+// Bytes per range of the passes, each one runs to the end of its last line
+#define OBJ_RANGE_BYTES (1u << 16)
+
+// Corner without a texture coordinate
+#define OBJ_NONE UINT32_MAX
+
+typedef enum {
+    OBJ_LINE_OTHER,
+    OBJ_LINE_POSITION,
+    OBJ_LINE_TEXCOORD,
+    OBJ_LINE_NORMAL,
+    OBJ_LINE_FACE,
+} ObjLine;
+
+typedef struct {
+    const char* begin;
+    const char* end;
+
+    // Lines of the range, then triangle corners of its faces
+    uint32_t positionCount, texCoordCount, normalCount, cornerCount;
+
+    // Of the ranges before, where the range writes
+    uint32_t positionFirst, texCoordFirst, normalFirst, cornerFirst;
+
+    const char* error; // First invalid line
+} ObjRange;
+
+typedef struct {
+    ObjRange* ranges;
+    uint32_t  rangeCount;
+
+    float*    positions; // xyz
+    float*    texCoords; // uv
+    uint32_t* corners;   // Position and texture coordinate of every triangle corner
+
+    uint32_t positionCount, texCoordCount, normalCount, cornerCount;
+} ObjParse;
+
+static const double objPowers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool obj_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool obj_is_digit(char c)
+{
+    return (uint8_t) (c - '0') < 10;
+}
+
+static inline const char* obj_skip_spaces(const char* p, const char* end)
+{
+    while(p < end && obj_is_space(*p))
+        ++p;
+    return p;
+}
+
+static inline const char* obj_line_end(const char* p, const char* end)
+{
+    const char* newline = (const char*) memchr(p, '\n', (size_t) (end - p));
+    return newline != NULL ? newline : end;
+}
+
+// Comments end the line
+static inline bool obj_at_end(const char* p, const char* end)
+{
+    return p == end || *p == '#';
+}
+
+static ObjLine obj_line_type(const char* p, const char* end)
+{
+    size_t length = (size_t) (end - p);
+    if(length >= 2 && p[0] == 'v' && obj_is_space(p[1]))
+        return OBJ_LINE_POSITION;
+    if(length >= 3 && p[0] == 'v' && obj_is_space(p[2]))
+        return p[1] == 't' ? OBJ_LINE_TEXCOORD : p[1] == 'n' ? OBJ_LINE_NORMAL : OBJ_LINE_OTHER;
+    if(length >= 2 && p[0] == 'f' && obj_is_space(p[1]))
+        return OBJ_LINE_FACE;
+    return OBJ_LINE_OTHER;
+}
+
+// Decimal with an optional fraction and exponent. Up to 19 significant digits go to the mantissa, then one
+// multiply or divide by an exact power of ten, within a float ulp of strtof
+static bool obj_parse_float(const char** cursor, const char* end, float* value)
+{
+    const char* p = *cursor;
+
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    uint32_t digits = 0, significant = 0;
+    for(; p < end && obj_is_digit(*p); ++p, ++digits)
+    {
+        if(significant < 19)
+        {
+            mantissa = mantissa * 10 + (uint8_t) (*p - '0');
+            significant += mantissa != 0;
+        }
+        else
+            ++exponent;
+    }
+
+    if(p < end && *p == '.')
+    {
+        for(++p; p < end && obj_is_digit(*p); ++p, ++digits)
+        {
+            if(significant < 19)
+            {
+                mantissa = mantissa * 10 + (uint8_t) (*p - '0');
+                significant += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+
+    if(digits == 0)
+        return false;
+
+    if(p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+
+        bool negativeExponent = false;
+        if(p < end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+
+        const char* first = p;
+        int32_t e = 0;
+        for(; p < end && obj_is_digit(*p); ++p)
+            if(e < 10000)
+                e = e * 10 + (*p - '0');
+
+        if(p == first)
+            return false;
+
+        exponent += negativeExponent ? -e : e;
+    }
+
+    if(p < end && !obj_is_space(*p))
+        return false;
+
+    double v = (double) mantissa;
+    if(exponent < 0)
+    {
+        for(; exponent < -22; exponent += 22)
+            v /= 1e22;
+        v /= objPowers[-exponent];
+    }
+    else
+    {
+        for(; exponent > 22; exponent -= 22)
+            v *= 1e22;
+        v *= objPowers[exponent];
+    }
+
+    *value  = (float) (negative ? -v : v);
+    *cursor = p;
+    return true;
+}
+
+static bool obj_parse_floats(const char* p, const char* end, float* values, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        p = obj_skip_spaces(p, end);
+        if(!obj_parse_float(&p, end, &values[i]))
+            return false;
+    }
+    return true;
+}
+
+// 1 based index, or negative from the last element seen, to a 0 based one below count
+static bool obj_parse_index(const char** cursor, const char* end, uint32_t seen, uint32_t count, uint32_t* index)
+{
+    const char* p = *cursor;
+
+    bool negative = p < end && *p == '-';
+    p += negative;
+
+    const char* first = p;
+    uint64_t value = 0;
+    for(; p < end && obj_is_digit(*p) && value <= UINT32_MAX; ++p)
+        value = value * 10 + (uint8_t) (*p - '0');
+
+    if(p == first || value == 0 || (negative ? value > seen : value > count))
+        return false;
+
+    *index  = negative ? seen - (uint32_t) value : (uint32_t) value - 1;
+    *cursor = p;
+    return true;
+}
+
+// Counts of the lines before the face, for its negative indices
+typedef struct {
+    uint32_t positions, texCoords, normals;
+} ObjSeen;
+
+// v, v/vt, v//vn or v/vt/vn
+static bool obj_parse_corner(const char** cursor, const char* end, const ObjParse* parse, ObjSeen seen,
+    uint32_t corner[2])
+{
+    const char* p = *cursor;
+
+    if(!obj_parse_index(&p, end, seen.positions, parse->positionCount, &corner[0]))
+        return false;
+
+    corner[1] = OBJ_NONE;
+    if(p < end && *p == '/')
+    {
+        ++p;
+        if(p < end && *p != '/' && !obj_parse_index(&p, end, seen.texCoords, parse->texCoordCount, &corner[1]))
+            return false;
+
+        if(p < end && *p == '/')
+        {
+            ++p;
+
+            uint32_t normal;
+            if(!obj_parse_index(&p, end, seen.normals, parse->normalCount, &normal))
+                return false;
+        }
+    }
+
+    if(p < end && !obj_is_space(*p))
+        return false;
+
+    *cursor = p;
+    return true;
+}
+
+// Fans the face into triangles, as many as its corners the first pass counted minus two
+static bool obj_parse_face(const char* p, const char* end, const ObjParse* parse, ObjSeen seen, uint32_t** corners)
+{
+    uint32_t first[2], previous[2], corner[2];
+    uint32_t count = 0;
+    for(p = obj_skip_spaces(p, end); !obj_at_end(p, end); p = obj_skip_spaces(p, end), ++count)
+    {
+        if(!obj_parse_corner(&p, end, parse, seen, corner))
+            return false;
+
+        if(count == 0)
+            memcpy(first, corner, sizeof(first));
+        else if(count >= 2)
+        {
+            uint32_t* out = *corners;
+            out[0] = first[0];    out[1] = first[1];
+            out[2] = previous[0]; out[3] = previous[1];
+            out[4] = corner[0];   out[5] = corner[1];
+            *corners += 6;
+        }
+        memcpy(previous, corner, sizeof(previous));
+    }
+    return count >= 3;
+}
+
+static void obj_count(uint32_t begin, uint32_t end, void* data)
+{
+    ObjParse* parse = (ObjParse*) data;
+    for(uint32_t r = begin; r < end; ++r)
+    {
+        ObjRange* range = &parse->ranges[r];
+        for(const char* p = range->begin; p < range->end;)
+        {
+            const char* lineEnd = obj_line_end(p, range->end);
+            p = obj_skip_spaces(p, lineEnd);
+
+            switch(obj_line_type(p, lineEnd))
+            {
+            case OBJ_LINE_POSITION: ++range->positionCount; break;
+            case OBJ_LINE_TEXCOORD: ++range->texCoordCount; break;
+            case OBJ_LINE_NORMAL:   ++range->normalCount;   break;
+            case OBJ_LINE_FACE:
+            {
+                uint32_t corners = 0;
+                for(p = obj_skip_spaces(p + 1, lineEnd); !obj_at_end(p, lineEnd); p = obj_skip_spaces(p, lineEnd))
+                {
+                    while(p < lineEnd && !obj_is_space(*p))
+                        ++p;
+                    ++corners;
+                }
+                range->cornerCount += corners >= 3 ? (corners - 2) * 3 : 0;
+                break;
+            }
+            case OBJ_LINE_OTHER:
+                break;
+            }
+
+            p = lineEnd + 1;
+        }
+    }
+}
+
+static void obj_fill(uint32_t begin, uint32_t end, void* data)
+{
+    ObjParse* parse = (ObjParse*) data;
+    for(uint32_t r = begin; r < end; ++r)
+    {
+        ObjRange* range = &parse->ranges[r];
+
+        float*    position = parse->positions + (size_t) range->positionFirst * 3;
+        float*    texCoord = parse->texCoords + (size_t) range->texCoordFirst * 2;
+        uint32_t* corners  = parse->corners   + (size_t) range->cornerFirst * 2;
+
+        ObjSeen seen = { range->positionFirst, range->texCoordFirst, range->normalFirst };
+
+        for(const char* p = range->begin; p < range->end;)
+        {
+            const char* line    = p;
+            const char* lineEnd = obj_line_end(p, range->end);
+            p = obj_skip_spaces(p, lineEnd);
+
+            bool valid = true;
+            switch(obj_line_type(p, lineEnd))
+            {
+            case OBJ_LINE_POSITION:
+                valid = obj_parse_floats(p + 1, lineEnd, position, 3);
+                position += 3;
+                ++seen.positions;
+                break;
+            case OBJ_LINE_TEXCOORD:
+                valid = obj_parse_floats(p + 2, lineEnd, texCoord, 2);
+                texCoord += 2;
+                ++seen.texCoords;
+                break;
+            case OBJ_LINE_NORMAL:
+            {
+                float normal[3];
+                valid = obj_parse_floats(p + 2, lineEnd, normal, 3);
+                ++seen.normals;
+                break;
+            }
+            case OBJ_LINE_FACE:
+            {
+                uint32_t* faceEnd = corners;
+                valid = obj_parse_face(p + 1, lineEnd, parse, seen, &faceEnd);
+                corners = faceEnd;
+                break;
+            }
+            case OBJ_LINE_OTHER:
+                break;
+            }
+
+            if(!valid)
+            {
+                range->error = line;
+                break;
+            }
+
+            p = lineEnd + 1;
+        }
+    }
+}
+
+static void obj_parse_destroy(ObjParse* parse)
+{
+    free(parse->ranges);
+    free(parse->positions);
+    free(parse->texCoords);
+    free(parse->corners);
+    *parse = (ObjParse) {0};
+}
+
+// Cuts the ranges, counts their lines over the job system and allocates the arrays of the second pass
+static bool obj_count_ranges(const char* data, size_t size, ObjParse* parse)
+{
+    *parse = (ObjParse) {0};
+
+    parse->rangeCount = (uint32_t) (size / OBJ_RANGE_BYTES + 1);
+    parse->ranges     = (ObjRange*) calloc(parse->rangeCount, sizeof(ObjRange));
+    if(!parse->ranges)
+        return false;
+
+    const char* end = data + size;
+    const char* p   = data;
+    for(uint32_t r = 0; r < parse->rangeCount; ++r)
+    {
+        const char* cut = end;
+        if(r + 1 < parse->rangeCount)
+        {
+            cut = data + (size_t) (r + 1) * OBJ_RANGE_BYTES;
+            cut = cut > p ? cut : p;
+            cut = obj_line_end(cut, end);
+            cut = cut < end ? cut + 1 : end;
+        }
+
+        parse->ranges[r].begin = p;
+        parse->ranges[r].end   = cut;
+        p = cut;
+    }
+
+    jobs_parallel_for(parse->rangeCount, 1, obj_count, parse);
+
+    uint64_t positions = 0, texCoords = 0, normals = 0, corners = 0;
+    for(uint32_t r = 0; r < parse->rangeCount; ++r)
+    {
+        ObjRange* range = &parse->ranges[r];
+        range->positionFirst = (uint32_t) positions;
+        range->texCoordFirst = (uint32_t) texCoords;
+        range->normalFirst   = (uint32_t) normals;
+        range->cornerFirst   = (uint32_t) corners;
+
+        positions += range->positionCount;
+        texCoords += range->texCoordCount;
+        normals   += range->normalCount;
+        corners   += range->cornerCount;
+
+        if(positions >= UINT32_MAX || texCoords >= UINT32_MAX || normals >= UINT32_MAX || corners >= UINT32_MAX)
+        {
+            log_error("Obj file of more than %u elements", UINT32_MAX);
+            return false;
+        }
+    }
+
+    if(corners == 0)
+    {
+        log_error("Obj file without faces");
+        return false;
+    }
+
+    parse->positionCount = (uint32_t) positions;
+    parse->texCoordCount = (uint32_t) texCoords;
+    parse->normalCount   = (uint32_t) normals;
+    parse->cornerCount   = (uint32_t) corners;
+
+    parse->positions = (float*)    malloc((positions > 0 ? positions : 1) * 3 * sizeof(float));
+    parse->texCoords = (float*)    malloc((texCoords > 0 ? texCoords : 1) * 2 * sizeof(float));
+    parse->corners   = (uint32_t*) malloc(corners * 2 * sizeof(uint32_t));
+    return parse->positions != NULL && parse->texCoords != NULL && parse->corners != NULL;
+}
+
+static bool obj_fill_ranges(const char* data, ObjParse* parse)
+{
+    jobs_parallel_for(parse->rangeCount, 1, obj_fill, parse);
+
+    for(uint32_t r = 0; r < parse->rangeCount; ++r)
+    {
+        const char* line = parse->ranges[r].error;
+        if(line == NULL)
+            continue;
+
+        size_t number = 1;
+        for(const char* p = data; (p = (const char*) memchr(p, '\n', (size_t) (line - p))) != NULL; ++p)
+            ++number;
+
+        const char* lineEnd = obj_line_end(line, parse->ranges[r].end);
+        int length = (int) (lineEnd - line < 64 ? lineEnd - line : 64);
+        log_error("Obj line %zu invalid: %.*s", number, length, line);
+        return false;
+    }
+    return true;
+}
+
+// One vertex per distinct position and texture coordinate pair, in the order of their first corner. The
+// table hashes the pair on its position alone, one bucket per position chaining its vertices: faces index
+// nearby positions, the buckets they touch stay in cache where a mixing hash would scatter them
+static bool obj_deduplicate(const ObjParse* parse, ObjMesh* mesh)
+{
+    uint32_t* buckets   = (uint32_t*) malloc(((size_t) parse->positionCount + 1) * sizeof(uint32_t));
+    uint32_t* chains    = (uint32_t*) malloc((size_t) parse->cornerCount * sizeof(uint32_t));
+    uint32_t* texCoords = (uint32_t*) malloc((size_t) parse->cornerCount * sizeof(uint32_t));
+
+    mesh->vertices = (ObjVertex*) malloc((size_t) parse->cornerCount * sizeof(ObjVertex));
+    mesh->indices  = (uint32_t*)  malloc((size_t) parse->cornerCount * sizeof(uint32_t));
+
+    bool result = buckets != NULL && chains != NULL && texCoords != NULL && mesh->vertices != NULL &&
+        mesh->indices != NULL;
+    if(result)
+    {
+        memset(buckets, 0xFF, (size_t) parse->positionCount * sizeof(uint32_t));
+
+        uint32_t vertexCount = 0;
+        for(uint32_t c = 0; c < parse->cornerCount; ++c)
+        {
+            uint32_t position = parse->corners[c * 2 + 0];
+            uint32_t texCoord = parse->corners[c * 2 + 1];
+
+            uint32_t vertex = buckets[position];
+            while(vertex != OBJ_NONE && texCoords[vertex] != texCoord)
+                vertex = chains[vertex];
+
+            if(vertex == OBJ_NONE)
+            {
+                const float* p = &parse->positions[(size_t) position * 3];
+                const float* t = texCoord != OBJ_NONE ? &parse->texCoords[(size_t) texCoord * 2] : NULL;
+
+                vertex = vertexCount++;
+                mesh->vertices[vertex] = (ObjVertex) {
+                    .position = { p[0], p[1], p[2], 1.0f },
+                    .color    = { 1.0f, 1.0f, 1.0f, 1.0f },
+                    .texCoord = { t != NULL ? t[0] : 0.0f, t != NULL ? 1.0f - t[1] : 0.0f },
+                };
+
+                texCoords[vertex] = texCoord;
+                chains[vertex]    = buckets[position];
+                buckets[position] = vertex;
+            }
+
+            mesh->indices[c] = vertex;
+        }
+
+        mesh->vertexCount = vertexCount;
+        mesh->indexCount  = parse->cornerCount;
+
+        ObjVertex* vertices = (ObjVertex*) realloc(mesh->vertices, (size_t) vertexCount * sizeof(ObjVertex));
+        mesh->vertices = vertices != NULL ? vertices : mesh->vertices;
+    }
+
+    free(buckets);
+    free(chains);
+    free(texCoords);
+    return result;
+}
+
+bool obj_parse(const char* data, size_t size, ObjMesh* mesh)
+{
+    *mesh = (ObjMesh) {0};
+
+    ObjParse parse;
+    bool result = obj_count_ranges(data, size, &parse) && obj_fill_ranges(data, &parse) &&
+        obj_deduplicate(&parse, mesh);
+
+    obj_parse_destroy(&parse);
+    if(!result)
+        obj_destroy(mesh);
+    return result;
+}
+
+bool obj_load(const char* filepath, ObjMesh* mesh)
+{
+    const uint8_t* data;
+    size_t size;
+    if(!file_map(filepath, &data, &size))
+        return false;
+
+    bool result = obj_parse((const char*) data, size, mesh);
+    file_unmap(data, size);
+
+    if(!result)
+        log_error("Obj file invalid: %s", filepath);
+    return result;
+}
+
+void obj_destroy(ObjMesh* mesh)
+{
+    free(mesh->vertices);
+    free(mesh->indices);
+    *mesh = (ObjMesh) {0};
+}
+
+// ##### Benchmark #####
+
+// Position and texture coordinate of a vertex of the benchmark grid, a rolling heightfield
+static void obj_benchmark_values(uint32_t size, uint32_t vertex, float values[5])
+{
+    uint32_t x = vertex % size, z = vertex / size;
+    uint32_t hash = x * 0x8DA6B343u ^ z * 0xD8163841u;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+
+    values[0] = x * 0.125f - size * 0.0625f;
+    values[1] = (float) (hash % 100000) * 1e-4f - 5.0f;
+    values[2] = z * -0.125f;
+    values[3] = (float) x / (size - 1);
+    values[4] = (float) z / (size - 1);
+}
+
+// Corners of the two triangles of a cell in the order the parse fans them
+static void obj_benchmark_cell(uint32_t size, uint32_t cell, uint32_t corners[6])
+{
+    uint32_t x = cell % (size - 1), z = cell / (size - 1);
+    uint32_t a = x + z * size, b = a + 1, c = b + size, d = a + size;
+
+    corners[0] = a; corners[1] = b; corners[2] = c;
+    corners[3] = a; corners[4] = c; corners[5] = d;
+}
+
+// Every element of a cell in about 160 bytes. Rows alternate between quads of v/vt/vn corners and
+// triangles of v/vt corners relative to the end of the vertices
+static bool obj_benchmark_write(const char* path, uint32_t size)
+{
+    FILE* f = fopen(path, "wb");
+    if(!f)
+        return false;
+
+    uint32_t vertexCount = size * size;
+
+    fprintf(f, "# Benchmark grid\nmtllib grid.mtl\no grid\n");
+    for(uint32_t v = 0; v < vertexCount; ++v)
+    {
+        float values[5];
+        obj_benchmark_values(size, v, values);
+        fprintf(f, "v %.6f %.6f %.6f\n", values[0], values[1], values[2]);
+    }
+    for(uint32_t v = 0; v < vertexCount; ++v)
+    {
+        float values[5];
+        obj_benchmark_values(size, v, values);
+        fprintf(f, "vt %.6f %.6f\n", values[3], values[4]);
+    }
+    fprintf(f, "vn 0.000000 1.000000 0.000000\nusemtl grid\ns off\n");
+
+    uint32_t cellCount = (size - 1) * (size - 1);
+    for(uint32_t cell = 0; cell < cellCount; ++cell)
+    {
+        uint32_t c[6];
+        obj_benchmark_cell(size, cell, c);
+
+        int64_t n = vertexCount;
+        if((cell / (size - 1)) % 2 == 0)
+            fprintf(f, "f %u/%u/1 %u/%u/1 %u/%u/1 %u/%u/1\n", c[0] + 1, c[0] + 1, c[1] + 1, c[1] + 1,
+                c[2] + 1, c[2] + 1, c[5] + 1, c[5] + 1);
+        else
+        {
+            for(uint32_t t = 0; t < 6; t += 3)
+            {
+                long long a = c[t] - n, b = c[t + 1] - n, d = c[t + 2] - n;
+                fprintf(f, "f %lld/%lld %lld/%lld %lld/%lld\n", a, a, b, b, d, d);
+            }
+        }
+    }
+
+    bool result = !ferror(f);
+    return fclose(f) == 0 && result;
+}
+
+static uint32_t obj_ulps(float a, float b)
+{
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    return ia == ib ? 0 : (uint32_t) (ia > ib ? (int64_t) ia - ib : (int64_t) ib - ia);
+}
+
+// Triangles against strtof of the printed values, more than an ulp apart is a mismatch
+static uint32_t obj_benchmark_check(const ObjMesh* mesh, uint32_t size, uint32_t* maxUlps)
+{
+    uint32_t vertexCount = size * size;
+    uint32_t cellCount = (size - 1) * (size - 1);
+
+    float* expected = (float*) malloc((size_t) vertexCount * 5 * sizeof(float));
+    if(!expected)
+        return 1;
+
+    char str[64];
+    for(uint32_t v = 0; v < vertexCount; ++v)
+    {
+        float values[5];
+        obj_benchmark_values(size, v, values);
+        for(uint32_t i = 0; i < 5; ++i)
+        {
+            snprintf(str, sizeof(str), "%.6f", values[i]);
+            expected[v * 5 + i] = strtof(str, NULL);
+        }
+        expected[v * 5 + 4] = 1.0f - expected[v * 5 + 4];
+    }
+
+    uint32_t mismatches = mesh->vertexCount != vertexCount || mesh->indexCount != cellCount * 6;
+    for(uint32_t cell = 0; cell < cellCount && mismatches == 0; ++cell)
+    {
+        uint32_t c[6];
+        obj_benchmark_cell(size, cell, c);
+        for(uint32_t i = 0; i < 6; ++i)
+        {
+            const ObjVertex* vertex = &mesh->vertices[mesh->indices[cell * 6 + i]];
+            const float* e = &expected[c[i] * 5];
+
+            float parsed[5] = {
+                vertex->position.x, vertex->position.y, vertex->position.z, vertex->texCoord.x, vertex->texCoord.y,
+            };
+
+            bool mismatch = vertex->position.w != 1.0f;
+            for(uint32_t k = 0; k < 5; ++k)
+            {
+                uint32_t ulps = obj_ulps(parsed[k], e[k]);
+                *maxUlps = ulps > *maxUlps ? ulps : *maxUlps;
+                mismatch |= ulps > 1;
+            }
+            mismatches += mismatch;
+        }
+    }
+
+    free(expected);
+    return mismatches;
+}
+
+// The same lines through strtof and strtol on one thread, without deduplication
+static double obj_benchmark_libc(const char* data, size_t size)
+{
+    const char* end = data + size;
+
+    double sum = 0.0;
+    for(const char* p = data; p < end;)
+    {
+        const char* lineEnd = obj_line_end(p, end);
+        char* next;
+        switch(obj_line_type(p, lineEnd))
+        {
+        case OBJ_LINE_POSITION:
+        case OBJ_LINE_NORMAL:
+            next = (char*) p + 2;
+            for(uint32_t i = 0; i < 3; ++i)
+                sum += strtof(next, &next);
+            break;
+        case OBJ_LINE_TEXCOORD:
+            next = (char*) p + 2;
+            for(uint32_t i = 0; i < 2; ++i)
+                sum += strtof(next, &next);
+            break;
+        case OBJ_LINE_FACE:
+            next = (char*) p + 1;
+            while(next < lineEnd)
+            {
+                char* start = next;
+                sum += strtol(start, &next, 10);
+                if(next < lineEnd && *next == '/')
+                    ++next;
+                else if(next == start)
+                    break;
+            }
+            break;
+        case OBJ_LINE_OTHER:
+            break;
+        }
+        p = lineEnd + 1;
+    }
+    return sum;
+}
+
+bool obj_benchmark(uint32_t megabytes)
+{
+    // Vertices per side
+    uint32_t size = (uint32_t) sqrt((double) ((uint64_t) megabytes << 20) / 160.0);
+    size = size > 16 ? size : 16;
+
+    char path[] = "/tmp/objXXXXXX";
+    int file = mkstemp(path);
+    if(file < 0)
+    {
+        log_error("Obj benchmark failed to create a temporary file");
+        return false;
+    }
+    close(file);
+
+    bool result = obj_benchmark_write(path, size);
+
+    char timeStr[64], sizeStr[64];
+    Timer t;
+
+    const uint8_t* data = NULL;
+    size_t fileSize = 0;
+    ObjParse parse = {0};
+    ObjMesh mesh = {0};
+
+    double mapNs = 0.0, countNs = 0.0, fillNs = 0.0, dedupNs = 0.0;
+    if(result)
+    {
+        // Warm, the file was just written
+        timer_start(&t);
+        result = file_map(path, &data, &fileSize);
+        timer_stop(&t);
+        mapNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && obj_count_ranges((const char*) data, fileSize, &parse);
+        timer_stop(&t);
+        countNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && obj_fill_ranges((const char*) data, &parse);
+        timer_stop(&t);
+        fillNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && obj_deduplicate(&parse, &mesh);
+        timer_stop(&t);
+        dedupNs = timer_get_ns(&t);
+    }
+
+    uint32_t maxUlps = 0;
+    uint32_t mismatches = result ? obj_benchmark_check(&mesh, size, &maxUlps) : 0;
+    if(result)
+    {
+        double parseNs = countNs + fillNs + dedupNs;
+
+        num_to_str(sizeStr, fileSize);
+        log_info("Obj benchmark, %u vertices and %u triangles in a %sB file:", mesh.vertexCount,
+            mesh.indexCount / 3, sizeStr);
+
+        time_to_str(timeStr, mapNs);
+        log_info("    map                %s", timeStr);
+        time_to_str(timeStr, countNs);
+        log_info("    count, %2u threads  %s, %.0f MB/s", jobs_thread_count(), timeStr, fileSize / (countNs * 1e-9) / 1e6);
+        time_to_str(timeStr, fillNs);
+        log_info("    fill, %2u threads   %s, %.0f MB/s", jobs_thread_count(), timeStr, fileSize / (fillNs * 1e-9) / 1e6);
+        time_to_str(timeStr, dedupNs);
+        log_info("    deduplicate        %s, %.0f M corners/s", timeStr, mesh.indexCount / (dedupNs * 1e-9) / 1e6);
+        time_to_str(timeStr, mapNs + parseNs);
+        log_info("    load               %s, %.0f MB/s", timeStr, fileSize / ((mapNs + parseNs) * 1e-9) / 1e6);
+
+        timer_start(&t);
+        volatile double sum = obj_benchmark_libc((const char*) data, fileSize);
+        timer_stop(&t);
+        (void) sum;
+
+        time_to_str(timeStr, timer_get_ns(&t));
+        log_info("    strtof and strtol  %s, %.0f MB/s on one thread", timeStr, fileSize / (timer_get_ns(&t) * 1e-9) / 1e6);
+        log_info("    %u mismatches, %u ulps at most from strtof", mismatches, maxUlps);
+    }
+
+    obj_parse_destroy(&parse);
+    obj_destroy(&mesh);
+    if(data != NULL)
+        file_unmap(data, fileSize);
+
+    unlink(path);
+    return result && mismatches == 0;
+}
+
+// ##### Benchmark #####
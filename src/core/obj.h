@@ -0,0 +1,52 @@
+#ifndef OBJ_H_
+#define OBJ_H_
+
+#include "vec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Wavefront .obj meshes. The file is mapped and parsed in place, cut in ranges that end on
+ *  a newline and spread over the job system: a first pass counts the v, vt and f lines of
+ *  every range, their prefix sums place the ranges in the arrays, a second pass parses the
+ *  floats and the face corners straight into them. Numbers are read by hand, no strtof nor
+ *  locale.
+ *
+ *  Faces are fanned into triangles. Corners are deduplicated on their v/vt pair through a
+ *  hash table, vertices come in the order of their first corner. Normals aren't kept, the
+ *  shaders take them from the triangles, vn lines and indices are only checked.
+ */
+
+// Layout of the vertices in the raster and raytracing shaders
+typedef struct {
+    Vec4 position;
+    Vec4 color;
+    Vec2 texCoord;
+
+    Vec2 padding;
+} ObjVertex;
+
+typedef struct {
+    ObjVertex* vertices;
+    uint32_t   vertexCount;
+    uint32_t*  indices; // Triangle list
+    uint32_t   indexCount;
+} ObjMesh;
+
+// Maps and parses the file then unmaps it. Texture coordinates have v flipped to the top left origin of
+// the images, colors are white
+bool obj_load(const char* filepath, ObjMesh* mesh);
+
+// Parses a file already in memory, data only has to outlive the call
+bool obj_parse(const char* data, size_t size, ObjMesh* mesh);
+
+void obj_destroy(ObjMesh* mesh);
+
+// Writes a grid mesh of about megabytes to a temporary file, then times the map, both passes over the job
+// system and the deduplication against a strtof and strtol parse of the same lines. Checks every triangle
+// against the generator
+bool obj_benchmark(uint32_t megabytes);
+
+#endif // OBJ_H_
@@ -7,18 +7,263 @@
 #include "core/window.h"
 #include "core/camera.h"
 #include "core/input.h"
+#include "core/jobs.h"
 #include "core/core.h"
+#include "core/obj.h"
 #include "core/log.h"
 
+#include "voxel/brickmap.h"
+#include "voxel/palette.h"
+#include "voxel/svo.h"
+#include "voxel/dag.h"
+#include "voxel/morton.h"
+#include "voxel/vox.h"
+
+#include "world/terrain.h"
+#include "world/stream.h"
+#include "world/region.h"
+#include "world/codec.h"
+
 #include "render/vulkan_globals.h"
+#include "render/allocator.h"
 #include "render/vulkan.h"
 
+#include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 #define TITLE "Vulkan"
 
-int main()
+#define TEST(x) { if (!(x)) { log_error("Test failed " #x); return false; } }
+
+// Device of the allocator checks, memory type 1 is host visible
+typedef struct {
+    uint32_t              liveBlocks;
+    uintptr_t             nextMemory;
+    VkDeviceSize          lastSize;
+    VkMemoryAllocateFlags lastFlags;
+} MainMockDevice;
+
+static bool main_mock_allocate(void* user, uint32_t memoryTypeIndex, VkMemoryAllocateFlags flags, VkDeviceSize size,
+    VkDeviceMemory* memory, void** map)
+{
+    MainMockDevice* mock = (MainMockDevice*) user;
+
+    *map = NULL;
+    if(memoryTypeIndex == 1)
+    {
+        *map = malloc(size);
+        if(*map == NULL)
+            return false;
+    }
+
+    *memory = (VkDeviceMemory) ++mock->nextMemory;
+    ++mock->liveBlocks;
+    mock->lastSize  = size;
+    mock->lastFlags = flags;
+    return true;
+}
+
+static void main_mock_free(void* user, VkDeviceMemory memory, void* map)
 {
+    UNUSED(memory);
+
+    MainMockDevice* mock = (MainMockDevice*) user;
+    --mock->liveBlocks;
+    free(map);
+}
+
+static bool main_test_allocator()
+{
+    const VkDeviceSize blockSize = 1 << 20;
+
+    MainMockDevice mock = {0};
+    AllocatorDevice device = { &mock, main_mock_allocate, main_mock_free };
+
+    Allocator allocator;
+    TEST(allocator_create(&device, blockSize, &allocator));
+
+    // Buddy split: the second 256 bytes take the buddy of the first, 1KB the best fitting free range after them
+    Allocation a, b, c;
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 256, .alignment = 1 }, &a));
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 200, .alignment = 1 }, &b));
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 1024, .alignment = 1 }, &c));
+    TEST(mock.liveBlocks == 1 && mock.lastSize == blockSize);
+    TEST(a.block && a.block == b.block && b.block == c.block);
+    TEST(a.offset == 0 && b.offset == 256 && c.offset == 1024);
+
+    // Alignment over the size
+    Allocation aligned;
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 100, .alignment = 4096 }, &aligned));
+    TEST(aligned.offset != 0 && aligned.offset % 4096 == 0);
+
+    // Merge: once freed, half a block fits back at offset 0 of the same block
+    allocator_free(&allocator, &a);
+    allocator_free(&allocator, &b);
+    allocator_free(&allocator, &c);
+    allocator_free(&allocator, &aligned);
+
+    AllocatorStats stats;
+    allocator_get_stats(&allocator, &stats);
+    TEST(stats.blockCount == 1 && stats.usedBytes == 0 && stats.largestFreeBytes == blockSize);
+
+    Allocation half;
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = blockSize / 2, .alignment = 1 }, &half));
+    TEST(half.block && half.offset == 0 && mock.liveBlocks == 1);
+    allocator_free(&allocator, &half);
+
+    // Dedicated over half a block, of the requested size
+    Allocation dedicated;
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = blockSize / 2 + 1, .alignment = 1 }, &dedicated));
+    TEST(dedicated.block == NULL && dedicated.offset == 0 && mock.lastSize == blockSize / 2 + 1);
+
+    allocator_get_stats(&allocator, &stats);
+    TEST(stats.dedicatedCount == 1 && stats.dedicatedBytes == blockSize / 2 + 1 && mock.liveBlocks == 2);
+
+    allocator_free(&allocator, &dedicated);
+    allocator_get_stats(&allocator, &stats);
+    TEST(stats.dedicatedCount == 0 && mock.liveBlocks == 1);
+
+    // Optimal images, device address buffers and other memory types get blocks of their own
+    Allocation linear, optimal, address, host;
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 256, .alignment = 1, .linear = true }, &linear));
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 256, .alignment = 1 }, &optimal));
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 256, .alignment = 1, .linear = true,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT }, &address));
+    TEST(mock.lastFlags == VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT);
+    TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = 256, .alignment = 1, .linear = true,
+        .memoryTypeIndex = 1 }, &host));
+    TEST(mock.liveBlocks == 4);
+    TEST(linear.block != optimal.block && linear.block != address.block && linear.block != host.block &&
+        optimal.block != address.block && address.block != host.block);
+    TEST(linear.map == NULL && host.map == host.block->map);
+
+    allocator_free(&allocator, &linear);
+    allocator_free(&allocator, &optimal);
+    allocator_free(&allocator, &address);
+    allocator_free(&allocator, &host);
+
+    allocator_destroy(&allocator);
+    TEST(mock.liveBlocks == 0);
+
+    // Every other sixteenth of a block freed: half of it free, in ranges of a sixteenth
+    TEST(allocator_create(&device, blockSize, &allocator));
+
+    Allocation sixteenths[16];
+    for(uint32_t i = 0; i < ARRAYLEN(sixteenths); ++i)
+        TEST(allocator_alloc(&allocator, &(AllocationRequest) { .size = blockSize / 16, .alignment = 1 },
+            &sixteenths[i]));
+    for(uint32_t i = 0; i < ARRAYLEN(sixteenths); i += 2)
+        allocator_free(&allocator, &sixteenths[i]);
+
+    allocator_get_stats(&allocator, &stats);
+    log_info("Allocator fragmentation %.3f with every other sixteenth of a block free", stats.fragmentation);
+    TEST(stats.blockCount == 1 && stats.allocationCount == 8 && stats.usedBytes == blockSize / 2);
+    TEST(stats.largestFreeBytes == blockSize / 16 && stats.fragmentation == 0.875f);
+
+    for(uint32_t i = 1; i < ARRAYLEN(sixteenths); i += 2)
+        allocator_free(&allocator, &sixteenths[i]);
+
+    allocator_get_stats(&allocator, &stats);
+    TEST(stats.usedBytes == 0 && stats.requestedBytes == 0 && stats.fragmentation == 0.0f);
+
+    allocator_destroy(&allocator);
+    TEST(mock.liveBlocks == 0);
+    return true;
+}
+
+// The distance field, the palette and every raycast mode of a brickmap of terrain, caves included,
+// against their brute force references
+static bool main_test_brickmap(uint32_t size, uint32_t rayCount)
+{
+    uint8_t* data = (uint8_t*) malloc((size_t) size * size * size);
+    TEST(data);
+
+    Terrain terrain;
+    terrain_init(&terrain, 1);
+
+    BrickMap brickMap;
+    bool created = terrain_generate(&terrain, (IVec3) { 0, -(int) size / 2, 0 }, size, size, size, data) &&
+        brickmap_create(size, size, size, data, DISTANCE_CHEBYSHEV, &brickMap);
+    free(data);
+    TEST(created);
+
+    BrickPalette palette;
+    palette_create(&brickMap, &palette);
+
+    uint32_t distanceMismatches = brickmap_check_distance(&brickMap, 4096);
+    uint32_t paletteMismatches = palette_check(&palette, &brickMap);
+    log_info("Brickmap %u^3: %u distance mismatches against brute force, %u palette voxel mismatches", size,
+        distanceMismatches, paletteMismatches);
+
+    uint32_t raycastMismatches = brickmap_benchmark_raycast(&brickMap, rayCount);
+
+    palette_destroy(&palette);
+    brickmap_destroy(&brickMap);
+
+    TEST(distanceMismatches == 0);
+    TEST(paletteMismatches == 0);
+    TEST(raycastMismatches == 0);
+    return true;
+}
+
+// Every check that needs neither a window nor a device, stops at the first failure
+static bool main_run_tests()
+{
+    // Job system stress tests and parallel for scaling from one thread to every core
+    TEST(jobs_benchmark());
+
+    // Buddy placement, dedicated allocations, pools and stats of the block allocator against a mock device
+    TEST(main_test_allocator());
+
+    // Distance field, palette and ray marching of one brickmap against brute force
+    TEST(main_test_brickmap(256, 1 << 16));
+
+    // Memory and build time of a large mostly empty volume on both backends against the dense data
+    TEST(svo_benchmark_sparse(1024, 1 << 16));
+
+    // Memory of a dense terrain surface the octree distances can't address, against the brickmap
+    TEST(dag_benchmark_terrain(1024, 1 << 16));
+
+    // CPU ray marching through rows of voxels against bricks in rows and in Morton order
+    TEST(morton_benchmark(512, 1 << 16));
+
+    // Procedural chunks per second over the thread counts, the same voxels on every one
+    TEST(terrain_benchmark(256));
+
+    // Headless camera flight through a streamed world, residency against the radii and the memory budget
+    TEST(stream_benchmark());
+
+    // Region file written and committed, loaded through the map against file_read_all, torn commits fall back
+    TEST(region_benchmark(512));
+
+    // Ratio and MB/s of every codec level per chunk type, decoded on one thread and over the job system
+    TEST(codec_benchmark(512));
+
+    // Load time of a generated MagicaVoxel file of a few hundred MB, mapped against read up front
+    TEST(vox_benchmark(256));
+
+    // Parse MB/s of a generated OBJ grid, both passes over the job system against strtof on one thread
+    TEST(obj_benchmark(64));
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    // Headless checks, before any window or device
+    if(argc > 1 && strcmp(argv[1], "--test") == 0)
+    {
+        if(!jobs_init(0))
+            return 1;
+
+        bool passed = main_run_tests();
+        log_info("Tests %s", passed ? "passed" : "failed");
+
+        jobs_destroy();
+        return passed ? 0 : 1;
+    }
+
     // GLFW/GLEW init
     {
         int error = glfwInit();
@@ -40,6 +285,9 @@ int main()
 
     window_init();
 
+    if(!jobs_init(0))
+        return 1;
+
     if(!vulkan_init(TITLE))
         return 1;
     
@@ -82,6 +330,8 @@ int main()
 
     vulkan_destroy();
 
+    jobs_destroy();
+
     window_destroy();
     
     glfwTerminate();
@@ -0,0 +1,306 @@
+#include "allocator.h"
+
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t allocator_log2_ceil(VkDeviceSize value)
+{
+    uint32_t log = 0;
+    while (((VkDeviceSize) 1 << log) < value)
+        ++log;
+    return log;
+}
+
+static uint32_t allocator_pool_index(const AllocationRequest* request)
+{
+    bool deviceAddress = request->flags & VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    return (request->memoryTypeIndex * 2 + deviceAddress) * 2 + request->linear;
+}
+
+static VkDeviceSize allocator_class_size(uint32_t sizeClass)
+{
+    return (VkDeviceSize) 1 << (sizeClass + ALLOCATOR_MIN_SIZE_LOG2);
+}
+
+// Size class needed to hold size bytes at the given alignment, buddy ranges are aligned to their own size
+static uint32_t allocator_size_class(VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkDeviceSize rounded = size > alignment ? size : alignment;
+    uint32_t log = allocator_log2_ceil(rounded);
+    return log > ALLOCATOR_MIN_SIZE_LOG2 ? log - ALLOCATOR_MIN_SIZE_LOG2 : 0;
+}
+
+static AllocatorBlock* allocator_block_create(Allocator* allocator, const AllocationRequest* request)
+{
+    AllocatorBlock* block = (AllocatorBlock*) calloc(1, sizeof(AllocatorBlock));
+    if (block == NULL)
+        return NULL;
+
+    block->size     = allocator->blockSize;
+    block->maxClass = allocator_log2_ceil(allocator->blockSize) - ALLOCATOR_MIN_SIZE_LOG2;
+
+    size_t nodeCount = ((size_t) 2 << block->maxClass) - 1;
+    block->longest = (uint8_t*) malloc(nodeCount);
+    if (block->longest == NULL)
+    {
+        free(block);
+        return NULL;
+    }
+
+    // Fully free tree: every node advertises its own class
+    for (uint32_t depth = 0; depth <= block->maxClass; ++depth)
+    {
+        size_t first = ((size_t) 1 << depth) - 1;
+        memset(block->longest + first, (int) (block->maxClass - depth + 1), (size_t) 1 << depth);
+    }
+
+    if (!allocator->device.allocate(allocator->device.user, request->memoryTypeIndex, request->flags,
+        block->size, &block->memory, &block->map))
+    {
+        free(block->longest);
+        free(block);
+        return NULL;
+    }
+    return block;
+}
+
+static void allocator_block_destroy(Allocator* allocator, AllocatorBlock* block)
+{
+    allocator->device.free(allocator->device.user, block->memory, block->map);
+    free(block->longest);
+    free(block);
+}
+
+static void allocator_block_update_parents(AllocatorBlock* block, size_t node, uint32_t sizeClass)
+{
+    while (node > 0)
+    {
+        node = (node - 1) / 2;
+        ++sizeClass;
+
+        uint8_t left  = block->longest[node * 2 + 1];
+        uint8_t right = block->longest[node * 2 + 2];
+
+        // Both halves free: merge back into one range
+        if (left == sizeClass && right == sizeClass)
+            block->longest[node] = (uint8_t) (sizeClass + 1);
+        else
+            block->longest[node] = left > right ? left : right;
+    }
+}
+
+static bool allocator_block_alloc(AllocatorBlock* block, uint32_t sizeClass, VkDeviceSize* offset)
+{
+    if (block->longest[0] < sizeClass + 1)
+        return false;
+
+    size_t   node      = 0;
+    uint32_t nodeClass = block->maxClass;
+
+    while (nodeClass > sizeClass)
+    {
+        size_t  left       = node * 2 + 1;
+        uint8_t leftValue  = block->longest[left];
+        uint8_t rightValue = block->longest[left + 1];
+
+        // Best fit: descend into the child with the smallest range that still fits
+        if (leftValue >= sizeClass + 1 && (rightValue < sizeClass + 1 || leftValue <= rightValue))
+            node = left;
+        else
+            node = left + 1;
+
+        --nodeClass;
+    }
+
+    block->longest[node] = 0;
+    allocator_block_update_parents(block, node, sizeClass);
+
+    uint32_t depth = block->maxClass - sizeClass;
+    *offset = (VkDeviceSize) (node - (((size_t) 1 << depth) - 1)) * allocator_class_size(sizeClass);
+
+    block->usedBytes += allocator_class_size(sizeClass);
+    ++block->allocationCount;
+    return true;
+}
+
+static void allocator_block_free(AllocatorBlock* block, VkDeviceSize offset, uint32_t sizeClass)
+{
+    uint32_t depth = block->maxClass - sizeClass;
+    size_t   node  = (((size_t) 1 << depth) - 1) + (size_t) (offset / allocator_class_size(sizeClass));
+
+    ASSERT(block->longest[node] == 0);
+    block->longest[node] = (uint8_t) (sizeClass + 1);
+    allocator_block_update_parents(block, node, sizeClass);
+
+    block->usedBytes -= allocator_class_size(sizeClass);
+    --block->allocationCount;
+}
+
+bool allocator_create(const AllocatorDevice* device, VkDeviceSize blockSize, Allocator* allocator)
+{
+    if (blockSize < allocator_class_size(0) || (blockSize & (blockSize - 1)) != 0)
+    {
+        log_error("Allocator block size must be a power of two");
+        return false;
+    }
+
+    *allocator = (Allocator) {
+        .device    = *device,
+        .blockSize = blockSize,
+    };
+    return true;
+}
+
+void allocator_destroy(Allocator* allocator)
+{
+    for (size_t p = 0; p < ALLOCATOR_MAX_POOLS; ++p)
+    {
+        AllocatorBlocks* pool = &allocator->pools[p];
+        for (size_t i = 0; i < pool->count; ++i)
+        {
+            if (pool->items[i]->allocationCount > 0)
+                log_warn("Allocator destroying block with %u live allocations", pool->items[i]->allocationCount);
+
+            allocator_block_destroy(allocator, pool->items[i]);
+        }
+
+        list_destroy(*pool);
+        *pool = (AllocatorBlocks) {0};
+    }
+}
+
+bool allocator_alloc(Allocator* allocator, const AllocationRequest* request, Allocation* allocation)
+{
+    uint32_t poolIndex = allocator_pool_index(request);
+    uint32_t sizeClass = allocator_size_class(request->size, request->alignment);
+
+    ASSERT(poolIndex < ALLOCATOR_MAX_POOLS);
+
+    // Anything over half a block would waste most of it
+    if (allocator_class_size(sizeClass) > allocator->blockSize / 2)
+    {
+        *allocation = (Allocation) {
+            .offset = 0,
+            .size   = request->size,
+            .pool   = poolIndex,
+        };
+
+        if (!allocator->device.allocate(allocator->device.user, request->memoryTypeIndex, request->flags,
+            request->size, &allocation->memory, &allocation->map))
+            return false;
+
+        ++allocator->dedicatedCount;
+        allocator->dedicatedBytes += request->size;
+        allocator->requestedBytes += request->size;
+        return true;
+    }
+
+    AllocatorBlocks* pool = &allocator->pools[poolIndex];
+
+    VkDeviceSize    offset = 0;
+    AllocatorBlock* block  = NULL;
+    for (size_t i = 0; i < pool->count && block == NULL; ++i)
+        if (allocator_block_alloc(pool->items[i], sizeClass, &offset))
+            block = pool->items[i];
+
+    if (block == NULL)
+    {
+        block = allocator_block_create(allocator, request);
+        if (block == NULL)
+            return false;
+
+        list_append(*pool, block);
+
+        bool allocated = allocator_block_alloc(block, sizeClass, &offset);
+        ASSERT(allocated);
+        UNUSED(allocated);
+    }
+
+    *allocation = (Allocation) {
+        .memory    = block->memory,
+        .offset    = offset,
+        .size      = request->size,
+        .map       = block->map ? (uint8_t*) block->map + offset : NULL,
+        .block     = block,
+        .pool      = poolIndex,
+        .sizeClass = sizeClass,
+    };
+
+    allocator->requestedBytes += request->size;
+    return true;
+}
+
+void allocator_free(Allocator* allocator, Allocation* allocation)
+{
+    if (allocation->memory == VK_NULL_HANDLE)
+        return;
+
+    allocator->requestedBytes -= allocation->size;
+
+    if (allocation->block == NULL)
+    {
+        allocator->device.free(allocator->device.user, allocation->memory, allocation->map);
+
+        --allocator->dedicatedCount;
+        allocator->dedicatedBytes -= allocation->size;
+        *allocation = (Allocation) {0};
+        return;
+    }
+
+    AllocatorBlock* block = allocation->block;
+    allocator_block_free(block, allocation->offset, allocation->sizeClass);
+
+    // Release empty blocks but keep one per pool to avoid churn on alloc/free cycles
+    AllocatorBlocks* pool = &allocator->pools[allocation->pool];
+    if (block->allocationCount == 0 && pool->count > 1)
+    {
+        for (size_t i = 0; i < pool->count; ++i)
+            if (pool->items[i] == block)
+            {
+                pool->items[i] = pool->items[--pool->count];
+                break;
+            }
+
+        allocator_block_destroy(allocator, block);
+    }
+
+    *allocation = (Allocation) {0};
+}
+
+void allocator_get_stats(const Allocator* allocator, AllocatorStats* stats)
+{
+    *stats = (AllocatorStats) {
+        .dedicatedCount = allocator->dedicatedCount,
+        .dedicatedBytes = allocator->dedicatedBytes,
+        .requestedBytes = allocator->requestedBytes,
+    };
+
+    VkDeviceSize freeBytes = 0, largestSum = 0;
+    for (size_t p = 0; p < ALLOCATOR_MAX_POOLS; ++p)
+    {
+        const AllocatorBlocks* pool = &allocator->pools[p];
+        for (size_t i = 0; i < pool->count; ++i)
+        {
+            const AllocatorBlock* block = pool->items[i];
+
+            stats->blockCount      += 1;
+            stats->allocationCount += block->allocationCount;
+            stats->blockBytes      += block->size;
+            stats->usedBytes       += block->usedBytes;
+            freeBytes              += block->size - block->usedBytes;
+
+            if (block->longest[0] > 0)
+            {
+                VkDeviceSize largest = allocator_class_size(block->longest[0] - 1);
+                largestSum += largest;
+
+                if (largest > stats->largestFreeBytes)
+                    stats->largestFreeBytes = largest;
+            }
+        }
+    }
+
+    stats->fragmentation = freeBytes > 0 ? 1.0f - (float) largestSum / (float) freeBytes : 0.0f;
+}
@@ -0,0 +1,104 @@
+#ifndef ALLOCATOR_H_
+#define ALLOCATOR_H_
+
+#include "core/list.h"
+
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Block sub-allocator for device memory:
+ *  every (memory type, allocate flags, linear/optimal) pool owns large blocks split with a
+ *  buddy tree, big requests get a dedicated allocation. The device is reached only through
+ *  AllocatorDevice so the placement logic can run against a mock.
+ */
+
+#define ALLOCATOR_MAX_POOLS (VK_MAX_MEMORY_TYPES * 2 * 2)
+
+#define ALLOCATOR_MIN_SIZE_LOG2 8 // 256 bytes
+
+typedef struct {
+    void* user;
+
+    // Allocate a whole block, map is set for host visible memory types (NULL otherwise)
+    bool (*allocate)(void* user, uint32_t memoryTypeIndex, VkMemoryAllocateFlags flags, VkDeviceSize size,
+        VkDeviceMemory* memory, void** map);
+
+    void (*free)(void* user, VkDeviceMemory memory, void* map);
+} AllocatorDevice;
+
+typedef struct {
+    VkDeviceMemory memory;
+    void*          map;
+
+    VkDeviceSize size;
+    VkDeviceSize usedBytes;
+    uint32_t     allocationCount;
+    uint32_t     maxClass;
+
+    // Largest free class + 1 of every buddy subtree, 0 if fully used
+    uint8_t* longest;
+} AllocatorBlock;
+
+typedef AllocatorBlock* AllocatorBlockPtr;
+LIST_DEFINE(AllocatorBlockPtr, AllocatorBlocks);
+
+typedef struct {
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+
+    uint32_t             memoryTypeIndex;
+    VkMemoryAllocateFlags flags;
+
+    bool linear; // Buffers and linear images, kept apart from optimal images (bufferImageGranularity)
+} AllocationRequest;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize   offset;
+    VkDeviceSize   size;
+    void*          map;
+
+    AllocatorBlock* block; // NULL for dedicated allocations
+    uint32_t        pool;
+    uint32_t        sizeClass;
+} Allocation;
+
+typedef struct {
+    uint32_t     blockCount;
+    uint32_t     allocationCount;
+    uint32_t     dedicatedCount;
+    VkDeviceSize blockBytes;
+    VkDeviceSize usedBytes;
+    VkDeviceSize requestedBytes;
+    VkDeviceSize dedicatedBytes;
+    VkDeviceSize largestFreeBytes;
+
+    float fragmentation; // 1 - sum of the largest free range of every block / free bytes
+} AllocatorStats;
+
+typedef struct {
+    AllocatorDevice device;
+    VkDeviceSize    blockSize;
+
+    AllocatorBlocks pools[ALLOCATOR_MAX_POOLS];
+
+    uint32_t     dedicatedCount;
+    VkDeviceSize dedicatedBytes;
+    VkDeviceSize requestedBytes;
+} Allocator;
+
+// blockSize must be a power of two
+bool allocator_create(const AllocatorDevice* device, VkDeviceSize blockSize, Allocator* allocator);
+
+void allocator_destroy(Allocator* allocator);
+
+bool allocator_alloc(Allocator* allocator, const AllocationRequest* request, Allocation* allocation);
+
+void allocator_free(Allocator* allocator, Allocation* allocation);
+
+void allocator_get_stats(const Allocator* allocator, AllocatorStats* stats);
+
+#endif // ALLOCATOR_H_
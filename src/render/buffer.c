@@ -1,19 +1,28 @@
 #include "buffer.h"
 
 #include "vulkan_base.h"
+#include "vulkan_memory.h"
+#include "staging.h"
+#include "vulkan_queue.h"
 
 #include <string.h>
 
 extern VkDevice device;
 
 bool vulkan_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory)
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation)
 {
+    // Buffers are written on the async queue and read on the graphics one, sharing them avoids per buffer ownership transfers
+    uint32_t families[QUEUE_COUNT];
+    uint32_t familyCount = vulkan_queue_families(families);
+
     VkBufferCreateInfo bufferInfo = {
-        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size        = size,
-        .usage       = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .sType                 = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size                  = size,
+        .usage                 = usage,
+        .sharingMode           = familyCount > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = familyCount > 1 ? familyCount : 0,
+        .pQueueFamilyIndices   = families,
     };
 
     VKCHECK(vkCreateBuffer(device, &bufferInfo, NULL, buffer));
@@ -21,20 +30,8 @@ bool vulkan_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
 
-    VkMemoryAllocateFlagsInfoKHR flagsInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR,
-        .flags = nextFlags,
-    };
-
-    VkMemoryAllocateInfo allocInfo = {
-        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext           = nextFlags ? &flagsInfo : 0,
-        .allocationSize  = memRequirements.size,
-        .memoryTypeIndex = vulkan_find_memory_type(memRequirements.memoryTypeBits, properties),
-    };
-
-    VKCHECK(vkAllocateMemory(device, &allocInfo, NULL, memory));
-    VKCHECK(vkBindBufferMemory(device, *buffer, *memory, 0));
+    CHECK(vulkan_memory_alloc(&memRequirements, properties, nextFlags, true, allocation));
+    VKCHECK(vkBindBufferMemory(device, *buffer, allocation->memory, allocation->offset));
     return true;
 }
 
@@ -55,37 +52,40 @@ bool vulkan_copy_buffer(VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer
     return true;
 }
 
-bool vulkan_create_data_buffer(VkCommandPool commandPool, const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory)
+bool vulkan_create_data_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation)
 {
-    BufferData stagingBuffer;
-    if(!vulkan_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        0, &stagingBuffer.buffer, &stagingBuffer.memory))
-        return false;
-        
-    void* mappedData;
-    VKCHECK(vkMapMemory(device, stagingBuffer.memory, 0, size, 0, &mappedData));
-    memcpy(mappedData, data, size);
-    vkUnmapMemory(device, stagingBuffer.memory);
-    
-    if(!vulkan_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, properties, nextFlags, buffer, memory))
+    if(!vulkan_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, properties, nextFlags, buffer, allocation))
         return false;
     
-    if(!vulkan_copy_buffer(commandPool, stagingBuffer.buffer, *buffer, size))
+    // Recorded in the open staging batch, visible to anything submitted after it
+    return vulkan_staging_upload_buffer(data, size, *buffer, 0);
+}
+
+bool vulkan_create_upload_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
+    VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation)
+{
+    VkMemoryPropertyFlags properties = vulkan_memory_properties(MEMORY_USAGE_GPU_UPLOAD);
+    if(!(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+        return vulkan_create_data_buffer(data, size, usage, properties, nextFlags, buffer, allocation);
+
+    // Unified memory, write in place
+    if(!vulkan_create_buffer(size, usage, properties, nextFlags, buffer, allocation))
         return false;
-    
-    DeleteBuffer(stagingBuffer);
+
+    memcpy(allocation->map, data, size);
     return true;
 }
 
 bool vulkan_create_mapped_data_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory, void** map)
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation, void** map)
 {
-    if(!vulkan_create_buffer(size, usage, properties, nextFlags, buffer, memory))
+    ASSERT(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+    if(!vulkan_create_buffer(size, usage, properties, nextFlags, buffer, allocation))
         return false;
     
-    VKCHECK(vkMapMemory(device, *memory, 0, size, 0, map));
+    *map = allocation->map;
     memcpy(*map, data, size);
     
     return true;
@@ -2,38 +2,41 @@
 #define BUFFER_H_
 
 #include "vulkan_base.h"
+#include "vulkan_memory.h"
 
 struct BufferData{
-    VkBuffer       buffer;
-    VkDeviceMemory memory;
+    VkBuffer   buffer;
+    Allocation allocation;
 };
 
 struct MappedBufferData{
-    VkBuffer       buffer;
-    VkDeviceMemory memory;
-    void*          map;
+    VkBuffer   buffer;
+    Allocation allocation;
+    void*      map;
 };
 
 #define DeleteBuffer(buff) {                        \
-        vkFreeMemory(device, buff.memory, NULL);    \
         vkDestroyBuffer(device, buff.buffer, NULL); \
+        vulkan_memory_free(&buff.allocation);       \
     }
 
-#define DeleteMappedBuffer(buff) {                  \
-        vkUnmapMemory(device, buff.memory);         \
-        vkFreeMemory(device, buff.memory, NULL);    \
-        vkDestroyBuffer(device, buff.buffer, NULL); \
-    }
+// Host visible blocks stay mapped by the allocator, nothing to unmap
+#define DeleteMappedBuffer(buff) DeleteBuffer(buff)
 
 bool vulkan_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory);
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation);
 
 bool vulkan_copy_buffer(VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
-bool vulkan_create_data_buffer(VkCommandPool commandPool, const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory);
+// Device buffer filled through the staging ring, the copy lands with the next vulkan_staging_submit
+bool vulkan_create_data_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation);
+
+// Device local buffer filled once by the host, staged unless device memory is host visible
+bool vulkan_create_upload_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
+    VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation);
 
 bool vulkan_create_mapped_data_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, VkDeviceMemory* memory, void** map);
+    VkMemoryPropertyFlags properties, VkMemoryAllocateFlags nextFlags, VkBuffer* buffer, Allocation* allocation, void** map);
 
 #endif // BUFFER_H_
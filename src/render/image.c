@@ -45,15 +45,9 @@ bool vulkan_create_image(uint32_t width, uint32_t height, uint32_t mipLevels,
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image->image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {
-        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize  = memRequirements.size,
-        .memoryTypeIndex = vulkan_find_memory_type(memRequirements.memoryTypeBits, properties),
-    };
-
-    VKCHECK(vkAllocateMemory(device, &allocInfo, NULL, &image->memory));
+    CHECK(vulkan_memory_alloc(&memRequirements, properties, 0, tiling == VK_IMAGE_TILING_LINEAR, &image->allocation));
 
-    VKCHECK(vkBindImageMemory(device, image->image, image->memory, 0));
+    VKCHECK(vkBindImageMemory(device, image->image, image->allocation.memory, image->allocation.offset));
     return true;
 }
 
@@ -98,15 +92,9 @@ bool vulkan_create_image_3d(uint32_t width, uint32_t height, uint32_t depth, VkF
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image->image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {
-        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize  = memRequirements.size,
-        .memoryTypeIndex = vulkan_find_memory_type(memRequirements.memoryTypeBits, properties),
-    };
-
-    VKCHECK(vkAllocateMemory(device, &allocInfo, NULL, &image->memory));
+    CHECK(vulkan_memory_alloc(&memRequirements, properties, 0, false, &image->allocation));
 
-    VKCHECK(vkBindImageMemory(device, image->image, image->memory, 0));
+    VKCHECK(vkBindImageMemory(device, image->image, image->allocation.memory, image->allocation.offset));
     return true;
 }
 
@@ -5,8 +5,8 @@
 #include "buffer.h"
 
 struct Image {
-    VkImage image;
-    VkDeviceMemory memory;
+    VkImage    image;
+    Allocation allocation;
 
     VkImageView view;
 };
@@ -16,7 +16,7 @@ struct Image {
             vkDestroyImageView(device, (img).view, NULL); \
                                                           \
         vkDestroyImage(device, (img).image, NULL);        \
-        vkFreeMemory(device, (img).memory, NULL);         \
+        vulkan_memory_free(&(img).allocation);            \
     }
 
 bool vulkan_create_image(uint32_t width, uint32_t height, uint32_t mipLevels,
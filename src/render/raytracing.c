@@ -3,9 +3,20 @@
 #include "core/filesystem.h"
 #include "core/camera.h"
 #include "core/list.h"
+#include "core/timer.h"
+
+#include "voxel/brickmap.h"
+#include "voxel/bounds.h"
+#include "voxel/palette.h"
+#include "voxel/svo.h"
+#include "voxel/dag.h"
+#include "voxel/morton.h"
 
 #include "shader.h"
 #include "buffer.h"
+#include "vulkan_memory.h"
+#include "staging.h"
+#include "vulkan_queue.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -18,13 +29,13 @@ extern uint32_t maxRayRecursionDepth;
 
 typedef struct {
     VkBuffer        buffer;
-    VkDeviceMemory  memory;
+    Allocation      allocation;
     VkDeviceAddress address;
 } AddressedBuffer;
 
 typedef struct {
     VkBuffer        buffer;
-    VkDeviceMemory  memory;
+    Allocation      allocation;
     void*           map;
     VkDeviceAddress address;
 } MappedAddressedBuffer;
@@ -34,6 +45,49 @@ typedef struct {
     VkDeviceAddress indexAddress;
 } GeometryData;
 
+typedef struct {
+    VkDeviceAddress gridAddress;
+    VkDeviceAddress brickAddress;
+    VkDeviceAddress occupancyAddress;
+    VkDeviceAddress distanceAddress;
+    VkDeviceAddress aabbAddress;
+    VkDeviceAddress nodeAddress;
+    VkDeviceAddress paletteAddress;
+    VkDeviceAddress colorAddress; // RGBA8 of every voxel value, 0 for the fixed materials
+    uint32_t width, height, depth;
+    uint32_t gridWidth, gridHeight, gridDepth;
+    uint32_t levelCount;
+    uint32_t metric;
+    uint32_t bounds;
+    uint32_t octreeLevels;
+    uint32_t octreeRoot;
+    uint32_t padding;
+} VolumeData;
+
+typedef struct {
+    VolumeBackend backend;
+
+    // Brickmap, the bricks are the table of the palette encoded spans
+    BufferData grid;
+    BufferData bricks;
+    BufferData palette;
+    BufferData occupancy;
+    BufferData distance;
+
+    // SVO, the DAG nodes are shared in dagBuffer
+    BufferData nodes;
+
+    BufferData aabbs;
+    uint32_t   aabbCount;
+
+    BufferData colors; // Of raytracing_set_volume_colors, VK_NULL_HANDLE without
+
+    uint32_t     blas;    // Into blasInputs and blass, triangle geometries take the other slots
+    VkDeviceSize memory;  // MEMORY_CATEGORY_GEOMETRY bytes of its buffers
+    bool         removed; // Slot waits in retiredVolumes or freeVolumes
+    bool         device;  // Bricks in the device brick pool, without a palette buffer of its own
+} Volume;
+
 typedef struct {
     VkAccelerationStructureGeometryKHR geometry;
     VkAccelerationStructureBuildRangeInfoKHR rangeInfo;
@@ -45,19 +99,93 @@ typedef struct {
     VkAccelerationStructureBuildRangeInfoKHR* rangeInfo;
     VkAccelerationStructureBuildSizesInfoKHR sizesInfo;
     VkAccelerationStructureKHR as;
+    BufferData buffer;
+    VkDeviceSize scratchOffset; // Into the scratch range of its batch
 } BuildAccelerationStructure;
 
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} BlasBatch;
+
 typedef struct {
     BuildAccelerationStructure buildAs;
     VkDeviceAddress address;
 } BottomLevel;
 
+// Push constants of res/shaders/volume, the passes deriving a device volume from its voxels
+typedef struct {
+    VkDeviceAddress wordsAddress;
+    VkDeviceAddress gridAddress;
+    VkDeviceAddress occupancyAddress;
+    VkDeviceAddress aabbAddress;
+    VkDeviceAddress totalsAddress;
+    uint32_t gridWidth, gridHeight, gridDepth;
+    uint32_t levelCount;
+    uint32_t bounds;
+} VolumeBoundsConstants;
+
+typedef struct {
+    VkDeviceAddress occupancyAddress;
+    VkDeviceAddress prefixAddress;
+    VkDeviceAddress headAddress;
+    uint32_t wordCount;
+    uint32_t capacity;
+} VolumeScanConstants;
+
+typedef struct {
+    VkDeviceAddress wordsAddress;
+    VkDeviceAddress occupancyAddress;
+    VkDeviceAddress prefixAddress;
+    VkDeviceAddress tableAddress;
+    VkDeviceAddress poolAddress;
+    uint32_t gridWidth, gridHeight, gridDepth;
+    uint32_t wordCount;
+    uint32_t capacity;
+} VolumeCompactConstants;
+
+typedef struct {
+    VkDeviceAddress sourceAddress;
+    VkDeviceAddress destinationAddress;
+    VkDeviceAddress occupancyAddress;
+    VkDeviceAddress distanceAddress;
+    VkDeviceAddress aabbAddress;
+    VkDeviceAddress totalsAddress;
+    uint32_t gridWidth, gridHeight, gridDepth;
+    uint32_t axis;
+    uint32_t bounds;
+    uint32_t width, height, depth;
+} VolumeDistanceConstants;
+
+// Removed volume kept alive until no frame in flight can trace it anymore
+typedef struct {
+    Volume      volume;
+    BottomLevel blas;
+    uint32_t    slot;
+    uint32_t    frames; // Top layer updates left before its buffers and BLAS are destroyed
+    uint64_t    value;  // Async timeline value of the BLAS build still reading its buffers, 0 without
+} RetiredVolume;
+
+// Volume BLAS on its way on the async queue, its instances get the structure once value completed
+typedef struct {
+    uint32_t                   volume; // UINT32_MAX once removed, the structures are only destroyed
+    BuildAccelerationStructure buildAs;
+    BuildAccelerationStructure source; // Uncompacted structure while the compacted copy runs
+    VkCommandBuffer            commandBuffer;
+    uint64_t                   value;
+    uint32_t                   query;  // Compacted size query, UINT32_MAX without compaction
+} PendingBlas;
+
 LIST_DEFINE(GeometryData, GeometriesAddresses);
+LIST_DEFINE(VolumeData, VolumeDatas);
+LIST_DEFINE(Volume, Volumes);
 LIST_DEFINE(BlasInput, BlasInputs);
 LIST_DEFINE(BottomLevel, BottomLevels);
 LIST_DEFINE(VkAccelerationStructureInstanceKHR, Tlas);
-LIST_DEFINE(AddressedBuffer, AddressedBuffers);
 LIST_DEFINE(BuildAccelerationStructure, BuildAccelerationStructures);
+LIST_DEFINE(BlasBatch, BlasBatches);
+LIST_DEFINE(RetiredVolume, RetiredVolumes);
+LIST_DEFINE(PendingBlas, PendingBlass);
 
 static PFN_vkGetBufferDeviceAddressKHR                   GetBufferDeviceAddressKHR                   = NULL;
 static PFN_vkCreateAccelerationStructureKHR              CreateAccelerationStructureKHR              = NULL;
@@ -69,20 +197,47 @@ static PFN_vkGetRayTracingShaderGroupHandlesKHR          GetRayTracingShaderGrou
 static PFN_vkCmdTraceRaysKHR                             CmdTraceRaysKHR                             = NULL;
 static PFN_vkGetAccelerationStructureDeviceAddressKHR    GetAccelerationStructureDeviceAddressKHR    = NULL;
 static PFN_vkCmdWriteAccelerationStructuresPropertiesKHR CmdWriteAccelerationStructuresPropertiesKHR = NULL;
+static PFN_vkCmdCopyAccelerationStructureKHR             CmdCopyAccelerationStructureKHR             = NULL;
+
+static BlasInputs   blasInputs = {0};
+static BottomLevels blass = {0};
+static bool         blassBuilt;
+static VkBuildAccelerationStructureFlagsKHR blasFlags;
 
-static BlasInputs       blasInputs = {0};
-static BottomLevels     blass = {0};
-static AddressedBuffers blasAddresses = {0};
+// Volume BLAS built after the bottom layer, one after the other on the async queue with the same scratch
+static PendingBlass    pendingBlass = {0};
+static AddressedBuffer blasScratch;
+static VkDeviceSize    blasScratchSize;
+static VkQueryPool     blasQueryPool;
+static UInt32s         freeBlasQueries = {0};
 
 static GeometriesAddresses geometriesAddresses = {0};
 static BufferData          geometriesAddressesBuffer;
 
-static BufferDatas aabbBuffers = {0};
-static Images volumes = {0};
+static Volumes     volumes = {0};
+static VolumeDatas volumeDatas = {0};
+static BufferData  volumeDatasBuffer; // RAYTRACING_MAX_VOLUMES wide, the descriptors never change
+static bool        volumeDatasUploaded;
+
+// Slots of the removed volumes and BLAS, handed out again once retired
+static RetiredVolumes retiredVolumes = {0};
+static UInt32s        freeVolumes = {0};
+static UInt32s        freeBlass = {0};
+static UInt32s        dirtyVolumes = {0}; // Volume datas written since the upload, copied by the next frame
+
+// Every DAG volume is a root into the same nodes, uploaded once with the volume datas
+static Dag        dag = {0};
+static BufferData dagBuffer;
+static bool       dagUploaded;
 
 static Tlas                       tlas = {0};
 static VkAccelerationStructureKHR tlasAs;
-static MappedAddressedBuffer      instanceBuffer;
+static MappedAddressedBuffer      instanceBuffers[MAX_FRAMES_IN_FLIGHT];
+static VkBuildAccelerationStructureFlagsKHR tlasFlags;
+static bool                       tlasDirty;      // Instances changed since the last build
+static bool                       tlasRebuild;    // Instances added or removed, a refit keeps the instance set
+static uint32_t                   tlasRefitCount; // Refits since the last full build
+static UInt32s                    freeInstances = {0};
 
 static BufferData accelerationBuffer;
 static AddressedBuffer tempAsBuild;
@@ -96,12 +251,34 @@ static VkPipeline pipeline;
 
 static uint32_t sbtGroupCount;
 
+static VkDeviceSize scratchAlignment = 1;
+
 static VkStridedDeviceAddressRegionKHR rayGenRegion;
 static VkStridedDeviceAddressRegionKHR rayMissRegion;
 static VkStridedDeviceAddressRegionKHR rayHitRegion;
 static VkStridedDeviceAddressRegionKHR rayCallRegion;
 static BufferData raySBTBuffer;
 
+// Created with the first device volume
+static VkPipelineLayout volumeBoundsLayout;
+static VkPipeline       volumeBoundsPipeline;
+static VkPipelineLayout volumeScanLayout;
+static VkPipeline       volumeScanPipeline;
+static VkPipelineLayout volumeCompactLayout;
+static VkPipeline       volumeCompactPipeline;
+static VkPipelineLayout volumeDistanceLayout;
+static VkPipeline       volumeDistancePipeline;
+
+// Solid bricks of every device volume, handed out on the device from the next and dropped counts of the head.
+// Brick 0 stays empty
+static BufferData deviceBricks;
+static BufferData deviceBricksHead;
+
+static VkDeviceSize raytracing_align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
 static VkDeviceAddress raytracing_get_buffer_device_address(VkBuffer buffer)
 {
     VkBufferDeviceAddressInfo addressInfo =
@@ -124,32 +301,209 @@ bool raytracing_init()
     VK_DEVICE_PFN(device, CmdTraceRaysKHR);
     VK_DEVICE_PFN(device, GetAccelerationStructureDeviceAddressKHR);
     VK_DEVICE_PFN(device, CmdWriteAccelerationStructuresPropertiesKHR);
+    VK_DEVICE_PFN(device, CmdCopyAccelerationStructureKHR);
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+    };
+    VkPhysicalDeviceProperties2 deviceProperties2 =
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &accelerationStructureProperties,
+    };
+    vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties2);
+
+    // Every build of a batch gets its own scratch range, each has to start on this alignment
+    scratchAlignment = accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+    return true;
+}
+
+static bool raytracing_create_brickmap_volume(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBounds bounds, Volume* volume, VolumeData* volumeData, AABBs* aabbs)
+{
+    BrickMap brickMap;
+    CHECK(brickmap_create(width, height, depth, data, DISTANCE_CHEBYSHEV, &brickMap));
+
+    // Fully empty volumes keep the single AABB, a BLAS needs at least one primitive to be traced
+    if(brickMap.bricks.count == 0)
+        bounds = VOLUME_BOUNDS_SINGLE;
+
+    if(bounds == VOLUME_BOUNDS_BRICKS)
+    {
+        // Tight box of every non empty brick in grid order, the shader finds the brick back from the box
+        for(uint32_t z = 0; z < brickMap.gridDepth; ++z)
+            for(uint32_t y = 0; y < brickMap.gridHeight; ++y)
+                for(uint32_t x = 0; x < brickMap.gridWidth; ++x)
+                {
+                    if(brickMap.grid[x + y * brickMap.gridWidth + z * (brickMap.gridWidth * brickMap.gridHeight)] == BRICK_EMPTY)
+                        continue;
+
+                    uint32_t min[3], max[3];
+                    brickmap_brick_bounds(&brickMap, x, y, z, min, max);
+
+                    AABB aabb = {
+                        .min = { min[0], min[1], min[2] },
+                        .max = { max[0], max[1], max[2] },
+                    };
+                    list_append(*aabbs, aabb);
+                }
+    }
+    else
+    {
+        // Bounds of the non zero voxels, the shader reads the box back and starts the traversal on it
+        AABB aabb = {
+            .min = { brickMap.boundsMin[0], brickMap.boundsMin[1], brickMap.boundsMin[2] },
+            .max = { brickMap.boundsMax[0], brickMap.boundsMax[1], brickMap.boundsMax[2] },
+        };
+
+        if(brickMap.bricks.count == 0)
+            aabb.max = (Vec3) { width, height, depth };
+
+        list_append(*aabbs, aabb);
+    }
+
+    // 1 to 8 bits per voxel instead of a byte, the width of every brick fits its own palette
+    BrickPalette palette;
+    palette_create(&brickMap, &palette);
+
+    // Fully empty volumes still need valid brick table and palette addresses
+    uint32_t emptyWord = 0;
+    const void*  bricksData  = palette.table.count > 0 ? (const void*) palette.table.items : (const void*) &emptyWord;
+    VkDeviceSize bricksSize  = palette.table.count > 0 ? palette.table.count * sizeof(uint32_t) : sizeof(uint32_t);
+    const void*  paletteData = palette.words.count > 0 ? (const void*) palette.words.items : (const void*) &emptyWord;
+    VkDeviceSize paletteSize = palette.words.count > 0 ? palette.words.count * sizeof(uint32_t) : sizeof(uint32_t);
+
+    CHECK(vulkan_create_upload_buffer(brickMap.grid, brickmap_grid_size(&brickMap) * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->grid.buffer, &volume->grid.allocation));
+
+    CHECK(vulkan_create_upload_buffer(bricksData, bricksSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->bricks.buffer, &volume->bricks.allocation));
+
+    CHECK(vulkan_create_upload_buffer(paletteData, paletteSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->palette.buffer, &volume->palette.allocation));
+
+    CHECK(vulkan_create_upload_buffer(brickMap.occupancy, brickmap_occupancy_size(&brickMap) * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->occupancy.buffer, &volume->occupancy.allocation));
+
+    CHECK(vulkan_create_upload_buffer(brickMap.distance, brickmap_distance_size(&brickMap),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->distance.buffer, &volume->distance.allocation));
+    volume->memory = (brickmap_grid_size(&brickMap) + brickmap_occupancy_size(&brickMap)) * sizeof(uint32_t) +
+        bricksSize + paletteSize + brickmap_distance_size(&brickMap);
+    vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, volume->memory);
+
+    volumeData->gridAddress      = raytracing_get_buffer_device_address(volume->grid.buffer);
+    volumeData->brickAddress     = raytracing_get_buffer_device_address(volume->bricks.buffer);
+    volumeData->paletteAddress   = raytracing_get_buffer_device_address(volume->palette.buffer);
+    volumeData->occupancyAddress = raytracing_get_buffer_device_address(volume->occupancy.buffer);
+    volumeData->distanceAddress  = raytracing_get_buffer_device_address(volume->distance.buffer);
+    volumeData->gridWidth        = brickMap.gridWidth;
+    volumeData->gridHeight       = brickMap.gridHeight;
+    volumeData->gridDepth        = brickMap.gridDepth;
+    volumeData->levelCount       = brickMap.levelCount;
+    volumeData->metric           = brickMap.metric;
+    volumeData->bounds           = bounds;
+
+    log_trace("Raytracing volume %ux%ux%u: %zu/%zu bricks, %u occupancy levels, %zu bytes (dense %zu bytes), "
+        "%zu palette encoded brick bytes (raw %zu bytes), %zu AABBs, bounds %u,%u,%u..%u,%u,%u", width, height, depth,
+        brickMap.bricks.count, brickmap_grid_size(&brickMap), brickMap.levelCount, brickmap_memory_size(&brickMap),
+        (size_t) width * height * depth, palette_memory_size(&palette), brickMap.bricks.count * sizeof(Brick), aabbs->count,
+        brickMap.boundsMin[0], brickMap.boundsMin[1], brickMap.boundsMin[2],
+        brickMap.boundsMax[0], brickMap.boundsMax[1], brickMap.boundsMax[2]);
+
+    palette_destroy(&palette);
+    brickmap_destroy(&brickMap);
     return true;
 }
 
-bool raytracing_add_volume_geometry(VkCommandPool commandPool, uint32_t width, uint32_t height, uint32_t depth, uint8_t* data)
+static bool raytracing_create_svo_volume(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    Volume* volume, VolumeData* volumeData, AABBs* aabbs)
 {
+    Svo svo;
+    CHECK(svo_create(width, height, depth, data, &svo));
+
+    // The octree skips the empty space itself, one AABB over the non zero voxels or the whole volume when empty
+    uint32_t min[3] = { 0, 0, 0 }, max[3] = { width, height, depth };
+    bounds_scan(data, width, height, depth, min, max);
+
     AABB aabb = {
-        .min = { 0.0f, 0.0f, 0.0f },
-        .max = { width, height, depth },
+        .min = { min[0], min[1], min[2] },
+        .max = { max[0], max[1], max[2] },
     };
-    BufferData aabbBuffer;
+    list_append(*aabbs, aabb);
 
-    CHECK(vulkan_create_data_buffer(commandPool, &aabb, sizeof(AABB),
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &aabbBuffer.buffer, &aabbBuffer.memory));
-    
-    Texture volume = {
-        .mipLevels = 1,
+    bool result = vulkan_create_upload_buffer(svo.nodes, svo_memory_size(&svo),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->nodes.buffer, &volume->nodes.allocation);
+
+    if(result)
+    {
+        volume->memory = svo_memory_size(&svo);
+        vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, volume->memory);
+
+        volumeData->nodeAddress  = raytracing_get_buffer_device_address(volume->nodes.buffer);
+        volumeData->octreeLevels = svo.levels;
+        volumeData->octreeRoot   = svo_root(&svo);
+        volumeData->bounds       = VOLUME_BOUNDS_SINGLE;
+
+        log_trace("Raytracing volume %ux%ux%u: SVO of %u levels, %zu bytes (dense %zu bytes), bounds %u,%u,%u..%u,%u,%u",
+            width, height, depth, svo.levels, svo_memory_size(&svo), (size_t) width * height * depth,
+            min[0], min[1], min[2], max[0], max[1], max[2]);
+    }
+
+    svo_destroy(&svo);
+    return result;
+}
+
+static bool raytracing_create_dag_volume(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    Volume* volume, VolumeData* volumeData, AABBs* aabbs)
+{
+    if(dagUploaded)
+    {
+        log_error("DAG volumes have to be added before the geometries address buffer is created");
+        return false;
+    }
+
+    if(dag.slots == NULL)
+        dag_create(&dag);
+
+    size_t wordCount = dag.nodes.count;
+
+    uint32_t index;
+    CHECK(dag_add_volume(&dag, width, height, depth, data, &index));
+
+    // Same single AABB as the SVO volumes
+    uint32_t min[3] = { 0, 0, 0 }, max[3] = { width, height, depth };
+    bounds_scan(data, width, height, depth, min, max);
+
+    AABB aabb = {
+        .min = { min[0], min[1], min[2] },
+        .max = { max[0], max[1], max[2] },
     };
+    list_append(*aabbs, aabb);
+
+    // The node address is only known once the shared buffer is uploaded
+    volumeData->octreeLevels = dag.roots.items[index].levels;
+    volumeData->octreeRoot   = dag.roots.items[index].node;
+    volumeData->bounds       = VOLUME_BOUNDS_SINGLE;
 
-    CHECK(vulkan_create_image_3d(width, height, depth, VK_FORMAT_R8_UINT,
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &volume.image));
-    CHECK(vulkan_create_image_view_3d(volume.image.image, VK_FORMAT_R8_UINT, VK_IMAGE_ASPECT_COLOR_BIT, &volume.image.view));
+    log_trace("Raytracing volume %ux%ux%u: DAG of %u levels, %zu new bytes (dense %zu bytes), %zu shared bytes, "
+        "bounds %u,%u,%u..%u,%u,%u", width, height, depth, volumeData->octreeLevels,
+        (dag.nodes.count - wordCount) * sizeof(uint32_t), (size_t) width * height * depth, dag_memory_size(&dag),
+        min[0], min[1], min[2], max[0], max[1], max[2]);
 
-    CHECK(vulkan_upload_texture_buffer_3d(data, width, height, depth, commandPool, &volume));
+    return true;
+}
 
-    VkDeviceAddress address = raytracing_get_buffer_device_address(aabbBuffer.buffer);
+// Volume data and BLAS input of a volume whose buffers exist, in the slots of the retired ones first
+static void raytracing_register_volume(Volume* volume, VolumeData* volumeData, uint32_t* volumeIndex)
+{
+    volumeData->aabbAddress = raytracing_get_buffer_device_address(volume->aabbs.buffer);
+    VkDeviceAddress address = volumeData->aabbAddress;
 
     BlasInput blasInput = {
         .geometry = (VkAccelerationStructureGeometryKHR)
@@ -166,20 +520,460 @@ bool raytracing_add_volume_geometry(VkCommandPool commandPool, uint32_t width, u
         },
         .rangeInfo = (VkAccelerationStructureBuildRangeInfoKHR)
         {
-            .primitiveCount  = 1,
+            .primitiveCount  = volume->aabbCount,
             .primitiveOffset = 0,
             .firstVertex     = 0,
             .transformOffset = 0,
         },
         .structureFlags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_DATA_ACCESS_KHR,
     };
-    list_append(blasInputs, blasInput);
-    
-    list_append(aabbBuffers, aabbBuffer);
-    list_append(volumes, volume);
+
+    if(freeBlass.count > 0)
+    {
+        volume->blas = freeBlass.items[--freeBlass.count];
+        blasInputs.items[volume->blas] = blasInput;
+    }
+    else
+    {
+        volume->blas = (uint32_t) blasInputs.count;
+        list_append(blasInputs, blasInput);
+    }
+
+    if(freeVolumes.count > 0)
+    {
+        *volumeIndex = freeVolumes.items[--freeVolumes.count];
+        volumes.items[*volumeIndex]     = *volume;
+        volumeDatas.items[*volumeIndex] = *volumeData;
+    }
+    else
+    {
+        *volumeIndex = (uint32_t) volumes.count;
+        list_append(volumes, *volume);
+        list_append(volumeDatas, *volumeData);
+    }
+
+    // Uploaded volume datas are patched in place by the next frame
+    if(volumeDatasUploaded)
+        list_append(dirtyVolumes, *volumeIndex);
+}
+
+static bool raytracing_volume_slot_free()
+{
+    if(freeVolumes.count == 0 && volumes.count >= RAYTRACING_MAX_VOLUMES)
+    {
+        log_error("Raytracing volumes full, %u volumes", RAYTRACING_MAX_VOLUMES);
+        return false;
+    }
+    return true;
+}
+
+// Buffers, volume data and BLAS input of a volume
+static bool raytracing_create_volume_geometry(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBackend backend, VolumeBounds bounds, uint32_t* volumeIndex)
+{
+    CHECK(raytracing_volume_slot_free());
+
+    Volume volume = {
+        .backend = backend,
+    };
+
+    VolumeData volumeData = {
+        .width  = width,
+        .height = height,
+        .depth  = depth,
+    };
+
+    AABBs aabbs = {0};
+    bool created = false;
+    switch(backend)
+    {
+    case VOLUME_BACKEND_BRICKMAP:
+        created = raytracing_create_brickmap_volume(width, height, depth, data, bounds, &volume, &volumeData, &aabbs);
+        break;
+    case VOLUME_BACKEND_SVO:
+        created = raytracing_create_svo_volume(width, height, depth, data, &volume, &volumeData, &aabbs);
+        break;
+    case VOLUME_BACKEND_DAG:
+        created = raytracing_create_dag_volume(width, height, depth, data, &volume, &volumeData, &aabbs);
+        break;
+    }
+    CHECK(created);
+
+    CHECK(vulkan_create_upload_buffer(aabbs.items, aabbs.count * sizeof(AABB),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume.aabbs.buffer, &volume.aabbs.allocation));
+    vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, aabbs.count * sizeof(AABB));
+
+    volume.aabbCount = (uint32_t) aabbs.count;
+    volume.memory   += aabbs.count * sizeof(AABB);
+    list_destroy(aabbs);
+
+    raytracing_register_volume(&volume, &volumeData, volumeIndex);
+    return true;
+}
+
+static void raytracing_memory_barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage,
+    VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = srcAccess,
+        .dstAccessMask = dstAccess,
+    };
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static bool raytracing_create_device_buffer(VkDeviceSize size, VkBufferUsageFlags usage, BufferData* buffer)
+{
+    return vulkan_create_buffer(size, usage | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY),
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &buffer->buffer, &buffer->allocation);
+}
+
+// Brickmap buffers of a device volume filled on the async queue: the writer fills a raw brick per cell in scratch,
+// a prefix sum over the occupancy gives the solid ones their slot in the device brick pool and the brick table
+// points at them. The pyramid and the distances follow the host brickmap layout
+static bool raytracing_create_device_volume_geometry(uint32_t width, uint32_t height, uint32_t depth,
+    VolumeBounds bounds, VolumeWriter writer, void* user, Volume* volume, VolumeData* volumeData)
+{
+    bool firstVolume = volumeBoundsPipeline == VK_NULL_HANDLE;
+    if(firstVolume)
+    {
+        CHECK(vulkan_shader_create_compute_pipeline("res/shaders/volume/volumeBounds.comp.spv",
+            sizeof(VolumeBoundsConstants), &volumeBoundsLayout, &volumeBoundsPipeline));
+        CHECK(vulkan_shader_create_compute_pipeline("res/shaders/volume/volumeScan.comp.spv",
+            sizeof(VolumeScanConstants), &volumeScanLayout, &volumeScanPipeline));
+        CHECK(vulkan_shader_create_compute_pipeline("res/shaders/volume/volumeCompact.comp.spv",
+            sizeof(VolumeCompactConstants), &volumeCompactLayout, &volumeCompactPipeline));
+        CHECK(vulkan_shader_create_compute_pipeline("res/shaders/volume/volumeDistance.comp.spv",
+            sizeof(VolumeDistanceConstants), &volumeDistanceLayout, &volumeDistancePipeline));
+
+        CHECK(raytracing_create_device_buffer((VkDeviceSize) RAYTRACING_DEVICE_BRICKS * BRICK_VOLUME, 0, &deviceBricks));
+        CHECK(raytracing_create_device_buffer(2 * sizeof(uint32_t), 0, &deviceBricksHead));
+        vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, (VkDeviceSize) RAYTRACING_DEVICE_BRICKS * BRICK_VOLUME);
+    }
+
+    uint32_t gridSize[3] = {
+        (width  + BRICK_SIZE - 1) / BRICK_SIZE,
+        (height + BRICK_SIZE - 1) / BRICK_SIZE,
+        (depth  + BRICK_SIZE - 1) / BRICK_SIZE,
+    };
+    uint32_t cellCount = gridSize[0] * gridSize[1] * gridSize[2];
+
+    // Same levels and word offsets as brickmap_create_occupancy
+    uint32_t maxSize = gridSize[0] > gridSize[1] ? gridSize[0] : gridSize[1];
+    maxSize = maxSize > gridSize[2] ? maxSize : gridSize[2];
+
+    uint32_t levelCount = 1;
+    while((1u << (levelCount - 1)) < maxSize)
+        ++levelCount;
+
+    if(levelCount > BRICKMAP_MAX_LEVELS)
+    {
+        log_error("Raytracing device volume %ux%ux%u needs %u occupancy levels", width, height, depth, levelCount);
+        return false;
+    }
+
+    uint32_t offsets[BRICKMAP_MAX_LEVELS] = {0};
+    uint32_t occupancyWords = BRICKMAP_MAX_LEVELS;
+    for(uint32_t level = 0; level < levelCount; ++level)
+    {
+        offsets[level] = occupancyWords;
+        occupancyWords += (((gridSize[0] + (1u << level) - 1) >> level) * ((gridSize[1] + (1u << level) - 1) >> level) *
+            ((gridSize[2] + (1u << level) - 1) >> level) + 31) / 32;
+    }
+
+    *volume = (Volume) {
+        .backend   = VOLUME_BACKEND_BRICKMAP,
+        .aabbCount = bounds == VOLUME_BOUNDS_BRICKS ? cellCount : 1,
+        .device    = true,
+    };
+
+    // Level 0 of the pyramid, one bit per brick
+    uint32_t brickWords = (cellCount + 31) / 32;
+
+    VkDeviceSize gridBytes      = (VkDeviceSize) cellCount * sizeof(uint32_t);
+    VkDeviceSize wordsBytes     = (VkDeviceSize) cellCount * BRICK_VOLUME;
+    VkDeviceSize occupancyBytes = (VkDeviceSize) occupancyWords * sizeof(uint32_t);
+    VkDeviceSize distanceBytes  = ((VkDeviceSize) cellCount + 3) & ~(VkDeviceSize) 3;
+    VkDeviceSize aabbBytes      = (VkDeviceSize) volume->aabbCount * sizeof(AABB);
+
+    CHECK(raytracing_create_device_buffer(gridBytes, 0, &volume->grid));
+    CHECK(raytracing_create_device_buffer(gridBytes, 0, &volume->bricks));
+    CHECK(raytracing_create_device_buffer(occupancyBytes, 0, &volume->occupancy));
+    CHECK(raytracing_create_device_buffer(distanceBytes, 0, &volume->distance));
+    CHECK(raytracing_create_device_buffer(aabbBytes, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+        &volume->aabbs));
+
+    volume->memory = gridBytes * 2 + occupancyBytes + distanceBytes + aabbBytes;
+    vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, volume->memory);
+
+    // Scratch of the passes: the voxels of every brick, the box of the non zero voxels, the solid bricks before
+    // every occupancy word then the first slot of the volume, and the distances along x, then along x and y
+    BufferData words, totals, prefix, lines[2];
+    CHECK(raytracing_create_device_buffer(wordsBytes, 0, &words));
+    CHECK(raytracing_create_device_buffer(6 * sizeof(uint32_t), 0, &totals));
+    CHECK(raytracing_create_device_buffer(((VkDeviceSize) brickWords + 1) * sizeof(uint32_t), 0, &prefix));
+    CHECK(raytracing_create_device_buffer(gridBytes, 0, &lines[0]));
+    CHECK(raytracing_create_device_buffer(gridBytes, 0, &lines[1]));
+
+    *volumeData = (VolumeData) {
+        .gridAddress      = raytracing_get_buffer_device_address(volume->grid.buffer),
+        .brickAddress     = raytracing_get_buffer_device_address(volume->bricks.buffer),
+        .paletteAddress   = raytracing_get_buffer_device_address(deviceBricks.buffer),
+        .occupancyAddress = raytracing_get_buffer_device_address(volume->occupancy.buffer),
+        .distanceAddress  = raytracing_get_buffer_device_address(volume->distance.buffer),
+        .aabbAddress      = raytracing_get_buffer_device_address(volume->aabbs.buffer),
+        .width            = width,
+        .height           = height,
+        .depth            = depth,
+        .gridWidth        = gridSize[0],
+        .gridHeight       = gridSize[1],
+        .gridDepth        = gridSize[2],
+        .levelCount       = levelCount,
+        .metric           = DISTANCE_CHEBYSHEV,
+        .bounds           = bounds,
+    };
+
+    VkDeviceAddress wordsAddress    = raytracing_get_buffer_device_address(words.buffer);
+    VkDeviceAddress totalsAddress   = raytracing_get_buffer_device_address(totals.buffer);
+    VkDeviceAddress prefixAddress   = raytracing_get_buffer_device_address(prefix.buffer);
+    VkDeviceAddress lineAddresses[] = {
+        raytracing_get_buffer_device_address(lines[0].buffer),
+        raytracing_get_buffer_device_address(lines[1].buffer),
+    };
+
+    VkCommandBuffer commandBuffer;
+    CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+
+    // The pool starts with its empty brick 0
+    if(firstVolume)
+    {
+        const uint32_t head[2] = { 1, 0 };
+        vkCmdFillBuffer(commandBuffer, deviceBricks.buffer, 0, BRICK_VOLUME, 0);
+        vkCmdUpdateBuffer(commandBuffer, deviceBricksHead.buffer, 0, sizeof(head), head);
+    }
+
+    // Level offsets then cleared bits, cleared distances for the bytes or-ed in, an empty box for the totals
+    const uint32_t emptyBox[6] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, 0, 0, 0 };
+    vkCmdUpdateBuffer(commandBuffer, volume->occupancy.buffer, 0, sizeof(offsets), offsets);
+    vkCmdFillBuffer(commandBuffer, volume->occupancy.buffer, sizeof(offsets), VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(commandBuffer, volume->distance.buffer, 0, VK_WHOLE_SIZE, 0);
+    vkCmdUpdateBuffer(commandBuffer, totals.buffer, 0, sizeof(emptyBox), emptyBox);
+
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    writer(commandBuffer, wordsAddress, gridSize, user);
+
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // One workgroup per brick: grid cell, AABB, occupancy bits of every level and the total box
+    VolumeBoundsConstants boundsConstants = {
+        .wordsAddress     = wordsAddress,
+        .gridAddress      = volumeData->gridAddress,
+        .occupancyAddress = volumeData->occupancyAddress,
+        .aabbAddress      = volumeData->aabbAddress,
+        .totalsAddress    = totalsAddress,
+        .gridWidth        = gridSize[0],
+        .gridHeight       = gridSize[1],
+        .gridDepth        = gridSize[2],
+        .levelCount       = levelCount,
+        .bounds           = bounds,
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeBoundsPipeline);
+    vkCmdPushConstants(commandBuffer, volumeBoundsLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(boundsConstants),
+        &boundsConstants);
+    vkCmdDispatch(commandBuffer, gridSize[0], gridSize[1], gridSize[2]);
+
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Prefix sum of the level 0 bits in one workgroup, which also takes the range of the volume from the pool head
+    VolumeScanConstants scanConstants = {
+        .occupancyAddress = volumeData->occupancyAddress,
+        .prefixAddress    = prefixAddress,
+        .headAddress      = raytracing_get_buffer_device_address(deviceBricksHead.buffer),
+        .wordCount        = brickWords,
+        .capacity         = RAYTRACING_DEVICE_BRICKS,
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeScanPipeline);
+    vkCmdPushConstants(commandBuffer, volumeScanLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(scanConstants),
+        &scanConstants);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // One workgroup per brick: the solid ones are copied to their slot and get their table entry
+    VolumeCompactConstants compactConstants = {
+        .wordsAddress     = wordsAddress,
+        .occupancyAddress = volumeData->occupancyAddress,
+        .prefixAddress    = prefixAddress,
+        .tableAddress     = volumeData->brickAddress,
+        .poolAddress      = volumeData->paletteAddress,
+        .gridWidth        = gridSize[0],
+        .gridHeight       = gridSize[1],
+        .gridDepth        = gridSize[2],
+        .wordCount        = brickWords,
+        .capacity         = RAYTRACING_DEVICE_BRICKS,
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeCompactPipeline);
+    vkCmdPushConstants(commandBuffer, volumeCompactLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(compactConstants),
+        &compactConstants);
+    vkCmdDispatch(commandBuffer, gridSize[0], gridSize[1], gridSize[2]);
+
+    // Separable distance transform, x into lines[0], y into lines[1], z into the distance bytes
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeDistancePipeline);
+    for(uint32_t axis = 0; axis < 3; ++axis)
+    {
+        raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        VolumeDistanceConstants distanceConstants = {
+            .sourceAddress      = lineAddresses[(axis + 1) & 1],
+            .destinationAddress = lineAddresses[axis & 1],
+            .occupancyAddress   = volumeData->occupancyAddress,
+            .distanceAddress    = volumeData->distanceAddress,
+            .aabbAddress        = volumeData->aabbAddress,
+            .totalsAddress      = totalsAddress,
+            .gridWidth          = gridSize[0],
+            .gridHeight         = gridSize[1],
+            .gridDepth          = gridSize[2],
+            .axis               = axis,
+            .bounds             = bounds,
+            .width              = width,
+            .height             = height,
+            .depth              = depth,
+        };
+
+        vkCmdPushConstants(commandBuffer, volumeDistanceLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(distanceConstants),
+            &distanceConstants);
+        vkCmdDispatch(commandBuffer, (cellCount + 63) / 64, 1, 1);
+    }
+
+    // The AABBs feed the BLAS build of the next submission, the rest is read by the intersection shader
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        VK_ACCESS_SHADER_READ_BIT);
+
+    bool result = vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer);
+
+    DeleteBuffer(words);
+    DeleteBuffer(totals);
+    DeleteBuffer(prefix);
+    DeleteBuffer(lines[0]);
+    DeleteBuffer(lines[1]);
+    CHECK(result);
+
+    log_trace("Raytracing device volume %ux%ux%u: %u cells, %u occupancy levels, %zu bytes and its pool bricks, %u AABBs",
+        width, height, depth, cellCount, levelCount, (size_t) volume->memory, volume->aabbCount);
     return true;
 }
 
+bool raytracing_add_volume_geometry(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBackend backend, VolumeBounds bounds)
+{
+    uint32_t volumeIndex;
+    return raytracing_create_volume(width, height, depth, data, backend, bounds, &volumeIndex);
+}
+
+void raytracing_log_intersection_estimate(uint32_t screenWidth, uint32_t screenHeight)
+{
+    // The AABBs of the brick bounded volumes are read back in one copy, the estimate walks them on the host
+    VkDeviceSize* offsets = (VkDeviceSize*) calloc(volumes.count > 0 ? volumes.count : 1, sizeof(VkDeviceSize));
+    if(offsets == NULL)
+        return;
+
+    VkDeviceSize readbackSize = 0;
+    for(size_t i = 0; i < volumes.count; ++i)
+    {
+        offsets[i] = readbackSize;
+        if(!volumes.items[i].removed && volumeDatas.items[i].bounds == VOLUME_BOUNDS_BRICKS)
+            readbackSize += (VkDeviceSize) volumes.items[i].aabbCount * sizeof(AABB);
+    }
+
+    // Uploads still in the staging ring land first
+    BufferData readback = {0};
+    bool readbackDone = readbackSize == 0;
+    if(!readbackDone && vulkan_staging_flush() && vulkan_create_buffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        vulkan_memory_properties(MEMORY_USAGE_STAGING), 0, &readback.buffer, &readback.allocation))
+    {
+        VkCommandBuffer commandBuffer;
+        if(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer))
+        {
+            for(size_t i = 0; i < volumes.count; ++i)
+            {
+                if(volumes.items[i].removed || volumeDatas.items[i].bounds != VOLUME_BOUNDS_BRICKS)
+                    continue;
+
+                VkBufferCopy copyRegion = {
+                    .dstOffset = offsets[i],
+                    .size      = (VkDeviceSize) volumes.items[i].aabbCount * sizeof(AABB),
+                };
+                vkCmdCopyBuffer(commandBuffer, volumes.items[i].aabbs.buffer, readback.buffer, 1, &copyRegion);
+            }
+
+            raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+            readbackDone = vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer);
+        }
+    }
+
+    char invocationsStr[64];
+    uint64_t pixels = (uint64_t) screenWidth * screenHeight;
+
+    for(size_t i = 0; i < volumes.count; ++i)
+    {
+        const Volume*     volume     = &volumes.items[i];
+        const VolumeData* volumeData = &volumeDatas.items[i];
+        if(volume->removed)
+            continue;
+
+        float invocationsPerRay = 1.0f;
+        if(volumeData->bounds == VOLUME_BOUNDS_BRICKS)
+        {
+            if(!readbackDone)
+                continue;
+
+            const AABB* aabbs = (const AABB*) ((const uint8_t*) readback.allocation.map + offsets[i]);
+
+            float (*boxes)[2][3] = (float (*)[2][3]) malloc((volume->aabbCount > 0 ? volume->aabbCount : 1) *
+                sizeof(*boxes));
+            if(boxes == NULL)
+                continue;
+
+            for(uint32_t b = 0; b < volume->aabbCount; ++b)
+            {
+                boxes[b][0][0] = aabbs[b].min.x; boxes[b][0][1] = aabbs[b].min.y; boxes[b][0][2] = aabbs[b].min.z;
+                boxes[b][1][0] = aabbs[b].max.x; boxes[b][1][1] = aabbs[b].max.y; boxes[b][1][2] = aabbs[b].max.z;
+            }
+
+            const uint32_t size[3] = { volumeData->width, volumeData->height, volumeData->depth };
+            invocationsPerRay = brickmap_estimate_intersections(size, (const float (*)[2][3]) boxes, volume->aabbCount,
+                4096);
+            free(boxes);
+        }
+
+        num_to_str(invocationsStr, pixels * invocationsPerRay);
+
+        log_trace("Raytracing volume %zu: %u AABBs, %.2f intersection invocations per ray entering its bounds, "
+            "%s per %ux%u frame covered by the volume", i, volume->aabbCount, invocationsPerRay, invocationsStr,
+            screenWidth, screenHeight);
+    }
+
+    if(readback.buffer != VK_NULL_HANDLE)
+        DeleteBuffer(readback);
+    free(offsets);
+}
+
 void raytracing_add_triangle_geometry(VkBuffer vertexBuffer, VkBuffer indexBuffer,
     uint32_t vertexCount, uint64_t vertexStride, uint32_t indexCount)
 {
@@ -226,17 +1020,38 @@ void raytracing_add_triangle_geometry(VkBuffer vertexBuffer, VkBuffer indexBuffe
     list_append(geometriesAddresses, addresses);
 }
 
+// Into the slot of a removed instance first, the TLAS was created for RAYTRACING_MAX_INSTANCES
+static VkAccelerationStructureInstanceKHR* raytracing_add_instance(VkAccelerationStructureInstanceKHR* instance)
+{
+    // The instance count changes, a refit can't pick the new one up
+    tlasDirty   = true;
+    tlasRebuild = true;
+
+    if(freeInstances.count > 0)
+    {
+        VkAccelerationStructureInstanceKHR* slot = &tlas.items[freeInstances.items[--freeInstances.count]];
+        *slot = *instance;
+        return slot;
+    }
+
+    ASSERT(tlas.count < RAYTRACING_MAX_INSTANCES);
+    return list_append(tlas, *instance);
+}
+
 VkAccelerationStructureInstanceKHR* raytracing_add_volume_instance(uint32_t objIndex, VkTransformMatrixKHR* transform)
 {
+    ASSERT(objIndex < volumes.count && !volumes.items[objIndex].removed);
+
+    // Hit group 0 traces the triangles, the volume ones follow in VolumeBackend order
     VkAccelerationStructureInstanceKHR instance = {
         .transform                              = *transform,
         .instanceCustomIndex                    = objIndex,
         .mask                                   = 0xFF,
-        .instanceShaderBindingTableRecordOffset = 1,
+        .instanceShaderBindingTableRecordOffset = 1 + volumes.items[objIndex].backend,
         .flags                                  = VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR,
-        .accelerationStructureReference         = blass.items[objIndex].address
+        .accelerationStructureReference         = blass.items[volumes.items[objIndex].blas].address
     };
-    return list_append(tlas, instance);
+    return raytracing_add_instance(&instance);
 }
 
 VkAccelerationStructureInstanceKHR* raytracing_add_triangle_instance(uint32_t objIndex, VkTransformMatrixKHR* transform)
@@ -249,215 +1064,1041 @@ VkAccelerationStructureInstanceKHR* raytracing_add_triangle_instance(uint32_t ob
         .flags                                  = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
         .accelerationStructureReference         = blass.items[objIndex].address
     };
-    return list_append(tlas, instance);
+    return raytracing_add_instance(&instance);
+}
+
+uint32_t raytracing_instance_index(const VkAccelerationStructureInstanceKHR* instance)
+{
+    return (uint32_t) (instance - tlas.items);
+}
+
+void raytracing_update_instance(VkTransformMatrixKHR* transform, uint32_t instanceIndex)
+{
+    memcpy(&tlas.items[instanceIndex].transform, transform, sizeof(VkTransformMatrixKHR));
+    tlasDirty = true;
+}
+
+void raytracing_remove_instance(uint32_t instanceIndex)
+{
+    ASSERT(instanceIndex < tlas.count);
+
+    // Null reference, the build skips the instance until the slot is used again
+    tlas.items[instanceIndex] = (VkAccelerationStructureInstanceKHR) {0};
+    list_append(freeInstances, instanceIndex);
+
+    tlasDirty   = true;
+    tlasRebuild = true;
+}
+
+bool raytracing_create_geometries_address_buffer()
+{
+    if(dag.roots.count > 0)
+    {
+        CHECK(vulkan_create_upload_buffer(dag.nodes.items, dag_memory_size(&dag),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &dagBuffer.buffer, &dagBuffer.allocation));
+        vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, dag_memory_size(&dag));
+
+        VkDeviceAddress dagAddress = raytracing_get_buffer_device_address(dagBuffer.buffer);
+        for(size_t i = 0; i < volumes.count; ++i)
+            if(volumes.items[i].backend == VOLUME_BACKEND_DAG)
+                volumeDatas.items[i].nodeAddress = dagAddress;
+
+        log_trace("Raytracing DAG: %zu volumes in %zu bytes", dag.roots.count, dag_memory_size(&dag));
+        dagUploaded = true;
+    }
+
+    // The nodes live on the device from now on
+    dag_destroy(&dag);
+
+    CHECK(vulkan_create_upload_buffer(geometriesAddresses.items, geometriesAddresses.count * sizeof(GeometryData),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, &geometriesAddressesBuffer.buffer, &geometriesAddressesBuffer.allocation));
+
+    // Sized for every volume the world can hold, the frames copy the datas of later volumes into their slot
+    VolumeData* volumeDatasData = (VolumeData*) calloc(RAYTRACING_MAX_VOLUMES, sizeof(VolumeData));
+    CHECK(volumeDatasData);
+    memcpy(volumeDatasData, volumeDatas.items, volumeDatas.count * sizeof(VolumeData));
+
+    bool result = vulkan_create_upload_buffer(volumeDatasData, RAYTRACING_MAX_VOLUMES * sizeof(VolumeData),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0,
+        &volumeDatasBuffer.buffer, &volumeDatasBuffer.allocation);
+    free(volumeDatasData);
+    CHECK(result);
+
+    vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY,
+        geometriesAddresses.count * sizeof(GeometryData) + RAYTRACING_MAX_VOLUMES * sizeof(VolumeData));
+
+    volumeDatasUploaded = true;
+    return true;
+}
+
+// Batched: one build command for every BLAS of the batch, each with its own scratch range, and a single barrier.
+// Serial: one build per BLAS on a shared scratch range with a barrier after each
+static bool raytracing_create_blas(VkCommandBuffer commandBuffer, UInt32s indices, BuildAccelerationStructures* buildAs,
+    VkDeviceAddress scratchAddress, VkQueryPool queryPool, uint32_t firstQuery, bool batched)
+{
+    if (queryPool)
+        vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery, (uint32_t) indices.count);
+    
+    VkAccelerationStructureBuildGeometryInfoKHR* geometryInfos =
+        (VkAccelerationStructureBuildGeometryInfoKHR*) malloc(indices.count * sizeof(VkAccelerationStructureBuildGeometryInfoKHR));
+    const VkAccelerationStructureBuildRangeInfoKHR** rangeInfos =
+        (const VkAccelerationStructureBuildRangeInfoKHR**) malloc(indices.count * sizeof(VkAccelerationStructureBuildRangeInfoKHR*));
+    VkAccelerationStructureKHR* structures =
+        (VkAccelerationStructureKHR*) malloc(indices.count * sizeof(VkAccelerationStructureKHR));
+
+    VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+    };
+
+    bool result = true;
+    for (size_t i = 0; i < indices.count; ++i)
+    {
+        uint32_t idx = indices.items[i];
+
+        // Actual allocation of buffer and acceleration structure.
+        BufferData* accelerationBuffer = &buildAs->items[idx].buffer;
+        if (!vulkan_create_buffer(buildAs->items[idx].sizesInfo.accelerationStructureSize,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+            &accelerationBuffer->buffer, &accelerationBuffer->allocation))
+        {
+            result = false;
+            break;
+        }
+        vulkan_memory_track(MEMORY_CATEGORY_BLAS, buildAs->items[idx].sizesInfo.accelerationStructureSize);
+        
+        VkAccelerationStructureCreateInfoKHR structureCreateInfo = {
+            .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .buffer = accelerationBuffer->buffer,
+            .offset = 0,
+            .size   = buildAs->items[idx].sizesInfo.accelerationStructureSize,
+            .type   = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        };
+
+        if (CreateAccelerationStructureKHR(device, &structureCreateInfo, NULL, &buildAs->items[idx].as) != VK_SUCCESS)
+        {
+            log_error("Raytracing failed to create BLAS");
+            result = false;
+            break;
+        }
+
+        // BuildInfo #2 part
+        buildAs->items[idx].geometryInfo.dstAccelerationStructure  = buildAs->items[idx].as; // Setting where the build lands
+        buildAs->items[idx].geometryInfo.scratchData.deviceAddress = scratchAddress + buildAs->items[idx].scratchOffset;
+
+        geometryInfos[i] = buildAs->items[idx].geometryInfo;
+        rangeInfos[i]    = buildAs->items[idx].rangeInfo;
+        structures[i]    = buildAs->items[idx].as;
+
+        if (batched)
+            continue;
+
+        // Building the bottom-level-acceleration-structure, the next build reuses the scratch memory
+        CmdBuildAccelerationStructuresKHR(commandBuffer, 1, &geometryInfos[i], &rangeInfos[i]);
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0,
+            1, &barrier,
+            0, NULL,
+            0, NULL);
+    }
+
+    if (result && batched)
+    {
+        // Scratch ranges do not overlap, the driver is free to run every build of the batch concurrently
+        CmdBuildAccelerationStructuresKHR(commandBuffer, (uint32_t) indices.count, geometryInfos, rangeInfos);
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0,
+            1, &barrier,
+            0, NULL,
+            0, NULL);
+    }
+
+    if (result && queryPool)
+        CmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, (uint32_t) indices.count, structures,
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, firstQuery);
+
+    free(geometryInfos);
+    free(rangeInfos);
+    free(structures);
+    return result;
+}
+
+static bool raytracing_compact_blas(VkCommandBuffer commandBuffer, UInt32s indices, BuildAccelerationStructures* buildAs,
+    VkQueryPool queryPool, uint32_t firstQuery, BuildAccelerationStructures* cleanupAs)
+{
+    VkDeviceSize* compactSizes = (VkDeviceSize*) malloc(indices.count * sizeof(VkDeviceSize));
+
+    // Sizes written by vkCmdWriteAccelerationStructuresPropertiesKHR during the build
+    if(vkGetQueryPoolResults(device, queryPool, firstQuery, (uint32_t) indices.count, indices.count * sizeof(VkDeviceSize),
+        compactSizes, sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+        log_error("Raytracing failed to read BLAS compacted sizes");
+        free(compactSizes);
+        return false;
+    }
+
+    VkDeviceSize sizeBefore = 0, sizeAfter = 0;
+
+    for (size_t i = 0; i < indices.count; ++i)
+    {
+        uint32_t idx = indices.items[i];
+
+        sizeBefore += buildAs->items[idx].sizesInfo.accelerationStructureSize;
+        sizeAfter  += compactSizes[i];
+
+        // Original structure is destroyed once the copy has been executed
+        list_append(*cleanupAs, buildAs->items[idx]);
+
+        BufferData* accelerationBuffer = &buildAs->items[idx].buffer;
+        CHECK(vulkan_create_buffer(compactSizes[i],
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+            &accelerationBuffer->buffer, &accelerationBuffer->allocation));
+        vulkan_memory_track(MEMORY_CATEGORY_BLAS, compactSizes[i]);
+
+        VkAccelerationStructureCreateInfoKHR structureCreateInfo = {
+            .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .buffer = accelerationBuffer->buffer,
+            .offset = 0,
+            .size   = compactSizes[i],
+            .type   = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        };
+
+        VKCHECK(CreateAccelerationStructureKHR(device, &structureCreateInfo, NULL, &buildAs->items[idx].as));
+
+        VkCopyAccelerationStructureInfoKHR copyInfo = {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src   = cleanupAs->items[cleanupAs->count - 1].as,
+            .dst   = buildAs->items[idx].as,
+            .mode  = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+        };
+        CmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+        buildAs->items[idx].geometryInfo.dstAccelerationStructure = buildAs->items[idx].as;
+        buildAs->items[idx].sizesInfo.accelerationStructureSize   = compactSizes[i];
+    }
+
+    free(compactSizes);
+
+    char beforeStr[64], afterStr[64];
+    num_to_str(beforeStr, sizeBefore);
+    num_to_str(afterStr, sizeAfter);
+    log_trace("Raytracing BLAS compaction of %zu structures: %sB -> %sB (%.1f%%)", indices.count, beforeStr, afterStr,
+        sizeBefore ? 100.0 * sizeAfter / sizeBefore : 100.0);
+    return true;
+}
+
+static void raytracing_destroy_blas(BuildAccelerationStructure* buildAs)
+{
+    DestroyAccelerationStructureKHR(device, buildAs->as, NULL);
+    DeleteBuffer(buildAs->buffer);
+    vulkan_memory_release(MEMORY_CATEGORY_BLAS, buildAs->sizesInfo.accelerationStructureSize);
+}
+
+static void raytracing_destroy_build_as(BuildAccelerationStructures* buildAs)
+{
+    for (size_t i = 0; i < buildAs->count; ++i)
+        raytracing_destroy_blas(&buildAs->items[i]);
+    buildAs->count = 0;
+}
+
+// Build info and sizes of a BLAS input, the structure is created by raytracing_create_blas
+static void raytracing_blas_sizes(uint32_t input, VkBuildAccelerationStructureFlagsKHR flags,
+    BuildAccelerationStructure* buildAs)
+{
+    BlasInput* blasInput = &blasInputs.items[input];
+
+    *buildAs = (BuildAccelerationStructure) {
+        .geometryInfo = (VkAccelerationStructureBuildGeometryInfoKHR) {
+            .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags                    = blasInput->structureFlags | flags,
+            .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+            .srcAccelerationStructure = NULL,
+            .dstAccelerationStructure = NULL,
+            .geometryCount            = 1,
+            .pGeometries              = &blasInput->geometry,
+            .ppGeometries             = NULL,
+        },
+        .rangeInfo = &blasInput->rangeInfo,
+        .sizesInfo = (VkAccelerationStructureBuildSizesInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+        },
+    };
+
+    uint32_t maxPrimCount = blasInput->rangeInfo.primitiveCount;
+
+    GetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &buildAs->geometryInfo, &maxPrimCount, &buildAs->sizesInfo);
+}
+
+// Builds the BLAS inputs into buildAs in the same order, batches stay within the memory budget of structures plus scratch
+static bool raytracing_build_bottom_level_as(UInt32s inputs, VkBuildAccelerationStructureFlagsKHR flags, bool batched,
+    BuildAccelerationStructures* buildAs, double* buildNs)
+{
+    // Geometry uploads run on the async queue too, submitted first they are ordered before the builds
+    CHECK(vulkan_staging_submit());
+
+    size_t nbBlas        = inputs.count;
+    size_t nbCompactions = 0;
+
+    *buildAs = (BuildAccelerationStructures) {0};
+    list_alloc(*buildAs, nbBlas);
+    buildAs->count = nbBlas;
+
+    for (uint32_t idx = 0; idx < nbBlas; idx++)
+    {
+        raytracing_blas_sizes(inputs.items[idx], flags, &buildAs->items[idx]);
+
+        nbCompactions += (buildAs->items[idx].geometryInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) ? 1 : 0;
+    }
+
+    // Batching creation/compaction of BLAS to allow staying in restricted amount of memory,
+    // scratch ranges of a batch are laid out one after the other
+    BlasBatches  batches       = {0};
+    BlasBatch    batch         = {0};
+    VkDeviceSize batchSize     = 0;
+    VkDeviceSize batchScratch  = 0;
+    VkDeviceSize batchLimit    = 256000000;  // 256 MB
+    VkDeviceSize scratchSize   = 0;          // Largest batch scratch
+
+    for (uint32_t idx = 0; idx < nbBlas; idx++)
+    {
+        VkDeviceSize blasScratch = raytracing_align_up(buildAs->items[idx].sizesInfo.buildScratchSize, scratchAlignment);
+
+        buildAs->items[idx].scratchOffset = batched ? batchScratch : 0;
+        batchScratch = batched ? batchScratch + blasScratch : (batchScratch > blasScratch ? batchScratch : blasScratch);
+
+        batchSize += buildAs->items[idx].sizesInfo.accelerationStructureSize + (batched ? blasScratch : 0);
+        ++batch.count;
+
+        // Over the limit or last BLAS element
+        if (batchSize >= batchLimit || idx == nbBlas - 1)
+        {
+            list_append(batches, batch);
+            scratchSize = scratchSize > batchScratch ? scratchSize : batchScratch;
+
+            // Reset
+            batch = (BlasBatch) { .first = idx + 1 };
+            batchSize = batchScratch = 0;
+        }
+    }
+
+    // Allocate the scratch buffer holding the temporary data of the acceleration structure builder,
+    // padded so its base address can be aligned as well
+    BufferData scratchBuffer;
+    CHECK(vulkan_create_buffer(scratchSize + scratchAlignment,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+        &scratchBuffer.buffer, &scratchBuffer.allocation));
+    vulkan_memory_track(MEMORY_CATEGORY_SCRATCH, scratchSize + scratchAlignment);
+
+    VkDeviceAddress scratchAddress = raytracing_align_up(raytracing_get_buffer_device_address(scratchBuffer.buffer), scratchAlignment);
+
+    // Allocate a query pool for storing the needed size for every BLAS compaction.
+    VkQueryPool queryPool = NULL;
+    if (nbCompactions > 0)
+    {
+        ASSERT(nbCompactions == nbBlas);
+        VkQueryPoolCreateInfo qpci = {
+            .sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType          = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            .queryCount         = nbBlas,
+            .pipelineStatistics = 0
+        };
+        VKCHECK(vkCreateQueryPool(device, &qpci, NULL, &queryPool));
+    }
+
+    BuildAccelerationStructures cleanupAs = {0};
+    UInt32s indices = {0};  // Indices of the BLAS to create
+
+    Timer  t;
+    double buildTime = 0.0, compactTime = 0.0;
+
+    for (size_t i = 0; i < batches.count; ++i)
+    {
+        indices.count = 0;
+        for (uint32_t idx = batches.items[i].first; idx < batches.items[i].first + batches.items[i].count; ++idx)
+            list_append(indices, idx);
+
+        // Builds run on the async queue, the host waits on its timeline while rendering goes on
+        timer_start(&t);
+
+        VkCommandBuffer commandBuffer;
+        CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+        CHECK(raytracing_create_blas(commandBuffer, indices, buildAs, scratchAddress, queryPool, 0, batched));
+        CHECK(vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer));
+
+        timer_stop(&t);
+        buildTime += timer_get_ns(&t);
+
+        if (queryPool)
+        {
+            timer_start(&t);
+
+            CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+            CHECK(raytracing_compact_blas(commandBuffer, indices, buildAs, queryPool, 0, &cleanupAs));
+            CHECK(vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer));
+
+            raytracing_destroy_build_as(&cleanupAs);
+
+            timer_stop(&t);
+            compactTime += timer_get_ns(&t);
+        }
+    }
+
+    char buildStr[64], compactStr[64], scratchStr[64];
+    time_to_str(buildStr, buildTime);
+    time_to_str(compactStr, compactTime);
+    num_to_str(scratchStr, scratchSize);
+    log_trace("Raytracing %s BLAS build of %zu structures in %zu batches: build %s, compaction %s, scratch %sB",
+        batched ? "batched" : "serial", nbBlas, batches.count, buildStr, compactStr, scratchStr);
+
+    if (buildNs)
+        *buildNs = buildTime;
+
+    list_destroy(indices);
+    list_destroy(cleanupAs);
+    list_destroy(batches);
+
+    // Clean up
+    vkDestroyQueryPool(device, queryPool, NULL);
+
+    DeleteBuffer(scratchBuffer);
+    vulkan_memory_release(MEMORY_CATEGORY_SCRATCH, scratchSize + scratchAlignment);
+    return true;
+}
+
+static VkDeviceAddress raytracing_get_blas_address(VkAccelerationStructureKHR as)
+{
+    VkAccelerationStructureDeviceAddressInfoKHR asDeviceAddressInfo = {
+        .sType                 = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .accelerationStructure = as,
+    };
+    return GetAccelerationStructureDeviceAddressKHR(device, &asDeviceAddressInfo);
+}
+
+static void raytracing_all_blas_inputs(UInt32s* inputs)
+{
+    *inputs = (UInt32s) {0};
+    for (uint32_t idx = 0; idx < blasInputs.count; ++idx)
+        list_append(*inputs, idx);
+}
+
+static bool raytracing_create_bottom_level_as(VkBuildAccelerationStructureFlagsKHR flags)
+{
+    UInt32s inputs;
+    raytracing_all_blas_inputs(&inputs);
+
+    BuildAccelerationStructures buildAs;
+    bool result = raytracing_build_bottom_level_as(inputs, flags, true, &buildAs, NULL);
+    list_destroy(inputs);
+    CHECK(result);
+
+    // Keeping all the created acceleration structures
+    for (size_t i = 0; i < buildAs.count; ++i)
+    {
+        BottomLevel bottomLevel = {
+            .buildAs = buildAs.items[i],
+            .address = raytracing_get_blas_address(buildAs.items[i].as),
+        };
+        list_append(blass, bottomLevel);
+    }
+
+    list_destroy(buildAs);
+    return true;
+}
+
+bool raytracing_create_bottom_layer(bool allowCompaction)
+{
+    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    if (allowCompaction)
+        flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+
+    CHECK(raytracing_create_bottom_level_as(flags));
+
+    // Volumes created from now on build their BLAS right away with the same flags
+    blasFlags  = flags;
+    blassBuilt = true;
+    return true;
+}
+
+// Grows the scratch shared by the volume builds. Builds in flight use the old one, growing waits for them
+// and only happens for the first volumes of each size
+static bool raytracing_reserve_blas_scratch(VkDeviceSize size)
+{
+    if (size <= blasScratchSize)
+        return true;
+
+    if (blasScratchSize > 0)
+    {
+        CHECK(vulkan_queue_wait(QUEUE_ASYNC, vulkan_queue_submitted(QUEUE_ASYNC)));
+        DeleteBuffer(blasScratch);
+        vulkan_memory_release(MEMORY_CATEGORY_SCRATCH, blasScratchSize + scratchAlignment);
+    }
+
+    blasScratchSize = 0;
+    CHECK(vulkan_create_buffer(size + scratchAlignment,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+        &blasScratch.buffer, &blasScratch.allocation));
+    vulkan_memory_track(MEMORY_CATEGORY_SCRATCH, size + scratchAlignment);
+
+    blasScratch.address = raytracing_align_up(raytracing_get_buffer_device_address(blasScratch.buffer), scratchAlignment);
+    blasScratchSize     = size;
+    return true;
+}
+
+// Compacted size queries of the volume builds, one per build in flight
+static bool raytracing_create_blas_queries()
+{
+    if (blasQueryPool)
+        return true;
+
+    VkQueryPoolCreateInfo qpci = {
+        .sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType          = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount         = RAYTRACING_MAX_PENDING_BLAS,
+        .pipelineStatistics = 0
+    };
+    VKCHECK(vkCreateQueryPool(device, &qpci, NULL, &blasQueryPool));
+
+    for (uint32_t i = RAYTRACING_MAX_PENDING_BLAS; i > 0; --i)
+    {
+        uint32_t query = i - 1;
+        list_append(freeBlasQueries, query);
+    }
+    return true;
+}
+
+// Ends and submits commands of the async queue without waiting, graphics waits for them once the instances
+// reference the structure
+static bool raytracing_submit_pending_blas(PendingBlas* pending, VkCommandBuffer commandBuffer)
+{
+    VKCHECK(vkEndCommandBuffer(commandBuffer));
+
+    QueueSubmit submit = {
+        .detached = true,
+    };
+    CHECK(vulkan_queue_submit(QUEUE_ASYNC, commandBuffer, &submit, &pending->value));
+
+    pending->commandBuffer = commandBuffer;
+    return true;
+}
+
+// Once the bottom layer exists the BLAS of new volumes is submitted to the async queue right away,
+// raytracing_update_pending_blas compacts it and adds it to the instances of the volume once it completed
+static bool raytracing_build_volume_blas(uint32_t volumeIndex)
+{
+    if (!blassBuilt)
+        return true;
+
+    // Geometry uploads run on the async queue too, submitted first they are ordered before the build
+    CHECK(vulkan_staging_submit_detached(NULL));
+
+    uint32_t slot = volumes.items[volumeIndex].blas;
+
+    PendingBlas pending = {
+        .volume = volumeIndex,
+        .query  = UINT32_MAX,
+    };
+    raytracing_blas_sizes(slot, blasFlags, &pending.buildAs);
+
+    CHECK(raytracing_reserve_blas_scratch(raytracing_align_up(pending.buildAs.sizesInfo.buildScratchSize, scratchAlignment)));
+
+    // Past RAYTRACING_MAX_PENDING_BLAS builds in flight the structure stays uncompacted
+    if (pending.buildAs.geometryInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)
+    {
+        CHECK(raytracing_create_blas_queries());
+        if (freeBlasQueries.count > 0)
+            pending.query = freeBlasQueries.items[--freeBlasQueries.count];
+    }
+
+    BuildAccelerationStructures buildAs = {0};
+    list_append(buildAs, pending.buildAs);
+
+    UInt32s indices = {0};
+    uint32_t first = 0;
+    list_append(indices, first);
+
+    VkCommandBuffer commandBuffer;
+    CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+
+    // The previous volume build on the queue may still use the scratch
+    VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+    };
+
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
+
+    bool result = raytracing_create_blas(commandBuffer, indices, &buildAs, blasScratch.address,
+        pending.query != UINT32_MAX ? blasQueryPool : NULL, pending.query, true);
+    pending.buildAs = buildAs.items[0];
+
+    list_destroy(indices);
+    list_destroy(buildAs);
+    CHECK(result);
+
+    CHECK(raytracing_submit_pending_blas(&pending, commandBuffer));
+    list_append(pendingBlass, pending);
+
+    // Empty until the build completed, instances added meanwhile hold a null reference the TLAS build skips
+    BottomLevel bottomLevel = {0};
+    if (slot < blass.count)
+        blass.items[slot] = bottomLevel;
+    else
+        list_append(blass, bottomLevel);
+
+    return true;
+}
+
+// The structure of a completed volume build goes to the instances of the volume
+static void raytracing_finish_volume_blas(PendingBlas* pending)
+{
+    // Graphics traces the structure from now on
+    vulkan_queue_depend(QUEUE_GRAPHICS, QUEUE_ASYNC, pending->value,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+
+    Volume* volume = &volumes.items[pending->volume];
+    BottomLevel* bottomLevel = &blass.items[volume->blas];
+    *bottomLevel = (BottomLevel) {
+        .buildAs = pending->buildAs,
+        .address = raytracing_get_blas_address(pending->buildAs.as),
+    };
+
+    uint32_t hitGroup = 1 + volume->backend;
+    for (size_t i = 0; i < tlas.count; ++i)
+    {
+        VkAccelerationStructureInstanceKHR* instance = &tlas.items[i];
+        if (instance->instanceCustomIndex != pending->volume || instance->instanceShaderBindingTableRecordOffset != hitGroup ||
+            instance->accelerationStructureReference != 0)
+            continue;
+
+        // The instance joins the TLAS, a refit can't pick it up
+        instance->accelerationStructureReference = bottomLevel->address;
+        tlasDirty   = true;
+        tlasRebuild = true;
+    }
+}
+
+// Moves the volume builds the async queue completed one step further: compaction, then the instances. Never blocks
+static bool raytracing_update_pending_blas()
+{
+    uint64_t completed = vulkan_queue_completed(QUEUE_ASYNC);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < pendingBlass.count; ++i)
+    {
+        PendingBlas pending = pendingBlass.items[i];
+        if (pending.value > completed)
+        {
+            pendingBlass.items[kept++] = pending;
+            continue;
+        }
+
+        vkFreeCommandBuffers(device, vulkan_queue_command_pool(QUEUE_ASYNC), 1, &pending.commandBuffer);
+
+        // The compacted copy completed, the structure it was copied from goes
+        if (pending.source.as != NULL)
+        {
+            raytracing_destroy_blas(&pending.source);
+            pending.source = (BuildAccelerationStructure) {0};
+        }
+
+        if (pending.volume == UINT32_MAX)
+        {
+            if (pending.query != UINT32_MAX)
+                list_append(freeBlasQueries, pending.query);
+            raytracing_destroy_blas(&pending.buildAs);
+            continue;
+        }
+
+        if (pending.query != UINT32_MAX)
+        {
+            BuildAccelerationStructures buildAs = {0}, cleanupAs = {0};
+            list_append(buildAs, pending.buildAs);
+
+            UInt32s indices = {0};
+            uint32_t first = 0;
+            list_append(indices, first);
+
+            VkCommandBuffer commandBuffer;
+            CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+            bool result = raytracing_compact_blas(commandBuffer, indices, &buildAs, blasQueryPool, pending.query, &cleanupAs);
+
+            // Copied into a structure of the compacted size, the instances wait for the copy
+            if (result)
+            {
+                pending.buildAs = buildAs.items[0];
+                pending.source  = cleanupAs.items[0];
+            }
+            list_append(freeBlasQueries, pending.query);
+            pending.query = UINT32_MAX;
+
+            list_destroy(indices);
+            list_destroy(buildAs);
+            list_destroy(cleanupAs);
+            CHECK(result);
+
+            CHECK(raytracing_submit_pending_blas(&pending, commandBuffer));
+            pendingBlass.items[kept++] = pending;
+            continue;
+        }
+
+        raytracing_finish_volume_blas(&pending);
+    }
+    pendingBlass.count = kept;
+    return true;
+}
+
+bool raytracing_create_volume(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBackend backend, VolumeBounds bounds, uint32_t* volumeIndex)
+{
+    CHECK(raytracing_create_volume_geometry(width, height, depth, data, backend, bounds, volumeIndex));
+    return raytracing_build_volume_blas(*volumeIndex);
+}
+
+bool raytracing_create_device_volume(uint32_t width, uint32_t height, uint32_t depth, VolumeBounds bounds,
+    VolumeWriter writer, void* user, uint32_t* volumeIndex)
+{
+    CHECK(raytracing_volume_slot_free());
+
+    Volume     volume;
+    VolumeData volumeData;
+    CHECK(raytracing_create_device_volume_geometry(width, height, depth, bounds, writer, user, &volume, &volumeData));
+
+    raytracing_register_volume(&volume, &volumeData, volumeIndex);
+    return raytracing_build_volume_blas(*volumeIndex);
+}
+
+bool raytracing_set_volume_colors(uint32_t volumeIndex, const uint32_t* colors, uint32_t colorCount)
+{
+    ASSERT(volumeIndex < volumes.count && !volumes.items[volumeIndex].removed);
+
+    Volume* volume = &volumes.items[volumeIndex];
+    if(volume->colors.buffer != VK_NULL_HANDLE)
+    {
+        log_error("Raytracing volume %u already has its colors", volumeIndex);
+        return false;
+    }
+
+    CHECK(vulkan_create_upload_buffer(colors, colorCount * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &volume->colors.buffer, &volume->colors.allocation));
+
+    volume->memory += colorCount * sizeof(uint32_t);
+    vulkan_memory_track(MEMORY_CATEGORY_GEOMETRY, colorCount * sizeof(uint32_t));
+
+    volumeDatas.items[volumeIndex].colorAddress = raytracing_get_buffer_device_address(volume->colors.buffer);
+
+    // Uploaded volume datas are patched in place by the next frame
+    if(volumeDatasUploaded)
+        list_append(dirtyVolumes, volumeIndex);
+    return true;
+}
+
+void raytracing_remove_volume(uint32_t volumeIndex)
+{
+    ASSERT(blassBuilt && volumeIndex < volumes.count && !volumes.items[volumeIndex].removed);
+
+    Volume* volume = &volumes.items[volumeIndex];
+    ASSERT(volume->backend != VOLUME_BACKEND_DAG && !volume->device);
+
+    // Frames still in flight may trace it, the slot and the BLAS are freed after they all retired
+    RetiredVolume retired = {
+        .volume = *volume,
+        .blas   = blass.items[volume->blas],
+        .slot   = volumeIndex,
+        .frames = MAX_FRAMES_IN_FLIGHT,
+    };
+
+    // A build still on its way reads the buffers of the volume, its structures are left to raytracing_update_pending_blas
+    for (size_t i = 0; i < pendingBlass.count; ++i)
+    {
+        if (pendingBlass.items[i].volume != volumeIndex)
+            continue;
+
+        pendingBlass.items[i].volume = UINT32_MAX;
+        retired.value = pendingBlass.items[i].value;
+        break;
+    }
+    list_append(retiredVolumes, retired);
+
+    volume->removed = true;
+    blass.items[volume->blas] = (BottomLevel) {0};
 }
 
-void raytracing_update_instance(VkTransformMatrixKHR* transform, uint32_t instanceIndex)
+static void raytracing_destroy_volume(Volume* volume)
 {
-    memcpy(&tlas.items[instanceIndex].transform, transform, sizeof(VkTransformMatrixKHR));
+    DeleteBuffer(volume->aabbs);
+    vulkan_memory_release(MEMORY_CATEGORY_GEOMETRY, volume->memory);
+
+    if(volume->colors.buffer != VK_NULL_HANDLE)
+        DeleteBuffer(volume->colors);
+
+    if(volume->backend == VOLUME_BACKEND_SVO)
+    {
+        DeleteBuffer(volume->nodes);
+        return;
+    }
+
+    if(volume->backend == VOLUME_BACKEND_DAG)
+        return;
+
+    DeleteBuffer(volume->grid);
+    DeleteBuffer(volume->bricks);
+    DeleteBuffer(volume->palette);
+    DeleteBuffer(volume->occupancy);
+    DeleteBuffer(volume->distance);
 }
 
-bool raytracing_create_geometries_address_buffer(VkCommandPool commandPool)
+static void raytracing_destroy_retired_volume(RetiredVolume* retired)
 {
-    CHECK(vulkan_create_data_buffer(commandPool, geometriesAddresses.items, geometriesAddresses.count * sizeof(GeometryData),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
-        &geometriesAddressesBuffer.buffer, &geometriesAddressesBuffer.memory));
-    return true;
+    raytracing_destroy_volume(&retired->volume);
+
+    // Removed before its build completed
+    if (retired->blas.buildAs.as != NULL)
+        raytracing_destroy_blas(&retired->blas.buildAs);
 }
 
-static bool raytracing_create_blas(VkCommandBuffer commandBuffer, UInt32s indices, BuildAccelerationStructures* buildAs,
-    VkDeviceAddress scratchAddress, VkQueryPool queryPool)
+// Destroys the volumes no frame in flight can trace anymore and hands their slots out again
+static void raytracing_retire_volumes()
 {
-    if (queryPool)
-        vkResetQueryPool(device, queryPool, 0, (uint32_t) indices.count);
-    
-    uint32_t queryCnt = 0;
+    uint64_t completed = vulkan_queue_completed(QUEUE_ASYNC);
 
-    blasAddresses.count = 0;
-    for (size_t i = 0; i < indices.count; ++i)
+    size_t kept = 0;
+    for (size_t i = 0; i < retiredVolumes.count; ++i)
     {
-        uint32_t idx = indices.items[i];
+        RetiredVolume* retired = &retiredVolumes.items[i];
+        if (retired->frames > 0 || retired->value > completed)
+        {
+            if (retired->frames > 0)
+                --retired->frames;
+            retiredVolumes.items[kept++] = *retired;
+            continue;
+        }
 
-        // Actual allocation of buffer and acceleration structure.
-        BufferData accelerationBuffer;
-        CHECK(vulkan_create_buffer(buildAs->items[idx].sizesInfo.accelerationStructureSize,
-            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-            &accelerationBuffer.buffer, &accelerationBuffer.memory));
-        
-        VkAccelerationStructureCreateInfoKHR structureCreateInfo = {
-            .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-            .buffer = accelerationBuffer.buffer,
-            .offset = 0,
-            .size   = buildAs->items[idx].sizesInfo.accelerationStructureSize,
-            .type   = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-        };
+        raytracing_destroy_retired_volume(retired);
+        list_append(freeVolumes, retired->slot);
+        list_append(freeBlass, retired->volume.blas);
+    }
+    retiredVolumes.count = kept;
+}
 
-        CreateAccelerationStructureKHR(device, &structureCreateInfo, NULL, &buildAs->items[idx].as);
+bool raytracing_benchmark_bottom_layer()
+{
+    // Compaction is left out, it costs the same in both modes
+    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
 
-        // BuildInfo #2 part
-        buildAs->items[idx].geometryInfo.dstAccelerationStructure = buildAs->items[idx].as; // Setting where the build lands
-        buildAs->items[idx].geometryInfo.scratchData.deviceAddress = scratchAddress;        // All build are using the same scratch buffer
+    UInt32s inputs;
+    raytracing_all_blas_inputs(&inputs);
 
-        // Building the bottom-level-acceleration-structure
-        CmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildAs->items[idx].geometryInfo,
-            (const VkAccelerationStructureBuildRangeInfoKHR *const *)&buildAs->items[idx].rangeInfo);
+    BuildAccelerationStructures buildAs;
+    double serialNs, batchedNs;
 
-        VkMemoryBarrier barrier = {
-            .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
-            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
-        };
+    CHECK(raytracing_build_bottom_level_as(inputs, flags, false, &buildAs, &serialNs));
+    raytracing_destroy_build_as(&buildAs);
+    list_destroy(buildAs);
 
-        vkCmdPipelineBarrier(commandBuffer,
-            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-            0,
-            1, &barrier,
-            0, NULL,
-            0, NULL);
+    CHECK(raytracing_build_bottom_level_as(inputs, flags, true, &buildAs, &batchedNs));
+    raytracing_destroy_build_as(&buildAs);
+    list_destroy(buildAs);
+    list_destroy(inputs);
 
-        if(queryPool)
-            CmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, 1, &buildAs->items[idx].geometryInfo.dstAccelerationStructure,
-                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, queryCnt++);
-        
-        list_append(blasAddresses, accelerationBuffer);
-    }
+    char serialStr[64], batchedStr[64];
+    time_to_str(serialStr, serialNs);
+    time_to_str(batchedStr, batchedNs);
+    log_info("Raytracing BLAS build of %zu structures: serial %s, batched %s (%.2fx)", blasInputs.count,
+        serialStr, batchedStr, batchedNs > 0.0 ? serialNs / batchedNs : 0.0);
     return true;
 }
 
-static bool raytracing_create_bottom_level_as(VkCommandPool commandPool, VkBuildAccelerationStructureFlagsKHR flags)
+bool raytracing_benchmark_device_volume(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data,
+    VolumeWriter writer, void* user)
 {
-    size_t nbBlas         = blasInputs.count;
-    size_t nbCompactions  = 0;
-    size_t maxScratchSize = 0;
+    char deviceStr[64], hostStr[64], deviceBytesStr[64], uploadStr[64];
+    Timer t;
 
-    BuildAccelerationStructures buildAs = {0};
-    list_alloc(buildAs, nbBlas);
-    buildAs.count = nbBlas;
+    timer_start(&t);
 
-    for (uint32_t idx = 0; idx < nbBlas; idx++)
-    {
-        buildAs.items[idx] = (BuildAccelerationStructure) {
-            .geometryInfo = (VkAccelerationStructureBuildGeometryInfoKHR) {
-                .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-                .type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-                .flags                    = blasInputs.items[idx].structureFlags | flags,
-                .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-                .srcAccelerationStructure = NULL,
-                .dstAccelerationStructure = NULL,
-                .geometryCount            = 1,
-                .pGeometries              = &blasInputs.items[idx].geometry,
-                .ppGeometries             = NULL,
-            },
-            .rangeInfo = &blasInputs.items[idx].rangeInfo,
-            .sizesInfo = (VkAccelerationStructureBuildSizesInfoKHR) {
-                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-            },
-        };
+    Volume     volume;
+    VolumeData volumeData;
+    CHECK(raytracing_create_device_volume_geometry(width, height, depth, VOLUME_BOUNDS_BRICKS, writer, user,
+        &volume, &volumeData));
 
-        uint32_t maxPrimCount = blasInputs.items[idx].rangeInfo.primitiveCount;
-        
-        GetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-            &buildAs.items[idx].geometryInfo, &maxPrimCount, &buildAs.items[idx].sizesInfo);
+    timer_stop(&t);
+    time_to_str(deviceStr, timer_get_ns(&t));
 
-        maxScratchSize = fmaxf(maxScratchSize, (uint32_t) buildAs.items[idx].sizesInfo.buildScratchSize);
-        nbCompactions += buildAs.items[idx].geometryInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
-    }
+    // Host path up to its upload, the voxels are already there
+    timer_start(&t);
 
-    // Allocate the scratch buffers holding the temporary data of the acceleration structure builder
-    BufferData scratchBuffer;
-    CHECK(vulkan_create_buffer(maxScratchSize,
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-        &scratchBuffer.buffer, &scratchBuffer.memory));
+    BrickMap brickMap;
+    CHECK(brickmap_create(width, height, depth, data, DISTANCE_CHEBYSHEV, &brickMap));
 
-    VkDeviceAddress scratchAddress = raytracing_get_buffer_device_address(scratchBuffer.buffer);
+    BrickPalette palette;
+    palette_create(&brickMap, &palette);
 
-    // Allocate a query pool for storing the needed size for every BLAS compaction.
-    VkQueryPool queryPool = NULL;
-    if (nbCompactions > 0)
+    timer_stop(&t);
+    time_to_str(hostStr, timer_get_ns(&t));
+
+    num_to_str(uploadStr, brickmap_grid_size(&brickMap) * sizeof(uint32_t) + brickmap_occupancy_size(&brickMap) +
+        brickmap_distance_size(&brickMap) + palette_memory_size(&palette) + brickMap.bricks.count * sizeof(AABB));
+
+    uint32_t cellCount = volumeData.gridWidth * volumeData.gridHeight * volumeData.gridDepth;
+
+    // The whole pool, the range of the volume is only known on the device
+    BufferData* sources[] = { &volume.grid, &volume.bricks, &deviceBricks, &deviceBricksHead, &volume.occupancy,
+        &volume.distance, &volume.aabbs };
+    VkDeviceSize sizes[]  = {
+        (VkDeviceSize) cellCount * sizeof(uint32_t),
+        (VkDeviceSize) cellCount * sizeof(uint32_t),
+        (VkDeviceSize) RAYTRACING_DEVICE_BRICKS * BRICK_VOLUME,
+        2 * sizeof(uint32_t),
+        brickmap_occupancy_size(&brickMap),
+        brickmap_distance_size(&brickMap),
+        (VkDeviceSize) cellCount * sizeof(AABB),
+    };
+
+    VkDeviceSize offsets[ARRAYLEN(sizes)], readbackSize = 0;
+    for(size_t i = 0; i < ARRAYLEN(sizes); ++i)
     {
-        ASSERT(nbCompactions == nbBlas);
-        VkQueryPoolCreateInfo qpci = {
-            .sType              = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-            .queryType          = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
-            .queryCount         = nbBlas,
-            .pipelineStatistics = 0
-        };
-        VKCHECK(vkCreateQueryPool(device, &qpci, NULL, &queryPool));
+        offsets[i]    = readbackSize;
+        readbackSize += sizes[i];
     }
 
-    // Batching creation/compaction of BLAS to allow staying in restricted amount of memory
-    UInt32s      indices    = {0};  // Indices of the BLAS to create
-    VkDeviceSize batchSize  = 0;
-    VkDeviceSize batchLimit = 256000000;  // 256 MB
+    BufferData readback;
+    CHECK(vulkan_create_buffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, vulkan_memory_properties(MEMORY_USAGE_STAGING),
+        0, &readback.buffer, &readback.allocation));
 
-    for (uint32_t idx = 0; idx < nbBlas; idx++)
+    VkCommandBuffer commandBuffer;
+    CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+    for(size_t i = 0; i < ARRAYLEN(sizes); ++i)
     {
-        list_append(indices, idx);
-        batchSize += buildAs.items[idx].sizesInfo.accelerationStructureSize;
+        VkBufferCopy copyRegion = {
+            .dstOffset = offsets[i],
+            .size      = sizes[i],
+        };
+        vkCmdCopyBuffer(commandBuffer, sources[i]->buffer, readback.buffer, 1, &copyRegion);
+    }
 
-        // Over the limit or last BLAS element
-        if (batchSize >= batchLimit || idx == nbBlas - 1)
-        {
-            VkCommandBuffer commandBuffer;
-            CHECK(vulkan_begin_single_time_commands(commandPool, &commandBuffer));
-            CHECK(raytracing_create_blas(commandBuffer, indices, &buildAs, scratchAddress, queryPool));
-            CHECK(vulkan_end_single_time_commands(commandPool, commandBuffer));
+    raytracing_memory_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+    CHECK(vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer));
+
+    const uint8_t*  map       = (const uint8_t*) readback.allocation.map;
+    const uint32_t* grid      = (const uint32_t*) (map + offsets[0]);
+    const uint32_t* table     = (const uint32_t*) (map + offsets[1]);
+    const uint8_t*  pool      = map + offsets[2];
+    const uint32_t* head      = (const uint32_t*) (map + offsets[3]);
+    const uint32_t* occupancy = (const uint32_t*) (map + offsets[4]);
+    const uint8_t*  distance  = map + offsets[5];
+    const AABB*     aabbs     = (const AABB*) (map + offsets[6]);
+
+    // Through the brick table into the pool, the empty cells have no entry
+    uint32_t voxelMismatches = 0;
+    for(uint32_t z = 0; z < depth; ++z)
+        for(uint32_t y = 0; y < height; ++y)
+            for(uint32_t x = 0; x < width; ++x)
+            {
+                uint32_t cell = (x / BRICK_SIZE) + (y / BRICK_SIZE) * volumeData.gridWidth +
+                    (z / BRICK_SIZE) * (volumeData.gridWidth * volumeData.gridHeight);
+                uint8_t value = grid[cell] == BRICK_EMPTY ? 0 : pool[(size_t) (table[cell] >> 2) * sizeof(uint32_t) +
+                    morton_brick_index(x % BRICK_SIZE, y % BRICK_SIZE, z % BRICK_SIZE)];
+
+                voxelMismatches += value != data[x + y * width + (size_t) z * (width * height)];
+            }
 
-            if (queryPool)
+    uint32_t gridMismatches = 0, distanceMismatches = 0, aabbMismatches = 0;
+    for(uint32_t z = 0; z < volumeData.gridDepth; ++z)
+        for(uint32_t y = 0; y < volumeData.gridHeight; ++y)
+            for(uint32_t x = 0; x < volumeData.gridWidth; ++x)
             {
-                // VkCommandBuffer commandBuffer = VulkanApplication::BeginSingleTimeCommands(device, commandPool);
-                // cmdCompactBlas(cmdBuf, indices, buildAs, queryPool);
-                // VulkanApplication::EndSingleTimeCommands(device, m_Queue, commandPool, commandBuffer);
+                uint32_t cell = x + y * volumeData.gridWidth + z * (volumeData.gridWidth * volumeData.gridHeight);
+                bool solid = brickMap.grid[cell] != BRICK_EMPTY;
+
+                gridMismatches     += grid[cell] != (solid ? cell + 1 : BRICK_EMPTY);
+                distanceMismatches += distance[cell] != brickMap.distance[cell];
+
+                // The empty bricks keep an inactive AABB, NaN min x
+                if(!solid)
+                {
+                    aabbMismatches += !isnan(aabbs[cell].min.x);
+                    continue;
+                }
+
+                uint32_t min[3], max[3];
+                brickmap_brick_bounds(&brickMap, x, y, z, min, max);
+
+                aabbMismatches += aabbs[cell].min.x != min[0] || aabbs[cell].min.y != min[1] ||
+                    aabbs[cell].min.z != min[2] || aabbs[cell].max.x != max[0] || aabbs[cell].max.y != max[1] ||
+                    aabbs[cell].max.z != max[2];
             }
-            
-            // Reset
-            batchSize = 0;
-            indices.count = 0;
-        }
-    }
 
-    list_destroy(indices);
+    uint32_t occupancyMismatches = 0;
+    for(size_t i = 0; i < brickMap.occupancyWords; ++i)
+        occupancyMismatches += occupancy[i] != brickMap.occupancy[i];
 
-    // Keeping all the created acceleration structures
-    VkAccelerationStructureDeviceAddressInfoKHR asDeviceAddressInfo = {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-    };
+    // Every solid brick took one slot of the pool, the dropped ones included
+    uint32_t poolBricks = 0;
+    for(uint32_t cell = 0; cell < cellCount; ++cell)
+        poolBricks += grid[cell] != BRICK_EMPTY;
 
-    for (size_t i = 0; i < buildAs.count; ++i)
-    {
-        asDeviceAddressInfo.accelerationStructure = buildAs.items[i].as;
-        BottomLevel bottomLevel = {
-            .buildAs = buildAs.items[i],
-            .address = GetAccelerationStructureDeviceAddressKHR(device, &asDeviceAddressInfo),
-        };
-        list_append(blass, bottomLevel);
-    }
+    uint32_t droppedBricks = head[1];
 
-    list_destroy(buildAs);
+    num_to_str(deviceBytesStr, volume.memory + (double) poolBricks * BRICK_VOLUME);
 
-    // Clean up
-    vkDestroyQueryPool(device, queryPool, NULL);
+    log_info("Raytracing device volume %ux%ux%u, %u/%u bricks: device %s then %sB on the device, host brickmap and "
+        "palette %s then %sB uploaded", width, height, depth, poolBricks, cellCount, deviceStr, deviceBytesStr, hostStr,
+        uploadStr);
+    log_info("    %u voxel, %u grid, %u occupancy word, %u distance, %u AABB mismatches, %u dropped bricks",
+        voxelMismatches, gridMismatches, occupancyMismatches, distanceMismatches, aabbMismatches, droppedBricks);
 
-    DeleteBuffer(scratchBuffer);
-    return true;
-}
+    // The bricks of the volume were the last ones taken from the pool
+    const uint32_t next = head[0] - poolBricks;
 
-bool raytracing_create_bottom_layer(VkCommandPool commandPool)
-{
-    return raytracing_create_bottom_level_as(commandPool, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    CHECK(vulkan_queue_begin_commands(QUEUE_ASYNC, &commandBuffer));
+    vkCmdUpdateBuffer(commandBuffer, deviceBricksHead.buffer, 0, sizeof(next), &next);
+    CHECK(vulkan_queue_end_commands(QUEUE_ASYNC, commandBuffer));
+
+    DeleteBuffer(readback);
+    raytracing_destroy_volume(&volume);
+    palette_destroy(&palette);
+    brickmap_destroy(&brickMap);
+
+    return voxelMismatches == 0 && gridMismatches == 0 && occupancyMismatches == 0 && distanceMismatches == 0 &&
+        aabbMismatches == 0 && droppedBricks == 0;
 }
 
-static bool raytracing_create_tlas(VkCommandBuffer commandBuffer,
-    uint32_t countInstance, VkBuildAccelerationStructureFlagsKHR flags, bool update)
+static bool raytracing_create_tlas(VkCommandBuffer commandBuffer, VkDeviceAddress instanceAddress,
+    uint32_t countInstance, VkBuildAccelerationStructureFlagsKHR flags, bool create, bool update)
 {
     // Wraps a device pointer to the above uploaded instances.
     VkAccelerationStructureGeometryInstancesDataKHR geometryInstancesData = {
         .sType              = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
         .arrayOfPointers    = VK_FALSE,
-        .data.deviceAddress = instanceBuffer.address,
+        .data.deviceAddress = instanceAddress,
     };
 
     // Put the above into a VkAccelerationStructureGeometryKHR. We need to put the instances struct in a union and label it as instance data.
@@ -487,17 +2128,20 @@ static bool raytracing_create_tlas(VkCommandBuffer commandBuffer,
         .updateScratchSize         = 0,
         .buildScratchSize          = 0,
     };
+    // Sized for the full instance capacity, instances come and go without recreating the structure
+    uint32_t maxInstance = RAYTRACING_MAX_INSTANCES;
     GetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
-        &countInstance, &sizeInfo);
+        &maxInstance, &sizeInfo);
 
 
-    // Actual allocation of buffer and acceleration structure.
-    if (!update)
+    // Actual allocation of buffer and acceleration structure, later builds land in the same structure
+    if (create)
     {
         CHECK(vulkan_create_buffer(sizeInfo.accelerationStructureSize,
             VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-            &accelerationBuffer.buffer, &accelerationBuffer.memory));
+            vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+            &accelerationBuffer.buffer, &accelerationBuffer.allocation));
+        vulkan_memory_track(MEMORY_CATEGORY_TLAS, sizeInfo.accelerationStructureSize);
 
         VkAccelerationStructureCreateInfoKHR createInfo = {
             .sType         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
@@ -511,13 +2155,18 @@ static bool raytracing_create_tlas(VkCommandBuffer commandBuffer,
 
         VKCHECK(CreateAccelerationStructureKHR(device, &createInfo, NULL, &tlasAs));
 
-        // Allocate the scratch buffers holding the temporary data of the acceleration structure builder
-        CHECK(vulkan_create_buffer(sizeInfo.buildScratchSize,
+        // Allocate the scratch buffers holding the temporary data of the acceleration structure builder,
+        // kept for the per frame refits and rebuilds
+        VkDeviceSize scratchSize = sizeInfo.buildScratchSize > sizeInfo.updateScratchSize ?
+            sizeInfo.buildScratchSize : sizeInfo.updateScratchSize;
+
+        CHECK(vulkan_create_buffer(scratchSize + scratchAlignment,
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-            &tempAsBuild.buffer, &tempAsBuild.memory));
+            vulkan_memory_properties(MEMORY_USAGE_GPU_ONLY), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+            &tempAsBuild.buffer, &tempAsBuild.allocation));
+        vulkan_memory_track(MEMORY_CATEGORY_SCRATCH, scratchSize + scratchAlignment);
 
-        tempAsBuild.address = raytracing_get_buffer_device_address(tempAsBuild.buffer);
+        tempAsBuild.address = raytracing_align_up(raytracing_get_buffer_device_address(tempAsBuild.buffer), scratchAlignment);
     }
 
     // Update build information
@@ -539,56 +2188,134 @@ static bool raytracing_create_tlas(VkCommandBuffer commandBuffer,
     return true;
 }
 
-static bool raytracing_build_tlas(VkCommandPool commandPool, VkBuildAccelerationStructureFlagsKHR flags, bool update)
+static bool raytracing_build_tlas(VkCommandPool commandPool, VkBuildAccelerationStructureFlagsKHR flags)
 {
     size_t countInstance = tlas.count;
-    size_t sizeInstance = countInstance * sizeof(VkAccelerationStructureInstanceKHR);
+    size_t sizeInstance = RAYTRACING_MAX_INSTANCES * sizeof(VkAccelerationStructureInstanceKHR);
+    ASSERT(countInstance <= RAYTRACING_MAX_INSTANCES);
 
-    if (!update)
+    // One instance buffer per frame in flight, the host rewrites one while the GPU may still read the other
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
     {
-        CHECK(vulkan_create_mapped_data_buffer(tlas.items, sizeInstance,
+        CHECK(vulkan_create_buffer(sizeInstance,
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-            &instanceBuffer.buffer, &instanceBuffer.memory, &instanceBuffer.map));
+            vulkan_memory_properties(MEMORY_USAGE_CPU_TO_GPU), VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+            &instanceBuffers[i].buffer, &instanceBuffers[i].allocation));
+        vulkan_memory_track(MEMORY_CATEGORY_INSTANCES, sizeInstance);
+
+        instanceBuffers[i].map = instanceBuffers[i].allocation.map;
+        memcpy(instanceBuffers[i].map, tlas.items, countInstance * sizeof(VkAccelerationStructureInstanceKHR));
         
-        instanceBuffer.address = raytracing_get_buffer_device_address(instanceBuffer.buffer);
+        instanceBuffers[i].address = raytracing_get_buffer_device_address(instanceBuffers[i].buffer);
     }
-    else
-        memcpy(instanceBuffer.map, tlas.items, sizeInstance);
     
     VkCommandBuffer commandBuffer;
     CHECK(vulkan_begin_single_time_commands(commandPool, &commandBuffer));
 
+    // Creating the TLAS
+    CHECK(raytracing_create_tlas(commandBuffer, instanceBuffers[0].address, countInstance, flags, true, false));
+    
+    CHECK(vulkan_end_single_time_commands(commandPool, commandBuffer));
+
+    tlasFlags      = flags;
+    tlasDirty      = false;
+    tlasRebuild    = false;
+    tlasRefitCount = 0;
+    return true;
+}
+
+bool raytracing_create_top_layer(VkCommandPool commandPool)
+{
+    return raytracing_build_tlas(commandPool,
+        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+}
+
+// Copies the datas of the volumes created since the upload into their slot of the volume datas buffer
+static void raytracing_flush_volume_datas(VkCommandBuffer commandBuffer)
+{
+    if (dirtyVolumes.count == 0)
+        return;
+
+    // Traces of the previous frames read the other slots of the same buffer
     VkMemoryBarrier barrier = {
         .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
     };
 
     vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT,
         0,
         1, &barrier,
         0, NULL,
         0, NULL);
 
-    // Creating the TLAS
-    CHECK(raytracing_create_tlas(commandBuffer, countInstance, flags, update));
-    
-    CHECK(vulkan_end_single_time_commands(commandPool, commandBuffer));
-    return true;
-}
+    for (size_t i = 0; i < dirtyVolumes.count; ++i)
+    {
+        uint32_t slot = dirtyVolumes.items[i];
+        vkCmdUpdateBuffer(commandBuffer, volumeDatasBuffer.buffer, slot * sizeof(VolumeData), sizeof(VolumeData),
+            &volumeDatas.items[slot]);
+    }
+    dirtyVolumes.count = 0;
 
-bool raytracing_create_top_layer(VkCommandPool commandPool)
-{
-    return raytracing_build_tlas(commandPool,
-        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, false);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
 }
 
-bool raytracing_update_top_layer(VkCommandPool commandPool)
+bool raytracing_update_top_layer(VkCommandBuffer commandBuffer, uint32_t frameIndex)
 {
-    return raytracing_build_tlas(commandPool,
-        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, true);
+    CHECK(raytracing_update_pending_blas());
+    raytracing_retire_volumes();
+    raytracing_flush_volume_datas(commandBuffer);
+
+    if (!tlasDirty)
+        return true;
+
+    // Previous frame finished with this slot, its fence was waited on before recording
+    MappedAddressedBuffer* instanceBuffer = &instanceBuffers[frameIndex];
+    memcpy(instanceBuffer->map, tlas.items, tlas.count * sizeof(VkAccelerationStructureInstanceKHR));
+
+    // Refits keep the original tree topology and its quality drops as instances move, rebuild every so often.
+    // Added or removed instances rebuild in place, the structure and its buffers were sized for the capacity
+    bool update = !tlasRebuild && tlasRefitCount < RAYTRACING_TLAS_MAX_REFITS;
+    tlasRefitCount = update ? tlasRefitCount + 1 : 0;
+    tlasRebuild    = false;
+
+    // Traces of the previous frame still read the structure the build writes
+    VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+    };
+
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
+
+    CHECK(raytracing_create_tlas(commandBuffer, instanceBuffer->address, tlas.count, tlasFlags, false, update));
+
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
+
+    tlasDirty = false;
+    return true;
 }
 
 static bool raytracing_create_descriptor_set_layouts()
@@ -623,9 +2350,9 @@ static bool raytracing_create_descriptor_set_layouts()
 
     VkDescriptorSetLayoutBinding volumesLayoutBinding = {
         .binding            = 4,
-        .descriptorType     = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .descriptorCount    = volumes.count,
-        .stageFlags         = VK_SHADER_STAGE_INTERSECTION_BIT_KHR,
+        .descriptorType     = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount    = 1,
+        .stageFlags         = VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
     };
     
     VkDescriptorSetLayoutBinding bindings[] = {
@@ -662,18 +2389,11 @@ bool raytracing_update_descriptor_sets(Images images, Texture* texture)
         .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
     };
 
-    DescriptorImageInfos volumesInfos = {0};
-    list_alloc(volumesInfos, volumes.count);
-
-    for(size_t i = 0; i < volumes.count; ++i)
-    {
-        VkDescriptorImageInfo info = {
-            .sampler = NULL,
-            .imageView = volumes.items[i].view,
-            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-        };
-        list_append(volumesInfos, info);
-    }
+    VkDescriptorBufferInfo volumesInfo = {
+        .buffer = volumeDatasBuffer.buffer,
+        .offset = 0,
+        .range  = RAYTRACING_MAX_VOLUMES * sizeof(VolumeData),
+    };
 
     for (size_t i = 0; i < images.count; ++i)
     {
@@ -725,9 +2445,9 @@ bool raytracing_update_descriptor_sets(Images images, Texture* texture)
                 .dstSet           = descriptorSets.items[i],
                 .dstBinding       = 4,
                 .dstArrayElement  = 0,
-                .descriptorCount  = volumesInfos.count,
-                .descriptorType   = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-                .pImageInfo       = volumesInfos.items,
+                .descriptorCount  = 1,
+                .descriptorType   = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo      = &volumesInfo,
             },
         };
 
@@ -758,7 +2478,7 @@ bool raytracing_create_descriptors(Images images, Texture* texture)
             .descriptorCount = images.count,
         },
         (VkDescriptorPoolSize) {
-            .type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             .descriptorCount = images.count,
         },
     };
@@ -798,7 +2518,7 @@ bool raytracing_create_descriptors(Images images, Texture* texture)
 bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayout)
 {
     enum Shaders {
-        rGen, rMiss, rShadow, rCHitTris, rCHitAabb, rIntAabb,
+        rGen, rMiss, rShadow, rCHitTris, rCHitAabb, rIntAabb, rIntSvo, rIntDag,
     };
 
     bool result = true;
@@ -808,7 +2528,9 @@ bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayo
     const char* rshadowShaderFilepath   = "res/shaders/raytracing/rayShadow.rmiss.spv";
     const char* rchitTrisShaderFilepath = "res/shaders/raytracing/rayCHitTris.rchit.spv";
     const char* rchitAabbShaderFilepath = "res/shaders/raytracing/rayCHitAabb.rchit.spv";
-    const char* rintAabbShaderFilepath = "res/shaders/raytracing/rayIntAabb.rint.spv";
+    const char* rintAabbShaderFilepath  = "res/shaders/raytracing/rayIntAabb.rint.spv";
+    const char* rintSvoShaderFilepath   = "res/shaders/raytracing/rayIntSvo.rint.spv";
+    const char* rintDagShaderFilepath   = "res/shaders/raytracing/rayIntDag.rint.spv";
 
     VkDescriptorSetLayout descriptorSetLayouts[] = {
         globalUBODescriptorSetLayout,
@@ -825,9 +2547,11 @@ bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayo
     VKCHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout));
 
     uint32_t *rgenShaderCode = NULL, *rmissShaderCode = NULL, *rshadowShaderCode = NULL,
-             *rchitTrisShaderCode = NULL, *rchitAabbShaderCode = NULL, *rintAabbShaderCode = NULL;
+             *rchitTrisShaderCode = NULL, *rchitAabbShaderCode = NULL, *rintAabbShaderCode = NULL,
+             *rintSvoShaderCode = NULL, *rintDagShaderCode = NULL;
     size_t rgenShaderCodeSize, rmissShaderCodeSize, rshadowShaderCodeSize,
-           rchitTrisShaderCodeSize, rchitAabbShaderCodeSize, rintAabbShaderCodeSize;
+           rchitTrisShaderCodeSize, rchitAabbShaderCodeSize, rintAabbShaderCodeSize, rintSvoShaderCodeSize,
+           rintDagShaderCodeSize;
 
     if(!file_read_all(rgenShaderFilepath, (char**)&rgenShaderCode, &rgenShaderCodeSize))
     {
@@ -888,6 +2612,26 @@ bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayo
     VkShaderModule rintAabbShaderModule = 0;
     if(!vulkan_shader_create_shader_module(rintAabbShaderCode, rintAabbShaderCodeSize, &rintAabbShaderModule))
         finalize(false);
+
+    if(!file_read_all(rintSvoShaderFilepath, (char**)&rintSvoShaderCode, &rintSvoShaderCodeSize))
+    {
+        log_error("Vulkan shader not found: %s", rintSvoShaderFilepath);
+        finalize(false);
+    }
+
+    VkShaderModule rintSvoShaderModule = 0;
+    if(!vulkan_shader_create_shader_module(rintSvoShaderCode, rintSvoShaderCodeSize, &rintSvoShaderModule))
+        finalize(false);
+
+    if(!file_read_all(rintDagShaderFilepath, (char**)&rintDagShaderCode, &rintDagShaderCodeSize))
+    {
+        log_error("Vulkan shader not found: %s", rintDagShaderFilepath);
+        finalize(false);
+    }
+
+    VkShaderModule rintDagShaderModule = 0;
+    if(!vulkan_shader_create_shader_module(rintDagShaderCode, rintDagShaderCodeSize, &rintDagShaderModule))
+        finalize(false);
     
     VkPipelineShaderStageCreateInfo rgenShaderStageInfo = {
         .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -931,9 +2675,24 @@ bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayo
         .pName  = "main",
     };
 
+    VkPipelineShaderStageCreateInfo rintSvoShaderStageInfo = {
+        .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage  = VK_SHADER_STAGE_INTERSECTION_BIT_KHR,
+        .module = rintSvoShaderModule,
+        .pName  = "main",
+    };
+
+    VkPipelineShaderStageCreateInfo rintDagShaderStageInfo = {
+        .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage  = VK_SHADER_STAGE_INTERSECTION_BIT_KHR,
+        .module = rintDagShaderModule,
+        .pName  = "main",
+    };
+
     VkPipelineShaderStageCreateInfo shaderStages[] = {
         rgenShaderStageInfo, rmissShaderStageInfo, rshadowShaderStageInfo,
-        rchitTrisShaderStageInfo, rchitAabbShaderStageInfo, rintAabbShaderStageInfo,
+        rchitTrisShaderStageInfo, rchitAabbShaderStageInfo, rintAabbShaderStageInfo, rintSvoShaderStageInfo,
+        rintDagShaderStageInfo,
     };
 
     VkRayTracingShaderGroupCreateInfoKHR rayGenGroup = {
@@ -985,8 +2744,29 @@ bool raytracing_create_pipeline(VkDescriptorSetLayout globalUBODescriptorSetLayo
         .intersectionShader = rIntAabb,
     };
 
+    // Same closest hit as the brickmap volumes, only the traversal differs
+    VkRayTracingShaderGroupCreateInfoKHR rayHitSvoGroup =
+    {
+        .sType              = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+        .type               = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+        .generalShader      = VK_SHADER_UNUSED_KHR,
+        .closestHitShader   = rCHitAabb,
+        .anyHitShader       = VK_SHADER_UNUSED_KHR,
+        .intersectionShader = rIntSvo,
+    };
+
+    VkRayTracingShaderGroupCreateInfoKHR rayHitDagGroup =
+    {
+        .sType              = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+        .type               = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+        .generalShader      = VK_SHADER_UNUSED_KHR,
+        .closestHitShader   = rCHitAabb,
+        .anyHitShader       = VK_SHADER_UNUSED_KHR,
+        .intersectionShader = rIntDag,
+    };
+
     VkRayTracingShaderGroupCreateInfoKHR shaderGroups[] = {
-        rayGenGroup, rayMissGroup, rayShadowGroup, rayHitTrisGroup, rayHitAabbGroup,
+        rayGenGroup, rayMissGroup, rayShadowGroup, rayHitTrisGroup, rayHitAabbGroup, rayHitSvoGroup, rayHitDagGroup,
     };
 
     VkRayTracingPipelineCreateInfoKHR pipelineInfo = {
@@ -1015,6 +2795,8 @@ finalize:
     if(rchitTrisShaderCode) free(rchitTrisShaderCode);
     if(rchitAabbShaderCode) free(rchitAabbShaderCode);
     if(rintAabbShaderCode) free(rintAabbShaderCode);
+    if(rintSvoShaderCode) free(rintSvoShaderCode);
+    if(rintDagShaderCode) free(rintDagShaderCode);
     
     if(rgenShaderModule) vkDestroyShaderModule(device, rgenShaderModule, NULL);
     if(rmissShaderModule) vkDestroyShaderModule(device, rmissShaderModule, NULL);
@@ -1022,14 +2804,11 @@ finalize:
     if(rchitTrisShaderModule) vkDestroyShaderModule(device, rchitTrisShaderModule, NULL);
     if(rchitAabbShaderModule) vkDestroyShaderModule(device, rchitAabbShaderModule, NULL);
     if(rintAabbShaderModule) vkDestroyShaderModule(device, rintAabbShaderModule, NULL);
+    if(rintSvoShaderModule) vkDestroyShaderModule(device, rintSvoShaderModule, NULL);
+    if(rintDagShaderModule) vkDestroyShaderModule(device, rintDagShaderModule, NULL);
     return result;
 }
 
-static uint32_t raytracing_align_up(uint32_t value, uint32_t alignment)
-{
-    return (value + alignment - 1) & ~(alignment - 1);
-}
-
 bool raytracing_create_shader_binding_table()
 {
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties = {
@@ -1043,7 +2822,7 @@ bool raytracing_create_shader_binding_table()
     vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties2);
 
     uint32_t missCount = 2;
-    uint32_t hitCount  = 2;
+    uint32_t hitCount  = 4;
     uint32_t handleCount = 1 + missCount + hitCount;
     uint32_t handleSize  = rayTracingPipelineProperties.shaderGroupHandleSize;
 
@@ -1065,19 +2844,9 @@ bool raytracing_create_shader_binding_table()
 
     VKCHECK(GetRayTracingShaderGroupHandlesKHR(device, pipeline, 0, handleCount, dataSize, handles.items));
 
+    // Table is laid out on the host, then uploaded to device local memory
     VkDeviceSize sbtSize = rayGenRegion.size + rayMissRegion.size + rayHitRegion.size + rayCallRegion.size;
-    CHECK(vulkan_create_buffer(sbtSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &raySBTBuffer.buffer, &raySBTBuffer.memory));
-    
-    VkDeviceAddress sbtAddress  = raytracing_get_buffer_device_address(raySBTBuffer.buffer);
-    rayGenRegion.deviceAddress  = sbtAddress;
-    rayMissRegion.deviceAddress = sbtAddress + rayGenRegion.size;
-    rayHitRegion.deviceAddress  = sbtAddress + rayGenRegion.size + rayMissRegion.size;
-
-    void* pSBTBuffer;
-    VKCHECK(vkMapMemory(device, raySBTBuffer.memory, 0, sbtSize, 0, &pSBTBuffer));
+    uint8_t* pSBTBuffer = (uint8_t*) calloc(sbtSize, 1);
 
     // Raygen
     memcpy(pSBTBuffer, handles.items, handleSize);
@@ -1100,7 +2869,18 @@ bool raytracing_create_shader_binding_table()
         pData += rayHitRegion.stride;
     }
 
-    vkUnmapMemory(device, raySBTBuffer.memory);
+    CHECK(vulkan_create_upload_buffer(pSBTBuffer, sbtSize,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &raySBTBuffer.buffer, &raySBTBuffer.allocation));
+    vulkan_memory_track(MEMORY_CATEGORY_SBT, sbtSize);
+
+    free(pSBTBuffer);
+    list_destroy(handles);
+
+    VkDeviceAddress sbtAddress  = raytracing_get_buffer_device_address(raySBTBuffer.buffer);
+    rayGenRegion.deviceAddress  = sbtAddress;
+    rayMissRegion.deviceAddress = sbtAddress + rayGenRegion.size;
+    rayHitRegion.deviceAddress  = sbtAddress + rayGenRegion.size + rayMissRegion.size;
     return true;
 }
 
@@ -1121,17 +2901,60 @@ bool raytracer_render(VkCommandBuffer commandBuffer, uint32_t frameIndex,
 
 void raytracing_destroy()
 {
-    for(size_t i = 0; i < aabbBuffers.count; ++i)
-        DeleteBuffer(aabbBuffers.items[i]);
-    
     for(size_t i = 0; i < volumes.count; ++i)
-        DeleteImage(volumes.items[i]);
+        if(!volumes.items[i].removed)
+            raytracing_destroy_volume(&volumes.items[i]);
+
+    for(size_t i = 0; i < retiredVolumes.count; ++i)
+        raytracing_destroy_retired_volume(&retiredVolumes.items[i]);
+
+    // The device is idle, the builds in flight completed
+    for(size_t i = 0; i < pendingBlass.count; ++i)
+    {
+        raytracing_destroy_blas(&pendingBlass.items[i].buildAs);
+        if(pendingBlass.items[i].source.as != NULL)
+            raytracing_destroy_blas(&pendingBlass.items[i].source);
+    }
+
+    if(blasScratchSize > 0)
+        DeleteBuffer(blasScratch);
+    vkDestroyQueryPool(device, blasQueryPool, NULL);
+
+    list_destroy(pendingBlass);
+    list_destroy(freeBlasQueries);
+    list_destroy(retiredVolumes);
+    list_destroy(freeVolumes);
+    list_destroy(freeBlass);
+    list_destroy(dirtyVolumes);
+    list_destroy(freeInstances);
+
+    DeleteBuffer(volumeDatasBuffer);
+
+    if(dagUploaded)
+        DeleteBuffer(dagBuffer);
+    dag_destroy(&dag);
 
     DeleteBuffer(raySBTBuffer);
 
     vkDestroyPipeline(device, pipeline, NULL);
     vkDestroyPipelineLayout(device, pipelineLayout, NULL);
 
+    vkDestroyPipeline(device, volumeBoundsPipeline, NULL);
+    vkDestroyPipelineLayout(device, volumeBoundsLayout, NULL);
+    vkDestroyPipeline(device, volumeScanPipeline, NULL);
+    vkDestroyPipelineLayout(device, volumeScanLayout, NULL);
+    vkDestroyPipeline(device, volumeCompactPipeline, NULL);
+    vkDestroyPipelineLayout(device, volumeCompactLayout, NULL);
+    vkDestroyPipeline(device, volumeDistancePipeline, NULL);
+    vkDestroyPipelineLayout(device, volumeDistanceLayout, NULL);
+
+    if(deviceBricks.buffer != VK_NULL_HANDLE)
+    {
+        DeleteBuffer(deviceBricks);
+        DeleteBuffer(deviceBricksHead);
+        vulkan_memory_release(MEMORY_CATEGORY_GEOMETRY, (VkDeviceSize) RAYTRACING_DEVICE_BRICKS * BRICK_VOLUME);
+    }
+
     vkFreeDescriptorSets(device, descriptorPool, descriptorSets.count, descriptorSets.items);
 
     vkDestroyDescriptorPool(device, descriptorPool, NULL);
@@ -1140,17 +2963,21 @@ void raytracing_destroy()
 
     DeleteBuffer(geometriesAddressesBuffer);
 
-    // Bottom layer
-    for(size_t i = 0; i < blasAddresses.count; ++i)
-        DeleteBuffer(blasAddresses.items[i]);
-
+    // Bottom layer, the slots of the removed volumes are empty
     for(size_t i = 0; i < blass.count; ++i)
+    {
+        if(blass.items[i].buildAs.as == NULL)
+            continue;
+
         DestroyAccelerationStructureKHR(device, blass.items[i].buildAs.as, NULL);
+        DeleteBuffer(blass.items[i].buildAs.buffer);
+    }
     
     // Top layer
     DeleteBuffer(tempAsBuild);
     DeleteBuffer(accelerationBuffer);
-    DeleteMappedBuffer(instanceBuffer);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        DeleteMappedBuffer(instanceBuffers[i]);
 
     DestroyAccelerationStructureKHR(device, tlasAs, NULL);
 }
@@ -4,23 +4,105 @@
 #include "vulkan_base.h"
 #include "texture.h"
 
+// Incremental TLAS updates before a full rebuild restores the trace performance
+#define RAYTRACING_TLAS_MAX_REFITS 64
+
+// Capacity of the volume datas buffer and of the TLAS, volumes and instances added at runtime
+// take free slots without touching the descriptor sets or recreating the TLAS
+#define RAYTRACING_MAX_VOLUMES   4096
+#define RAYTRACING_MAX_INSTANCES 16384
+
+// Volume BLAS builds in flight on the async queue that get compacted, the ones past it stay uncompacted
+#define RAYTRACING_MAX_PENDING_BLAS 64
+
+// Capacity in bricks of the pool shared by the device volumes, 64MB of raw bricks
+#define RAYTRACING_DEVICE_BRICKS (1u << 17)
+
+typedef enum {
+    VOLUME_BACKEND_BRICKMAP, // Brick grid with an occupancy pyramid and a distance field, see voxel/brickmap.h
+    VOLUME_BACKEND_SVO,      // Sparse voxel octree, see voxel/svo.h, for very large mostly empty volumes
+    VOLUME_BACKEND_DAG,      // Sparse voxel DAG, see voxel/dag.h, shares repeated subtrees across every DAG volume
+} VolumeBackend;
+
+typedef enum {
+    VOLUME_BOUNDS_SINGLE, // One AABB over the volume, the intersection shader skips the empty space
+    VOLUME_BOUNDS_BRICKS, // One tight AABB per non empty brick, the BVH culls the empty space
+} VolumeBounds;
+
+// Records the commands writing the voxels of a device volume at words, 8 bits each: brick after brick in grid
+// order, the BRICK_VOLUME voxels of a brick in Morton order, 4 per word. Voxels past the volume are written 0
+typedef void (*VolumeWriter)(VkCommandBuffer commandBuffer, VkDeviceAddress words, const uint32_t gridSize[3],
+    void* user);
+
 bool raytracing_init();
 
-bool raytracing_add_volume_geometry(VkCommandPool commandPool, uint32_t width, uint32_t height, uint32_t depth, uint8_t* data);
+// SVO and DAG volumes always use a single AABB, the octree traversal skips the empty space.
+// DAG volumes have to be added before raytracing_create_geometries_address_buffer uploads their shared nodes
+bool raytracing_add_volume_geometry(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBackend backend, VolumeBounds bounds);
+
+// raytracing_add_volume_geometry returning the objIndex of the volume. Once the bottom layer exists its BLAS
+// is submitted to the async queue without waiting and the next frame copies its data to the device. Its
+// instances are traced from the top layer update after the build, and the compaction, completed
+bool raytracing_create_volume(uint32_t width, uint32_t height, uint32_t depth, uint8_t* data,
+    VolumeBackend backend, VolumeBounds bounds, uint32_t* volumeIndex);
+
+// Brickmap volume generated on the device, nothing goes through the host: writer records the voxels into raw
+// bricks, then compute passes derive the grid, the occupancy pyramid, the distance field and the AABBs the BLAS
+// is built from. The empty bricks keep an inactive AABB. A prefix sum over the occupancy moves the solid bricks
+// into the device brick pool and writes the brick table, without reading the count back: the bricks past
+// RAYTRACING_DEVICE_BRICKS read as empty
+bool raytracing_create_device_volume(uint32_t width, uint32_t height, uint32_t depth, VolumeBounds bounds,
+    VolumeWriter writer, void* user, uint32_t* volumeIndex);
+
+// colorCount RGBA8 colors, R in the low byte, shading the voxel values of the volume instead of the fixed materials.
+// Once per volume, the values have to stay below colorCount
+bool raytracing_set_volume_colors(uint32_t volumeIndex, const uint32_t* colors, uint32_t colorCount);
+
+// Its instances have to be removed first. The buffers and the BLAS are destroyed, and the slots reused,
+// after MAX_FRAMES_IN_FLIGHT top layer updates. DAG volumes share their nodes and device volumes their
+// brick pool, neither can be removed
+void raytracing_remove_volume(uint32_t volumeIndex);
+
+// Logs the AABBs of every volume and the intersection shader invocations expected when it covers the screen.
+// Reads the brick AABBs back and waits on the device, a diagnostic for startup rather than the frame loop
+void raytracing_log_intersection_estimate(uint32_t screenWidth, uint32_t screenHeight);
 
 void raytracing_add_triangle_geometry(VkBuffer vertexBuffer, VkBuffer indexBuffer,
     uint32_t vertexCount, uint64_t vertexStride, uint32_t indexCount);
 
+// The instance stays inactive until the BLAS of the volume is built, see raytracing_create_volume
 VkAccelerationStructureInstanceKHR* raytracing_add_volume_instance(uint32_t objIndex, VkTransformMatrixKHR* transform);
 VkAccelerationStructureInstanceKHR* raytracing_add_triangle_instance(uint32_t objIndex, VkTransformMatrixKHR* transform);
 
+// Index of an instance returned by raytracing_add_*_instance, the pointer moves as instances are added
+uint32_t raytracing_instance_index(const VkAccelerationStructureInstanceKHR* instance);
+
 void raytracing_update_instance(VkTransformMatrixKHR* transform, uint32_t instanceIndex);
 
-bool raytracing_create_geometries_address_buffer(VkCommandPool commandPool);
+// Leaves an inactive instance the next raytracing_add_*_instance reuses, the next frame rebuilds the TLAS in place
+void raytracing_remove_instance(uint32_t instanceIndex);
+
+bool raytracing_create_geometries_address_buffer();
+
+bool raytracing_create_bottom_layer(bool allowCompaction);
+
+// Builds every BLAS serially then batched into throwaway structures and logs both times
+bool raytracing_benchmark_bottom_layer();
+
+// Device volume of writer against the brickmap of data built on the host: compares the voxels, grid, occupancy,
+// distances and AABBs read back, logs both build times, the bytes of the device volume and the bytes the host
+// path uploads. Its bricks are given back to the pool
+bool raytracing_benchmark_device_volume(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data,
+    VolumeWriter writer, void* user);
 
-bool raytracing_create_bottom_layer(VkCommandPool commandPool);
 bool raytracing_create_top_layer(VkCommandPool commandPool);
 
+// Records the volume data copies and the TLAS refit or rebuild of the frame when instances moved,
+// before raytracer_render. Compacts the volume BLAS whose build completed and adds the compacted ones to
+// their instances. Destroys the removed volumes no frame in flight nor build can read anymore
+bool raytracing_update_top_layer(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
 bool raytracing_update_descriptor_sets(Images images, Texture* texture);
 
 bool raytracing_create_descriptors(Images images, Texture* texture);
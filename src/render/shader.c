@@ -199,3 +199,64 @@ finalize:
     if(fragShaderModule) vkDestroyShaderModule(device, vertShaderModule, NULL);
     return result;
 }
+
+bool vulkan_shader_create_compute_pipeline(const char* shaderFilepath, uint32_t pushConstantSize,
+    VkPipelineLayout* pipelineLayout, VkPipeline* computePipeline)
+{
+    bool result = true;
+
+    uint32_t* shaderCode = NULL;
+    size_t shaderSize;
+    if(!file_read_all(shaderFilepath, (char**)&shaderCode, &shaderSize))
+    {
+        log_error("Vulkan shader not found: %s", shaderFilepath);
+        return false;
+    }
+
+    VkShaderModule shaderModule = 0;
+    if(!vulkan_shader_create_shader_module(shaderCode, shaderSize, &shaderModule))
+        finalize(false);
+
+    // Buffers are reached through device addresses in the push constants, no descriptor sets
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset     = 0,
+        .size       = pushConstantSize,
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &pushConstantRange,
+    };
+
+    if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, pipelineLayout) != VK_SUCCESS)
+    {
+        log_error("Vulkan vkcheck error");
+        finalize(false);
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {
+        .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage  = (VkPipelineShaderStageCreateInfo)
+        {
+            .sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage  = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shaderModule,
+            .pName  = "main",
+        },
+        .layout = *pipelineLayout,
+    };
+
+    if(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, computePipeline) != VK_SUCCESS)
+    {
+        log_error("Vulkan vkcheck error");
+        finalize(false);
+    }
+
+finalize:
+    free(shaderCode);
+
+    if(shaderModule) vkDestroyShaderModule(device, shaderModule, NULL);
+    return result;
+}
@@ -16,4 +16,8 @@ bool vulkan_shader_create_graphics_pipeline(const char* vertexShaderFilepath, co
     VkExtent2D swapchainSize, VkSampleCountFlagBits msaaSamples, VkDescriptorSetLayout* descriptorSetLayout,
     size_t descriptorSetLayoutCount, VkPipelineLayout* pipelineLayout, VkRenderPass renderPass, VkPipeline* graphicsPipeline);
 
+// Compute pipeline without descriptor sets, pushConstantSize bytes of push constants
+bool vulkan_shader_create_compute_pipeline(const char* shaderFilepath, uint32_t pushConstantSize,
+    VkPipelineLayout* pipelineLayout, VkPipeline* computePipeline);
+
 #endif // SHADER_H_
@@ -0,0 +1,367 @@
+#include "staging.h"
+
+#include "buffer.h"
+#include "vulkan_queue.h"
+
+#include <string.h>
+
+extern VkDevice device;
+
+#define STAGING_ALIGNMENT 16
+
+typedef struct {
+    VkCommandBuffer commandBuffer;
+    uint64_t        value;   // Async timeline value signaled once the batch completed
+    VkDeviceSize    end;     // Ring head once the batch was submitted
+    uint32_t        copies;
+    bool            pending;
+} StagingBatch;
+
+static BufferData   ring;
+static VkDeviceSize ringSize;
+static VkDeviceSize ringHead;
+static VkDeviceSize ringTail;
+
+static StagingBatch batches[STAGING_MAX_BATCHES];
+static uint32_t     currentBatch;
+static uint32_t     oldestBatch;
+static uint32_t     pendingBatches;
+static bool         recording;
+
+static VkDeviceSize staging_align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool staging_retire_oldest(bool wait)
+{
+    StagingBatch* batch = &batches[oldestBatch];
+    ASSERT(batch->pending);
+
+    if (wait)
+        CHECK(vulkan_queue_wait(QUEUE_ASYNC, batch->value))
+    else if (vulkan_queue_completed(QUEUE_ASYNC) < batch->value)
+        return false;
+
+    batch->pending = false;
+    ringTail = batch->end;
+
+    oldestBatch = (oldestBatch + 1) % STAGING_MAX_BATCHES;
+    --pendingBatches;
+
+    // Nothing left in flight, restart from the beginning to keep allocations contiguous
+    if (pendingBatches == 0 && (!recording || batches[currentBatch].copies == 0))
+        ringHead = ringTail = 0;
+
+    return true;
+}
+
+static bool staging_begin_batch()
+{
+    if (recording)
+        return true;
+
+    // Reusing the slot of a batch still in flight, it has to be the oldest one
+    if (batches[currentBatch].pending)
+        CHECK(staging_retire_oldest(true));
+
+    StagingBatch* batch = &batches[currentBatch];
+    VKCHECK(vkResetCommandBuffer(batch->commandBuffer, 0));
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VKCHECK(vkBeginCommandBuffer(batch->commandBuffer, &beginInfo));
+
+    batch->copies = 0;
+    recording = true;
+    return true;
+}
+
+static bool staging_ring_fit(VkDeviceSize size, VkDeviceSize* offset)
+{
+    VkDeviceSize start = staging_align_up(ringHead, STAGING_ALIGNMENT);
+
+    if (ringHead >= ringTail)
+    {
+        // Free space is [head, size) and [0, tail), head == tail only when empty
+        if (start + size <= ringSize)
+        {
+            *offset = start;
+            return true;
+        }
+
+        if (size < ringTail)
+        {
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Wrapped, free space is [head, tail)
+    if (start + size < ringTail)
+    {
+        *offset = start;
+        return true;
+    }
+    return false;
+}
+
+// Reserves ring space for the open batch, retiring or submitting batches until it fits
+static bool staging_ring_alloc(VkDeviceSize size, VkDeviceSize* offset)
+{
+    if (size > ringSize - STAGING_ALIGNMENT)
+    {
+        log_error("Staging upload of %llu bytes does not fit the ring", (unsigned long long) size);
+        return false;
+    }
+
+    CHECK(staging_begin_batch());
+
+    while (!staging_ring_fit(size, offset))
+    {
+        if (pendingBatches > 0)
+            CHECK(staging_retire_oldest(true))
+        else
+        {
+            // Open batch alone fills the ring
+            ASSERT(batches[currentBatch].copies > 0);
+            CHECK(vulkan_staging_submit());
+            CHECK(staging_begin_batch());
+        }
+    }
+
+    ringHead = *offset + size;
+    return true;
+}
+
+bool vulkan_staging_init(VkDeviceSize size)
+{
+    ringSize = size;
+    ringHead = ringTail = 0;
+
+    CHECK(vulkan_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
+        &ring.buffer, &ring.allocation));
+
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandPool        = vulkan_queue_command_pool(QUEUE_ASYNC),
+        .commandBufferCount = 1,
+    };
+
+    for (size_t i = 0; i < STAGING_MAX_BATCHES; ++i)
+    {
+        batches[i] = (StagingBatch) {0};
+        VKCHECK(vkAllocateCommandBuffers(device, &allocInfo, &batches[i].commandBuffer));
+    }
+
+    currentBatch = oldestBatch = pendingBatches = 0;
+    recording = false;
+    return true;
+}
+
+void vulkan_staging_destroy()
+{
+    vulkan_staging_flush();
+
+    if (recording)
+        vkEndCommandBuffer(batches[currentBatch].commandBuffer);
+
+    for (size_t i = 0; i < STAGING_MAX_BATCHES; ++i)
+        vkFreeCommandBuffers(device, vulkan_queue_command_pool(QUEUE_ASYNC), 1, &batches[i].commandBuffer);
+
+    DeleteBuffer(ring);
+    recording = false;
+}
+
+bool vulkan_staging_upload_buffer(const void* data, VkDeviceSize size, VkBuffer buffer, VkDeviceSize offset)
+{
+    // Uploads larger than the ring go through in ring sized pieces
+    VkDeviceSize chunkLimit = (ringSize / 2) & ~(VkDeviceSize) (STAGING_ALIGNMENT - 1);
+
+    for (VkDeviceSize done = 0; done < size;)
+    {
+        VkDeviceSize chunk = size - done < chunkLimit ? size - done : chunkLimit;
+
+        VkDeviceSize ringOffset;
+        CHECK(staging_ring_alloc(chunk, &ringOffset));
+        memcpy((uint8_t*) ring.allocation.map + ringOffset, (const uint8_t*) data + done, chunk);
+
+        VkBufferCopy copyRegion = {
+            .srcOffset = ringOffset,
+            .dstOffset = offset + done,
+            .size      = chunk,
+        };
+        vkCmdCopyBuffer(batches[currentBatch].commandBuffer, ring.buffer, buffer, 1, &copyRegion);
+        ++batches[currentBatch].copies;
+
+        done += chunk;
+    }
+    return true;
+}
+
+static void staging_image_barrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipLevels,
+    VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    bool toTransfer = newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+    VkImageMemoryBarrier barrier = {
+        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask       = toTransfer ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask       = toTransfer ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout           = oldLayout,
+        .newLayout           = newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image               = image,
+        .subresourceRange    = (VkImageSubresourceRange) {
+            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel   = 0,
+            .levelCount     = mipLevels,
+            .baseArrayLayer = 0,
+            .layerCount     = 1,
+        },
+    };
+
+    vkCmdPipelineBarrier(commandBuffer,
+        toTransfer ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+        toTransfer ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0, NULL,
+        0, NULL,
+        1, &barrier);
+}
+
+bool vulkan_staging_upload_image(const void* data, VkDeviceSize size, VkImage image, VkExtent3D extent,
+    uint32_t mipLevels, VkImageLayout finalLayout)
+{
+    CHECK(staging_begin_batch());
+    staging_image_barrier(batches[currentBatch].commandBuffer, image, mipLevels,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    // Split along depth for volumes and along rows for 2D images
+    uint32_t     rows     = extent.depth > 1 ? extent.depth : extent.height;
+    VkDeviceSize rowSize  = size / rows;
+    uint32_t     rowLimit = (uint32_t) ((ringSize / 2) / rowSize);
+    if (rowLimit == 0)
+    {
+        log_error("Staging image row of %llu bytes does not fit the ring", (unsigned long long) rowSize);
+        return false;
+    }
+
+    for (uint32_t row = 0; row < rows;)
+    {
+        uint32_t     count = rows - row < rowLimit ? rows - row : rowLimit;
+        VkDeviceSize chunk = count * rowSize;
+
+        VkDeviceSize ringOffset;
+        CHECK(staging_ring_alloc(chunk, &ringOffset));
+        memcpy((uint8_t*) ring.allocation.map + ringOffset, (const uint8_t*) data + row * rowSize, chunk);
+
+        bool volume = extent.depth > 1;
+        VkBufferImageCopy region = {
+            .bufferOffset      = ringOffset,
+            .bufferRowLength   = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource  = (VkImageSubresourceLayers) {
+                .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel       = 0,
+                .baseArrayLayer = 0,
+                .layerCount     = 1,
+            },
+            .imageOffset = { 0, volume ? 0 : (int32_t) row, volume ? (int32_t) row : 0 },
+            .imageExtent = (VkExtent3D) {
+                extent.width,
+                volume ? extent.height : count,
+                volume ? count : 1,
+            },
+        };
+
+        vkCmdCopyBufferToImage(batches[currentBatch].commandBuffer, ring.buffer, image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        ++batches[currentBatch].copies;
+
+        row += count;
+    }
+
+    // The image is used on the graphics queue, hand it over together with the final transition
+    return vulkan_queue_release_image(batches[currentBatch].commandBuffer, QUEUE_ASYNC, QUEUE_GRAPHICS, image,
+        mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout);
+}
+
+static bool staging_submit(bool detached, uint64_t* value)
+{
+    if (!recording)
+        return true;
+
+    StagingBatch* batch = &batches[currentBatch];
+    if (batch->copies == 0)
+    {
+        // Keep the open command buffer for the next uploads
+        if (value)
+            *value = vulkan_queue_submitted(QUEUE_ASYNC);
+        return true;
+    }
+
+    // Make the transfers visible to whatever is submitted next on the queue, and through the timeline to the other one
+    VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+    };
+
+    vkCmdPipelineBarrier(batch->commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
+
+    VKCHECK(vkEndCommandBuffer(batch->commandBuffer));
+
+    QueueSubmit submit = {
+        .detached = detached,
+    };
+    CHECK(vulkan_queue_submit(QUEUE_ASYNC, batch->commandBuffer, &submit, &batch->value));
+
+    if (value)
+        *value = batch->value;
+
+    batch->end     = ringHead;
+    batch->pending = true;
+    ++pendingBatches;
+
+    currentBatch = (currentBatch + 1) % STAGING_MAX_BATCHES;
+    recording = false;
+    return true;
+}
+
+bool vulkan_staging_submit()
+{
+    return staging_submit(false, NULL);
+}
+
+bool vulkan_staging_submit_detached(uint64_t* value)
+{
+    return staging_submit(true, value);
+}
+
+bool vulkan_staging_flush()
+{
+    CHECK(vulkan_staging_submit());
+
+    while (pendingBatches > 0)
+        CHECK(staging_retire_oldest(true));
+
+    return true;
+}
+
+bool vulkan_staging_update()
+{
+    while (pendingBatches > 0 && staging_retire_oldest(false));
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef STAGING_H_
+#define STAGING_H_
+
+#include "vulkan_base.h"
+
+/*
+ *  Persistent staging ring:
+ *  uploads are copied into one mapped host buffer and recorded into the open batch command buffer.
+ *  Batches run on the async queue, are submitted without waiting and retired through the async
+ *  timeline, ring space is reclaimed as batches retire. Every batch ends with a transfer -> all
+ *  commands barrier and uploaded images are released to the graphics queue.
+ */
+
+#define STAGING_RING_SIZE   (64ull * 1024 * 1024)
+#define STAGING_MAX_BATCHES 8
+
+bool vulkan_staging_init(VkDeviceSize size);
+
+void vulkan_staging_destroy();
+
+bool vulkan_staging_upload_buffer(const void* data, VkDeviceSize size, VkBuffer buffer, VkDeviceSize offset);
+
+// Transitions every mip from UNDEFINED to TRANSFER_DST, fills mip 0 and moves every mip to finalLayout
+bool vulkan_staging_upload_image(const void* data, VkDeviceSize size, VkImage image, VkExtent3D extent,
+    uint32_t mipLevels, VkImageLayout finalLayout);
+
+// Submits the open batch without waiting, the next graphics submission waits for it on the GPU
+bool vulkan_staging_submit();
+
+// Submits the open batch without making graphics wait for it, value is the async timeline value to poll
+bool vulkan_staging_submit_detached(uint64_t* value);
+
+// Submits the open batch and waits for every batch in flight
+bool vulkan_staging_flush();
+
+// Retires the batches the async queue completed, never blocks
+bool vulkan_staging_update();
+
+#endif // STAGING_H_
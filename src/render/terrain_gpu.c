@@ -0,0 +1,116 @@
+#include "terrain_gpu.h"
+
+#include "shader.h"
+
+#include <stdlib.h>
+
+extern VkDevice device;
+
+// Push constants of res/shaders/terrain/terrainGenerate.comp
+typedef struct {
+    VkDeviceAddress wordsAddress;
+    int32_t  originX, originY, originZ;
+    uint32_t width, height, depth;
+    uint32_t seed;
+    float    baseHeight;
+    float    amplitude;
+    float    frequency;
+    uint32_t octaves;
+    float    lacunarity;
+    float    gain;
+    float    invTotal;
+    float    caveFrequency;
+    float    caveRadius2;
+    float    caveMinDepth;
+    float    dirtDepth;
+    float    deepHeight;
+    float    bottom;
+} TerrainConstants;
+
+static VkPipelineLayout pipelineLayout;
+static VkPipeline       pipeline;
+
+bool terrain_gpu_init()
+{
+    return vulkan_shader_create_compute_pipeline("res/shaders/terrain/terrainGenerate.comp.spv",
+        sizeof(TerrainConstants), &pipelineLayout, &pipeline);
+}
+
+void terrain_gpu_destroy()
+{
+    vkDestroyPipeline(device, pipeline, NULL);
+    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+}
+
+void terrain_gpu_write(VkCommandBuffer commandBuffer, VkDeviceAddress words, const uint32_t gridSize[3], void* region)
+{
+    const TerrainRegion* terrainRegion = (const TerrainRegion*) region;
+    const Terrain*       terrain       = terrainRegion->terrain;
+
+    // Same float sum as terrain_fbm2, the division stays on the host
+    float amplitude = 1.0f, total = 0.0f;
+    for(uint32_t octave = 0; octave < terrain->octaves; ++octave)
+    {
+        total     += amplitude;
+        amplitude *= terrain->gain;
+    }
+
+    TerrainConstants constants = {
+        .wordsAddress  = words,
+        .originX       = terrainRegion->origin.x,
+        .originY       = terrainRegion->origin.y,
+        .originZ       = terrainRegion->origin.z,
+        .width         = terrainRegion->width,
+        .height        = terrainRegion->height,
+        .depth         = terrainRegion->depth,
+        .seed          = terrain->seed,
+        .baseHeight    = terrain->baseHeight,
+        .amplitude     = terrain->amplitude,
+        .frequency     = terrain->frequency,
+        .octaves       = terrain->octaves,
+        .lacunarity    = terrain->lacunarity,
+        .gain          = terrain->gain,
+        .invTotal      = 1.0f / total,
+        .caveFrequency = terrain->caveFrequency,
+        .caveRadius2   = terrain->caveRadius * terrain->caveRadius,
+        .caveMinDepth  = terrain->caveMinDepth,
+        .dirtDepth     = terrain->dirtDepth,
+        .deepHeight    = terrain->deepHeight,
+        .bottom        = terrain->bottom,
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, gridSize[0], gridSize[1], gridSize[2]);
+}
+
+bool terrain_gpu_create_volume(const TerrainRegion* region, VolumeBounds bounds, uint32_t* volumeIndex)
+{
+    return raytracing_create_device_volume(region->width, region->height, region->depth, bounds, terrain_gpu_write,
+        (void*) region, volumeIndex);
+}
+
+bool terrain_gpu_benchmark(uint32_t size)
+{
+    Terrain terrain;
+    terrain_init(&terrain, 1337);
+
+    // Around the surface, the grass, dirt and stone layers and the caves below them
+    TerrainRegion region = {
+        .terrain = &terrain,
+        .origin  = { -(int) size / 2, -(int) size / 2, (int) size },
+        .width   = size + 4,
+        .height  = size,
+        .depth   = size,
+    };
+
+    uint8_t* voxels = (uint8_t*) malloc((size_t) region.width * region.height * region.depth);
+    if(voxels == NULL)
+        return false;
+
+    bool result = terrain_generate(&terrain, region.origin, region.width, region.height, region.depth, voxels) &&
+        raytracing_benchmark_device_volume(region.width, region.height, region.depth, voxels, terrain_gpu_write, &region);
+
+    free(voxels);
+    return result;
+}
@@ -0,0 +1,37 @@
+#ifndef TERRAIN_GPU_H_
+#define TERRAIN_GPU_H_
+
+#include "vulkan_base.h"
+#include "raytracing.h"
+
+#include "world/terrain.h"
+
+/*
+ *  Compute shader port of world/terrain.c writing the voxels of a device volume, see
+ *  raytracing_create_device_volume: one workgroup per brick, the heights of its 8x8 columns
+ *  shared by the voxels above them. Every float operation of the shader is precise and the
+ *  fBm normalization is divided on the host, so the voxels match terrain_generate bit for bit
+ *  and device regions meet the host chunks without seams. Only the push constants cross
+ *  from the host.
+ */
+
+typedef struct {
+    const Terrain* terrain;
+    IVec3          origin; // World voxel of the first voxel
+    uint32_t       width, height, depth;
+} TerrainRegion;
+
+bool terrain_gpu_init();
+
+void terrain_gpu_destroy();
+
+// VolumeWriter of a TerrainRegion
+void terrain_gpu_write(VkCommandBuffer commandBuffer, VkDeviceAddress words, const uint32_t gridSize[3], void* region);
+
+// Brickmap volume of the region generated on the device, its voxels never exist on the host
+bool terrain_gpu_create_volume(const TerrainRegion* region, VolumeBounds bounds, uint32_t* volumeIndex);
+
+// A surface region of size^3 voxels, partial bricks on x, generated on the device against terrain_generate
+bool terrain_gpu_benchmark(uint32_t size);
+
+#endif // TERRAIN_GPU_H_
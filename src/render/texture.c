@@ -1,4 +1,5 @@
 #include "texture.h"
+#include "staging.h"
 
 #include <stb_image.h>
 
@@ -23,31 +24,22 @@ bool vulkan_create_texture_image(const char* filepath, VkCommandPool commandPool
 
     texture->mipLevels = mipmaps ? (uint32_t) floorf(log2f(fmaxf(texWidth, texHeight))) + 1 : 1;
 
-    BufferData stagingBuffer;
-    if(!vulkan_create_buffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, &stagingBuffer.buffer, &stagingBuffer.memory))
-        return false;
-
-    void* data;
-    vkMapMemory(device, stagingBuffer.memory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, (size_t) imageSize);
-    vkUnmapMemory(device, stagingBuffer.memory);
-
-    stbi_image_free(pixels);
-
     if(!vulkan_create_image(texWidth, texHeight, texture->mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture->image))
+    {
+        stbi_image_free(pixels);
         return false;
+    }
 
-    if(!vulkan_transition_image_layout(commandPool, texture->image.image,
-        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture->mipLevels))
-        return false;
-    
-    if(!vulkan_copy_buffer_to_image(commandPool, stagingBuffer.buffer, texture->image.image, (uint32_t) texWidth, (uint32_t) texHeight))
+    bool uploaded = vulkan_staging_upload_image(pixels, imageSize, texture->image.image,
+        (VkExtent3D) { (uint32_t) texWidth, (uint32_t) texHeight, 1 }, texture->mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    stbi_image_free(pixels);
+
+    // Mip chain is blitted from level 0, the upload has to be on the queue first
+    if(!uploaded || !vulkan_staging_submit())
         return false;
-    
-    DeleteBuffer(stagingBuffer);
 
     if(!vulkan_generate_mipmaps(commandPool, texture->image.image, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture->mipLevels))
         return false;
@@ -55,30 +47,12 @@ bool vulkan_create_texture_image(const char* filepath, VkCommandPool commandPool
     return true;
 }
 
-bool vulkan_upload_texture_buffer_3d(void* data, uint32_t width, uint32_t height, uint32_t depth,
-    VkCommandPool commandPool, Texture* texture)
+bool vulkan_upload_texture_buffer_3d(void* data, uint32_t width, uint32_t height, uint32_t depth, Texture* texture)
 {
     size_t size = width * height * depth;
 
-    BufferData stagingBuffer;
-    if(!vulkan_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, &stagingBuffer.buffer, &stagingBuffer.memory))
-        return false;
-    
-    void* stagingData;
-    vkMapMemory(device, stagingBuffer.memory, 0, size, 0, &stagingData);
-    memcpy(stagingData, data, size);
-    vkUnmapMemory(device, stagingBuffer.memory);
-    
-    if(!vulkan_transition_image_layout(commandPool, texture->image.image,
-        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture->mipLevels))
-        return false;
-    
-    if(!vulkan_copy_buffer_to_image_3d(commandPool, stagingBuffer.buffer, texture->image.image, width, height, depth))
-        return false;
-    
-    DeleteBuffer(stagingBuffer);
-    return true;
+    return vulkan_staging_upload_image(data, size, texture->image.image, (VkExtent3D) { width, height, depth },
+        texture->mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 }
 
 bool vulkan_create_texture_image_view(Texture* texture)
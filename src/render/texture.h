@@ -21,8 +21,7 @@ typedef struct {
 bool vulkan_create_texture_image(const char* filepath, VkCommandPool commandPool,
     VkImageUsageFlags usage, bool mipmaps, Texture* texture);
 
-bool vulkan_upload_texture_buffer_3d(void* data, uint32_t width, uint32_t height, uint32_t depth,
-    VkCommandPool commandPool, Texture* texture);
+bool vulkan_upload_texture_buffer_3d(void* data, uint32_t width, uint32_t height, uint32_t depth, Texture* texture);
 
 bool vulkan_create_texture_image_view(Texture* texture);
 
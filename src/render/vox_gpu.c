@@ -0,0 +1,51 @@
+#include "vox_gpu.h"
+
+#include "core/core.h"
+
+#include <stdlib.h>
+
+bool vox_gpu_create_scene(const VoxScene* scene, float scale, Vec3 position, VolumeBackend backend,
+    VolumeBounds bounds)
+{
+    uint32_t* volumeIndices = (uint32_t*) malloc((scene->models.count + 1) * sizeof(uint32_t));
+    CHECK(volumeIndices != NULL);
+
+    for(size_t m = 0; m < scene->models.count; ++m)
+        volumeIndices[m] = UINT32_MAX;
+
+    bool result = true;
+    for(size_t i = 0; i < scene->instances.count && result; ++i)
+    {
+        const VoxInstance* instance = &scene->instances.items[i];
+        const VoxModel*    model    = &scene->models.items[instance->model];
+        if(model->voxelCount == 0)
+            continue;
+
+        // Volumes of the models on their first instance
+        uint32_t* volumeIndex = &volumeIndices[instance->model];
+        if(*volumeIndex == UINT32_MAX)
+        {
+            result = raytracing_create_volume(model->width, model->height, model->depth, model->voxels, backend,
+                bounds, volumeIndex) && raytracing_set_volume_colors(*volumeIndex, model->colors, model->colorCount);
+            if(!result)
+                break;
+        }
+
+        VkTransformMatrixKHR transform;
+        for(uint32_t r = 0; r < 3; ++r)
+            for(uint32_t c = 0; c < 4; ++c)
+                transform.matrix[r][c] = instance->transform[r][c] * scale;
+
+        transform.matrix[0][3] += position.x;
+        transform.matrix[1][3] += position.y;
+        transform.matrix[2][3] += position.z;
+
+        raytracing_add_volume_instance(*volumeIndex, &transform);
+    }
+
+    if(result)
+        log_trace("Vox scene: %zu models, %zu instances", scene->models.count, scene->instances.count);
+
+    free(volumeIndices);
+    return result;
+}
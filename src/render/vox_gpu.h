@@ -0,0 +1,20 @@
+#ifndef VOX_GPU_H_
+#define VOX_GPU_H_
+
+#include "raytracing.h"
+
+#include "voxel/vox.h"
+
+#include "core/vec.h"
+
+/*
+ *  Raytracing volumes of a MagicaVoxel scene, see voxel/vox.h: one volume per model shaded
+ *  by the colors of its palette, one instance per instance of the scene graph. Models no
+ *  instance uses are skipped, empty ones too.
+ */
+
+// Instances scaled by scale then moved to position, in world units
+bool vox_gpu_create_scene(const VoxScene* scene, float scale, Vec3 position, VolumeBackend backend,
+    VolumeBounds bounds);
+
+#endif // VOX_GPU_H_
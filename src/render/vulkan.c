@@ -2,6 +2,7 @@
 
 #include "core/list_types.h"
 #include "core/filesystem.h"
+#include "core/obj.h"
 #include "core/window.h"
 #include "core/camera.h"
 #include "core/timer.h"
@@ -9,12 +10,23 @@
 #include "core/list.h"
 #include "core/vec.h"
 
+#include "voxel/vox.h"
+
+#include "world/world.h"
+#include "world/stream.h"
+#include "world/terrain.h"
+
 #include "vulkan_base.h"
 #include "raytracing.h"
+#include "terrain_gpu.h"
+#include "vox_gpu.h"
 #include "texture.h"
 #include "buffer.h"
 #include "shader.h"
 #include "image.h"
+#include "vulkan_memory.h"
+#include "staging.h"
+#include "vulkan_queue.h"
 
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
@@ -32,15 +44,13 @@ extern VkQueue graphicsQueue, presentQueue;
 typedef struct {
     uint32_t graphicsFamily;
     uint32_t presentFamily;
-} QueueFamilyIndices;
 
-typedef struct {
-    Vec4 position;
-    Vec4 color;
-    Vec2 texCoord;
+    // Uploads and acceleration structure builds, asyncIndex is 1 when it shares the graphics family
+    uint32_t asyncFamily;
+    uint32_t asyncIndex;
+} QueueFamilyIndices;
 
-    Vec2 padding;
-} Vertex;
+typedef ObjVertex Vertex;
 
 LIST_DEFINE(const char*, Extensions);
 LIST_DEFINE(VkSurfaceFormatKHR, SurfaceFormatKHRs);
@@ -75,57 +85,7 @@ const char* deviceExensions[] = {
     VK_KHR_RAY_TRACING_POSITION_FETCH_EXTENSION_NAME,
     VK_KHR_16BIT_STORAGE_EXTENSION_NAME,
     VK_KHR_8BIT_STORAGE_EXTENSION_NAME,
-};
-
-#define MAX_FRAMES_IN_FLIGHT 2
-
-const Vertex vertices[] = {
-    (Vertex) {
-        .position = { -0.5f, -0.5f, 0.0f, 1.0f },
-        .color    = { 1.0f, 0.0f, 0.0f, 1.0f },
-        .texCoord = { 1.0f, 0.0f },
-    },
-    (Vertex) {
-        .position = { 0.5f, -0.5f, 0.0f, 1.0f },
-        .color    = { 0.0f, 1.0f, 0.0f, 1.0f },
-        .texCoord = { 0.0f, 0.0f },
-    },
-    (Vertex) {
-        .position = { 0.5f, 0.5f, 0.0f, 1.0f },
-        .color    = { 0.0f, 0.0f, 1.0f, 1.0f },
-        .texCoord = { 0.0f, 1.0f },
-    },
-    (Vertex) {
-        .position = { -0.5f, 0.5f, 0.0f, 1.0f },
-        .color    = { 1.0f, 1.0f, 1.0f, 1.0f },
-        .texCoord = { 1.0f, 1.0f },
-    },
-
-    (Vertex) {
-        .position = { -0.5f, -0.5f, 0.5f, 1.0f },
-        .color    = { 1.0f, 0.0f, 0.0f, 1.0f },
-        .texCoord = { 1.0f, 0.0f },
-    },
-    (Vertex) {
-        .position = { 0.5f, -0.5f, 0.5f, 1.0f },
-        .color    = { 0.0f, 1.0f, 0.0f, 1.0f },
-        .texCoord = { 0.0f, 0.0f },
-    },
-    (Vertex) {
-        .position = { 0.5f, 0.5f, 0.5f, 1.0f },
-        .color    = { 0.0f, 0.0f, 1.0f, 1.0f },
-        .texCoord = { 0.0f, 1.0f },
-    },
-    (Vertex) {
-        .position = { -0.5f, 0.5f, 0.5f, 1.0f },
-        .color    = { 1.0f, 1.0f, 1.0f, 1.0f },
-        .texCoord = { 1.0f, 1.0f },
-    },
-};
-
-static uint32_t indices[] = {
-    0, 1, 2, 2, 3, 0,
-    4, 5, 6, 6, 7, 4,
+    VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
 };
 
 typedef struct {
@@ -170,6 +130,8 @@ static Texture texture;
 
 static BufferData vertexBuffer;
 static BufferData indexBuffer;
+static uint32_t vertexCount;
+static uint32_t indexCount;
 
 static MappedBufferDatas uniformBuffers = {0};
 
@@ -190,6 +152,10 @@ static bool framebufferResized = false;
 
 static BufferData aabbBuffer;
 
+static World world;
+static WorldStream worldStream;
+static Terrain terrain;
+
 static VkVertexInputBindingDescription vulkan_get_vertex_binding_description()
 {
     return (VkVertexInputBindingDescription) {
@@ -446,7 +412,7 @@ static bool vulkan_find_queue_families(VkPhysicalDevice device, QueueFamilyIndic
 
     bool hasGraphicsFamily = false, hasPresentFamily = false;
 
-    for(size_t i = 0; i < queueFamilyProperties.count; ++i)
+    for(size_t i = 0; i < queueFamilyProperties.count && !(hasGraphicsFamily && hasPresentFamily); ++i)
     {
         VkQueueFamilyProperties* queueFamily = &queueFamilyProperties.items[i];
         if (queueFamily->queueFlags & VK_QUEUE_GRAPHICS_BIT)
@@ -463,12 +429,33 @@ static bool vulkan_find_queue_families(VkPhysicalDevice device, QueueFamilyIndic
             queueFamilyIndices->presentFamily = i;
             hasPresentFamily = true;
         }
+    }
 
-        if(hasGraphicsFamily && hasPresentFamily)
-            return true;
+    if(!hasGraphicsFamily || !hasPresentFamily)
+    {
+        list_destroy(queueFamilyProperties);
+        return false;
     }
-    
-    return false;
+
+    // Async work builds acceleration structures so it needs compute, a family without graphics runs beside rendering.
+    // Otherwise take a second graphics queue and, as a last resort, share the graphics queue itself
+    uint32_t graphicsFamily = queueFamilyIndices->graphicsFamily;
+    queueFamilyIndices->asyncFamily = graphicsFamily;
+    queueFamilyIndices->asyncIndex  = queueFamilyProperties.items[graphicsFamily].queueCount > 1 ? 1 : 0;
+
+    for(size_t i = 0; i < queueFamilyProperties.count; ++i)
+    {
+        VkQueueFlags flags = queueFamilyProperties.items[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            queueFamilyIndices->asyncFamily = i;
+            queueFamilyIndices->asyncIndex  = 0;
+            break;
+        }
+    }
+
+    list_destroy(queueFamilyProperties);
+    return true;
 }
 
 static bool vulkan_check_device_extension_support(VkPhysicalDevice device)
@@ -659,21 +646,31 @@ static bool vulkan_create_logical_device()
 
     list_append_unique(queueFamiliesSet, queueFanilyIndices.graphicsFamily);
     list_append_unique(queueFamiliesSet, queueFanilyIndices.presentFamily);
+    list_append_unique(queueFamiliesSet, queueFanilyIndices.asyncFamily);
 
-    const float queuePriority = 1.0f;
+    // Rendering keeps priority over streaming when both share a family
+    const float queuePriorities[] = { 1.0f, 0.5f };
     for(size_t i = 0; i < queueFamiliesSet.count; ++i)
     {
+        uint32_t family = queueFamiliesSet.items[i];
+
         VkDeviceQueueCreateInfo queueCreateInfo = {
             .sType            = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = queueFamiliesSet.items[i],
-            .queueCount       = 1,
-            .pQueuePriorities = &queuePriority,
+            .queueFamilyIndex = family,
+            .queueCount       = family == queueFanilyIndices.asyncFamily ? queueFanilyIndices.asyncIndex + 1 : 1,
+            .pQueuePriorities = queuePriorities,
         };
         list_append(queueCreateInfos, queueCreateInfo);
     }
     
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {
+        .sType             = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        .timelineSemaphore = VK_TRUE,
+    };
+
     VkPhysicalDeviceRayTracingPositionFetchFeaturesKHR positionFetchFeatures = {
         .sType                   = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_POSITION_FETCH_FEATURES_KHR,
+        .pNext                   = &timelineSemaphoreFeatures,
         .rayTracingPositionFetch = VK_TRUE,
     };
 
@@ -732,7 +729,9 @@ static bool vulkan_create_logical_device()
 
     vkGetDeviceQueue(device, queueFanilyIndices.graphicsFamily, 0, &graphicsQueue);
     vkGetDeviceQueue(device, queueFanilyIndices.presentFamily, 0, &presentQueue);
-    return true;
+
+    return vulkan_queue_init(queueFanilyIndices.graphicsFamily, queueFanilyIndices.asyncFamily,
+        queueFanilyIndices.asyncIndex);
 }
 
 static VkSurfaceFormatKHR vulkan_choose_swap_surface_format(const SurfaceFormatKHRs* availableFormats)
@@ -1161,6 +1160,38 @@ static bool vulkan_create_command_pool()
     return true;
 }
 
+// Vertex and index buffers of the mesh, sized to it, read by the raster pipeline and the triangle BLAS
+static bool vulkan_create_mesh_buffers(const char* filepath)
+{
+    char timeStr[64];
+    Timer t;
+
+    timer_start(&t);
+
+    ObjMesh mesh;
+    CHECK(obj_load(filepath, &mesh));
+
+    timer_stop(&t);
+    time_to_str(timeStr, timer_get_ns(&t));
+    log_trace("Loaded %s, %u vertices and %u triangles, in %s", filepath, mesh.vertexCount, mesh.indexCount / 3,
+        timeStr);
+
+    bool result = vulkan_create_data_buffer(mesh.vertices, (VkDeviceSize) mesh.vertexCount * sizeof(Vertex),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &vertexBuffer.buffer, &vertexBuffer.allocation) &&
+        vulkan_create_data_buffer(mesh.indices, (VkDeviceSize) mesh.indexCount * sizeof(uint32_t),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &indexBuffer.buffer, &indexBuffer.allocation);
+
+    vertexCount = mesh.vertexCount;
+    indexCount  = mesh.indexCount;
+
+    obj_destroy(&mesh);
+    return result;
+}
+
 static bool vulkan_create_uniform_buffers()
 {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
@@ -1170,11 +1201,11 @@ static bool vulkan_create_uniform_buffers()
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
     {
-        vulkan_create_buffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        CHECK(vulkan_create_buffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0,
-            &uniformBuffers.items[i].buffer, &uniformBuffers.items[i].memory);
+            &uniformBuffers.items[i].buffer, &uniformBuffers.items[i].allocation));
         
-        VKCHECK(vkMapMemory(device, uniformBuffers.items[i].memory, 0, bufferSize, 0, (void**)&uniformBuffers.items[i].map));
+        uniformBuffers.items[i].map = uniformBuffers.items[i].allocation.map;
     }
     return true;
 }
@@ -1335,9 +1366,50 @@ static bool vulkan_create_sync_objects()
     return true;
 }
 
+// Procedural terrain under the scene, streamed in around the camera by the jobs of worldStream
+static bool vulkan_create_world()
+{
+    CHECK(world_create(&world, 0.2f, VOLUME_BACKEND_BRICKMAP, VOLUME_BOUNDS_BRICKS));
+
+    terrain_init(&terrain, 1337);
+    terrain.baseHeight = -40.0f;
+    terrain.deepHeight = -88.0f;
+    terrain.bottom     = -136.0f;
+
+    StreamSettings settings = {
+        .loadRadius    = 4.0f,
+        .evictRadius   = 6.0f,
+        .memoryBudget  = (size_t) 256 << 20,
+        .frameBudgetNs = ms_to_ns(2.0),
+        .generate      = terrain_generate_chunk,
+        .user          = &terrain,
+    };
+    CHECK(stream_create(&worldStream, &world, &settings));
+
+    return true;
+}
+
+// MagicaVoxel scene above the world, when there is one
+static bool vulkan_create_vox_scene()
+{
+    const char* filepath = "res/voxels/scene.vox";
+    if(!file_exists(filepath))
+        return true;
+
+    VoxScene scene;
+    CHECK(vox_load(filepath, &scene));
+
+    bool created = vox_gpu_create_scene(&scene, 0.2f, (Vec3) { 0.0f, 16.0f, 0.0f }, VOLUME_BACKEND_BRICKMAP,
+        VOLUME_BOUNDS_BRICKS);
+
+    vox_destroy(&scene);
+    return created;
+}
+
 static bool vulkan_create_raytracing()
 {
     CHECK(raytracing_init());
+    CHECK(terrain_gpu_init());
     
     char tempStr[1024];
     Timer t;
@@ -1354,7 +1426,8 @@ static bool vulkan_create_raytracing()
                     for(uint32_t x = 0; x < width; ++x)
                         volumeData[x + y * width + z * (width * height)] = 5;
 
-            CHECK(raytracing_add_volume_geometry(commandPool, width, height, depth, volumeData));
+            CHECK(raytracing_add_volume_geometry(width, height, depth, volumeData,
+                VOLUME_BACKEND_BRICKMAP, VOLUME_BOUNDS_BRICKS));
         }
         {
             uint32_t width = 1, height = 32, depth = 32;
@@ -1365,7 +1438,8 @@ static bool vulkan_create_raytracing()
                     for(uint32_t x = 0; x < width; ++x)
                         volumeData[x + y * width + z * (width * height)] = 6;
 
-            CHECK(raytracing_add_volume_geometry(commandPool, width, height, depth, volumeData));
+            CHECK(raytracing_add_volume_geometry(width, height, depth, volumeData,
+                VOLUME_BACKEND_BRICKMAP, VOLUME_BOUNDS_BRICKS));
         }
         {
             uint32_t width = 32, height = 1, depth = 32;
@@ -1376,7 +1450,8 @@ static bool vulkan_create_raytracing()
                     for(uint32_t x = 0; x < width; ++x)
                         volumeData[x + y * width + z * (width * height)] = 7;
 
-            CHECK(raytracing_add_volume_geometry(commandPool, width, height, depth, volumeData));
+            CHECK(raytracing_add_volume_geometry(width, height, depth, volumeData,
+                VOLUME_BACKEND_BRICKMAP, VOLUME_BOUNDS_BRICKS));
         }
         {
             uint32_t width = 32, height = 32, depth = 1;
@@ -1387,7 +1462,8 @@ static bool vulkan_create_raytracing()
                     for(uint32_t x = 0; x < width; ++x)
                         volumeData[x + y * width + z * (width * height)] = 1;
 
-            CHECK(raytracing_add_volume_geometry(commandPool, width, height, depth, volumeData));
+            CHECK(raytracing_add_volume_geometry(width, height, depth, volumeData,
+                VOLUME_BACKEND_DAG, VOLUME_BOUNDS_SINGLE));
         }
         {
             uint32_t width = 8, height = 8, depth = 8;
@@ -1401,29 +1477,43 @@ static bool vulkan_create_raytracing()
                         volumeData[i] = (i % 3) + 2;
                     }
 
-            CHECK(raytracing_add_volume_geometry(commandPool, width, height, depth, volumeData));
+            CHECK(raytracing_add_volume_geometry(width, height, depth, volumeData,
+                VOLUME_BACKEND_SVO, VOLUME_BOUNDS_SINGLE));
         }
 
         raytracing_add_triangle_geometry(vertexBuffer.buffer, indexBuffer.buffer,
-            ARRAYLEN(vertices), sizeof(Vertex), ARRAYLEN(indices));
+            vertexCount, sizeof(Vertex), indexCount);
 
         timer_stop(&t);
         time_to_str(tempStr, timer_get_ns(&t));
         log_trace("Raytracing added geometries in %s", tempStr);
+
+        raytracing_log_intersection_estimate(swapChainExtent.width, swapChainExtent.height);
     }
 
-    CHECK(raytracing_create_geometries_address_buffer(commandPool));
+    CHECK(raytracing_create_geometries_address_buffer());
+
+#if defined(VKBENCHMARK)
+    // The checks without a device run from the --test argument, see main.c
+    CHECK(raytracing_benchmark_bottom_layer());
+
+    // The same terrain generated into a device volume, its brickmap against the host one
+    CHECK(terrain_gpu_benchmark(64));
+#endif
 
     {
         timer_start(&t);
 
-        CHECK(raytracing_create_bottom_layer(commandPool));
+        CHECK(raytracing_create_bottom_layer(true));
 
         timer_stop(&t);
         time_to_str(tempStr, timer_get_ns(&t));
         log_trace("Raytracing building bottom layer in %s", tempStr);
     }
 
+    CHECK(vulkan_create_world());
+    CHECK(vulkan_create_vox_scene());
+
     {
         Mat4 transform;
         VkTransformMatrixKHR outTransform;
@@ -1556,21 +1646,20 @@ static bool vulkan_create_raytracing()
                 }
         }
 
-        Vec3 pos;
+        {
+            // The room is modeled z up, turned to y up
+            float roomScale = 4.0f;
 
-        float size = 1;
-        for(pos.z = 0; pos.z < size; ++pos.z)
-            for(pos.y = 0; pos.y > -size; --pos.y)
-                for(pos.x = 0; pos.x < size; ++pos.x)
-                {
-                    mat4_identity(&transform);
-                    mat4_translate(&transform, &pos, &transform);
-                    
-                    mat4_to_vk_transform(&transform, &outTransform);
+            transform.r0 = (Vec4) { roomScale, 0.0f, 0.0f, 0.0f };
+            transform.r1 = (Vec4) { 0.0f, 0.0f, -roomScale, 0.0f };
+            transform.r2 = (Vec4) { 0.0f, roomScale, 0.0f, 0.0f };
+            transform.r3 = (Vec4) { 0.0f, 0.0f, 0.0f, 1.0f };
 
-                    raytracing_add_triangle_instance(5, &outTransform);
-                    ++instances;
-                }
+            mat4_to_vk_transform(&transform, &outTransform);
+
+            raytracing_add_triangle_instance(5, &outTransform);
+            ++instances;
+        }
 
         log_trace("Raytracing added instances: %zu", instances);
     }
@@ -1588,6 +1677,8 @@ static bool vulkan_create_raytracing()
     CHECK(raytracing_create_descriptors(viewportImages, &texture));
     CHECK(raytracing_create_pipeline(globalUBODescriptorSetLayout));
     CHECK(raytracing_create_shader_binding_table());
+
+    vulkan_memory_report();
     return true;
 }
 
@@ -1598,6 +1689,7 @@ bool vulkan_init(const char* title)
     CHECK(vulkan_create_surface());
     CHECK(vulkan_pick_physical_device());
     CHECK(vulkan_create_logical_device());
+    CHECK(vulkan_memory_init());
     CHECK(vulkan_create_swap_chain());
     CHECK(vulkan_create_image_views());
 
@@ -1621,6 +1713,7 @@ bool vulkan_init(const char* title)
     }
 
     CHECK(vulkan_create_command_pool());
+    CHECK(vulkan_staging_init(STAGING_RING_SIZE));
 
     CHECK(vulkan_create_viewport_image(commandPool));
     CHECK(vulkan_create_viewport_image_views());
@@ -1629,19 +1722,11 @@ bool vulkan_init(const char* title)
     CHECK(vulkan_create_depth_resources());
     CHECK(vulkan_create_framebuffers());
 
-    CHECK(vulkan_create_texture_image("res/textures/texture.jpg", commandPool, VK_IMAGE_USAGE_SAMPLED_BIT, true, &texture));
+    CHECK(vulkan_create_texture_image("res/textures/viking_room.png", commandPool, VK_IMAGE_USAGE_SAMPLED_BIT, true, &texture));
     CHECK(vulkan_create_texture_image_view(&texture));
     CHECK(vulkan_create_texture_sampler(&texture));
 
-    CHECK(vulkan_create_data_buffer(commandPool, vertices, sizeof(vertices),
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &vertexBuffer.buffer, &vertexBuffer.memory));
-
-    CHECK(vulkan_create_data_buffer(commandPool, indices, sizeof(indices),
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, &indexBuffer.buffer, &indexBuffer.memory));
+    CHECK(vulkan_create_mesh_buffers("res/objects/viking_room.obj"));
 
     CHECK(vulkan_create_uniform_buffers());
 
@@ -1707,7 +1792,10 @@ void vulkan_destroy()
 {
     vkDeviceWaitIdle(device);
 
+    stream_destroy(&worldStream);
+    terrain_gpu_destroy();
     raytracing_destroy();
+    world_destroy(&world);
 
     DeleteBuffer(aabbBuffer);
 
@@ -1738,7 +1826,13 @@ void vulkan_destroy()
         vkDestroyFence(device, inFlightFences.items[i], NULL);
     }
     
+    vulkan_staging_destroy();
+
     vkDestroyCommandPool(device, commandPool, NULL);
+
+    vulkan_queue_destroy();
+
+    vulkan_memory_destroy();
     
     vkDestroyDevice(device, NULL);
     
@@ -1761,6 +1855,8 @@ static bool vulkan_record_command_buffer(VkCommandBuffer commandBuffer, uint32_t
 
     VKCHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+    vulkan_queue_record_acquires(QUEUE_GRAPHICS, commandBuffer);
+
     /*
     VkClearValue clearColor[] = {
         [0] = (VkClearValue) {
@@ -1817,7 +1913,7 @@ static bool vulkan_record_command_buffer(VkCommandBuffer commandBuffer, uint32_t
 
         vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UIN32);
 
-        vkCmdDrawIndexed(commandBuffer, ARRAYLEN(indices), 1, 0, 0, 0);
+        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
     }
     vkCmdEndRenderPass(commandBuffer);
     */
@@ -1854,6 +1950,8 @@ static bool vulkan_record_command_buffer(VkCommandBuffer commandBuffer, uint32_t
             0, NULL,
             1, &barrier);
 
+        CHECK(raytracing_update_top_layer(commandBuffer, currentFrame));
+
         raytracer_render(commandBuffer, currentFrame,
             swapChainExtent.width, swapChainExtent.height, globalUBODescriptorSets.items[currentFrame]);
         
@@ -1974,28 +2072,38 @@ bool vulkan_draw_frame()
 
     VKCHECK(vkResetFences(device, 1, &inFlightFences.items[currentFrame]));
 
+    // Chunks around the camera, their volumes queue their uploads before the staging submit below
+    const Mat4* invView = &camera_get_data()->invView;
+    Vec3 cameraPosition  = {  invView->r3.x,  invView->r3.y,  invView->r3.z };
+    Vec3 cameraDirection = { -invView->r2.x, -invView->r2.y, -invView->r2.z };
+    stream_update(&worldStream, &cameraPosition, &cameraDirection);
+
+    // Uploads queued since the last frame go to the async queue ahead of it, finished batches give back ring space.
+    // Submitted before recording so the frame acquires the images they release
+    CHECK(vulkan_staging_update());
+    CHECK(vulkan_staging_submit());
+
     VKCHECK(vkResetCommandBuffer(commandBuffers.items[currentFrame], 0));
     CHECK(vulkan_record_command_buffer(commandBuffers.items[currentFrame], imageIndex));
     
-    VkSemaphore waitSemaphores[] = { imageAvailableSemaphores.items[currentFrame] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    QueueWait waits[] = {
+        { imageAvailableSemaphores.items[currentFrame], 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT },
+    };
 
     VkSemaphore signalSemaphores[] = { renderFinishedSemaphores.items[currentFrame] };
 
     vulkan_update_uniform_buffer(currentFrame);
 
-    VkSubmitInfo submitInfo = {
-        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount   = 1,
-        .pWaitSemaphores      = waitSemaphores,
-        .pWaitDstStageMask    = waitStages,
-        .commandBufferCount   = 1,
-        .pCommandBuffers      = &commandBuffers.items[currentFrame],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores    = signalSemaphores,
+    // Also waits on the async timeline for the uploads above, detached streaming work is not waited on
+    QueueSubmit submit = {
+        .waits       = waits,
+        .waitCount   = ARRAYLEN(waits),
+        .signals     = signalSemaphores,
+        .signalCount = ARRAYLEN(signalSemaphores),
+        .fence       = inFlightFences.items[currentFrame],
     };
-    
-    VKCHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences.items[currentFrame]));
+
+    CHECK(vulkan_queue_submit(QUEUE_GRAPHICS, commandBuffers.items[currentFrame], &submit, NULL));
 
     VkSwapchainKHR swapChains[] = { swapChain };
 
@@ -1,10 +1,9 @@
 #include "vulkan_base.h"
+#include "vulkan_queue.h"
 
 extern VkDevice device;
 extern VkPhysicalDevice physicalDevice;
 
-extern VkQueue graphicsQueue;
-
 uint32_t vulkan_find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
     VkPhysicalDeviceMemoryProperties memProperties;
@@ -15,8 +14,8 @@ uint32_t vulkan_find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags prop
             (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
             return i;
     
-    ASSERT_MSG(false, "Vulkan failed to find suitable memory type!");
-    return -1;
+    log_error("Vulkan no memory type of bits 0x%x with properties 0x%x", typeFilter, properties);
+    return UINT32_MAX;
 }
 
 bool vulkan_begin_single_time_commands(VkCommandPool commandPool, VkCommandBuffer* commandBuffer)
@@ -36,6 +35,9 @@ bool vulkan_begin_single_time_commands(VkCommandPool commandPool, VkCommandBuffe
     };
 
     VKCHECK(vkBeginCommandBuffer(*commandBuffer, &beginInfo));
+
+    // commandPool is always a graphics pool, images handed over by the async queue are taken here
+    vulkan_queue_record_acquires(QUEUE_GRAPHICS, *commandBuffer);
     return true;
 }
 
@@ -43,14 +45,10 @@ bool vulkan_end_single_time_commands(VkCommandPool commandPool, VkCommandBuffer
 {
     VKCHECK(vkEndCommandBuffer(commandBuffer));
 
-    VkSubmitInfo submitInfo = {
-        .sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers    = &commandBuffer,
-    };
-
-    VKCHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
-    VKCHECK(vkQueueWaitIdle(graphicsQueue));
+    // Waits on the graphics timeline, async work in flight is not drained
+    uint64_t value;
+    CHECK(vulkan_queue_submit(QUEUE_GRAPHICS, commandBuffer, NULL, &value));
+    CHECK(vulkan_queue_wait(QUEUE_GRAPHICS, value));
 
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     return true;
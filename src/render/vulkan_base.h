@@ -7,6 +7,8 @@
 
 #include <stdbool.h>
 
+#define MAX_FRAMES_IN_FLIGHT 2
+
 #if defined(VKDEBUG)
 
     #define VKCHECK(x) { VkResult res = (x); if (res != VK_SUCCESS) { log_error("Vulkan vkcheck error " #x ": %d", *(int*)&res); return false; } }
@@ -27,6 +29,7 @@
         }                                                                         \
     }
 
+// UINT32_MAX when no type of typeFilter has every property
 uint32_t vulkan_find_memory_type(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 bool vulkan_begin_single_time_commands(VkCommandPool commandPool, VkCommandBuffer* commandBuffer);
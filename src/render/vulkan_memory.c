@@ -0,0 +1,200 @@
+#include "vulkan_memory.h"
+
+extern VkPhysicalDevice physicalDevice;
+extern VkDevice device;
+
+#define VULKAN_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+
+static const char* categoryNames[MEMORY_CATEGORY_COUNT] = {
+    "BLAS", "TLAS", "Scratch", "Instances", "SBT", "Geometry",
+};
+
+static bool unifiedMemory = false;
+
+static VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT] = {0};
+
+static VkPhysicalDeviceMemoryProperties memoryProperties;
+static Allocator allocator;
+
+static bool vulkan_memory_device_allocate(void* user, uint32_t memoryTypeIndex, VkMemoryAllocateFlags flags,
+    VkDeviceSize size, VkDeviceMemory* memory, void** map)
+{
+    UNUSED(user);
+
+    VkMemoryAllocateFlagsInfoKHR flagsInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR,
+        .flags = flags,
+    };
+
+    VkMemoryAllocateInfo allocInfo = {
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = flags ? &flagsInfo : 0,
+        .allocationSize  = size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+
+    VKCHECK(vkAllocateMemory(device, &allocInfo, NULL, memory));
+
+    // Host visible blocks stay mapped for their whole lifetime, allocations hand out pointers into them
+    *map = NULL;
+    if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        VkResult result = vkMapMemory(device, *memory, 0, VK_WHOLE_SIZE, 0, map);
+        if (result != VK_SUCCESS)
+        {
+            log_error("Vulkan failed to map a memory block: %d", result);
+            vkFreeMemory(device, *memory, NULL);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static void vulkan_memory_device_free(void* user, VkDeviceMemory memory, void* map)
+{
+    UNUSED(user);
+
+    if (map)
+        vkUnmapMemory(device, memory);
+    
+    vkFreeMemory(device, memory, NULL);
+}
+
+static bool vulkan_memory_has_type(const VkPhysicalDeviceMemoryProperties* memProperties, VkMemoryPropertyFlags properties)
+{
+    for (uint32_t i = 0; i < memProperties->memoryTypeCount; i++)
+        if ((memProperties->memoryTypes[i].propertyFlags & properties) == properties)
+            return true;
+    return false;
+}
+
+bool vulkan_memory_init()
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    // Only integrated/cpu devices share the heap with the host, a small host visible
+    // device local window on a discrete GPU (BAR) is not worth spending on static data
+    bool integrated = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+                      properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+
+    unifiedMemory = integrated && vulkan_memory_has_type(&memoryProperties,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+        categoryBytes[i] = 0;
+
+    AllocatorDevice allocatorDevice = {
+        .allocate = vulkan_memory_device_allocate,
+        .free     = vulkan_memory_device_free,
+    };
+    CHECK(allocator_create(&allocatorDevice, VULKAN_MEMORY_BLOCK_SIZE, &allocator));
+
+    log_trace("Vulkan memory placement: %s", unifiedMemory ? "unified" : "device local + staging");
+    return true;
+}
+
+void vulkan_memory_destroy()
+{
+    allocator_destroy(&allocator);
+}
+
+bool vulkan_memory_alloc(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags properties,
+    VkMemoryAllocateFlags flags, bool linear, Allocation* allocation)
+{
+    uint32_t memoryTypeIndex = vulkan_find_memory_type(requirements->memoryTypeBits, properties);
+    if (memoryTypeIndex == UINT32_MAX)
+        return false;
+
+    AllocationRequest request = {
+        .size            = requirements->size,
+        .alignment       = requirements->alignment,
+        .memoryTypeIndex = memoryTypeIndex,
+        .flags           = flags,
+        .linear          = linear,
+    };
+
+    if (!allocator_alloc(&allocator, &request, allocation))
+    {
+        log_error("Vulkan failed to allocate %llu bytes of memory type %u",
+            (unsigned long long) request.size, request.memoryTypeIndex);
+        return false;
+    }
+    return true;
+}
+
+void vulkan_memory_free(Allocation* allocation)
+{
+    allocator_free(&allocator, allocation);
+}
+
+bool vulkan_memory_is_unified()
+{
+    return unifiedMemory;
+}
+
+VkMemoryPropertyFlags vulkan_memory_properties(MemoryUsage usage)
+{
+    switch (usage)
+    {
+    case MEMORY_USAGE_GPU_ONLY:
+        return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    
+    case MEMORY_USAGE_GPU_UPLOAD:
+        return unifiedMemory ?
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT :
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    
+    case MEMORY_USAGE_CPU_TO_GPU:
+        return unifiedMemory ?
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT :
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    
+    case MEMORY_USAGE_STAGING:
+        return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+
+    ASSERT_MSG(false, "Vulkan unknown memory usage!");
+    return 0;
+}
+
+void vulkan_memory_track(MemoryCategory category, VkDeviceSize size)
+{
+    categoryBytes[category] += size;
+}
+
+void vulkan_memory_release(MemoryCategory category, VkDeviceSize size)
+{
+    ASSERT(categoryBytes[category] >= size);
+    categoryBytes[category] -= size;
+}
+
+void vulkan_memory_report()
+{
+    char tempStr[64];
+    VkDeviceSize total = 0;
+
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+    {
+        num_to_str(tempStr, categoryBytes[i]);
+        log_info("Vulkan memory %-10s %sB", categoryNames[i], tempStr);
+        total += categoryBytes[i];
+    }
+
+    num_to_str(tempStr, total);
+    log_info("Vulkan memory %-10s %sB", "Total", tempStr);
+
+    AllocatorStats stats;
+    allocator_get_stats(&allocator, &stats);
+
+    char usedStr[64], blockStr[64], dedicatedStr[64];
+    num_to_str(usedStr, stats.usedBytes);
+    num_to_str(blockStr, stats.blockBytes);
+    num_to_str(dedicatedStr, stats.dedicatedBytes);
+    log_info("Vulkan allocator %u allocations in %u blocks (%sB / %sB), %u dedicated (%sB), fragmentation %.1f%%",
+        stats.allocationCount, stats.blockCount, usedStr, blockStr, stats.dedicatedCount, dedicatedStr,
+        stats.fragmentation * 100.0f);
+}
@@ -0,0 +1,45 @@
+#ifndef VULKAN_MEMORY_H_
+#define VULKAN_MEMORY_H_
+
+#include "vulkan_base.h"
+#include "allocator.h"
+
+typedef enum {
+    MEMORY_USAGE_GPU_ONLY,   // Written and read by the device only (acceleration structures, scratch)
+    MEMORY_USAGE_GPU_UPLOAD, // Written once by the host through staging, read by the device (SBT, geometry)
+    MEMORY_USAGE_CPU_TO_GPU, // Rewritten by the host while in use (instances, uniforms)
+    MEMORY_USAGE_STAGING,    // Host side source of transfers
+} MemoryUsage;
+
+typedef enum {
+    MEMORY_CATEGORY_BLAS,
+    MEMORY_CATEGORY_TLAS,
+    MEMORY_CATEGORY_SCRATCH,
+    MEMORY_CATEGORY_INSTANCES,
+    MEMORY_CATEGORY_SBT,
+    MEMORY_CATEGORY_GEOMETRY,
+    MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+bool vulkan_memory_init();
+
+void vulkan_memory_destroy();
+
+// Sub-allocates from the block pool of the first memory type matching requirements and properties
+bool vulkan_memory_alloc(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags properties,
+    VkMemoryAllocateFlags flags, bool linear, Allocation* allocation);
+
+void vulkan_memory_free(Allocation* allocation);
+
+// Device local heaps are host visible (integrated / unified memory GPUs)
+bool vulkan_memory_is_unified();
+
+VkMemoryPropertyFlags vulkan_memory_properties(MemoryUsage usage);
+
+void vulkan_memory_track(MemoryCategory category, VkDeviceSize size);
+
+void vulkan_memory_release(MemoryCategory category, VkDeviceSize size);
+
+void vulkan_memory_report();
+
+#endif // VULKAN_MEMORY_H_
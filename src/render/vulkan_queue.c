@@ -0,0 +1,379 @@
+#include "vulkan_queue.h"
+
+extern VkDevice device;
+
+extern VkQueue graphicsQueue;
+
+typedef struct {
+    VkQueue       queue;
+    uint32_t      family;
+    VkCommandPool commandPool;
+
+    VkSemaphore timeline;
+    uint64_t    submitted;
+
+    // Timeline values of the other queues the next submission waits for, 0 if none
+    uint64_t             dependValues[QUEUE_COUNT];
+    VkPipelineStageFlags dependStages[QUEUE_COUNT];
+} QueueState;
+
+typedef struct {
+    VkImage       image;
+    uint32_t      mipLevels;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+
+    QueueType src;
+    QueueType dst;
+    uint64_t  value; // Timeline value of the release, 0 until src submitted it
+} QueueAcquire;
+
+static const char* queueNames[QUEUE_COUNT] = {
+    "graphics", "async",
+};
+
+static QueueState queues[QUEUE_COUNT];
+
+static QueueAcquire acquires[QUEUE_MAX_ACQUIRES];
+static uint32_t     acquireCount;
+
+static PFN_vkWaitSemaphoresKHR           WaitSemaphoresKHR           = NULL;
+static PFN_vkGetSemaphoreCounterValueKHR GetSemaphoreCounterValueKHR = NULL;
+
+static bool vulkan_queue_create_state(QueueType type, uint32_t family, uint32_t index)
+{
+    QueueState* queue = &queues[type];
+    *queue = (QueueState) { .family = family };
+
+    vkGetDeviceQueue(device, family, index, &queue->queue);
+
+    VkCommandPoolCreateInfo poolInfo = {
+        .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = family,
+    };
+    VKCHECK(vkCreateCommandPool(device, &poolInfo, NULL, &queue->commandPool));
+
+    VkSemaphoreTypeCreateInfoKHR typeInfo = {
+        .sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+        .initialValue  = 0,
+    };
+
+    VkSemaphoreCreateInfo semaphoreInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+    VKCHECK(vkCreateSemaphore(device, &semaphoreInfo, NULL, &queue->timeline));
+
+    log_trace("Vulkan %s queue: family %u index %u", queueNames[type], family, index);
+    return true;
+}
+
+bool vulkan_queue_init(uint32_t graphicsFamily, uint32_t asyncFamily, uint32_t asyncIndex)
+{
+    VK_DEVICE_PFN(device, WaitSemaphoresKHR);
+    VK_DEVICE_PFN(device, GetSemaphoreCounterValueKHR);
+
+    CHECK(vulkan_queue_create_state(QUEUE_GRAPHICS, graphicsFamily, 0));
+    CHECK(vulkan_queue_create_state(QUEUE_ASYNC, asyncFamily, asyncIndex));
+
+    ASSERT(queues[QUEUE_GRAPHICS].queue == graphicsQueue);
+
+    acquireCount = 0;
+    return true;
+}
+
+void vulkan_queue_destroy()
+{
+    for (size_t i = 0; i < QUEUE_COUNT; ++i)
+    {
+        vkDestroySemaphore(device, queues[i].timeline, NULL);
+        vkDestroyCommandPool(device, queues[i].commandPool, NULL);
+    }
+
+    acquireCount = 0;
+}
+
+VkQueue vulkan_queue_get(QueueType type)
+{
+    return queues[type].queue;
+}
+
+uint32_t vulkan_queue_family(QueueType type)
+{
+    return queues[type].family;
+}
+
+VkCommandPool vulkan_queue_command_pool(QueueType type)
+{
+    return queues[type].commandPool;
+}
+
+uint32_t vulkan_queue_families(uint32_t families[QUEUE_COUNT])
+{
+    uint32_t count = 0;
+    for (size_t i = 0; i < QUEUE_COUNT; ++i)
+    {
+        bool found = false;
+        for (size_t j = 0; j < count; ++j)
+            found |= families[j] == queues[i].family;
+
+        if (!found)
+            families[count++] = queues[i].family;
+    }
+    return count;
+}
+
+bool vulkan_queue_submit(QueueType type, VkCommandBuffer commandBuffer, const QueueSubmit* submit, uint64_t* value)
+{
+    static const QueueSubmit defaultSubmit = {0};
+    if (!submit)
+        submit = &defaultSubmit;
+
+    ASSERT(submit->waitCount <= QUEUE_MAX_WAITS && submit->signalCount <= QUEUE_MAX_WAITS);
+
+    QueueState* queue = &queues[type];
+
+    VkSemaphore          waitSemaphores[QUEUE_MAX_WAITS + QUEUE_COUNT];
+    uint64_t             waitValues[QUEUE_MAX_WAITS + QUEUE_COUNT];
+    VkPipelineStageFlags waitStages[QUEUE_MAX_WAITS + QUEUE_COUNT];
+    uint32_t             waitCount = 0;
+
+    for (uint32_t i = 0; i < submit->waitCount; ++i, ++waitCount)
+    {
+        waitSemaphores[waitCount] = submit->waits[i].semaphore;
+        waitValues[waitCount]     = submit->waits[i].value;
+        waitStages[waitCount]     = submit->waits[i].stage;
+    }
+
+    for (size_t i = 0; i < QUEUE_COUNT; ++i)
+    {
+        if (queue->dependValues[i] == 0)
+            continue;
+
+        waitSemaphores[waitCount] = queues[i].timeline;
+        waitValues[waitCount]     = queue->dependValues[i];
+        waitStages[waitCount]     = queue->dependStages[i];
+        ++waitCount;
+    }
+
+    VkSemaphore signalSemaphores[QUEUE_MAX_WAITS + 1];
+    uint64_t    signalValues[QUEUE_MAX_WAITS + 1];
+    uint32_t    signalCount = 0;
+
+    for (uint32_t i = 0; i < submit->signalCount; ++i, ++signalCount)
+    {
+        signalSemaphores[signalCount] = submit->signals[i];
+        signalValues[signalCount]     = 0;
+    }
+
+    uint64_t signalValue = queue->submitted + 1;
+    signalSemaphores[signalCount] = queue->timeline;
+    signalValues[signalCount]     = signalValue;
+    ++signalCount;
+
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {
+        .sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .waitSemaphoreValueCount   = waitCount,
+        .pWaitSemaphoreValues      = waitValues,
+        .signalSemaphoreValueCount = signalCount,
+        .pSignalSemaphoreValues    = signalValues,
+    };
+
+    VkSubmitInfo submitInfo = {
+        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext                = &timelineInfo,
+        .waitSemaphoreCount   = waitCount,
+        .pWaitSemaphores      = waitSemaphores,
+        .pWaitDstStageMask    = waitStages,
+        .commandBufferCount   = commandBuffer ? 1 : 0,
+        .pCommandBuffers      = &commandBuffer,
+        .signalSemaphoreCount = signalCount,
+        .pSignalSemaphores    = signalSemaphores,
+    };
+
+    VKCHECK(vkQueueSubmit(queue->queue, 1, &submitInfo, submit->fence));
+
+    queue->submitted = signalValue;
+    for (size_t i = 0; i < QUEUE_COUNT; ++i)
+    {
+        queue->dependValues[i] = 0;
+        queue->dependStages[i] = 0;
+    }
+
+    // Releases recorded into this submission become visible to their consumer
+    for (uint32_t i = 0; i < acquireCount; ++i)
+        if (acquires[i].src == type && acquires[i].value == 0)
+            acquires[i].value = signalValue;
+
+    if (type == QUEUE_ASYNC && !submit->detached)
+        vulkan_queue_depend(QUEUE_GRAPHICS, QUEUE_ASYNC, signalValue, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+    if (value)
+        *value = signalValue;
+    return true;
+}
+
+uint64_t vulkan_queue_submitted(QueueType type)
+{
+    return queues[type].submitted;
+}
+
+uint64_t vulkan_queue_completed(QueueType type)
+{
+    uint64_t value = 0;
+    if (GetSemaphoreCounterValueKHR(device, queues[type].timeline, &value) != VK_SUCCESS)
+        return 0;
+
+    return value;
+}
+
+bool vulkan_queue_wait(QueueType type, uint64_t value)
+{
+    VkSemaphoreWaitInfoKHR waitInfo = {
+        .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+        .semaphoreCount = 1,
+        .pSemaphores    = &queues[type].timeline,
+        .pValues        = &value,
+    };
+
+    VKCHECK(WaitSemaphoresKHR(device, &waitInfo, UINT64_MAX));
+    return true;
+}
+
+void vulkan_queue_depend(QueueType consumer, QueueType producer, uint64_t value, VkPipelineStageFlags stage)
+{
+    // Submissions on the same queue are already ordered by the barriers they record
+    if (consumer == producer || value == 0)
+        return;
+
+    QueueState* queue = &queues[consumer];
+    if (value > queue->dependValues[producer])
+        queue->dependValues[producer] = value;
+
+    queue->dependStages[producer] |= stage;
+}
+
+static void vulkan_queue_image_barrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipLevels,
+    VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t srcFamily, uint32_t dstFamily,
+    VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+    VkImageMemoryBarrier barrier = {
+        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask       = srcAccess,
+        .dstAccessMask       = dstAccess,
+        .oldLayout           = oldLayout,
+        .newLayout           = newLayout,
+        .srcQueueFamilyIndex = srcFamily,
+        .dstQueueFamilyIndex = dstFamily,
+        .image               = image,
+        .subresourceRange    = (VkImageSubresourceRange) {
+            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel   = 0,
+            .levelCount     = mipLevels,
+            .baseArrayLayer = 0,
+            .layerCount     = 1,
+        },
+    };
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0,
+        0, NULL,
+        0, NULL,
+        1, &barrier);
+}
+
+bool vulkan_queue_release_image(VkCommandBuffer commandBuffer, QueueType src, QueueType dst, VkImage image,
+    uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    uint32_t srcFamily = queues[src].family;
+    uint32_t dstFamily = queues[dst].family;
+
+    // Same family, ownership does not move: a plain transition, the timeline wait orders the queues
+    if (srcFamily == dstFamily)
+    {
+        if (oldLayout != newLayout)
+            vulkan_queue_image_barrier(commandBuffer, image, mipLevels, oldLayout, newLayout,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        return true;
+    }
+
+    if (acquireCount == QUEUE_MAX_ACQUIRES)
+    {
+        log_error("Vulkan too many pending queue family ownership transfers");
+        return false;
+    }
+
+    // The destination access of a release is ignored, visibility comes with the acquire
+    vulkan_queue_image_barrier(commandBuffer, image, mipLevels, oldLayout, newLayout, srcFamily, dstFamily,
+        VK_ACCESS_MEMORY_WRITE_BIT, 0,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+    acquires[acquireCount++] = (QueueAcquire) {
+        .image     = image,
+        .mipLevels = mipLevels,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .src       = src,
+        .dst       = dst,
+        .value     = 0,
+    };
+    return true;
+}
+
+void vulkan_queue_record_acquires(QueueType type, VkCommandBuffer commandBuffer)
+{
+    for (uint32_t i = 0; i < acquireCount;)
+    {
+        QueueAcquire* acquire = &acquires[i];
+        if (acquire->dst != type || acquire->value == 0)
+        {
+            ++i;
+            continue;
+        }
+
+        // Must match the release, the source access of an acquire is ignored
+        vulkan_queue_image_barrier(commandBuffer, acquire->image, acquire->mipLevels,
+            acquire->oldLayout, acquire->newLayout, queues[acquire->src].family, queues[type].family,
+            0, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+        vulkan_queue_depend(type, acquire->src, acquire->value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+        *acquire = acquires[--acquireCount];
+    }
+}
+
+bool vulkan_queue_begin_commands(QueueType type, VkCommandBuffer* commandBuffer)
+{
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandPool        = queues[type].commandPool,
+        .commandBufferCount = 1,
+    };
+    VKCHECK(vkAllocateCommandBuffers(device, &allocInfo, commandBuffer));
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VKCHECK(vkBeginCommandBuffer(*commandBuffer, &beginInfo));
+
+    vulkan_queue_record_acquires(type, *commandBuffer);
+    return true;
+}
+
+bool vulkan_queue_end_commands(QueueType type, VkCommandBuffer commandBuffer)
+{
+    VKCHECK(vkEndCommandBuffer(commandBuffer));
+
+    uint64_t value;
+    CHECK(vulkan_queue_submit(type, commandBuffer, NULL, &value));
+    CHECK(vulkan_queue_wait(type, value));
+
+    vkFreeCommandBuffers(device, queues[type].commandPool, 1, &commandBuffer);
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef VULKAN_QUEUE_H_
+#define VULKAN_QUEUE_H_
+
+#include "vulkan_base.h"
+
+/*
+ *  Queue scheduler:
+ *  the graphics queue renders, the async queue (a compute family without graphics when the
+ *  device has one) takes uploads and acceleration structure builds. Every queue owns a timeline
+ *  semaphore signaled with an increasing value by each submission, work on one queue waits for
+ *  the other through those values instead of idling the device.
+ *
+ *  Buffers are created concurrent across both families, images stay exclusive and move between
+ *  them with release/acquire barriers: the release is recorded by the producer, the matching
+ *  acquire is recorded into the next command buffer of the consumer.
+ */
+
+#define QUEUE_MAX_WAITS    8
+#define QUEUE_MAX_ACQUIRES 64
+
+typedef enum {
+    QUEUE_GRAPHICS,
+    QUEUE_ASYNC,
+    QUEUE_COUNT,
+} QueueType;
+
+typedef struct {
+    VkSemaphore          semaphore;
+    uint64_t             value;      // Ignored for binary semaphores
+    VkPipelineStageFlags stage;
+} QueueWait;
+
+typedef struct {
+    const QueueWait*   waits;
+    uint32_t           waitCount;
+    const VkSemaphore* signals;      // Binary semaphores, the queue timeline is always signaled
+    uint32_t           signalCount;
+    VkFence            fence;
+
+    // Polled by the caller, the next graphics submission does not wait on it (async queue only)
+    bool detached;
+} QueueSubmit;
+
+bool vulkan_queue_init(uint32_t graphicsFamily, uint32_t asyncFamily, uint32_t asyncIndex);
+
+void vulkan_queue_destroy();
+
+VkQueue vulkan_queue_get(QueueType type);
+
+uint32_t vulkan_queue_family(QueueType type);
+
+VkCommandPool vulkan_queue_command_pool(QueueType type);
+
+// Families buffers have to be shared with, returns 1 when every queue lives in the same family
+uint32_t vulkan_queue_families(uint32_t families[QUEUE_COUNT]);
+
+bool vulkan_queue_submit(QueueType type, VkCommandBuffer commandBuffer, const QueueSubmit* submit, uint64_t* value);
+
+// Last value submitted on the queue
+uint64_t vulkan_queue_submitted(QueueType type);
+
+// Last value the queue completed, never blocks
+uint64_t vulkan_queue_completed(QueueType type);
+
+bool vulkan_queue_wait(QueueType type, uint64_t value);
+
+// Makes the next submission on consumer wait until producer reached value
+void vulkan_queue_depend(QueueType consumer, QueueType producer, uint64_t value, VkPipelineStageFlags stage);
+
+// One time command buffer from the queue pool, acquires pending for the queue are recorded first
+bool vulkan_queue_begin_commands(QueueType type, VkCommandBuffer* commandBuffer);
+
+// Submits, waits on this queue timeline only and frees the command buffer, other queues keep running
+bool vulkan_queue_end_commands(QueueType type, VkCommandBuffer commandBuffer);
+
+// Records the release half of an ownership transfer, the acquire is recorded for dst once src submitted
+bool vulkan_queue_release_image(VkCommandBuffer commandBuffer, QueueType src, QueueType dst, VkImage image,
+    uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout);
+
+// Records the acquires of every submitted release targeting type
+void vulkan_queue_record_acquires(QueueType type, VkCommandBuffer commandBuffer);
+
+#endif // VULKAN_QUEUE_H_
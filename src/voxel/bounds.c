@@ -0,0 +1,115 @@
+#include "bounds.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// First non zero voxel of the row, width when the row is empty
+static uint32_t bounds_row_first(const uint8_t* row, uint32_t width)
+{
+    uint32_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for(; x + 16 <= width; x += 16)
+    {
+        uint32_t mask = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (row + x)), zero)) & 0xFFFFu;
+        if(mask != 0)
+            return x + (uint32_t) __builtin_ctz(mask);
+    }
+#endif
+
+    for(; x + 8 <= width; x += 8)
+    {
+        uint64_t word;
+        memcpy(&word, row + x, sizeof(word));
+        if(word != 0)
+            break;
+    }
+
+    for(; x < width; ++x)
+        if(row[x] != 0)
+            return x;
+
+    return width;
+}
+
+// One past the last non zero voxel of the row above floor, floor when there is none
+static uint32_t bounds_row_last(const uint8_t* row, uint32_t width, uint32_t floor)
+{
+    uint32_t x = width;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for(; x >= floor + 16; x -= 16)
+    {
+        uint32_t mask = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (row + x - 16)), zero)) & 0xFFFFu;
+        if(mask != 0)
+            return x - 16 + 32 - (uint32_t) __builtin_clz(mask);
+    }
+#endif
+
+    for(; x >= floor + 8; x -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, row + x - 8, sizeof(word));
+        if(word != 0)
+            break;
+    }
+
+    for(; x > floor; --x)
+        if(row[x - 1] != 0)
+            return x;
+
+    return floor;
+}
+
+bool bounds_scan(const uint8_t* data, uint32_t width, uint32_t height, uint32_t depth, uint32_t min[3], uint32_t max[3])
+{
+    uint32_t lo[3] = { width, height, depth };
+    uint32_t hi[3] = { 0, 0, 0 };
+
+    for(uint32_t z = 0; z < depth; ++z)
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            const uint8_t* row = data + (size_t) y * width + (size_t) z * width * height;
+
+            uint32_t first = bounds_row_first(row, width);
+            if(first == width)
+                continue;
+
+            // Only the voxels past the current x range can still grow it
+            uint32_t last = bounds_row_last(row, width, hi[0]);
+
+            lo[0] = first < lo[0] ? first : lo[0];
+            hi[0] = last  > hi[0] ? last  : hi[0];
+            lo[1] = y < lo[1] ? y : lo[1];
+            hi[1] = y + 1 > hi[1] ? y + 1 : hi[1];
+            lo[2] = z < lo[2] ? z : lo[2];
+            hi[2] = z + 1;
+        }
+
+    if(hi[2] == 0)
+        return false;
+
+    memcpy(min, lo, sizeof(lo));
+    memcpy(max, hi, sizeof(hi));
+    return true;
+}
+
+bool bounds_empty(const uint8_t* data, uint32_t width, uint32_t height, const uint32_t min[3], const uint32_t max[3])
+{
+    uint32_t length = max[0] - min[0];
+
+    for(uint32_t z = min[2]; z < max[2]; ++z)
+        for(uint32_t y = min[1]; y < max[1]; ++y)
+        {
+            const uint8_t* row = data + min[0] + (size_t) y * width + (size_t) z * width * height;
+            if(bounds_row_first(row, length) < length)
+                return false;
+        }
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef BOUNDS_H_
+#define BOUNDS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Bounds of the non zero voxels of a dense width x height x depth block, x fastest.
+ *  Rows are scanned 16 voxels at a time with SSE2 where available: the first and the
+ *  last non zero voxel of a row come from the byte mask of a compare against zero.
+ */
+
+// Returns false when every voxel is zero, min and max are then left untouched
+bool bounds_scan(const uint8_t* data, uint32_t width, uint32_t height, uint32_t depth, uint32_t min[3], uint32_t max[3]);
+
+// Whether every voxel of the box [min, max) is zero, the box lies inside the data
+bool bounds_empty(const uint8_t* data, uint32_t width, uint32_t height, const uint32_t min[3], const uint32_t max[3]);
+
+#endif // BOUNDS_H_
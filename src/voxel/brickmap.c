@@ -0,0 +1,769 @@
+#include "brickmap.h"
+
+#include "voxel/bounds.h"
+#include "voxel/morton.h"
+
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+static uint32_t brickmap_div_up(uint32_t value, uint32_t divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+static uint32_t brick_voxel_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    return morton_brick_index(x, y, z);
+}
+
+static void brickmap_level_size(const BrickMap* map, uint32_t level, uint32_t size[3])
+{
+    size[0] = (map->gridWidth  + (1u << level) - 1) >> level;
+    size[1] = (map->gridHeight + (1u << level) - 1) >> level;
+    size[2] = (map->gridDepth  + (1u << level) - 1) >> level;
+}
+
+static void brickmap_set_occupied(BrickMap* map, uint32_t level, uint32_t x, uint32_t y, uint32_t z, bool occupied)
+{
+    uint32_t size[3];
+    brickmap_level_size(map, level, size);
+
+    uint32_t index = x + y * size[0] + z * (size[0] * size[1]);
+    uint32_t* word = &map->occupancy[map->occupancy[level] + (index >> 5)];
+
+    if(occupied)
+        *word |= 1u << (index & 31u);
+    else
+        *word &= ~(1u << (index & 31u));
+}
+
+// Rebuilds the bits covering bricks [min, max) on every level
+static void brickmap_update_occupancy(BrickMap* map, const uint32_t min[3], const uint32_t max[3])
+{
+    for(uint32_t z = min[2]; z < max[2]; ++z)
+        for(uint32_t y = min[1]; y < max[1]; ++y)
+            for(uint32_t x = min[0]; x < max[0]; ++x)
+                brickmap_set_occupied(map, 0, x, y, z,
+                    map->grid[x + y * map->gridWidth + z * (map->gridWidth * map->gridHeight)] != BRICK_EMPTY);
+
+    // Every level above is the OR of the 2x2x2 children
+    for(uint32_t level = 1; level < map->levelCount; ++level)
+    {
+        uint32_t childSize[3];
+        brickmap_level_size(map, level - 1, childSize);
+
+        for(uint32_t z = min[2] >> level; z <= (max[2] - 1) >> level; ++z)
+            for(uint32_t y = min[1] >> level; y <= (max[1] - 1) >> level; ++y)
+                for(uint32_t x = min[0] >> level; x <= (max[0] - 1) >> level; ++x)
+                {
+                    bool occupied = false;
+                    for(uint32_t child = 0; child < 8 && !occupied; ++child)
+                    {
+                        uint32_t cx = x * 2 + (child & 1), cy = y * 2 + ((child >> 1) & 1), cz = z * 2 + (child >> 2);
+                        occupied = cx < childSize[0] && cy < childSize[1] && cz < childSize[2] &&
+                            brickmap_occupied(map, level - 1, cx, cy, cz);
+                    }
+
+                    brickmap_set_occupied(map, level, x, y, z, occupied);
+                }
+    }
+}
+
+static bool brickmap_create_occupancy(BrickMap* map)
+{
+    // Levels until a single cell covers the whole grid
+    uint32_t maxSize = map->gridWidth > map->gridHeight ? map->gridWidth : map->gridHeight;
+    maxSize = maxSize > map->gridDepth ? maxSize : map->gridDepth;
+
+    map->levelCount = 1;
+    while((1u << (map->levelCount - 1)) < maxSize)
+        ++map->levelCount;
+
+    if(map->levelCount > BRICKMAP_MAX_LEVELS)
+        return false;
+
+    uint32_t offsets[BRICKMAP_MAX_LEVELS] = {0};
+    size_t words = BRICKMAP_MAX_LEVELS;
+    for(uint32_t level = 0; level < map->levelCount; ++level)
+    {
+        uint32_t size[3];
+        brickmap_level_size(map, level, size);
+
+        offsets[level] = (uint32_t) words;
+        words += ((size_t) size[0] * size[1] * size[2] + 31) / 32;
+    }
+
+    map->occupancy = (uint32_t*) calloc(words, sizeof(uint32_t));
+    if(map->occupancy == NULL)
+        return false;
+
+    memcpy(map->occupancy, offsets, sizeof(offsets));
+    map->occupancyWords = words;
+
+    const uint32_t min[3] = { 0, 0, 0 };
+    const uint32_t max[3] = { map->gridWidth, map->gridHeight, map->gridDepth };
+    brickmap_update_occupancy(map, min, max);
+    return true;
+}
+
+// Bricks [min, max) changed, every cell within BRICKMAP_MAX_DISTANCE of them may get a new distance
+static bool brickmap_update_distance(BrickMap* map, const uint32_t min[3], const uint32_t max[3])
+{
+    const uint32_t size[3] = { map->gridWidth, map->gridHeight, map->gridDepth };
+
+    uint32_t regionMin[3], regionMax[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        regionMin[i] = min[i] > BRICKMAP_MAX_DISTANCE ? min[i] - BRICKMAP_MAX_DISTANCE : 0;
+        regionMax[i] = size[i] - max[i] > BRICKMAP_MAX_DISTANCE ? max[i] + BRICKMAP_MAX_DISTANCE : size[i];
+    }
+
+    return distance_transform_region(map->grid, size, regionMin, regionMax, map->metric, BRICKMAP_MAX_DISTANCE,
+        map->distance);
+}
+
+static bool brickmap_create_distance(BrickMap* map)
+{
+    map->distance = (uint8_t*) calloc(brickmap_distance_size(map), sizeof(uint8_t));
+    if(map->distance == NULL)
+        return false;
+
+    const uint32_t size[3] = { map->gridWidth, map->gridHeight, map->gridDepth };
+    return distance_transform(map->grid, size, map->metric, BRICKMAP_MAX_DISTANCE, map->distance);
+}
+
+bool brickmap_create(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, DistanceMetric metric,
+    BrickMap* map)
+{
+    *map = (BrickMap) {
+        .width      = width,
+        .height     = height,
+        .depth      = depth,
+        .gridWidth  = brickmap_div_up(width,  BRICK_SIZE),
+        .gridHeight = brickmap_div_up(height, BRICK_SIZE),
+        .gridDepth  = brickmap_div_up(depth,  BRICK_SIZE),
+        .metric     = metric,
+    };
+
+    map->grid = (uint32_t*) calloc(brickmap_grid_size(map), sizeof(uint32_t));
+    if(map->grid == NULL)
+        return false;
+
+    Brick brick;
+    for(uint32_t bz = 0; bz < map->gridDepth; ++bz)
+        for(uint32_t by = 0; by < map->gridHeight; ++by)
+            for(uint32_t bx = 0; bx < map->gridWidth; ++bx)
+            {
+                memset(&brick, 0, sizeof(Brick));
+                bool empty = true;
+
+                for(uint32_t z = 0; z < BRICK_SIZE && bz * BRICK_SIZE + z < depth; ++z)
+                    for(uint32_t y = 0; y < BRICK_SIZE && by * BRICK_SIZE + y < height; ++y)
+                        for(uint32_t x = 0; x < BRICK_SIZE && bx * BRICK_SIZE + x < width; ++x)
+                        {
+                            uint32_t vx = bx * BRICK_SIZE + x, vy = by * BRICK_SIZE + y, vz = bz * BRICK_SIZE + z;
+                            uint8_t value = data[vx + vy * width + vz * (width * height)];
+
+                            brick.voxels[brick_voxel_index(x, y, z)] = value;
+                            empty &= value == 0;
+                        }
+
+                if(empty)
+                    continue;
+
+                list_append(map->bricks, brick);
+                map->grid[bx + by * map->gridWidth + bz * (map->gridWidth * map->gridHeight)] = (uint32_t) map->bricks.count;
+            }
+
+    bounds_scan(data, width, height, depth, map->boundsMin, map->boundsMax);
+    return brickmap_create_occupancy(map) && brickmap_create_distance(map);
+}
+
+// Union of the bounds of every non empty brick, the voxel data is gone once the bricks are built
+static void brickmap_update_bounds(BrickMap* map)
+{
+    memset(map->boundsMin, 0, sizeof(map->boundsMin));
+    memset(map->boundsMax, 0, sizeof(map->boundsMax));
+
+    bool empty = true;
+    for(uint32_t z = 0; z < map->gridDepth; ++z)
+        for(uint32_t y = 0; y < map->gridHeight; ++y)
+            for(uint32_t x = 0; x < map->gridWidth; ++x)
+            {
+                if(map->grid[x + y * map->gridWidth + z * (map->gridWidth * map->gridHeight)] == BRICK_EMPTY)
+                    continue;
+
+                uint32_t min[3], max[3];
+                brickmap_brick_bounds(map, x, y, z, min, max);
+
+                for(int i = 0; i < 3; ++i)
+                {
+                    map->boundsMin[i] = empty || min[i] < map->boundsMin[i] ? min[i] : map->boundsMin[i];
+                    map->boundsMax[i] = empty || max[i] > map->boundsMax[i] ? max[i] : map->boundsMax[i];
+                }
+                empty = false;
+            }
+}
+
+void brickmap_destroy(BrickMap* map)
+{
+    free(map->grid);
+    map->grid = NULL;
+
+    free(map->occupancy);
+    map->occupancy = NULL;
+
+    free(map->distance);
+    map->distance = NULL;
+
+    list_destroy(map->bricks);
+    map->bricks = (Bricks) {0};
+
+    list_destroy(map->freeBricks);
+    map->freeBricks = (BrickIndices) {0};
+}
+
+uint8_t brickmap_get(const BrickMap* map, uint32_t x, uint32_t y, uint32_t z)
+{
+    if(x >= map->width || y >= map->height || z >= map->depth)
+        return 0;
+
+    uint32_t bx = x >> BRICK_SIZE_LOG2, by = y >> BRICK_SIZE_LOG2, bz = z >> BRICK_SIZE_LOG2;
+    uint32_t brick = map->grid[bx + by * map->gridWidth + bz * (map->gridWidth * map->gridHeight)];
+    if(brick == BRICK_EMPTY)
+        return 0;
+
+    return map->bricks.items[brick - 1].voxels[
+        brick_voxel_index(x & (BRICK_SIZE - 1), y & (BRICK_SIZE - 1), z & (BRICK_SIZE - 1))];
+}
+
+bool brickmap_edit(BrickMap* map, const uint32_t min[3], const uint32_t size[3], const uint8_t* data)
+{
+    const uint32_t volume[3] = { map->width, map->height, map->depth };
+
+    uint32_t brickMin[3], brickMax[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        if(size[i] == 0)
+            return true;
+
+        if(min[i] >= volume[i] || volume[i] - min[i] < size[i])
+            return false;
+
+        brickMin[i] = min[i] >> BRICK_SIZE_LOG2;
+        brickMax[i] = brickmap_div_up(min[i] + size[i], BRICK_SIZE);
+    }
+
+    Brick brick;
+    for(uint32_t bz = brickMin[2]; bz < brickMax[2]; ++bz)
+        for(uint32_t by = brickMin[1]; by < brickMax[1]; ++by)
+            for(uint32_t bx = brickMin[0]; bx < brickMax[0]; ++bx)
+            {
+                uint32_t* cell = &map->grid[bx + by * map->gridWidth + bz * (map->gridWidth * map->gridHeight)];
+                if(*cell == BRICK_EMPTY)
+                    memset(&brick, 0, sizeof(Brick));
+                else
+                    brick = map->bricks.items[*cell - 1];
+
+                // Edited voxels overlapping the brick
+                for(uint32_t z = 0; z < BRICK_SIZE; ++z)
+                    for(uint32_t y = 0; y < BRICK_SIZE; ++y)
+                        for(uint32_t x = 0; x < BRICK_SIZE; ++x)
+                        {
+                            uint32_t vx = bx * BRICK_SIZE + x, vy = by * BRICK_SIZE + y, vz = bz * BRICK_SIZE + z;
+                            if(vx < min[0] || vy < min[1] || vz < min[2] ||
+                                vx >= min[0] + size[0] || vy >= min[1] + size[1] || vz >= min[2] + size[2])
+                                continue;
+
+                            brick.voxels[brick_voxel_index(x, y, z)] =
+                                data[(vx - min[0]) + (vy - min[1]) * size[0] + (vz - min[2]) * (size[0] * size[1])];
+                        }
+
+                bool empty = true;
+                for(uint32_t i = 0; i < BRICK_VOLUME && empty; ++i)
+                    empty = brick.voxels[i] == 0;
+
+                if(empty)
+                {
+                    if(*cell != BRICK_EMPTY)
+                    {
+                        uint32_t index = *cell - 1;
+                        list_append(map->freeBricks, index);
+                        *cell = BRICK_EMPTY;
+                    }
+                    continue;
+                }
+
+                if(*cell == BRICK_EMPTY)
+                {
+                    if(map->freeBricks.count > 0)
+                        *cell = map->freeBricks.items[--map->freeBricks.count] + 1;
+                    else
+                    {
+                        list_append(map->bricks, brick);
+                        *cell = (uint32_t) map->bricks.count;
+                    }
+                }
+
+                map->bricks.items[*cell - 1] = brick;
+            }
+
+    brickmap_update_occupancy(map, brickMin, brickMax);
+    brickmap_update_bounds(map);
+    return brickmap_update_distance(map, brickMin, brickMax);
+}
+
+size_t brickmap_grid_size(const BrickMap* map)
+{
+    return (size_t) map->gridWidth * map->gridHeight * map->gridDepth;
+}
+
+size_t brickmap_memory_size(const BrickMap* map)
+{
+    return brickmap_grid_size(map) * sizeof(uint32_t) + map->bricks.count * sizeof(Brick) +
+        brickmap_occupancy_size(map) + brickmap_distance_size(map);
+}
+
+size_t brickmap_occupancy_size(const BrickMap* map)
+{
+    return map->occupancyWords * sizeof(uint32_t);
+}
+
+bool brickmap_occupied(const BrickMap* map, uint32_t level, uint32_t x, uint32_t y, uint32_t z)
+{
+    uint32_t size[3];
+    brickmap_level_size(map, level, size);
+
+    uint32_t index = x + y * size[0] + z * (size[0] * size[1]);
+    return (map->occupancy[map->occupancy[level] + (index >> 5)] >> (index & 31u)) & 1u;
+}
+
+size_t brickmap_distance_size(const BrickMap* map)
+{
+    return (brickmap_grid_size(map) + 3) & ~(size_t) 3;
+}
+
+uint32_t brickmap_check_distance(const BrickMap* map, uint32_t sampleCount)
+{
+    const uint32_t size[3] = { map->gridWidth, map->gridHeight, map->gridDepth };
+    return distance_check(map->grid, size, map->metric, BRICKMAP_MAX_DISTANCE, map->distance, sampleCount);
+}
+
+void brickmap_brick_bounds(const BrickMap* map, uint32_t x, uint32_t y, uint32_t z, uint32_t min[3], uint32_t max[3])
+{
+    uint32_t brick = map->grid[x + y * map->gridWidth + z * (map->gridWidth * map->gridHeight)];
+    const uint32_t cell[3] = { x, y, z };
+
+    // Empty bricks get an empty box at their corner
+    memset(min, 0, 3 * sizeof(uint32_t));
+    memset(max, 0, 3 * sizeof(uint32_t));
+
+    bool empty = true;
+    for(uint32_t i = 0; i < BRICK_VOLUME && brick != BRICK_EMPTY; ++i)
+    {
+        if(map->bricks.items[brick - 1].voxels[i] == 0)
+            continue;
+
+        uint32_t voxel[3];
+        morton_brick_coords(i, voxel);
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = empty || voxel[axis] < min[axis] ? voxel[axis] : min[axis];
+            max[axis] = empty || voxel[axis] + 1 > max[axis] ? voxel[axis] + 1 : max[axis];
+        }
+        empty = false;
+    }
+
+    for(int i = 0; i < 3; ++i)
+    {
+        min[i] += cell[i] * BRICK_SIZE;
+        max[i] += cell[i] * BRICK_SIZE;
+    }
+}
+
+static bool brickmap_raycast_brick(const Brick* brick, const int cell[3], const double o[3], const double d[3],
+    const int step[3], double t, double tExit, int axis, RayHit* hit)
+{
+    int base[3], voxel[3];
+    double tDelta[3], tNext[3];
+
+    for(int i = 0; i < 3; ++i)
+    {
+        base[i]  = cell[i] * (int) BRICK_SIZE;
+        voxel[i] = ray_clampi((int) floor(o[i] + d[i] * t), base[i], base[i] + (int) BRICK_SIZE - 1);
+
+        if(step[i] == 0)
+        {
+            tDelta[i] = DBL_MAX;
+            tNext[i]  = DBL_MAX;
+            continue;
+        }
+
+        tDelta[i] = 1.0 / fabs(d[i]);
+        tNext[i]  = ((double) (voxel[i] + (step[i] > 0)) - o[i]) / d[i];
+    }
+
+    while(t <= tExit)
+    {
+        ++hit->steps;
+
+        uint8_t value = brick->voxels[brick_voxel_index(voxel[0] - base[0], voxel[1] - base[1], voxel[2] - base[2])];
+        if(value != 0)
+        {
+            ray_fill_hit(d, voxel, step, axis, t, value, hit);
+            return true;
+        }
+
+        axis = ray_min_axis(tNext);
+        t    = tNext[axis];
+
+        voxel[axis] += step[axis];
+        if(voxel[axis] < base[axis] || voxel[axis] >= base[axis] + (int) BRICK_SIZE)
+            return false;
+
+        tNext[axis] += tDelta[axis];
+    }
+
+    return false;
+}
+
+// Exit distance of the ray through every axis of the brick box [first, last]
+static void brickmap_box_exit(const double o[3], const double d[3], const int step[3], const int first[3],
+    const int last[3], double tNext[3])
+{
+    for(int i = 0; i < 3; ++i)
+        tNext[i] = step[i] == 0 ? DBL_MAX : ((double) (step[i] > 0 ? last[i] + 1 : first[i]) * BRICK_SIZE - o[i]) / d[i];
+}
+
+// Radius of the cube of empty bricks around the cell, 0 or less when the distance field can't skip
+static int brickmap_distance_radius(const BrickMap* map, const int cell[3])
+{
+    int distance = map->distance[cell[0] + cell[1] * map->gridWidth + cell[2] * (map->gridWidth * map->gridHeight)];
+
+    // Manhattan distance d keeps empty the cube of radius (d - 1) / 3 inside its ball of radius d - 1
+    return map->metric == DISTANCE_CHEBYSHEV ? distance - 1 : (distance - 1) / 3;
+}
+
+// levelCount 1 without distance is the plain brick by brick DDA
+static bool brickmap_raycast_levels(const BrickMap* map, Vec3* origin, Vec3* direction, float tMax,
+    uint32_t levelCount, bool useDistance, RayHit* hit)
+{
+    const double o[3] = { origin->x, origin->y, origin->z };
+    const double d[3] = { direction->x, direction->y, direction->z };
+
+    const double size[3] = { (double) map->width, (double) map->height, (double) map->depth };
+    const int   grid[3] = { (int) map->gridWidth, (int) map->gridHeight, (int) map->gridDepth };
+
+    hit->steps = 0;
+
+    // Volume bounds
+    const double zero[3] = { 0.0, 0.0, 0.0 };
+
+    double tEnter, tExit;
+    int axis;
+    if(!ray_box_intersect(o, d, zero, size, tMax, &tEnter, &tExit, &axis))
+        return false;
+
+    // Hierarchical DDA over the occupancy pyramid, cell holds brick coordinates
+    int cell[3], step[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        step[i] = d[i] > 0.0 ? 1 : (d[i] < 0.0 ? -1 : 0);
+        cell[i] = ray_clampi((int) floor((o[i] + d[i] * tEnter) / BRICK_SIZE), 0, grid[i] - 1);
+    }
+
+    uint32_t level = 0;
+    while(level + 1 < levelCount && !brickmap_occupied(map, level + 1,
+        cell[0] >> (level + 1), cell[1] >> (level + 1), cell[2] >> (level + 1)))
+        ++level;
+
+    double t = tEnter;
+    while(t <= tExit)
+    {
+        ++hit->steps;
+
+        int levelCell[3] = { cell[0] >> level, cell[1] >> level, cell[2] >> level };
+        if(brickmap_occupied(map, level, levelCell[0], levelCell[1], levelCell[2]))
+        {
+            // Descend without moving, the finer cell holding the ray is checked next
+            if(level > 0)
+            {
+                --level;
+                continue;
+            }
+
+            uint32_t brick = map->grid[cell[0] + cell[1] * grid[0] + cell[2] * (grid[0] * grid[1])];
+            if(brickmap_raycast_brick(&map->bricks.items[brick - 1], cell, o, d, step, t, tExit, axis, hit))
+                return true;
+        }
+
+        // Exit of the current cell, 2^level bricks wide
+        int first[3], last[3];
+        for(int i = 0; i < 3; ++i)
+        {
+            first[i] = levelCell[i] << level;
+            last[i]  = ((levelCell[i] + 1) << level) - 1;
+        }
+
+        double tNext[3];
+        brickmap_box_exit(o, d, step, first, last, tNext);
+
+        // Every brick closer than the cell distance is empty, leave the cube around the cell when it reaches further
+        int radius = useDistance ? brickmap_distance_radius(map, cell) : 0;
+        if(radius > 0)
+        {
+            int cubeFirst[3], cubeLast[3];
+            for(int i = 0; i < 3; ++i)
+            {
+                cubeFirst[i] = cell[i] - radius > 0 ? cell[i] - radius : 0;
+                cubeLast[i]  = cell[i] + radius < grid[i] - 1 ? cell[i] + radius : grid[i] - 1;
+            }
+
+            double cubeNext[3];
+            brickmap_box_exit(o, d, step, cubeFirst, cubeLast, cubeNext);
+
+            if(cubeNext[ray_min_axis(cubeNext)] > tNext[ray_min_axis(tNext)])
+            {
+                memcpy(first, cubeFirst, sizeof(first));
+                memcpy(last, cubeLast, sizeof(last));
+                memcpy(tNext, cubeNext, sizeof(tNext));
+            }
+        }
+
+        axis = ray_min_axis(tNext);
+        t    = tNext[axis];
+
+        // The exit axis moves to the neighbour cell, the others follow the ray inside the box left
+        for(int i = 0; i < 3; ++i)
+        {
+            if(i == axis)
+                cell[i] = step[i] > 0 ? last[i] + 1 : first[i] - 1;
+            else
+                cell[i] = ray_clampi((int) floor((o[i] + d[i] * t) / BRICK_SIZE), first[i],
+                    last[i] < grid[i] - 1 ? last[i] : grid[i] - 1);
+        }
+
+        if(cell[axis] < 0 || cell[axis] >= grid[axis])
+            return false;
+
+        // Climb while the parent cell is empty
+        while(level + 1 < levelCount && !brickmap_occupied(map, level + 1,
+            cell[0] >> (level + 1), cell[1] >> (level + 1), cell[2] >> (level + 1)))
+            ++level;
+    }
+
+    return false;
+}
+
+bool brickmap_raycast(const BrickMap* map, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    return brickmap_raycast_levels(map, origin, direction, tMax, map->levelCount, true, hit);
+}
+
+float brickmap_estimate_intersections(const uint32_t size[3], const float (*boxes)[2][3], uint32_t boxCount,
+    uint32_t rayCount)
+{
+    const int grid[3] = {
+        (int) ((size[0] + BRICK_SIZE - 1) / BRICK_SIZE),
+        (int) ((size[1] + BRICK_SIZE - 1) / BRICK_SIZE),
+        (int) ((size[2] + BRICK_SIZE - 1) / BRICK_SIZE),
+    };
+
+    // Box of every cell, 0 without one. Inactive boxes, NaN or empty, pierce nothing
+    uint32_t* cells = (uint32_t*) calloc((size_t) grid[0] * grid[1] * grid[2], sizeof(uint32_t));
+    if(cells == NULL)
+        return 0.0f;
+
+    for(uint32_t i = 0; i < boxCount; ++i)
+    {
+        if(!(boxes[i][0][0] < boxes[i][1][0] && boxes[i][0][1] < boxes[i][1][1] && boxes[i][0][2] < boxes[i][1][2]))
+            continue;
+
+        int cell[3];
+        for(int axis = 0; axis < 3; ++axis)
+            cell[axis] = ray_clampi((int) (boxes[i][0][axis] / BRICK_SIZE), 0, grid[axis] - 1);
+
+        cells[cell[0] + cell[1] * grid[0] + cell[2] * (grid[0] * grid[1])] = i + 1;
+    }
+
+    const double zero[3]   = { 0.0, 0.0, 0.0 };
+    const double extent[3] = { size[0], size[1], size[2] };
+
+    uint64_t invocations = 0;
+    uint32_t boundsRays  = 0;
+    uint32_t state = RAY_SEED;
+
+    for(uint32_t r = 0; r < rayCount; ++r)
+    {
+        Vec3 origin, direction;
+        ray_random_ray(size, &state, &origin, &direction);
+
+        const double o[3] = { origin.x, origin.y, origin.z };
+        const double d[3] = { direction.x, direction.y, direction.z };
+
+        double tEnter, tExit;
+        int axis;
+        if(!ray_box_intersect(o, d, zero, extent, DBL_MAX, &tEnter, &tExit, &axis))
+            continue;
+
+        ++boundsRays;
+
+        // Every brick the ray crosses, the BVH invokes the shader for each tight box it pierces
+        int cell[3], step[3];
+        double tNext[3], tDelta[3];
+        for(int i = 0; i < 3; ++i)
+        {
+            step[i] = d[i] > 0.0 ? 1 : (d[i] < 0.0 ? -1 : 0);
+            cell[i] = ray_clampi((int) floor((o[i] + d[i] * tEnter) / BRICK_SIZE), 0, grid[i] - 1);
+
+            tDelta[i] = step[i] == 0 ? DBL_MAX : BRICK_SIZE / fabs(d[i]);
+            tNext[i]  = step[i] == 0 ? DBL_MAX : ((double) (cell[i] + (step[i] > 0)) * BRICK_SIZE - o[i]) / d[i];
+        }
+
+        while(true)
+        {
+            uint32_t box = cells[cell[0] + cell[1] * grid[0] + cell[2] * (grid[0] * grid[1])];
+
+            if(box != 0)
+            {
+                const double min[3] = { boxes[box - 1][0][0], boxes[box - 1][0][1], boxes[box - 1][0][2] };
+                const double max[3] = { boxes[box - 1][1][0], boxes[box - 1][1][1], boxes[box - 1][1][2] };
+
+                double t0, t1;
+                if(ray_box_intersect(o, d, min, max, DBL_MAX, &t0, &t1, &axis))
+                    ++invocations;
+            }
+
+            axis = ray_min_axis(tNext);
+            if(tNext[axis] > tExit)
+                break;
+
+            cell[axis] += step[axis];
+            if(cell[axis] < 0 || cell[axis] >= grid[axis])
+                break;
+
+            tNext[axis] += tDelta[axis];
+        }
+    }
+
+    free(cells);
+    return boundsRays ? (float) invocations / boundsRays : 0.0f;
+}
+
+uint32_t brickmap_benchmark_raycast(const BrickMap* map, uint32_t rayCount)
+{
+    // Every mode is compared against the first one, the brick by brick DDA
+    const char*    names[]     = { "linear", "distance", "hierarchical", "combined" };
+    const uint32_t levels[]    = { 1, 1, map->levelCount, map->levelCount };
+    const bool     distances[] = { false, true, false, true };
+
+    uint64_t steps[ARRAYLEN(names)]      = {0};
+    double   times[ARRAYLEN(names)]      = {0};
+    uint32_t mismatches[ARRAYLEN(names)] = {0};
+    uint32_t hits = 0;
+
+    uint32_t state = RAY_SEED;
+    const uint32_t size[3] = { map->width, map->height, map->depth };
+    Timer t;
+
+    for(uint32_t i = 0; i < rayCount; ++i)
+    {
+        Vec3 origin, direction;
+        ray_random_ray(size, &state, &origin, &direction);
+
+        RayHit reference = {0};
+        bool referenceHit = false;
+
+        for(size_t mode = 0; mode < ARRAYLEN(names); ++mode)
+        {
+            RayHit hit;
+
+            timer_start(&t);
+            bool hitFound = brickmap_raycast_levels(map, &origin, &direction, FLT_MAX, levels[mode], distances[mode], &hit);
+            timer_stop(&t);
+
+            times[mode] += timer_get_ns(&t);
+            steps[mode] += hit.steps;
+
+            if(mode == 0)
+            {
+                reference    = hit;
+                referenceHit = hitFound;
+                hits        += hitFound;
+            }
+            else if(hitFound != referenceHit || (hitFound && (hit.voxel.x != reference.voxel.x ||
+                hit.voxel.y != reference.voxel.y || hit.voxel.z != reference.voxel.z)))
+                ++mismatches[mode];
+        }
+    }
+
+    log_info("Brickmap raycast %ux%ux%u, %u rays (%u hits), %u levels, %s distance:",
+        map->width, map->height, map->depth, rayCount, hits, map->levelCount,
+        map->metric == DISTANCE_CHEBYSHEV ? "chebyshev" : "manhattan");
+
+    uint32_t total = 0;
+    for(size_t mode = 0; mode < ARRAYLEN(names); ++mode)
+    {
+        char timeStr[64];
+        time_to_str(timeStr, times[mode]);
+
+        log_info("    %-12s %.1f steps/ray in %s, %u mismatches", names[mode],
+            rayCount ? (double) steps[mode] / rayCount : 0.0, timeStr, mismatches[mode]);
+        total += mismatches[mode];
+    }
+    return total;
+}
+
+uint32_t brickmap_compare_raycast(const BrickMap* map, const char* name, RayCast cast, const void* volume,
+    uint32_t rayCount)
+{
+    uint64_t steps[2] = {0};
+    double   times[2] = {0};
+    uint32_t hits = 0, mismatches = 0;
+
+    uint32_t state = RAY_SEED;
+    const uint32_t size[3] = { map->width, map->height, map->depth };
+    Timer t;
+
+    for(uint32_t i = 0; i < rayCount; ++i)
+    {
+        Vec3 origin, direction;
+        ray_random_ray(size, &state, &origin, &direction);
+
+        RayHit reference;
+        timer_start(&t);
+        bool referenceHit = brickmap_raycast(map, &origin, &direction, FLT_MAX, &reference);
+        timer_stop(&t);
+        times[0] += timer_get_ns(&t);
+        steps[0] += reference.steps;
+
+        RayHit hit;
+        timer_start(&t);
+        bool hitFound = cast(volume, &origin, &direction, FLT_MAX, &hit);
+        timer_stop(&t);
+        times[1] += timer_get_ns(&t);
+        steps[1] += hit.steps;
+
+        hits += referenceHit;
+        if(hitFound != referenceHit || (hitFound && (hit.voxel.x != reference.voxel.x ||
+            hit.voxel.y != reference.voxel.y || hit.voxel.z != reference.voxel.z || hit.value != reference.value)))
+            ++mismatches;
+    }
+
+    const char* names[] = { "brickmap", name };
+    log_info("    %u rays (%u hits), %u %s mismatches", rayCount, hits, mismatches, name);
+    for(size_t mode = 0; mode < ARRAYLEN(names); ++mode)
+    {
+        char timeStr[64];
+        time_to_str(timeStr, times[mode]);
+        log_info("    %-9s %.1f steps/ray in %s", names[mode], rayCount ? (double) steps[mode] / rayCount : 0.0, timeStr);
+    }
+
+    return mismatches;
+}
@@ -0,0 +1,113 @@
+#ifndef BRICKMAP_H_
+#define BRICKMAP_H_
+
+#include "core/list.h"
+#include "core/vec.h"
+
+#include "voxel/distance.h"
+#include "voxel/ray.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Two level sparse voxel storage:
+ *  a coarse grid of BRICK_SIZE^3 cells where every cell holds 0 (empty brick)
+ *  or the index + 1 of its brick inside the brick pool. Empty bricks cost only
+ *  the grid cell.
+ *
+ *  On top of the grid sits an occupancy pyramid: level 0 has one bit per brick,
+ *  every level above is the max (OR) of 2x2x2 cells of the one below, so rays
+ *  skip empty regions of 2^n bricks in a single step.
+ *
+ *  Every grid cell also stores its distance in bricks to the nearest non empty
+ *  brick (Chebyshev or Manhattan), clamped to BRICKMAP_MAX_DISTANCE, rays leave
+ *  the empty cube around the cell in one step. Edits only rebuild the occupancy
+ *  and the distances of the region they can reach.
+ */
+
+#define BRICK_SIZE_LOG2 3
+#define BRICK_SIZE      (1u << BRICK_SIZE_LOG2)
+#define BRICK_VOLUME    (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+
+#define BRICK_EMPTY 0u
+
+#define BRICKMAP_MAX_LEVELS 16
+
+#define BRICKMAP_MAX_DISTANCE 16
+
+// Voxels in Morton order, see voxel/morton.h
+typedef struct {
+    uint8_t voxels[BRICK_VOLUME];
+} Brick;
+
+LIST_DEFINE(Brick, Bricks);
+LIST_DEFINE(uint32_t, BrickIndices);
+
+typedef struct {
+    uint32_t width, height, depth;
+    uint32_t gridWidth, gridHeight, gridDepth;
+
+    // Voxel space bounds [min, max) of the non zero voxels, all zero when the volume is empty
+    uint32_t boundsMin[3], boundsMax[3];
+
+    uint32_t*    grid;
+    Bricks       bricks;
+    BrickIndices freeBricks;
+
+    // First BRICKMAP_MAX_LEVELS words are the word offset of every level, then the bits of each level
+    uint32_t* occupancy;
+    size_t    occupancyWords;
+    uint32_t  levelCount;
+
+    // One byte per grid cell, padded to a multiple of 4 bytes for the shader
+    uint8_t*       distance;
+    DistanceMetric metric;
+} BrickMap;
+
+bool brickmap_create(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, DistanceMetric metric,
+    BrickMap* map);
+
+void brickmap_destroy(BrickMap* map);
+
+uint8_t brickmap_get(const BrickMap* map, uint32_t x, uint32_t y, uint32_t z);
+
+// Writes the size[0] x size[1] x size[2] voxels of data at min, the bricks emptied go back to the pool
+bool brickmap_edit(BrickMap* map, const uint32_t min[3], const uint32_t size[3], const uint8_t* data);
+
+size_t brickmap_grid_size(const BrickMap* map);
+
+size_t brickmap_memory_size(const BrickMap* map);
+
+size_t brickmap_occupancy_size(const BrickMap* map);
+
+bool brickmap_occupied(const BrickMap* map, uint32_t level, uint32_t x, uint32_t y, uint32_t z);
+
+size_t brickmap_distance_size(const BrickMap* map);
+
+// Voxel space bounds [min, max) of the non empty voxels in brick x, y, z
+void brickmap_brick_bounds(const BrickMap* map, uint32_t x, uint32_t y, uint32_t z, uint32_t min[3], uint32_t max[3]);
+
+// Compares sampleCount distances against the brute force reference, returns the mismatches
+uint32_t brickmap_check_distance(const BrickMap* map, uint32_t sampleCount);
+
+// CPU reference of the rayIntAabb hierarchical traversal, origin and direction in voxel space
+bool brickmap_raycast(const BrickMap* map, Vec3* origin, Vec3* direction, float tMax, RayHit* hit);
+
+// Average tight brick boxes pierced by the random rays entering the size[0] x size[1] x size[2] bounds, the
+// intersection shader invocations per ray with one AABB per non empty brick. boxes are [min, max) in voxels,
+// at most one per brick, the empty and NaN ones are skipped
+float brickmap_estimate_intersections(const uint32_t size[3], const float (*boxes)[2][3], uint32_t boxCount,
+    uint32_t rayCount);
+
+// Casts the same random rays with the brick by brick DDA, the distance field, the hierarchical DDA and both,
+// logs steps and mismatches against the brick by brick DDA. Returns the mismatches of every mode
+uint32_t brickmap_benchmark_raycast(const BrickMap* map, uint32_t rayCount);
+
+// Casts the same random rays through the brickmap and through cast of volume, logs steps and time of both.
+// Returns the rays whose hit voxel or value disagrees with the brickmap one
+uint32_t brickmap_compare_raycast(const BrickMap* map, const char* name, RayCast cast, const void* volume,
+    uint32_t rayCount);
+
+#endif // BRICKMAP_H_
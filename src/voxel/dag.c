@@ -0,0 +1,560 @@
+#include "dag.h"
+
+#include "voxel/bounds.h"
+#include "voxel/brickmap.h"
+
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define DAG_EMPTY_SLOT UINT32_MAX
+
+#define DAG_MIN_SLOTS 1024
+
+// Nodes this wide test their whole block for zeros before descending
+#define DAG_EMPTY_TEST_SIZE 16
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t       width, height, depth;
+    uint32_t       boundsMin[3], boundsMax[3];
+} DagSource;
+
+// One volume of a Dag for brickmap_compare_raycast
+typedef struct {
+    const Dag* dag;
+    uint32_t   index;
+} DagVolume;
+
+static uint32_t dag_hash(const uint32_t* words, uint32_t count)
+{
+    uint32_t hash = 0x811C9DC5u ^ count;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t k = words[i] * 0xCC9E2D51u;
+        k = (k << 15) | (k >> 17);
+        hash ^= k * 0x1B873593u;
+        hash = ((hash << 13) | (hash >> 19)) * 5u + 0xE6546B64u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static bool dag_grow_slots(Dag* dag)
+{
+    size_t slotCount = dag->slotCount > 0 ? dag->slotCount * 2 : DAG_MIN_SLOTS;
+
+    DagSlot* slots = (DagSlot*) malloc(slotCount * sizeof(DagSlot));
+    if(slots == NULL)
+        return false;
+
+    for(size_t i = 0; i < slotCount; ++i)
+        slots[i].node = DAG_EMPTY_SLOT;
+
+    // Every stored node keeps its hash, no need to know its size to move it
+    for(size_t i = 0; i < dag->slotCount; ++i)
+    {
+        if(dag->slots[i].node == DAG_EMPTY_SLOT)
+            continue;
+
+        size_t slot = dag->slots[i].hash & (slotCount - 1);
+        while(slots[slot].node != DAG_EMPTY_SLOT)
+            slot = (slot + 1) & (slotCount - 1);
+
+        slots[slot] = dag->slots[i];
+    }
+
+    free(dag->slots);
+    dag->slots     = slots;
+    dag->slotCount = slotCount;
+    return true;
+}
+
+// Slot of the node equal to words, or the free slot where it goes. Only the words are compared,
+// a longer node starting with the same ones reads the same
+static bool dag_lookup(const Dag* dag, const uint32_t* words, uint32_t count, uint32_t hash, size_t* slot)
+{
+    *slot = hash & (dag->slotCount - 1);
+
+    while(dag->slots[*slot].node != DAG_EMPTY_SLOT)
+    {
+        uint32_t other = dag->slots[*slot].node;
+        if(dag->slots[*slot].hash == hash && other + count <= dag->nodes.count &&
+            memcmp(dag->nodes.items + other, words, count * sizeof(uint32_t)) == 0)
+            return true;
+
+        *slot = (*slot + 1) & (dag->slotCount - 1);
+    }
+
+    return false;
+}
+
+// Index of the node equal to words, appended when there is none yet
+static bool dag_insert(Dag* dag, const uint32_t* words, uint32_t count, uint32_t* node)
+{
+    // Kept at most half full
+    if((dag->slotUsed + 1) * 2 > dag->slotCount && !dag_grow_slots(dag))
+        return false;
+
+    uint32_t hash = dag_hash(words, count);
+
+    size_t slot;
+    if(dag_lookup(dag, words, count, hash, &slot))
+    {
+        *node = dag->slots[slot].node;
+        return true;
+    }
+
+    if(dag->nodes.count + count > UINT32_MAX)
+    {
+        log_error("DAG over %u words", UINT32_MAX);
+        return false;
+    }
+
+    *node = (uint32_t) dag->nodes.count;
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t word = words[i];
+        list_append(dag->nodes, word);
+    }
+
+    if(dag->nodes.items == NULL)
+        return false;
+
+    dag->slots[slot] = (DagSlot) { .node = *node, .hash = hash };
+    ++dag->slotUsed;
+    return true;
+}
+
+// Puts the stored node in the table, found when an equal one is already there
+static bool dag_register(Dag* dag, uint32_t node, uint32_t count, bool* found)
+{
+    if((dag->slotUsed + 1) * 2 > dag->slotCount && !dag_grow_slots(dag))
+        return false;
+
+    const uint32_t* words = dag->nodes.items + node;
+    uint32_t hash = dag_hash(words, count);
+
+    size_t slot;
+    *found = dag_lookup(dag, words, count, hash, &slot);
+    if(*found)
+        return true;
+
+    dag->slots[slot] = (DagSlot) { .node = node, .hash = hash };
+    ++dag->slotUsed;
+    return true;
+}
+
+void dag_create(Dag* dag)
+{
+    *dag = (Dag) {0};
+}
+
+void dag_destroy(Dag* dag)
+{
+    list_destroy(dag->nodes);
+    list_destroy(dag->roots);
+    free(dag->slots);
+
+    *dag = (Dag) {0};
+}
+
+// Whether [x, x + size) on every axis misses the non zero voxels
+static bool dag_source_empty(const DagSource* source, uint32_t x, uint32_t y, uint32_t z, uint32_t size)
+{
+    const uint32_t min[3] = { x, y, z };
+
+    uint32_t first[3], last[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        first[i] = min[i] > source->boundsMin[i] ? min[i] : source->boundsMin[i];
+        last[i]  = min[i] + size < source->boundsMax[i] ? min[i] + size : source->boundsMax[i];
+
+        if(first[i] >= last[i])
+            return true;
+    }
+
+    return size <= DAG_EMPTY_TEST_SIZE && bounds_empty(source->data, source->width, source->height, first, last);
+}
+
+static uint8_t dag_source_get(const DagSource* source, uint32_t x, uint32_t y, uint32_t z)
+{
+    if(x >= source->width || y >= source->height || z >= source->depth)
+        return 0;
+    return source->data[x + (size_t) y * source->width + (size_t) z * source->width * source->height];
+}
+
+// Index of the node at x, y, z built bottom up, nothing is stored when it is empty
+static bool dag_build_node(Dag* dag, const DagSource* source, uint32_t x, uint32_t y, uint32_t z, uint32_t size,
+    uint32_t* node, bool* empty)
+{
+    *empty = dag_source_empty(source, x, y, z, size);
+    if(*empty)
+        return true;
+
+    uint32_t words[9] = {0};
+    uint32_t count;
+
+    if(size == 2)
+    {
+        // Leaf, the 8 voxel values
+        for(uint32_t c = 0; c < 8; ++c)
+            words[c >> 2] |= (uint32_t) dag_source_get(source, x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2)) << ((c & 3) * 8);
+
+        *empty = words[0] == 0 && words[1] == 0;
+        count = 2;
+    }
+    else
+    {
+        uint32_t half = size / 2;
+        count = 1;
+
+        for(uint32_t c = 0; c < 8; ++c)
+        {
+            bool childEmpty;
+            if(!dag_build_node(dag, source, x + (c & 1) * half, y + ((c >> 1) & 1) * half, z + (c >> 2) * half, half,
+                &words[count], &childEmpty))
+                return false;
+
+            if(childEmpty)
+                continue;
+
+            words[0] |= 1u << c;
+            ++count;
+        }
+
+        *empty = words[0] == 0;
+    }
+
+    return *empty || dag_insert(dag, words, count, node);
+}
+
+bool dag_add_volume(Dag* dag, uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t* index)
+{
+    ASSERT(width > 0 && height > 0 && depth > 0);
+
+    uint32_t maxSize = width > height ? (width > depth ? width : depth) : (height > depth ? height : depth);
+
+    DagRoot root = {
+        .width  = width,
+        .height = height,
+        .depth  = depth,
+        .levels = 1,
+    };
+
+    while((1u << root.levels) < maxSize)
+        ++root.levels;
+
+    if(root.levels > SVO_MAX_LEVELS)
+    {
+        log_error("DAG of %ux%ux%u over the %u levels limit", width, height, depth, SVO_MAX_LEVELS);
+        return false;
+    }
+
+    DagSource source = {
+        .data   = data,
+        .width  = width,
+        .height = height,
+        .depth  = depth,
+    };
+
+    // Empty volumes keep empty bounds, every node is then empty
+    bounds_scan(data, width, height, depth, source.boundsMin, source.boundsMax);
+
+    // The root of an empty volume is an empty leaf or an empty mask
+    const uint32_t emptyRoot[2] = { 0, 0 };
+
+    bool empty;
+    bool result = dag_build_node(dag, &source, 0, 0, 0, 1u << root.levels, &root.node, &empty);
+    if(result && empty)
+        result = dag_insert(dag, emptyRoot, root.levels == 1 ? 2 : 1, &root.node);
+
+    if(!result)
+    {
+        log_error("Could not build the DAG of %ux%ux%u", width, height, depth);
+        return false;
+    }
+
+    *index = (uint32_t) dag->roots.count;
+    list_append(dag->roots, root);
+    return dag->roots.items != NULL;
+}
+
+uint8_t dag_get(const Dag* dag, uint32_t index, uint32_t x, uint32_t y, uint32_t z)
+{
+    const DagRoot* root = &dag->roots.items[index];
+    if(x >= root->width || y >= root->height || z >= root->depth)
+        return 0;
+
+    uint32_t node = root->node;
+    for(uint32_t level = 0; level < root->levels; ++level)
+    {
+        uint32_t shift = root->levels - 1 - level;
+        uint32_t c = ((x >> shift) & 1) | ((y >> shift) & 1) << 1 | ((z >> shift) & 1) << 2;
+
+        if(level + 1 == root->levels)
+            return (uint8_t) (dag->nodes.items[node + (c >> 2)] >> ((c & 3) * 8));
+
+        uint32_t mask = dag->nodes.items[node];
+        if((mask & (1u << c)) == 0)
+            return 0;
+
+        node = dag->nodes.items[node + 1 + ray_child_offset(mask, c)];
+    }
+
+    return 0;
+}
+
+size_t dag_memory_size(const Dag* dag)
+{
+    return dag->nodes.count * sizeof(uint32_t);
+}
+
+static RayChild dag_fetch(const uint32_t* nodes, uint32_t node, uint32_t c, bool leaf, uint32_t* child,
+    uint8_t* value)
+{
+    if(leaf)
+    {
+        *value = (uint8_t) (nodes[node + (c >> 2)] >> ((c & 3) * 8));
+        return *value != 0 ? RAY_CHILD_VOXEL : RAY_CHILD_EMPTY;
+    }
+
+    uint32_t mask = nodes[node];
+    if((mask & (1u << c)) == 0)
+        return RAY_CHILD_EMPTY;
+
+    *child = nodes[node + 1 + ray_child_offset(mask, c)];
+    return RAY_CHILD_NODE;
+}
+
+bool dag_raycast(const Dag* dag, uint32_t index, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    const DagRoot* root = &dag->roots.items[index];
+
+    RayOctree tree = {
+        .nodes  = dag->nodes.items,
+        .root   = root->node,
+        .fetch  = dag_fetch,
+        .levels = root->levels,
+        .width  = root->width,
+        .height = root->height,
+        .depth  = root->depth,
+    };
+
+    return ray_march_octree(&tree, origin, direction, tMax, hit);
+}
+
+bool dag_save(const Dag* dag, const char* filepath)
+{
+    FILE* f = fopen(filepath, "wb");
+    if(f == NULL)
+    {
+        log_error("DAG save open: %s", filepath);
+        return false;
+    }
+
+    DagFileHeader header = {
+        .magic     = DAG_MAGIC,
+        .version   = DAG_VERSION,
+        .rootCount = (uint32_t) dag->roots.count,
+        .nodeCount = (uint32_t) dag->nodes.count,
+    };
+
+    bool result = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(dag->roots.items, sizeof(DagRoot), dag->roots.count, f) == dag->roots.count &&
+        fwrite(dag->nodes.items, sizeof(uint32_t), dag->nodes.count, f) == dag->nodes.count;
+
+    result &= fclose(f) == 0;
+    if(!result)
+        log_error("DAG save write: %s", filepath);
+
+    return result;
+}
+
+// Puts in the table every node reachable from node, a node found there already has its subtree there too
+static bool dag_register_tree(Dag* dag, uint32_t node, uint32_t level, uint32_t levels)
+{
+    bool found;
+    if(level + 1 == levels)
+        return node + 2 <= dag->nodes.count && dag_register(dag, node, 2, &found);
+
+    if(node >= dag->nodes.count)
+        return false;
+
+    uint32_t mask  = dag->nodes.items[node] & 0xFFu;
+    uint32_t count = 1 + (uint32_t) __builtin_popcount(mask);
+    if(node + count > dag->nodes.count || !dag_register(dag, node, count, &found))
+        return false;
+
+    if(found)
+        return true;
+
+    for(uint32_t i = 1; i < count; ++i)
+        if(!dag_register_tree(dag, dag->nodes.items[node + i], level + 1, levels))
+            return false;
+
+    return true;
+}
+
+bool dag_load(const char* filepath, Dag* dag)
+{
+    dag_create(dag);
+
+    FILE* f = fopen(filepath, "rb");
+    if(f == NULL)
+    {
+        log_error("DAG load open: %s", filepath);
+        return false;
+    }
+
+    DagFileHeader header;
+    bool result = fread(&header, sizeof(header), 1, f) == 1 && header.magic == DAG_MAGIC && header.version == DAG_VERSION;
+
+    if(result && header.rootCount > 0)
+    {
+        list_alloc(dag->roots, header.rootCount);
+        result = dag->roots.items != NULL && fread(dag->roots.items, sizeof(DagRoot), header.rootCount, f) == header.rootCount;
+        dag->roots.count = result ? header.rootCount : 0;
+    }
+
+    if(result && header.nodeCount > 0)
+    {
+        list_alloc(dag->nodes, header.nodeCount);
+        result = dag->nodes.items != NULL && fread(dag->nodes.items, sizeof(uint32_t), header.nodeCount, f) == header.nodeCount;
+        dag->nodes.count = result ? header.nodeCount : 0;
+    }
+
+    fclose(f);
+
+    // The nodes stay where they are, the table only finds them back
+    for(size_t i = 0; i < dag->roots.count && result; ++i)
+    {
+        result = dag->roots.items[i].levels > 0 && dag->roots.items[i].levels <= SVO_MAX_LEVELS &&
+            dag_register_tree(dag, dag->roots.items[i].node, 0, dag->roots.items[i].levels);
+    }
+
+    if(!result)
+    {
+        log_error("DAG load read: %s", filepath);
+        dag_destroy(dag);
+    }
+
+    return result;
+}
+
+static bool dag_cast(const void* volume, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    const DagVolume* dagVolume = (const DagVolume*) volume;
+    return dag_raycast(dagVolume->dag, dagVolume->index, origin, direction, tMax, hit);
+}
+
+bool dag_benchmark(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t rayCount)
+{
+    char timeStr[64], sizeStr[64];
+    Timer t;
+
+    size_t denseSize = (size_t) width * height * depth;
+
+    BrickMap brickMap;
+    timer_start(&t);
+    bool result = brickmap_create(width, height, depth, data, DISTANCE_CHEBYSHEV, &brickMap);
+    timer_stop(&t);
+    double brickMapTime = timer_get_ns(&t);
+
+    if(!result)
+        return false;
+
+    // Dense surfaces can overflow the 24 bit octree distances, the DAG has none
+    Svo svo;
+    timer_start(&t);
+    bool svoBuilt = svo_create(width, height, depth, data, &svo);
+    timer_stop(&t);
+    double svoTime = timer_get_ns(&t);
+
+    Dag dag;
+    dag_create(&dag);
+
+    uint32_t index;
+    timer_start(&t);
+    result = dag_add_volume(&dag, width, height, depth, data, &index);
+    timer_stop(&t);
+    double dagTime = timer_get_ns(&t);
+
+    if(!result)
+    {
+        dag_destroy(&dag);
+        if(svoBuilt)
+            svo_destroy(&svo);
+        brickmap_destroy(&brickMap);
+        return false;
+    }
+
+    log_info("DAG benchmark %ux%ux%u, %u levels:", width, height, depth, dag.roots.items[index].levels);
+
+    num_to_str(sizeStr, (double) denseSize);
+    log_info("    %-9s %sB", "dense", sizeStr);
+
+    time_to_str(timeStr, brickMapTime);
+    num_to_str(sizeStr, (double) brickmap_memory_size(&brickMap));
+    log_info("    %-9s %sB (%.3f%% of dense) built in %s", "brickmap", sizeStr,
+        100.0 * brickmap_memory_size(&brickMap) / denseSize, timeStr);
+
+    time_to_str(timeStr, svoTime);
+    if(svoBuilt)
+    {
+        num_to_str(sizeStr, (double) svo_memory_size(&svo));
+        log_info("    %-9s %sB (%.3f%% of dense) built in %s", "svo", sizeStr, 100.0 * svo_memory_size(&svo) / denseSize,
+            timeStr);
+    }
+    else
+        log_info("    %-9s over the distance limit after %s", "svo", timeStr);
+
+    time_to_str(timeStr, dagTime);
+    num_to_str(sizeStr, (double) dag_memory_size(&dag));
+    log_info("    %-9s %sB (%.3f%% of dense) built in %s", "dag", sizeStr, 100.0 * dag_memory_size(&dag) / denseSize, timeStr);
+
+    // Same random rays through both, the brickmap is the reference
+    DagVolume volume = { &dag, index };
+    uint32_t mismatches = brickmap_compare_raycast(&brickMap, "dag", dag_cast, &volume, rayCount);
+
+    dag_destroy(&dag);
+    if(svoBuilt)
+        svo_destroy(&svo);
+    brickmap_destroy(&brickMap);
+    return mismatches == 0;
+}
+
+bool dag_benchmark_terrain(uint32_t size, uint32_t rayCount)
+{
+    uint8_t* data = (uint8_t*) calloc((size_t) size * size * size, 1);
+    if(data == NULL)
+        return false;
+
+    // Rolling hills quantized to whole voxels, stone under dirt under grass
+    for(uint32_t z = 0; z < size; ++z)
+        for(uint32_t x = 0; x < size; ++x)
+        {
+            float hills = sinf(x * 0.049f) * cosf(z * 0.037f) + 0.5f * sinf((x + z) * 0.021f);
+            uint32_t top = (uint32_t) (size * (0.25f + 0.08f * hills));
+            if(top >= size)
+                top = size - 1;
+
+            for(uint32_t y = 0; y <= top; ++y)
+            {
+                uint8_t value = y == top ? 4 : (y + 3 >= top ? 3 : 2);
+                data[x + (size_t) y * size + (size_t) z * size * size] = value;
+            }
+        }
+
+    bool result = dag_benchmark(size, size, size, data, rayCount);
+    free(data);
+    return result;
+}
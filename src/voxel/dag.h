@@ -0,0 +1,89 @@
+#ifndef DAG_H_
+#define DAG_H_
+
+#include "core/list.h"
+#include "core/vec.h"
+
+#include "voxel/svo.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Sparse voxel DAG: the octree of voxel/svo.h with every identical subtree stored once.
+ *  Nodes are built bottom up from the dense voxels, each one is looked up in a hash table
+ *  of the nodes already stored before being appended, so a subtree repeated inside a
+ *  volume or across the volumes added to the same Dag costs a single copy.
+ *
+ *  A node is its child mask word followed by the node index of every non empty child
+ *  in child order, found with a popcount of the mask. Nodes two voxels wide are leaves:
+ *  two words holding their 8 voxel values, child c in byte c.
+ *
+ *  File layout, little endian: DagFileHeader, one DagRoot per volume, then the node words.
+ */
+
+#define DAG_MAGIC   0x47414456u // "VDAG"
+#define DAG_VERSION 1u
+
+typedef struct {
+    uint32_t width, height, depth;
+
+    // Root node is 2^levels voxels wide
+    uint32_t levels;
+    uint32_t node;
+} DagRoot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rootCount;
+    uint32_t nodeCount;
+} DagFileHeader;
+
+typedef struct {
+    uint32_t node;
+    uint32_t hash;
+} DagSlot;
+
+LIST_DEFINE(uint32_t, DagWords);
+LIST_DEFINE(DagRoot, DagRoots);
+
+typedef struct {
+    DagWords nodes;
+    DagRoots roots;
+
+    // Open addressing table over the stored nodes, host side only
+    DagSlot* slots;
+    size_t   slotCount;
+    size_t   slotUsed;
+} Dag;
+
+void dag_create(Dag* dag);
+
+void dag_destroy(Dag* dag);
+
+// Adds width x height x depth voxels, x fastest, sharing the subtrees of every volume already added.
+// index is its DagRoot
+bool dag_add_volume(Dag* dag, uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t* index);
+
+uint8_t dag_get(const Dag* dag, uint32_t index, uint32_t x, uint32_t y, uint32_t z);
+
+size_t dag_memory_size(const Dag* dag);
+
+// CPU reference of the rayIntDag traversal of volume index, origin and direction in voxel space
+bool dag_raycast(const Dag* dag, uint32_t index, Vec3* origin, Vec3* direction, float tMax, RayHit* hit);
+
+bool dag_save(const Dag* dag, const char* filepath);
+
+// Restores the nodes, the roots and the table, more volumes can be added to the loaded Dag
+bool dag_load(const char* filepath, Dag* dag);
+
+// Builds the brickmap, the octree and the DAG of the data, logs their build time and memory against the dense
+// volume and the DAG rays that disagree with the brickmap ones. Fails on any of them
+bool dag_benchmark(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t rayCount);
+
+// dag_benchmark on a size^3 layered terrain of rolling hills
+bool dag_benchmark_terrain(uint32_t size, uint32_t rayCount);
+
+#endif // DAG_H_
@@ -0,0 +1,269 @@
+#include "distance.h"
+
+#include "core/jobs.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DISTANCE_INF (1 << 24)
+
+#define DISTANCE_MIN_LINES_PER_JOB 256
+
+typedef struct {
+    int*            values;
+    const uint32_t* size;
+    uint32_t        axis;
+    DistanceMetric  metric;
+
+    atomic_bool failed;
+} DistancePass;
+
+static int distance_mini(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+static int distance_maxi(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+static int distance_absi(int v)
+{
+    return v < 0 ? -v : v;
+}
+
+static int distance_chebyshev_f(const int* g, int x, int i)
+{
+    return distance_maxi(distance_absi(x - i), g[i]);
+}
+
+// First x where the cone of u gets below the cone of i, with i < u
+static int distance_chebyshev_sep(const int* g, int i, int u)
+{
+    if(g[i] <= g[u])
+        return distance_maxi(i + g[u], (i + u) / 2);
+    return distance_mini(u - g[i], (i + u) / 2);
+}
+
+static void distance_chebyshev_line(const int* g, int n, int* s, int* t, int* out)
+{
+    // Lower envelope of max(|x - i|, g(i)), s holds the cells of the envelope and t where each one starts
+    int q = 0;
+    s[0] = 0;
+    t[0] = 0;
+
+    for(int u = 1; u < n; ++u)
+    {
+        while(q >= 0 && distance_chebyshev_f(g, t[q], s[q]) > distance_chebyshev_f(g, t[q], u))
+            --q;
+
+        if(q < 0)
+        {
+            q = 0;
+            s[0] = u;
+            continue;
+        }
+
+        int w = 1 + distance_chebyshev_sep(g, s[q], u);
+        if(w < n)
+        {
+            ++q;
+            s[q] = u;
+            t[q] = w;
+        }
+    }
+
+    for(int u = n - 1; u >= 0; --u)
+    {
+        out[u] = distance_chebyshev_f(g, u, s[q]);
+        if(u == t[q])
+            --q;
+    }
+}
+
+static void distance_manhattan_line(const int* g, int n, int* out)
+{
+    out[0] = g[0];
+    for(int u = 1; u < n; ++u)
+        out[u] = distance_mini(g[u], out[u - 1] + 1);
+
+    for(int u = n - 2; u >= 0; --u)
+        out[u] = distance_mini(out[u], out[u + 1] + 1);
+}
+
+// Lines [begin, end) of the pass
+static void distance_pass_range(uint32_t begin, uint32_t end, void* data)
+{
+    DistancePass* pass = (DistancePass*) data;
+
+    const uint32_t* size = pass->size;
+    uint32_t a = pass->axis, b = (a + 1) % 3, c = (a + 2) % 3;
+
+    size_t stride[3] = { 1, size[0], (size_t) size[0] * size[1] };
+    int n = (int) size[a];
+
+    int* scratch = (int*) malloc(4 * (size_t) n * sizeof(int));
+    if(scratch == NULL)
+    {
+        atomic_store(&pass->failed, true);
+        return;
+    }
+
+    int* g   = scratch;
+    int* out = scratch + n;
+    int* s   = scratch + 2 * n;
+    int* t   = scratch + 3 * n;
+
+    for(size_t line = begin; line < end; ++line)
+    {
+        size_t base = (line % size[b]) * stride[b] + (line / size[b]) * stride[c];
+
+        for(int u = 0; u < n; ++u)
+            g[u] = pass->values[base + u * stride[a]];
+
+        if(pass->metric == DISTANCE_CHEBYSHEV)
+            distance_chebyshev_line(g, n, s, t, out);
+        else
+            distance_manhattan_line(g, n, out);
+
+        for(int u = 0; u < n; ++u)
+            pass->values[base + u * stride[a]] = out[u];
+    }
+
+    free(scratch);
+}
+
+static bool distance_pass(int* values, const uint32_t size[3], uint32_t axis, DistanceMetric metric)
+{
+    uint32_t lineCount = size[(axis + 1) % 3] * size[(axis + 2) % 3];
+
+    DistancePass pass = {
+        .values = values,
+        .size   = size,
+        .axis   = axis,
+        .metric = metric,
+    };
+    atomic_init(&pass.failed, false);
+
+    // The calling thread takes its share of the lines
+    jobs_parallel_for(lineCount, DISTANCE_MIN_LINES_PER_JOB, distance_pass_range, &pass);
+
+    return !atomic_load(&pass.failed);
+}
+
+bool distance_transform_region(const uint32_t* cells, const uint32_t size[3], const uint32_t min[3], const uint32_t max[3],
+    DistanceMetric metric, uint32_t maxDistance, uint8_t* distance)
+{
+    if(maxDistance > UINT8_MAX)
+        maxDistance = UINT8_MAX;
+
+    // Window read by the transform, solid cells further than maxDistance from the region can't be the nearest
+    uint32_t windowMin[3], windowSize[3];
+    size_t count = 1;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(min[i] > max[i] || max[i] > size[i])
+            return false;
+
+        if(min[i] == max[i])
+            return true;
+
+        uint32_t windowMax = size[i] - max[i] > maxDistance ? max[i] + maxDistance : size[i];
+        windowMin[i]  = min[i] > maxDistance ? min[i] - maxDistance : 0;
+        windowSize[i] = windowMax - windowMin[i];
+        count *= windowSize[i];
+    }
+
+    int* values = (int*) malloc(count * sizeof(int));
+    if(values == NULL)
+        return false;
+
+    for(uint32_t z = 0; z < windowSize[2]; ++z)
+        for(uint32_t y = 0; y < windowSize[1]; ++y)
+        {
+            const uint32_t* src = cells + windowMin[0] + (size_t) (windowMin[1] + y) * size[0] +
+                (size_t) (windowMin[2] + z) * size[0] * size[1];
+            int* dst = values + (size_t) y * windowSize[0] + (size_t) z * windowSize[0] * windowSize[1];
+
+            for(uint32_t x = 0; x < windowSize[0]; ++x)
+                dst[x] = src[x] != 0 ? 0 : DISTANCE_INF;
+        }
+
+    bool result = distance_pass(values, windowSize, 0, metric) && distance_pass(values, windowSize, 1, metric) &&
+        distance_pass(values, windowSize, 2, metric);
+
+    if(result)
+    {
+        for(uint32_t z = min[2]; z < max[2]; ++z)
+            for(uint32_t y = min[1]; y < max[1]; ++y)
+                for(uint32_t x = min[0]; x < max[0]; ++x)
+                {
+                    int value = values[(x - windowMin[0]) + (size_t) (y - windowMin[1]) * windowSize[0] +
+                        (size_t) (z - windowMin[2]) * windowSize[0] * windowSize[1]];
+
+                    distance[x + (size_t) y * size[0] + (size_t) z * size[0] * size[1]] =
+                        (uint8_t) distance_mini(value, (int) maxDistance);
+                }
+    }
+
+    free(values);
+    return result;
+}
+
+bool distance_transform(const uint32_t* cells, const uint32_t size[3], DistanceMetric metric, uint32_t maxDistance,
+    uint8_t* distance)
+{
+    const uint32_t min[3] = { 0, 0, 0 };
+    return distance_transform_region(cells, size, min, size, metric, maxDistance, distance);
+}
+
+static uint32_t distance_brute_force(const uint32_t* cells, const uint32_t size[3], DistanceMetric metric,
+    uint32_t maxDistance, const int cell[3])
+{
+    int radius = (int) maxDistance;
+    int best   = radius;
+
+    for(int z = distance_maxi(cell[2] - radius, 0); z <= distance_mini(cell[2] + radius, (int) size[2] - 1); ++z)
+        for(int y = distance_maxi(cell[1] - radius, 0); y <= distance_mini(cell[1] + radius, (int) size[1] - 1); ++y)
+            for(int x = distance_maxi(cell[0] - radius, 0); x <= distance_mini(cell[0] + radius, (int) size[0] - 1); ++x)
+            {
+                if(cells[x + (size_t) y * size[0] + (size_t) z * size[0] * size[1]] == 0)
+                    continue;
+
+                int dx = distance_absi(x - cell[0]), dy = distance_absi(y - cell[1]), dz = distance_absi(z - cell[2]);
+                int d  = metric == DISTANCE_CHEBYSHEV ? distance_maxi(dx, distance_maxi(dy, dz)) : dx + dy + dz;
+
+                best = distance_mini(best, d);
+            }
+
+    return (uint32_t) best;
+}
+
+uint32_t distance_check(const uint32_t* cells, const uint32_t size[3], DistanceMetric metric, uint32_t maxDistance,
+    const uint8_t* distance, uint32_t sampleCount)
+{
+    if(maxDistance > UINT8_MAX)
+        maxDistance = UINT8_MAX;
+
+    size_t count = (size_t) size[0] * size[1] * size[2];
+    if(sampleCount == 0 || sampleCount > count)
+        sampleCount = (uint32_t) count;
+
+    uint32_t mismatches = 0;
+    for(uint32_t i = 0; i < sampleCount; ++i)
+    {
+        size_t index = count * i / sampleCount;
+        int cell[3] = {
+            (int) (index % size[0]),
+            (int) (index / size[0] % size[1]),
+            (int) (index / ((size_t) size[0] * size[1])),
+        };
+
+        if(distance[index] != distance_brute_force(cells, size, metric, maxDistance, cell))
+            ++mismatches;
+    }
+
+    return mismatches;
+}
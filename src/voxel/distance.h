@@ -0,0 +1,34 @@
+#ifndef DISTANCE_H_
+#define DISTANCE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Distance transform over a 3D grid of cells:
+ *  every cell stores the distance to the nearest solid (non zero) cell, clamped to maxDistance.
+ *  The transform is separable, one pass per axis where every line is independent, lines are
+ *  split between threads. Chebyshev lines use the lower envelope scan of Meijster et al.,
+ *  Manhattan lines a forward and a backward sweep.
+ *
+ *  Solid cells further than maxDistance can't change a clamped distance, so a region update
+ *  only reads the region grown by maxDistance.
+ */
+
+typedef enum {
+    DISTANCE_CHEBYSHEV,
+    DISTANCE_MANHATTAN,
+} DistanceMetric;
+
+// Recomputes the cells in [min, max), cells and distance are size[0] x size[1] x size[2] with x fastest
+bool distance_transform_region(const uint32_t* cells, const uint32_t size[3], const uint32_t min[3], const uint32_t max[3],
+    DistanceMetric metric, uint32_t maxDistance, uint8_t* distance);
+
+bool distance_transform(const uint32_t* cells, const uint32_t size[3], DistanceMetric metric, uint32_t maxDistance,
+    uint8_t* distance);
+
+// Brute force reference on sampleCount cells spread over the grid (every cell when 0), returns the mismatches
+uint32_t distance_check(const uint32_t* cells, const uint32_t size[3], DistanceMetric metric, uint32_t maxDistance,
+    const uint8_t* distance, uint32_t sampleCount);
+
+#endif // DISTANCE_H_
@@ -0,0 +1,267 @@
+#include "morton.h"
+
+#include "voxel/ray.h"
+
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+
+#define MORTON_MASK_X 0x09249249u
+#endif
+
+#define MORTON_BRICK_SIZE   (1u << MORTON_BRICK_BITS)
+#define MORTON_BRICK_VOLUME (MORTON_BRICK_SIZE * MORTON_BRICK_SIZE * MORTON_BRICK_SIZE)
+
+typedef enum {
+    MORTON_LAYOUT_ROWS,        // x + y * size + z * size^2
+    MORTON_LAYOUT_BRICK_ROWS,  // Bricks in rows, rows of x inside the bricks
+    MORTON_LAYOUT_BRICK_ORDER, // Bricks in rows, Morton order inside the bricks
+} MortonLayout;
+
+// The 3 bits of a brick coordinate two bits apart
+static const uint32_t mortonBrickSpread[MORTON_BRICK_SIZE] = {
+    0x000, 0x001, 0x008, 0x009, 0x040, 0x041, 0x048, 0x049,
+};
+
+#if !defined(__BMI2__)
+// Bits 0..9 of v spread to every third bit
+static uint32_t morton_spread(uint32_t v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8))  & 0x0300F00F;
+    v = (v | (v << 4))  & 0x030C30C3;
+    v = (v | (v << 2))  & 0x09249249;
+    return v;
+}
+
+static uint32_t morton_compact(uint32_t v)
+{
+    v &= 0x09249249;
+    v = (v | (v >> 2))  & 0x030C30C3;
+    v = (v | (v >> 4))  & 0x0300F00F;
+    v = (v | (v >> 8))  & 0x030000FF;
+    v = (v | (v >> 16)) & 0x000003FF;
+    return v;
+}
+#endif
+
+uint32_t morton_encode(uint32_t x, uint32_t y, uint32_t z)
+{
+#if defined(__BMI2__)
+    return _pdep_u32(x, MORTON_MASK_X) | _pdep_u32(y, MORTON_MASK_X << 1) | _pdep_u32(z, MORTON_MASK_X << 2);
+#else
+    return morton_spread(x) | morton_spread(y) << 1 | morton_spread(z) << 2;
+#endif
+}
+
+void morton_decode(uint32_t code, uint32_t xyz[3])
+{
+#if defined(__BMI2__)
+    xyz[0] = _pext_u32(code, MORTON_MASK_X);
+    xyz[1] = _pext_u32(code, MORTON_MASK_X << 1);
+    xyz[2] = _pext_u32(code, MORTON_MASK_X << 2);
+#else
+    xyz[0] = morton_compact(code);
+    xyz[1] = morton_compact(code >> 1);
+    xyz[2] = morton_compact(code >> 2);
+#endif
+}
+
+uint32_t morton_brick_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    return mortonBrickSpread[x] | mortonBrickSpread[y] << 1 | mortonBrickSpread[z] << 2;
+}
+
+void morton_brick_coords(uint32_t index, uint32_t xyz[3])
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        uint32_t bits = index >> i;
+        xyz[i] = (bits & 1) | ((bits >> 2) & 2) | ((bits >> 4) & 4);
+    }
+}
+
+static size_t morton_layout_index(MortonLayout layout, uint32_t size, uint32_t x, uint32_t y, uint32_t z)
+{
+    if(layout == MORTON_LAYOUT_ROWS)
+        return x + (size_t) y * size + (size_t) z * size * size;
+
+    uint32_t bricks = size >> MORTON_BRICK_BITS;
+    size_t brick = (x >> MORTON_BRICK_BITS) + (size_t) (y >> MORTON_BRICK_BITS) * bricks +
+        (size_t) (z >> MORTON_BRICK_BITS) * bricks * bricks;
+
+    uint32_t mask = MORTON_BRICK_SIZE - 1;
+    uint32_t local = layout == MORTON_LAYOUT_BRICK_ORDER ? morton_brick_index(x & mask, y & mask, z & mask) :
+        (x & mask) | (y & mask) << MORTON_BRICK_BITS | (z & mask) << (2 * MORTON_BRICK_BITS);
+
+    return brick * MORTON_BRICK_VOLUME + local;
+}
+
+// Voxel DDA from the entry of the size^3 box to the first non zero voxel
+static bool morton_march(const uint8_t* voxels, MortonLayout layout, uint32_t size, const Vec3* origin,
+    const Vec3* direction, uint32_t hit[3], uint32_t* steps)
+{
+    const float o[3] = { origin->x, origin->y, origin->z };
+    const float d[3] = { direction->x, direction->y, direction->z };
+
+    float tEnter = 0.0f, tExit = FLT_MAX;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(d[i] == 0.0f)
+        {
+            if(o[i] < 0.0f || o[i] >= (float) size)
+                return false;
+            continue;
+        }
+
+        float t0 = -o[i] / d[i], t1 = ((float) size - o[i]) / d[i];
+        tEnter = fmaxf(tEnter, fminf(t0, t1));
+        tExit  = fminf(tExit, fmaxf(t0, t1));
+    }
+
+    if(tEnter > tExit)
+        return false;
+
+    int voxel[3], step[3];
+    float tNext[3], tDelta[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        int v = (int) floorf(o[i] + d[i] * tEnter);
+        voxel[i]  = v < 0 ? 0 : (v >= (int) size ? (int) size - 1 : v);
+        step[i]   = d[i] > 0.0f ? 1 : (d[i] < 0.0f ? -1 : 0);
+        tDelta[i] = step[i] != 0 ? fabsf(1.0f / d[i]) : FLT_MAX;
+        tNext[i]  = step[i] != 0 ? ((float) (voxel[i] + (step[i] > 0)) - o[i]) / d[i] : FLT_MAX;
+    }
+
+    for(;;)
+    {
+        ++*steps;
+        if(voxels[morton_layout_index(layout, size, voxel[0], voxel[1], voxel[2])] != 0)
+        {
+            hit[0] = voxel[0];
+            hit[1] = voxel[1];
+            hit[2] = voxel[2];
+            return true;
+        }
+
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        voxel[axis] += step[axis];
+        if(voxel[axis] < 0 || voxel[axis] >= (int) size)
+            return false;
+
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+// Primary ray i of a side x side camera looking down across the volume, in 8x8 pixel tiles like a GPU dispatch
+static void morton_camera_ray(uint32_t size, uint32_t side, uint32_t i, Vec3* origin, Vec3* direction)
+{
+    uint32_t tile = i / 64, tilesX = side / 8;
+    uint32_t px = (tile % tilesX) * 8 + i % 8, py = (tile / tilesX) * 8 + (i % 64) / 8;
+
+    float u = (px + 0.5f) / side - 0.5f, v = (py + 0.5f) / side - 0.5f;
+
+    *origin    = (Vec3) { -0.3f * size, 1.2f * size, -0.3f * size };
+    *direction = (Vec3) {
+        0.577f + u * 0.707f + v * 0.408f,
+        -0.577f             + v * 0.816f,
+        0.577f - u * 0.707f + v * 0.408f,
+    };
+}
+
+bool morton_benchmark(uint32_t size, uint32_t rayCount)
+{
+    char timeStr[64];
+    Timer t;
+
+    size = (size + MORTON_BRICK_SIZE - 1) & ~(MORTON_BRICK_SIZE - 1);
+
+    // Whole 8x8 tiles of camera rays
+    uint32_t side = ((uint32_t) sqrtf((float) rayCount)) & ~7u;
+    rayCount = side * side;
+
+    uint8_t* voxels = (uint8_t*) malloc((size_t) size * size * size);
+    uint32_t* hits  = (uint32_t*) malloc((size_t) rayCount * 2 * 4 * sizeof(uint32_t));
+    if(voxels == NULL || hits == NULL)
+    {
+        free(voxels);
+        free(hits);
+        return false;
+    }
+
+    const char* names[] = { "rows", "brick rows", "brick morton" };
+    const char* rayNames[] = { "random", "camera" };
+    const uint32_t bounds[3] = { size, size, size };
+
+    log_info("Morton benchmark %u^3, %u random rays and %ux%u camera rays:", size, rayCount, side, side);
+
+    uint32_t totalMismatches = 0;
+
+    for(MortonLayout layout = MORTON_LAYOUT_ROWS; layout <= MORTON_LAYOUT_BRICK_ORDER; ++layout)
+    {
+        // Rolling hills with caves, written straight in the layout
+        for(uint32_t z = 0; z < size; ++z)
+            for(uint32_t y = 0; y < size; ++y)
+                for(uint32_t x = 0; x < size; ++x)
+                {
+                    float hills = sinf(x * 0.049f) * cosf(z * 0.037f) + 0.5f * sinf((x + z) * 0.021f);
+                    float caves = sinf(x * 0.11f) * sinf(y * 0.13f) * sinf(z * 0.07f);
+                    bool solid = y <= size * (0.45f + 0.08f * hills) && caves < 0.35f;
+
+                    voxels[morton_layout_index(layout, size, x, y, z)] = solid ? 1 : 0;
+                }
+
+        for(uint32_t rays = 0; rays < ARRAYLEN(rayNames); ++rays)
+        {
+            uint64_t steps = 0;
+            uint32_t hitCount = 0, mismatches = 0;
+
+            uint32_t state = RAY_SEED;
+            timer_start(&t);
+            for(uint32_t i = 0; i < rayCount; ++i)
+            {
+                Vec3 origin, direction;
+                if(rays == 0)
+                    ray_random_ray(bounds, &state, &origin, &direction);
+                else
+                    morton_camera_ray(size, side, i, &origin, &direction);
+
+                uint32_t stepCount = 0, voxel[3];
+                bool hit = morton_march(voxels, layout, size, &origin, &direction, voxel, &stepCount);
+                steps += stepCount;
+                hitCount += hit;
+
+                // The rows give the reference every other layout has to match
+                uint32_t* reference = &hits[((size_t) rays * rayCount + i) * 4];
+                if(layout == MORTON_LAYOUT_ROWS)
+                {
+                    reference[0] = hit;
+                    reference[1] = hit ? voxel[0] : 0;
+                    reference[2] = hit ? voxel[1] : 0;
+                    reference[3] = hit ? voxel[2] : 0;
+                }
+                else if(reference[0] != (uint32_t) hit ||
+                    (hit && (reference[1] != voxel[0] || reference[2] != voxel[1] || reference[3] != voxel[2])))
+                    ++mismatches;
+            }
+            timer_stop(&t);
+
+            double ns = timer_get_ns(&t);
+            time_to_str(timeStr, ns);
+            log_info("    %-12s %-6s %s, %.1f ns/step, %.1f steps/ray, %u hits, %u mismatches", names[layout],
+                rayNames[rays], timeStr, steps ? ns / steps : 0.0, (double) steps / rayCount, hitCount, mismatches);
+            totalMismatches += mismatches;
+        }
+    }
+
+    free(hits);
+    free(voxels);
+    return totalMismatches == 0;
+}
@@ -0,0 +1,35 @@
+#ifndef MORTON_H_
+#define MORTON_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Morton (Z-order) codes: the bits of x, y and z interleaved, x in the lowest bit.
+ *  Every aligned 2^n cube is contiguous, a voxel DDA stepping along any axis stays
+ *  on the same cache lines far longer than with rows of x. Bricks store their voxels
+ *  in this order, the 3 bits per axis of a brick make 9 bit indices.
+ *
+ *  The full width codes use BMI2 pdep/pext when the compiler targets it, shifts and
+ *  masks otherwise. Brick indices go through a table of the spread 3 bit values.
+ */
+
+#define MORTON_BITS 10 // Per axis of morton_encode
+
+#define MORTON_BRICK_BITS 3 // Per axis of morton_brick_index
+
+uint32_t morton_encode(uint32_t x, uint32_t y, uint32_t z);
+
+void morton_decode(uint32_t code, uint32_t xyz[3]);
+
+// Index of x, y, z inside a 2^MORTON_BRICK_BITS wide brick
+uint32_t morton_brick_index(uint32_t x, uint32_t y, uint32_t z);
+
+void morton_brick_coords(uint32_t index, uint32_t xyz[3]);
+
+// Marches the same random rays through a size^3 layered terrain stored as rows of x, as bricks of rows
+// and as bricks in Morton order, logs time and steps of each and the hits that disagree with the rows.
+// Fails on any of them
+bool morton_benchmark(uint32_t size, uint32_t rayCount);
+
+#endif // MORTON_H_
@@ -0,0 +1,186 @@
+#include "palette.h"
+
+#include <string.h>
+
+static uint32_t palette_entries(uint32_t width)
+{
+    return width == PALETTE_RAW_WIDTH ? 0 : 1u << (1u << width);
+}
+
+static uint32_t palette_span_words(uint32_t width)
+{
+    return (palette_entries(width) + 3) / 4 + BRICK_VOLUME * (1u << width) / 32;
+}
+
+// Narrowest width holding the count entries
+static uint32_t palette_width(uint32_t count)
+{
+    for(uint32_t width = 0; width < PALETTE_RAW_WIDTH; ++width)
+        if(count <= palette_entries(width))
+            return width;
+    return PALETTE_RAW_WIDTH;
+}
+
+// Span of width for brick, reuses its own when the width didn't change
+static uint32_t palette_alloc_span(BrickPalette* palette, uint32_t brick, uint32_t width)
+{
+    uint32_t none = PALETTE_NO_SPAN;
+    while(palette->table.count <= brick)
+        list_append(palette->table, none);
+
+    uint32_t entry = palette->table.items[brick];
+    if(entry != PALETTE_NO_SPAN)
+    {
+        if((entry & 3u) == width)
+            return entry >> 2;
+
+        uint32_t released = entry >> 2;
+        list_append(palette->freeSpans[entry & 3u], released);
+    }
+
+    uint32_t offset;
+
+    PaletteWords* freeSpans = &palette->freeSpans[width];
+    if(freeSpans->count > 0)
+        offset = freeSpans->items[--freeSpans->count];
+    else
+    {
+        offset = (uint32_t) palette->words.count;
+
+        uint32_t zero = 0;
+        for(uint32_t i = 0; i < palette_span_words(width); ++i)
+            list_append(palette->words, zero);
+    }
+
+    palette->table.items[brick] = offset << 2 | width;
+    return offset;
+}
+
+static void palette_encode(BrickPalette* palette, uint32_t brick, const Brick* voxels)
+{
+    // Entry of every value in first seen order, 0 always takes entry 0
+    uint8_t entries[256] = {0};
+    uint8_t lookup[256]  = {0};
+    bool    seen[256]    = { true };
+    uint32_t count = 1;
+
+    for(uint32_t i = 0; i < BRICK_VOLUME; ++i)
+    {
+        uint8_t value = voxels->voxels[i];
+        if(seen[value])
+            continue;
+
+        seen[value]     = true;
+        lookup[value]   = (uint8_t) count;
+        entries[count++] = value;
+    }
+
+    uint32_t width = palette_width(count);
+    uint32_t bits  = 1u << width;
+
+    // Taken once the span is allocated, the words may move
+    uint32_t  offset = palette_alloc_span(palette, brick, width);
+    uint32_t* span   = palette->words.items + offset;
+    memset(span, 0, palette_span_words(width) * sizeof(uint32_t));
+
+    uint32_t paletteWords = (palette_entries(width) + 3) / 4;
+    for(uint32_t i = 0; i < count && paletteWords > 0; ++i)
+        span[i >> 2] |= (uint32_t) entries[i] << ((i & 3) * 8);
+
+    // The indices never straddle two words, bits divides 32
+    uint32_t* indices = span + paletteWords;
+    for(uint32_t i = 0; i < BRICK_VOLUME; ++i)
+    {
+        uint32_t index = width == PALETTE_RAW_WIDTH ? voxels->voxels[i] : lookup[voxels->voxels[i]];
+        uint32_t bit   = i * bits;
+        indices[bit >> 5] |= index << (bit & 31);
+    }
+}
+
+void palette_create(const BrickMap* map, BrickPalette* palette)
+{
+    *palette = (BrickPalette) {0};
+
+    for(size_t i = 0; i < map->bricks.count; ++i)
+        palette_encode(palette, (uint32_t) i, &map->bricks.items[i]);
+}
+
+void palette_destroy(BrickPalette* palette)
+{
+    list_destroy(palette->table);
+    list_destroy(palette->words);
+    for(uint32_t width = 0; width < PALETTE_WIDTHS; ++width)
+        list_destroy(palette->freeSpans[width]);
+
+    *palette = (BrickPalette) {0};
+}
+
+void palette_update(BrickPalette* palette, const BrickMap* map, const uint32_t min[3], const uint32_t size[3])
+{
+    uint32_t brickMin[3], brickMax[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        if(size[i] == 0)
+            return;
+
+        brickMin[i] = min[i] >> BRICK_SIZE_LOG2;
+        brickMax[i] = (min[i] + size[i] + BRICK_SIZE - 1) >> BRICK_SIZE_LOG2;
+    }
+
+    // Emptied bricks keep their span, the pool hands their index out again
+    for(uint32_t bz = brickMin[2]; bz < brickMax[2]; ++bz)
+        for(uint32_t by = brickMin[1]; by < brickMax[1]; ++by)
+            for(uint32_t bx = brickMin[0]; bx < brickMax[0]; ++bx)
+            {
+                uint32_t cell = map->grid[bx + by * map->gridWidth + bz * (map->gridWidth * map->gridHeight)];
+                if(cell == BRICK_EMPTY)
+                    continue;
+
+                palette_encode(palette, cell - 1, &map->bricks.items[cell - 1]);
+            }
+}
+
+uint8_t palette_get(const BrickPalette* palette, uint32_t brick, uint32_t voxel)
+{
+    uint32_t entry = palette->table.items[brick];
+    uint32_t width = entry & 3u;
+    uint32_t bits  = 1u << width;
+
+    const uint32_t* span = palette->words.items + (entry >> 2);
+    uint32_t paletteWords = (palette_entries(width) + 3) / 4;
+
+    uint32_t bit   = voxel * bits;
+    uint32_t index = (span[paletteWords + (bit >> 5)] >> (bit & 31)) & ((1u << bits) - 1);
+
+    if(width == PALETTE_RAW_WIDTH)
+        return (uint8_t) index;
+
+    return (uint8_t) (span[index >> 2] >> ((index & 3) * 8));
+}
+
+uint32_t palette_bits(const BrickPalette* palette, uint32_t brick)
+{
+    return 1u << (palette->table.items[brick] & 3u);
+}
+
+size_t palette_memory_size(const BrickPalette* palette)
+{
+    return (palette->table.count + palette->words.count) * sizeof(uint32_t);
+}
+
+uint32_t palette_check(const BrickPalette* palette, const BrickMap* map)
+{
+    uint32_t mismatches = 0;
+    for(size_t i = 0; i < brickmap_grid_size(map); ++i)
+    {
+        uint32_t cell = map->grid[i];
+        if(cell == BRICK_EMPTY)
+            continue;
+
+        for(uint32_t voxel = 0; voxel < BRICK_VOLUME; ++voxel)
+            if(palette_get(palette, cell - 1, voxel) != map->bricks.items[cell - 1].voxels[voxel])
+                ++mismatches;
+    }
+
+    return mismatches;
+}
@@ -0,0 +1,58 @@
+#ifndef PALETTE_H_
+#define PALETTE_H_
+
+#include "core/list.h"
+
+#include "voxel/brickmap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Bit packed palette encoding of the bricks of a BrickMap, the layout read by rayIntAabb:
+ *  every brick stores the distinct values it holds in a small palette and one index per
+ *  voxel, 1, 2, 4 or 8 bits wide, the narrowest one its palette fits in. Entry 0 of every
+ *  palette is the empty value 0, a zero index is empty without resolving it. Bricks of
+ *  more than 16 values store the values themselves in 8 bits, without a palette.
+ *
+ *  The table holds one word per brick of the pool: the word offset of its span << 2 | log2
+ *  of its index bits. A span is the palette, 4 entries per word, then the indices, voxel i
+ *  at bit i * bits. Every span of one width has the same size, an edit changing the width
+ *  of a brick moves it to a span of the new width and keeps the old one for the next brick.
+ */
+
+#define PALETTE_WIDTHS    4
+#define PALETTE_RAW_WIDTH 3 // log2 of the bits of the bricks without a palette
+
+#define PALETTE_NO_SPAN UINT32_MAX
+
+LIST_DEFINE(uint32_t, PaletteWords);
+
+typedef struct {
+    PaletteWords table;
+    PaletteWords words;
+
+    // Spans given back by the bricks that changed width, for every width
+    PaletteWords freeSpans[PALETTE_WIDTHS];
+} BrickPalette;
+
+void palette_create(const BrickMap* map, BrickPalette* palette);
+
+void palette_destroy(BrickPalette* palette);
+
+// Re-encodes the bricks holding the voxels of the region, after brickmap_edit wrote them
+void palette_update(BrickPalette* palette, const BrickMap* map, const uint32_t min[3], const uint32_t size[3]);
+
+// Value of the voxel at Morton index voxel of brick, resolved through its palette
+uint8_t palette_get(const BrickPalette* palette, uint32_t brick, uint32_t voxel);
+
+// Bits per index of brick
+uint32_t palette_bits(const BrickPalette* palette, uint32_t brick);
+
+size_t palette_memory_size(const BrickPalette* palette);
+
+// Decodes every brick referenced by the grid, returns the voxels that differ from the map
+uint32_t palette_check(const BrickPalette* palette, const BrickMap* map);
+
+#endif // PALETTE_H_
@@ -0,0 +1,204 @@
+#include "ray.h"
+
+#include "core/core.h"
+
+#include <float.h>
+#include <math.h>
+
+int ray_clampi(int v, int min, int max)
+{
+    return v < min ? min : (v > max ? max : v);
+}
+
+int ray_min_axis(const double t[3])
+{
+    if(t[0] < t[1])
+        return t[0] < t[2] ? 0 : 2;
+    return t[1] < t[2] ? 1 : 2;
+}
+
+uint32_t ray_child_offset(uint32_t mask, uint32_t c)
+{
+    return (uint32_t) __builtin_popcount(mask & ((1u << c) - 1u));
+}
+
+bool ray_box_intersect(const double o[3], const double d[3], const double min[3], const double max[3], double tMax,
+    double* tEnter, double* tExit, int* axis)
+{
+    *tEnter = 0.0;
+    *tExit  = tMax;
+    *axis   = -1;
+
+    for(int i = 0; i < 3; ++i)
+    {
+        if(d[i] == 0.0)
+        {
+            if(o[i] < min[i] || o[i] > max[i])
+                return false;
+            continue;
+        }
+
+        double t0 = (min[i] - o[i]) / d[i], t1 = (max[i] - o[i]) / d[i];
+        if(t0 > t1)
+        {
+            double tmp = t0;
+            t0 = t1;
+            t1 = tmp;
+        }
+
+        if(t0 > *tEnter)
+        {
+            *tEnter = t0;
+            *axis   = i;
+        }
+
+        if(t1 < *tExit)
+            *tExit = t1;
+    }
+
+    return *tEnter <= *tExit;
+}
+
+void ray_fill_hit(const double d[3], const int voxel[3], const int step[3], int axis, double t, uint8_t value,
+    RayHit* hit)
+{
+    hit->t     = t;
+    hit->value = value;
+    hit->voxel = (IVec3) { voxel[0], voxel[1], voxel[2] };
+
+    float normal[3] = { 0.0f, 0.0f, 0.0f };
+    if(axis < 0)
+    {
+        // Origin inside a solid voxel, face the ray back along its dominant axis
+        axis = fabs(d[0]) > fabs(d[1]) ? (fabs(d[0]) > fabs(d[2]) ? 0 : 2) : (fabs(d[1]) > fabs(d[2]) ? 1 : 2);
+    }
+    normal[axis] = (float) -step[axis];
+    hit->normal  = (Vec3) { normal[0], normal[1], normal[2] };
+}
+
+float ray_random(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (float) (*state >> 8) / (float) (1u << 24);
+}
+
+void ray_random_ray(const uint32_t size[3], uint32_t* state, Vec3* origin, Vec3* direction)
+{
+    Vec3 center = { size[0] * 0.5f, size[1] * 0.5f, size[2] * 0.5f };
+    float radius = sqrtf(center.x * center.x + center.y * center.y + center.z * center.z) * 2.0f;
+
+    float theta = ray_random(state) * 6.2831853f;
+    float z     = ray_random(state) * 2.0f - 1.0f;
+    float r     = sqrtf(1.0f - z * z);
+
+    *origin = (Vec3) {
+        center.x + radius * r * cosf(theta),
+        center.y + radius * r * sinf(theta),
+        center.z + radius * z,
+    };
+
+    Vec3 target = {
+        ray_random(state) * size[0],
+        ray_random(state) * size[1],
+        ray_random(state) * size[2],
+    };
+
+    Vec3 delta = { target.x - origin->x, target.y - origin->y, target.z - origin->z };
+    float length = sqrtf(delta.x * delta.x + delta.y * delta.y + delta.z * delta.z);
+    *direction = (Vec3) { delta.x / length, delta.y / length, delta.z / length };
+}
+
+bool ray_march_octree(const RayOctree* tree, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    ASSERT(tree->levels <= RAY_MAX_LEVELS);
+
+    const double o[3] = { origin->x, origin->y, origin->z };
+    const double d[3] = { direction->x, direction->y, direction->z };
+
+    const int    dims[3] = { (int) tree->width, (int) tree->height, (int) tree->depth };
+    const double size[3] = { (double) tree->width, (double) tree->height, (double) tree->depth };
+    const double zero[3] = { 0.0, 0.0, 0.0 };
+
+    hit->steps = 0;
+
+    double tEnter, tExit;
+    int axis;
+    if(!ray_box_intersect(o, d, zero, size, tMax, &tEnter, &tExit, &axis))
+        return false;
+
+    int cell[3], step[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        step[i] = d[i] > 0.0 ? 1 : (d[i] < 0.0 ? -1 : 0);
+        cell[i] = ray_clampi((int) floor(o[i] + d[i] * tEnter), 0, dims[i] - 1);
+    }
+
+    // Node holding the cell on every level, the levels above the current one stay valid
+    uint32_t stack[RAY_MAX_LEVELS];
+    stack[0] = tree->root;
+
+    int levels = (int) tree->levels;
+    int level  = 0;
+
+    double t = tEnter;
+    while(t <= tExit)
+    {
+        ++hit->steps;
+
+        // Descend to the empty child or the voxel holding the cell
+        int emptyShift = -1;
+        while(emptyShift < 0)
+        {
+            int shift = levels - 1 - level;
+            uint32_t c = ((cell[0] >> shift) & 1) | ((cell[1] >> shift) & 1) << 1 | ((cell[2] >> shift) & 1) << 2;
+
+            uint32_t next  = 0;
+            uint8_t  value = 0;
+            RayChild child = tree->fetch(tree->nodes, stack[level], c, level == levels - 1, &next, &value);
+
+            if(child == RAY_CHILD_EMPTY)
+                emptyShift = shift;
+            else if(child == RAY_CHILD_VOXEL)
+            {
+                ray_fill_hit(d, cell, step, axis, t, value, hit);
+                return true;
+            }
+            else
+                stack[++level] = next;
+        }
+
+        // Exit of the empty child, 2^emptyShift voxels wide
+        int first[3], last[3];
+        double tNext[3];
+        for(int i = 0; i < 3; ++i)
+        {
+            first[i] = cell[i] >> emptyShift << emptyShift;
+            last[i]  = first[i] + (1 << emptyShift) - 1;
+            tNext[i] = step[i] == 0 ? DBL_MAX : ((double) (step[i] > 0 ? last[i] + 1 : first[i]) - o[i]) / d[i];
+        }
+
+        axis = ray_min_axis(tNext);
+        t    = tNext[axis];
+
+        // The exit axis moves to the neighbour cell, the others follow the ray inside the box left
+        int moved = 0;
+        for(int i = 0; i < 3; ++i)
+        {
+            int next = i == axis ? (step[i] > 0 ? last[i] + 1 : first[i] - 1) :
+                ray_clampi((int) floor(o[i] + d[i] * t), first[i], last[i] < dims[i] - 1 ? last[i] : dims[i] - 1);
+
+            moved |= next ^ cell[i];
+            cell[i] = next;
+        }
+
+        if(cell[axis] < 0 || cell[axis] >= dims[axis])
+            return false;
+
+        // Back to the deepest node holding both cells
+        int common = levels - 1 - (31 - __builtin_clz((uint32_t) moved));
+        if(common < level)
+            level = common;
+    }
+
+    return false;
+}
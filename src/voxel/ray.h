@@ -0,0 +1,79 @@
+#ifndef RAY_H_
+#define RAY_H_
+
+#include "core/vec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  CPU ray marching shared by the voxel volumes: the slab test, the DDA steps, the
+ *  hit of a voxel and the random rays of the benchmarks. Origins and distances are
+ *  doubles, so a ray grazing an edge crosses the same cells in every structure.
+ *
+ *  The octree march serves the SVO and the DAG, which only differ in how a node
+ *  reaches its children: the RayFetch of the octree returns the child node or the
+ *  voxel value. Child c sits at x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2).
+ */
+
+#define RAY_SEED 0x9E3779B9u
+
+#define RAY_MAX_LEVELS 16
+
+typedef struct {
+    float    t;
+    uint8_t  value;
+    IVec3    voxel;
+    Vec3     normal;
+    uint32_t steps;
+} RayHit;
+
+typedef enum {
+    RAY_CHILD_EMPTY,
+    RAY_CHILD_NODE,
+    RAY_CHILD_VOXEL,
+} RayChild;
+
+// Child c of node, its node index in child or its voxel in value when the node is a leaf, two voxels wide
+typedef RayChild (*RayFetch)(const uint32_t* nodes, uint32_t node, uint32_t c, bool leaf, uint32_t* child,
+    uint8_t* value);
+
+typedef struct {
+    const uint32_t* nodes;
+    uint32_t        root;
+    RayFetch        fetch;
+
+    // Root node is 2^levels voxels wide
+    uint32_t levels;
+    uint32_t width, height, depth;
+} RayOctree;
+
+// Any volume raycast, volume is its first argument
+typedef bool (*RayCast)(const void* volume, Vec3* origin, Vec3* direction, float tMax, RayHit* hit);
+
+int ray_clampi(int v, int min, int max);
+
+// Axis of the smallest distance, the one a DDA steps along
+int ray_min_axis(const double t[3]);
+
+// Slot of child c among the non empty children of mask
+uint32_t ray_child_offset(uint32_t mask, uint32_t c);
+
+// Slab test against [min, max], axis is the entry axis or -1 when the origin is inside
+bool ray_box_intersect(const double o[3], const double d[3], const double min[3], const double max[3], double tMax,
+    double* tEnter, double* tExit, int* axis);
+
+// Hit of voxel entered through axis, -1 faces the ray back along its dominant axis
+void ray_fill_hit(const double d[3], const int voxel[3], const int step[3], int axis, double t, uint8_t value,
+    RayHit* hit);
+
+float ray_random(uint32_t* state);
+
+// Rays from a sphere around the size[0] x size[1] x size[2] volume towards random points inside it, the same
+// ones for the same state
+void ray_random_ray(const uint32_t size[3], uint32_t* state, Vec3* origin, Vec3* direction);
+
+// CPU reference of the rayIntSvo and rayIntDag traversals, origin and direction in voxel space
+bool ray_march_octree(const RayOctree* tree, Vec3* origin, Vec3* direction, float tMax, RayHit* hit);
+
+#endif // RAY_H_
@@ -0,0 +1,507 @@
+#include "svo.h"
+
+#include "voxel/bounds.h"
+#include "voxel/brickmap.h"
+
+#include "core/list.h"
+#include "core/timer.h"
+#include "core/jobs.h"
+#include "core/core.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Subtrees per thread at the split level, mostly empty volumes leave many of them empty
+#define SVO_TASKS_PER_THREAD 16
+
+// Nodes this wide test their whole block for zeros before descending
+#define SVO_EMPTY_TEST_SIZE 16
+
+LIST_DEFINE(uint32_t, SvoWords);
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t       width, height, depth;
+    uint32_t       boundsMin[3], boundsMax[3];
+} SvoSource;
+
+typedef struct {
+    SvoWords words;
+    uint32_t mask;
+    size_t   block; // Into words, then into the nodes once concatenated
+} SvoTask;
+
+typedef struct {
+    const SvoSource* source;
+    SvoTask*         tasks;
+    uint32_t         taskCount;
+    uint32_t         splitLevel;
+    uint32_t         size; // Of the subtree of every task
+
+    atomic_bool failed;
+} SvoBuild;
+
+static uint8_t svo_source_get(const SvoSource* source, uint32_t x, uint32_t y, uint32_t z)
+{
+    if(x >= source->width || y >= source->height || z >= source->depth)
+        return 0;
+    return source->data[x + (size_t) y * source->width + (size_t) z * source->width * source->height];
+}
+
+// Whether [x, x + size) on every axis misses the non zero voxels
+static bool svo_source_empty(const SvoSource* source, uint32_t x, uint32_t y, uint32_t z, uint32_t size)
+{
+    const uint32_t min[3] = { x, y, z };
+
+    uint32_t first[3], last[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        first[i] = min[i] > source->boundsMin[i] ? min[i] : source->boundsMin[i];
+        last[i]  = min[i] + size < source->boundsMax[i] ? min[i] + size : source->boundsMax[i];
+
+        if(first[i] >= last[i])
+            return true;
+    }
+
+    return size <= SVO_EMPTY_TEST_SIZE && bounds_empty(source->data, source->width, source->height, first, last);
+}
+
+// Appends the subtree of the node at x, y, z in post order, mask stays 0 when it is empty
+static bool svo_build_node(const SvoSource* source, uint32_t x, uint32_t y, uint32_t z, uint32_t size,
+    SvoWords* words, uint32_t* mask, size_t* block)
+{
+    *mask = 0;
+
+    if(svo_source_empty(source, x, y, z, size))
+        return true;
+
+    if(size == 2)
+    {
+        uint32_t voxels[2] = {0};
+        for(uint32_t c = 0; c < 8; ++c)
+        {
+            uint8_t value = svo_source_get(source, x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2));
+            if(value == 0)
+                continue;
+
+            voxels[c >> 2] |= (uint32_t) value << ((c & 3) * 8);
+            *mask |= 1u << c;
+        }
+
+        if(*mask != 0)
+        {
+            *block = words->count;
+            list_append(*words, voxels[0]);
+            list_append(*words, voxels[1]);
+        }
+        return *mask == 0 || words->items != NULL;
+    }
+
+    uint32_t half = size / 2;
+    uint32_t childMasks[8];
+    size_t   childBlocks[8];
+
+    for(uint32_t c = 0; c < 8; ++c)
+        if(!svo_build_node(source, x + (c & 1) * half, y + ((c >> 1) & 1) * half, z + (c >> 2) * half, half,
+            words, &childMasks[c], &childBlocks[c]))
+            return false;
+
+    *block = words->count;
+    for(uint32_t c = 0; c < 8; ++c)
+    {
+        if(childMasks[c] == 0)
+            continue;
+
+        size_t distance = words->count - childBlocks[c];
+        if(distance > SVO_MAX_DISTANCE)
+        {
+            log_error("SVO child distance %zu over the %u limit", distance, SVO_MAX_DISTANCE);
+            return false;
+        }
+
+        uint32_t word = (uint32_t) distance << 8 | childMasks[c];
+        list_append(*words, word);
+        *mask |= 1u << c;
+    }
+
+    return *mask == 0 || words->items != NULL;
+}
+
+// Position of the subtree of task index, its child digits from the root down
+static void svo_task_position(uint32_t index, uint32_t splitLevel, uint32_t rootSize, uint32_t position[3])
+{
+    position[0] = position[1] = position[2] = 0;
+
+    for(uint32_t level = 0; level < splitLevel; ++level)
+    {
+        uint32_t c    = (index >> ((splitLevel - 1 - level) * 3)) & 7u;
+        uint32_t half = rootSize >> (level + 1);
+
+        position[0] += (c & 1) * half;
+        position[1] += ((c >> 1) & 1) * half;
+        position[2] += (c >> 2) * half;
+    }
+}
+
+// Ranges of subtrees down to single ones, the empty ones cost almost nothing
+static void svo_build_range(uint32_t begin, uint32_t end, void* data)
+{
+    SvoBuild* build = (SvoBuild*) data;
+    uint32_t rootSize = build->size << build->splitLevel;
+
+    for(uint32_t index = begin; index < end; ++index)
+    {
+        SvoTask* task = &build->tasks[index];
+
+        uint32_t position[3];
+        svo_task_position(index, build->splitLevel, rootSize, position);
+
+        if(!svo_build_node(build->source, position[0], position[1], position[2], build->size,
+            &task->words, &task->mask, &task->block))
+            atomic_store(&build->failed, true);
+    }
+}
+
+// Levels above the split, the task subtrees are already in the nodes
+static bool svo_build_top(SvoBuild* build, uint32_t level, uint32_t index, SvoWords* nodes, uint32_t* mask, size_t* block)
+{
+    if(level == build->splitLevel)
+    {
+        *mask  = build->tasks[index].mask;
+        *block = build->tasks[index].block;
+        return true;
+    }
+
+    uint32_t childMasks[8];
+    size_t   childBlocks[8];
+    for(uint32_t c = 0; c < 8; ++c)
+        if(!svo_build_top(build, level + 1, index * 8 + c, nodes, &childMasks[c], &childBlocks[c]))
+            return false;
+
+    *mask  = 0;
+    *block = nodes->count;
+    for(uint32_t c = 0; c < 8; ++c)
+    {
+        if(childMasks[c] == 0)
+            continue;
+
+        size_t distance = nodes->count - childBlocks[c];
+        if(distance > SVO_MAX_DISTANCE)
+        {
+            log_error("SVO child distance %zu over the %u limit", distance, SVO_MAX_DISTANCE);
+            return false;
+        }
+
+        uint32_t word = (uint32_t) distance << 8 | childMasks[c];
+        list_append(*nodes, word);
+        *mask |= 1u << c;
+    }
+
+    return nodes->items != NULL;
+}
+
+bool svo_create(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, Svo* svo)
+{
+    ASSERT(width > 0 && height > 0 && depth > 0);
+
+    uint32_t maxSize = width > height ? (width > depth ? width : depth) : (height > depth ? height : depth);
+
+    uint32_t levels = 1;
+    while((1u << levels) < maxSize)
+        ++levels;
+
+    if(levels > SVO_MAX_LEVELS)
+    {
+        log_error("SVO of %ux%ux%u over the %u levels limit", width, height, depth, SVO_MAX_LEVELS);
+        return false;
+    }
+
+    *svo = (Svo) {
+        .width  = width,
+        .height = height,
+        .depth  = depth,
+        .levels = levels,
+    };
+
+    SvoSource source = {
+        .data   = data,
+        .width  = width,
+        .height = height,
+        .depth  = depth,
+    };
+
+    SvoWords nodes = {0};
+
+    if(!bounds_scan(data, width, height, depth, source.boundsMin, source.boundsMax))
+    {
+        // Empty root
+        uint32_t root = 0;
+        list_append(nodes, root);
+        if(nodes.items == NULL)
+            return false;
+
+        svo->nodes     = nodes.items;
+        svo->nodeCount = nodes.count;
+        return true;
+    }
+
+    // Split the tree where there are enough subtrees to keep every thread busy, at most at the nodes two voxels wide
+    uint32_t threadCount = jobs_thread_count();
+    uint32_t splitLevel = 0;
+    while(splitLevel + 1 < levels && (1u << (3 * splitLevel)) < threadCount * SVO_TASKS_PER_THREAD)
+        ++splitLevel;
+
+    SvoBuild build = {
+        .source     = &source,
+        .taskCount  = 1u << (3 * splitLevel),
+        .splitLevel = splitLevel,
+        .size       = 1u << (levels - splitLevel),
+    };
+    atomic_init(&build.failed, false);
+
+    build.tasks = (SvoTask*) calloc(build.taskCount, sizeof(SvoTask));
+    if(build.tasks == NULL)
+        return false;
+
+    // The calling thread builds too, the subtrees go to the job system one by one
+    jobs_parallel_for(build.taskCount, 1, svo_build_range, &build);
+
+    bool result = !atomic_load(&build.failed);
+
+    // Concatenated in task order, the distances inside every subtree stay valid
+    size_t taskWords = 0;
+    for(uint32_t i = 0; i < build.taskCount; ++i)
+        taskWords += build.tasks[i].words.count;
+
+    if(result)
+    {
+        list_alloc(nodes, taskWords + 64);
+        result = nodes.items != NULL;
+    }
+
+    for(uint32_t i = 0; i < build.taskCount && result; ++i)
+    {
+        SvoTask* task = &build.tasks[i];
+        if(task->words.count == 0)
+            continue;
+
+        memcpy(nodes.items + nodes.count, task->words.items, task->words.count * sizeof(uint32_t));
+        task->block += nodes.count;
+        nodes.count += task->words.count;
+    }
+
+    for(uint32_t i = 0; i < build.taskCount; ++i)
+        list_destroy(build.tasks[i].words);
+
+    uint32_t rootMask = 0;
+    size_t   rootBlock = 0;
+    if(result)
+        result = svo_build_top(&build, 0, 0, &nodes, &rootMask, &rootBlock);
+
+    free(build.tasks);
+
+    if(result)
+    {
+        size_t distance = nodes.count - rootBlock;
+        result = distance <= SVO_MAX_DISTANCE;
+
+        uint32_t root = (uint32_t) distance << 8 | rootMask;
+        list_append(nodes, root);
+        result &= nodes.items != NULL;
+    }
+
+    if(!result)
+    {
+        log_error("Could not build the SVO of %ux%ux%u", width, height, depth);
+        list_destroy(nodes);
+        return false;
+    }
+
+    svo->nodes     = nodes.items;
+    svo->nodeCount = nodes.count;
+    return true;
+}
+
+void svo_destroy(Svo* svo)
+{
+    free(svo->nodes);
+    svo->nodes     = NULL;
+    svo->nodeCount = 0;
+}
+
+uint32_t svo_root(const Svo* svo)
+{
+    return (uint32_t) (svo->nodeCount - 1);
+}
+
+uint8_t svo_get(const Svo* svo, uint32_t x, uint32_t y, uint32_t z)
+{
+    if(x >= svo->width || y >= svo->height || z >= svo->depth)
+        return 0;
+
+    uint32_t node = svo_root(svo);
+    for(uint32_t level = 0; level < svo->levels; ++level)
+    {
+        uint32_t shift = svo->levels - 1 - level;
+        uint32_t c = ((x >> shift) & 1) | ((y >> shift) & 1) << 1 | ((z >> shift) & 1) << 2;
+
+        uint32_t word = svo->nodes[node];
+        if((word & (1u << c)) == 0)
+            return 0;
+
+        uint32_t block = node - (word >> 8);
+        if(level + 1 == svo->levels)
+            return (uint8_t) (svo->nodes[block + (c >> 2)] >> ((c & 3) * 8));
+
+        node = block + ray_child_offset(word & 0xFFu, c);
+    }
+
+    return 0;
+}
+
+size_t svo_memory_size(const Svo* svo)
+{
+    return svo->nodeCount * sizeof(uint32_t);
+}
+
+static RayChild svo_fetch(const uint32_t* nodes, uint32_t node, uint32_t c, bool leaf, uint32_t* child,
+    uint8_t* value)
+{
+    uint32_t word = nodes[node];
+    if((word & (1u << c)) == 0)
+        return RAY_CHILD_EMPTY;
+
+    uint32_t block = node - (word >> 8);
+    if(leaf)
+    {
+        *value = (uint8_t) (nodes[block + (c >> 2)] >> ((c & 3) * 8));
+        return RAY_CHILD_VOXEL;
+    }
+
+    *child = block + ray_child_offset(word & 0xFFu, c);
+    return RAY_CHILD_NODE;
+}
+
+bool svo_raycast(const Svo* svo, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    RayOctree tree = {
+        .nodes  = svo->nodes,
+        .root   = svo_root(svo),
+        .fetch  = svo_fetch,
+        .levels = svo->levels,
+        .width  = svo->width,
+        .height = svo->height,
+        .depth  = svo->depth,
+    };
+
+    return ray_march_octree(&tree, origin, direction, tMax, hit);
+}
+
+static bool svo_cast(const void* volume, Vec3* origin, Vec3* direction, float tMax, RayHit* hit)
+{
+    return svo_raycast((const Svo*) volume, origin, direction, tMax, hit);
+}
+
+bool svo_benchmark(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t rayCount)
+{
+    char timeStr[64], sizeStr[64];
+    Timer t;
+
+    size_t denseSize = (size_t) width * height * depth;
+
+    BrickMap brickMap;
+    timer_start(&t);
+    bool result = brickmap_create(width, height, depth, data, DISTANCE_CHEBYSHEV, &brickMap);
+    timer_stop(&t);
+
+    if(!result)
+        return false;
+
+    double brickMapTime = timer_get_ns(&t);
+
+    Svo svo;
+    timer_start(&t);
+    result = svo_create(width, height, depth, data, &svo);
+    timer_stop(&t);
+    double svoTime = timer_get_ns(&t);
+
+    if(!result)
+    {
+        brickmap_destroy(&brickMap);
+        return false;
+    }
+
+    size_t brickMapSize = brickmap_memory_size(&brickMap);
+
+    log_info("SVO benchmark %ux%ux%u, %u levels, %zu node words:", width, height, depth, svo.levels, svo.nodeCount);
+
+    num_to_str(sizeStr, (double) denseSize);
+    log_info("    %-9s %sB", "dense", sizeStr);
+
+    time_to_str(timeStr, brickMapTime);
+    num_to_str(sizeStr, (double) brickMapSize);
+    log_info("    %-9s %sB (%.3f%% of dense) built in %s", "brickmap", sizeStr, 100.0 * brickMapSize / denseSize, timeStr);
+
+    time_to_str(timeStr, svoTime);
+    num_to_str(sizeStr, (double) svo_memory_size(&svo));
+    log_info("    %-9s %sB (%.3f%% of dense) built in %s", "svo", sizeStr, 100.0 * svo_memory_size(&svo) / denseSize,
+        timeStr);
+
+    // Same random rays through both, the brickmap is the reference
+    uint32_t mismatches = brickmap_compare_raycast(&brickMap, "svo", svo_cast, &svo, rayCount);
+
+    svo_destroy(&svo);
+    brickmap_destroy(&brickMap);
+    return mismatches == 0;
+}
+
+bool svo_benchmark_sparse(uint32_t size, uint32_t rayCount)
+{
+    // Untouched pages of the zeroed volume aren't backed until read
+    uint8_t* data = (uint8_t*) calloc((size_t) size * size * size, 1);
+    if(data == NULL)
+        return false;
+
+    float center = size * 0.5f, radius = size * 0.375f;
+
+    // Thin sphere shell, built row by row from its two crossings
+    for(uint32_t z = 0; z < size; ++z)
+        for(uint32_t y = 0; y < size; ++y)
+        {
+            float dy = y + 0.5f - center, dz = z + 0.5f - center;
+            float inner = (radius - 1.0f) * (radius - 1.0f) - dy * dy - dz * dz;
+            float outer = radius * radius - dy * dy - dz * dz;
+            if(outer < 0.0f)
+                continue;
+
+            float outerX = sqrtf(outer), innerX = inner > 0.0f ? sqrtf(inner) : 0.0f;
+            uint8_t* row = data + (size_t) y * size + (size_t) z * size * size;
+
+            for(uint32_t x = (uint32_t) fmaxf(center - outerX, 0.0f); x < (uint32_t) fminf(center + outerX, (float) size); ++x)
+            {
+                float dx = fabsf(x + 0.5f - center);
+                if(dx <= outerX && dx >= innerX)
+                    row[x] = (uint8_t) (1 + (x / 16 + y / 16 + z / 16) % 7);
+            }
+        }
+
+    // Scattered boxes
+    uint32_t state = RAY_SEED;
+    for(uint32_t i = 0; i < 64; ++i)
+    {
+        uint32_t boxSize = 2 + (uint32_t) (ray_random(&state) * 14.0f);
+        uint32_t min[3];
+        for(int a = 0; a < 3; ++a)
+            min[a] = (uint32_t) (ray_random(&state) * (size - boxSize));
+
+        for(uint32_t z = min[2]; z < min[2] + boxSize; ++z)
+            for(uint32_t y = min[1]; y < min[1] + boxSize; ++y)
+                memset(data + min[0] + (size_t) y * size + (size_t) z * size * size, (int) (1 + i % 7), boxSize);
+    }
+
+    bool result = svo_benchmark(size, size, size, data, rayCount);
+    free(data);
+    return result;
+}
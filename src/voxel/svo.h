@@ -0,0 +1,61 @@
+#ifndef SVO_H_
+#define SVO_H_
+
+#include "core/vec.h"
+
+#include "voxel/ray.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Sparse voxel octree over a volume padded to the next power of two:
+ *  every node is one 32 bit word, the low 8 bits are the child mask and the high
+ *  24 bits the distance back from the word to the block of its non empty children,
+ *  stored next to each other in child order and found with a popcount of the mask.
+ *  Children of the nodes two voxels wide are voxels, their block is two words
+ *  holding the 8 voxel values, child c in byte c. Child c sits at x + (c & 1),
+ *  y + ((c >> 1) & 1), z + (c >> 2).
+ *
+ *  The tree is built bottom up in post order, every block lands before the words
+ *  pointing at it and the distances inside a subtree don't depend on where it is
+ *  stored: the subtrees of one level are built by separate threads and concatenated.
+ *  The root is the last word.
+ */
+
+#define SVO_MAX_LEVELS   RAY_MAX_LEVELS
+#define SVO_MAX_DISTANCE ((1u << 24) - 1)
+
+typedef struct {
+    uint32_t width, height, depth;
+
+    // Root node is 2^levels voxels wide
+    uint32_t levels;
+
+    uint32_t* nodes;
+    size_t    nodeCount;
+} Svo;
+
+// Builds from width x height x depth voxels, x fastest, fails when a subtree is too large for the 24 bit distances
+bool svo_create(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, Svo* svo);
+
+void svo_destroy(Svo* svo);
+
+uint32_t svo_root(const Svo* svo);
+
+uint8_t svo_get(const Svo* svo, uint32_t x, uint32_t y, uint32_t z);
+
+size_t svo_memory_size(const Svo* svo);
+
+// CPU reference of the rayIntSvo traversal, origin and direction in voxel space
+bool svo_raycast(const Svo* svo, Vec3* origin, Vec3* direction, float tMax, RayHit* hit);
+
+// Builds the brickmap and the octree of the data, logs their build time and memory against the dense volume
+// and the octree rays that disagree with the brickmap ones. Fails on any of them
+bool svo_benchmark(uint32_t width, uint32_t height, uint32_t depth, const uint8_t* data, uint32_t rayCount);
+
+// svo_benchmark on a size^3 volume empty but for a thin sphere shell and a few scattered boxes
+bool svo_benchmark_sparse(uint32_t size, uint32_t rayCount);
+
+#endif // SVO_H_
@@ -0,0 +1,1080 @@
+#include "vox.h"
+
+#include "core/filesystem.h"
+#include "core/jobs.h"
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define VOX_ID(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+#define VOX_MAX_DEPTH 64 // Of the scene graph, deeper files are cyclic or broken
+
+// XYZI entries per range of the conversion
+#define VOX_RANGE_VOXELS (1u << 16)
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool           ok;
+} VoxReader;
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t       size;
+} VoxString;
+
+// Values of the dictionary keys the scene graph uses, empty when missing
+typedef struct {
+    VoxString hidden;
+    VoxString rotation;
+    VoxString translation;
+} VoxDict;
+
+typedef enum {
+    VOX_NODE_NONE,
+    VOX_NODE_TRANSFORM,
+    VOX_NODE_GROUP,
+    VOX_NODE_SHAPE,
+} VoxNodeType;
+
+typedef struct {
+    VoxNodeType type;
+    bool        hidden;
+    uint32_t    layer;
+
+    // Transforms, of their first frame
+    int32_t  rotation[3][3];
+    int32_t  translation[3];
+    uint32_t child;
+
+    // Children of the groups, models of the shapes, in the links
+    uint32_t first;
+    uint32_t count;
+} VoxNode;
+
+LIST_DEFINE(VoxNode, VoxNodes);
+LIST_DEFINE(uint32_t, VoxLinks);
+LIST_DEFINE(bool, VoxLayers);
+
+typedef struct {
+    VoxNodes  nodes;
+    VoxLinks  links;
+    VoxLayers hiddenLayers;
+} VoxGraph;
+
+typedef struct {
+    uint32_t model;
+    uint32_t begin, end;
+    uint32_t used[8]; // Colors of the range
+    uint32_t written;
+} VoxRange;
+
+typedef struct {
+    VoxScene* scene;
+    VoxRange* ranges;
+    uint8_t (*remaps)[256];
+} VoxConvert;
+
+static uint32_t vox_read_u32(VoxReader* reader)
+{
+    if(reader->end - reader->p < 4)
+    {
+        reader->ok = false;
+        return 0;
+    }
+
+    uint32_t value;
+    memcpy(&value, reader->p, sizeof(value));
+    reader->p += 4;
+    return value;
+}
+
+static VoxString vox_read_string(VoxReader* reader)
+{
+    uint32_t size = vox_read_u32(reader);
+    if(!reader->ok || size > (size_t) (reader->end - reader->p))
+    {
+        reader->ok = false;
+        return (VoxString) {0};
+    }
+
+    VoxString string = { reader->p, size };
+    reader->p += size;
+    return string;
+}
+
+static bool vox_string_equals(VoxString string, const char* value)
+{
+    return string.size == strlen(value) && memcmp(string.data, value, string.size) == 0;
+}
+
+static VoxDict vox_read_dict(VoxReader* reader)
+{
+    VoxDict dict = {0};
+
+    uint32_t count = vox_read_u32(reader);
+    for(uint32_t i = 0; i < count && reader->ok; ++i)
+    {
+        VoxString key   = vox_read_string(reader);
+        VoxString value = vox_read_string(reader);
+
+        if(vox_string_equals(key, "_hidden"))
+            dict.hidden = value;
+        else if(vox_string_equals(key, "_r"))
+            dict.rotation = value;
+        else if(vox_string_equals(key, "_t"))
+            dict.translation = value;
+    }
+
+    return dict;
+}
+
+// Up to count integers separated by spaces, the others stay 0
+static void vox_parse_ints(VoxString string, int32_t* values, uint32_t count)
+{
+    char text[64];
+    uint32_t size = string.size < sizeof(text) - 1 ? string.size : (uint32_t) sizeof(text) - 1;
+    memcpy(text, string.data, size);
+    text[size] = '\0';
+
+    char* p = text;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        char* next;
+        values[i] = (int32_t) strtol(p, &next, 10);
+        if(next == p)
+            break;
+        p = next;
+    }
+}
+
+static bool vox_flag(VoxString string)
+{
+    return string.size > 0 && string.data[0] == '1';
+}
+
+// Packed rotation of a transform frame: the column of the one of the first two rows, and the signs of every row
+static bool vox_decode_rotation(uint32_t packed, int32_t rotation[3][3])
+{
+    uint32_t first  = packed & 3u;
+    uint32_t second = (packed >> 2) & 3u;
+    if(first > 2 || second > 2 || first == second)
+        return false;
+
+    uint32_t columns[3] = { first, second, 3 - first - second };
+
+    memset(rotation, 0, sizeof(int32_t) * 9);
+    for(uint32_t row = 0; row < 3; ++row)
+        rotation[row][columns[row]] = (packed >> (4 + row)) & 1u ? -1 : 1;
+    return true;
+}
+
+static VoxNode* vox_graph_node(VoxGraph* graph, uint32_t id)
+{
+    // Ids are dense in practice, the gaps stay VOX_NODE_NONE
+    if(id > (1u << 20))
+        return NULL;
+
+    VoxNode none = {0};
+    while(graph->nodes.count <= id)
+        list_append(graph->nodes, none);
+
+    return &graph->nodes.items[id];
+}
+
+static bool vox_parse_transform(VoxReader* reader, VoxGraph* graph)
+{
+    uint32_t id   = vox_read_u32(reader);
+    VoxDict  dict = vox_read_dict(reader);
+
+    VoxNode node = {
+        .type     = VOX_NODE_TRANSFORM,
+        .hidden   = vox_flag(dict.hidden),
+        .rotation = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+    };
+
+    node.child = vox_read_u32(reader);
+    vox_read_u32(reader); // Reserved
+    node.layer = vox_read_u32(reader);
+
+    uint32_t frameCount = vox_read_u32(reader);
+    for(uint32_t i = 0; i < frameCount && reader->ok; ++i)
+    {
+        VoxDict frame = vox_read_dict(reader);
+        if(i > 0)
+            continue;
+
+        if(frame.rotation.size > 0)
+        {
+            int32_t packed = 0;
+            vox_parse_ints(frame.rotation, &packed, 1);
+            if(!vox_decode_rotation((uint32_t) packed, node.rotation))
+                return false;
+        }
+
+        if(frame.translation.size > 0)
+            vox_parse_ints(frame.translation, node.translation, 3);
+    }
+
+    VoxNode* slot = vox_graph_node(graph, id);
+    if(!reader->ok || slot == NULL)
+        return false;
+
+    *slot = node;
+    return true;
+}
+
+// Groups list their children, shapes their models, both go to the links
+static bool vox_parse_links(VoxReader* reader, VoxGraph* graph, VoxNodeType type)
+{
+    uint32_t id = vox_read_u32(reader);
+    vox_read_dict(reader);
+
+    VoxNode node = {
+        .type  = type,
+        .first = (uint32_t) graph->links.count,
+    };
+
+    uint32_t count = vox_read_u32(reader);
+    for(uint32_t i = 0; i < count && reader->ok; ++i)
+    {
+        uint32_t link = vox_read_u32(reader);
+        list_append(graph->links, link);
+
+        if(type == VOX_NODE_SHAPE)
+            vox_read_dict(reader);
+    }
+    node.count = (uint32_t) graph->links.count - node.first;
+
+    VoxNode* slot = vox_graph_node(graph, id);
+    if(!reader->ok || slot == NULL)
+        return false;
+
+    *slot = node;
+    return true;
+}
+
+static void vox_default_palette(uint32_t palette[256])
+{
+    // A 6x6x6 cube of ff, cc, 99, 66, 33 and 00 from white down, then ramps of red, green, blue and gray
+    static const uint8_t cube[6]  = { 0xFF, 0xCC, 0x99, 0x66, 0x33, 0x00 };
+    static const uint8_t ramp[10] = { 0xEE, 0xDD, 0xBB, 0xAA, 0x88, 0x77, 0x55, 0x44, 0x22, 0x11 };
+
+    uint32_t i = 0;
+    palette[i++] = 0;
+
+    for(uint32_t r = 0; r < 6; ++r)
+        for(uint32_t g = 0; g < 6; ++g)
+            for(uint32_t b = 0; b < 6 && i < 216; ++b)
+                palette[i++] = cube[r] | (uint32_t) cube[g] << 8 | (uint32_t) cube[b] << 16 | 0xFF000000u;
+
+    for(uint32_t channel = 0; channel < 4; ++channel)
+        for(uint32_t j = 0; j < 10; ++j)
+        {
+            uint32_t mask = channel == 3 ? 0xFFFFFFu : 0xFFu << (channel * 8);
+            palette[i++] = (ramp[j] * 0x010101u & mask) | 0xFF000000u;
+        }
+}
+
+// Models, palette and scene graph from the chunks of MAIN, the XYZI lists stay in data
+static bool vox_parse_chunks(const uint8_t* data, size_t size, VoxScene* scene, VoxGraph* graph)
+{
+    VoxReader reader = { data, data + size, true };
+
+    if(vox_read_u32(&reader) != VOX_ID('V', 'O', 'X', ' '))
+    {
+        log_error("Vox file without the VOX magic");
+        return false;
+    }
+
+    uint32_t version = vox_read_u32(&reader);
+    if(vox_read_u32(&reader) != VOX_ID('M', 'A', 'I', 'N'))
+    {
+        log_error("Vox file %u without a MAIN chunk", version);
+        return false;
+    }
+
+    uint32_t mainContent  = vox_read_u32(&reader);
+    uint32_t mainChildren = vox_read_u32(&reader);
+    if(!reader.ok || mainContent > (size_t) (reader.end - reader.p) ||
+        mainChildren > (size_t) (reader.end - reader.p) - mainContent)
+    {
+        log_error("Vox file truncated MAIN chunk");
+        return false;
+    }
+
+    reader.p  += mainContent;
+    reader.end = reader.p + mainChildren;
+
+    vox_default_palette(scene->palette);
+
+    uint32_t size3[3] = {0};
+    bool sized = false;
+
+    while(reader.p < reader.end && reader.ok)
+    {
+        uint32_t id       = vox_read_u32(&reader);
+        uint32_t content  = vox_read_u32(&reader);
+        uint32_t children = vox_read_u32(&reader);
+        if(!reader.ok || content > (size_t) (reader.end - reader.p) ||
+            children > (size_t) (reader.end - reader.p) - content)
+        {
+            log_error("Vox file truncated chunk");
+            return false;
+        }
+
+        VoxReader chunk = { reader.p, reader.p + content, true };
+        reader.p += (size_t) content + children;
+
+        switch(id)
+        {
+        case VOX_ID('S', 'I', 'Z', 'E'):
+            for(uint32_t axis = 0; axis < 3; ++axis)
+                size3[axis] = vox_read_u32(&chunk);
+
+            sized = chunk.ok && size3[0] > 0 && size3[1] > 0 && size3[2] > 0 &&
+                size3[0] <= VOX_MAX_SIZE && size3[1] <= VOX_MAX_SIZE && size3[2] <= VOX_MAX_SIZE;
+            if(!sized)
+            {
+                log_error("Vox model of size %ux%ux%u", size3[0], size3[1], size3[2]);
+                return false;
+            }
+            break;
+        case VOX_ID('X', 'Y', 'Z', 'I'):
+        {
+            uint32_t count = vox_read_u32(&chunk);
+            if(!sized || !chunk.ok || count > (size_t) (chunk.end - chunk.p) / 4)
+            {
+                log_error("Vox XYZI chunk without a SIZE or past its content");
+                return false;
+            }
+
+            // Converted once every chunk is parsed
+            VoxModel model = {
+                .width      = size3[0],
+                .height     = size3[2],
+                .depth      = size3[1],
+                .voxelCount = count,
+                .xyzi       = chunk.p,
+                .sizeX      = size3[0],
+                .sizeY      = size3[1],
+                .sizeZ      = size3[2],
+            };
+            list_append(scene->models, model);
+            sized = false;
+            break;
+        }
+        case VOX_ID('R', 'G', 'B', 'A'):
+            // Entry i is color i + 1, the last one is unused
+            if(content < 256 * 4)
+            {
+                log_error("Vox RGBA chunk of %u bytes", content);
+                return false;
+            }
+            memcpy(&scene->palette[1], chunk.p, 255 * 4);
+            break;
+        case VOX_ID('n', 'T', 'R', 'N'):
+            if(!vox_parse_transform(&chunk, graph))
+            {
+                log_error("Vox nTRN chunk invalid");
+                return false;
+            }
+            break;
+        case VOX_ID('n', 'G', 'R', 'P'):
+        case VOX_ID('n', 'S', 'H', 'P'):
+            if(!vox_parse_links(&chunk, graph, id == VOX_ID('n', 'G', 'R', 'P') ? VOX_NODE_GROUP : VOX_NODE_SHAPE))
+            {
+                log_error("Vox nGRP or nSHP chunk invalid");
+                return false;
+            }
+            break;
+        case VOX_ID('L', 'A', 'Y', 'R'):
+        {
+            uint32_t layer = vox_read_u32(&chunk);
+            bool hidden = vox_flag(vox_read_dict(&chunk).hidden);
+            if(!chunk.ok || layer > 1024)
+                break;
+
+            bool visible = false;
+            while(graph->hiddenLayers.count <= layer)
+                list_append(graph->hiddenLayers, visible);
+            graph->hiddenLayers.items[layer] = hidden;
+            break;
+        }
+        default: // PACK, MATL, rOBJ, rCAM, NOTE, IMAP and the others only matter to the editor
+            break;
+        }
+    }
+
+    return reader.ok;
+}
+
+static void vox_mul(const int32_t a[3][3], const int32_t b[3][3], int32_t out[3][3])
+{
+    int32_t result[3][3];
+    for(uint32_t r = 0; r < 3; ++r)
+        for(uint32_t c = 0; c < 3; ++c)
+            result[r][c] = a[r][0] * b[0][c] + a[r][1] * b[1][c] + a[r][2] * b[2][c];
+    memcpy(out, result, sizeof(result));
+}
+
+static void vox_mul_vec(const int32_t m[3][3], const int32_t v[3], int32_t out[3])
+{
+    int32_t result[3];
+    for(uint32_t r = 0; r < 3; ++r)
+        result[r] = m[r][0] * v[0] + m[r][1] * v[1] + m[r][2] * v[2];
+    memcpy(out, result, sizeof(result));
+}
+
+// Scene transform R, T of the model into the engine axes, from its volume voxels
+static void vox_instance_transform(const VoxModel* model, const int32_t rotation[3][3], const int32_t translation[3],
+    float transform[3][4])
+{
+    // MagicaVoxel axes to the engine ones, and the volume voxels back to the model ones: x, z, size y - y
+    static const int32_t toEngine[3][3] = { { 1, 0, 0 }, { 0, 0, 1 }, { 0, -1, 0 } };
+    static const int32_t toModel[3][3]  = { { 1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } };
+
+    // The models turn around the voxel at half their size
+    int32_t offset[3] = {
+        -(int32_t) (model->sizeX / 2),
+        (int32_t) model->sizeY - (int32_t) (model->sizeY / 2),
+        -(int32_t) (model->sizeZ / 2),
+    };
+
+    int32_t linear[3][3];
+    vox_mul(rotation, toModel, linear);
+    vox_mul(toEngine, linear, linear);
+
+    int32_t position[3];
+    vox_mul_vec(rotation, offset, position);
+    for(uint32_t i = 0; i < 3; ++i)
+        position[i] += translation[i];
+    vox_mul_vec(toEngine, position, position);
+
+    for(uint32_t r = 0; r < 3; ++r)
+    {
+        for(uint32_t c = 0; c < 3; ++c)
+            transform[r][c] = (float) linear[r][c];
+        transform[r][3] = (float) position[r];
+    }
+}
+
+static void vox_add_instance(VoxScene* scene, uint32_t model, const int32_t rotation[3][3], const int32_t translation[3])
+{
+    if(model >= scene->models.count)
+        return;
+
+    VoxInstance instance = {
+        .model = model,
+    };
+    vox_instance_transform(&scene->models.items[model], rotation, translation, instance.transform);
+    list_append(scene->instances, instance);
+}
+
+// budget bounds the nodes visited, a tree visits each once, a broken file sharing nodes can't blow up
+static void vox_walk(VoxScene* scene, const VoxGraph* graph, uint32_t id, const int32_t rotation[3][3],
+    const int32_t translation[3], uint32_t depth, size_t* budget)
+{
+    if(id >= graph->nodes.count || depth > VOX_MAX_DEPTH || *budget == 0)
+        return;
+    --*budget;
+
+    const VoxNode* node = &graph->nodes.items[id];
+    switch(node->type)
+    {
+    case VOX_NODE_TRANSFORM:
+    {
+        bool layerHidden = node->layer < graph->hiddenLayers.count && graph->hiddenLayers.items[node->layer];
+        if(node->hidden || layerHidden)
+            return;
+
+        // Parent R, T after the node ones: R = Rp * R, T = Rp * T + Tp
+        int32_t childRotation[3][3], childTranslation[3];
+        vox_mul(rotation, node->rotation, childRotation);
+        vox_mul_vec(rotation, node->translation, childTranslation);
+        for(uint32_t i = 0; i < 3; ++i)
+            childTranslation[i] += translation[i];
+
+        vox_walk(scene, graph, node->child, childRotation, childTranslation, depth + 1, budget);
+        break;
+    }
+    case VOX_NODE_GROUP:
+        for(uint32_t i = 0; i < node->count; ++i)
+            vox_walk(scene, graph, graph->links.items[node->first + i], rotation, translation, depth + 1, budget);
+        break;
+    case VOX_NODE_SHAPE:
+        for(uint32_t i = 0; i < node->count; ++i)
+            vox_add_instance(scene, graph->links.items[node->first + i], rotation, translation);
+        break;
+    case VOX_NODE_NONE:
+        break;
+    }
+}
+
+static void vox_gather_colors(uint32_t begin, uint32_t end, void* data)
+{
+    VoxConvert* convert = (VoxConvert*) data;
+    for(uint32_t r = begin; r < end; ++r)
+    {
+        VoxRange* range = &convert->ranges[r];
+        const uint8_t* xyzi = convert->scene->models.items[range->model].xyzi;
+
+        for(uint32_t v = range->begin; v < range->end; ++v)
+        {
+            uint8_t color = xyzi[v * 4 + 3];
+            range->used[color >> 5] |= 1u << (color & 31u);
+        }
+    }
+}
+
+static void vox_write_voxels(uint32_t begin, uint32_t end, void* data)
+{
+    VoxConvert* convert = (VoxConvert*) data;
+    for(uint32_t r = begin; r < end; ++r)
+    {
+        VoxRange* range = &convert->ranges[r];
+        const VoxModel* model = &convert->scene->models.items[range->model];
+        const uint8_t* remap  = convert->remaps[range->model];
+
+        size_t sliceSize = (size_t) model->width * model->height;
+
+        uint32_t written = 0;
+        for(uint32_t v = range->begin; v < range->end; ++v)
+        {
+            const uint8_t* entry = &model->xyzi[v * 4];
+
+            uint32_t x = entry[0], y = entry[1], z = entry[2];
+            if(x >= model->sizeX || y >= model->sizeY || z >= model->sizeZ || entry[3] == 0)
+                continue;
+
+            model->voxels[x + z * model->width + (model->sizeY - 1 - y) * sliceSize] = remap[entry[3]];
+            ++written;
+        }
+        range->written = written;
+    }
+}
+
+// Dense volumes and palettes of every model from its XYZI list, both passes spread over the job system
+static bool vox_convert(VoxScene* scene)
+{
+    uint32_t rangeCount = 0;
+    for(size_t m = 0; m < scene->models.count; ++m)
+        rangeCount += (scene->models.items[m].voxelCount + VOX_RANGE_VOXELS - 1) / VOX_RANGE_VOXELS;
+
+    VoxConvert convert = {
+        .scene  = scene,
+        .ranges = (VoxRange*) calloc(rangeCount > 0 ? rangeCount : 1, sizeof(VoxRange)),
+        .remaps = (uint8_t(*)[256]) calloc(scene->models.count > 0 ? scene->models.count : 1, 256),
+    };
+
+    bool result = convert.ranges != NULL && convert.remaps != NULL;
+
+    uint32_t r = 0;
+    for(uint32_t m = 0; m < scene->models.count && result; ++m)
+    {
+        VoxModel* model = &scene->models.items[m];
+        for(uint32_t begin = 0; begin < model->voxelCount; begin += VOX_RANGE_VOXELS)
+        {
+            uint32_t end = model->voxelCount - begin > VOX_RANGE_VOXELS ? begin + VOX_RANGE_VOXELS : model->voxelCount;
+            convert.ranges[r++] = (VoxRange) { .model = m, .begin = begin, .end = end };
+        }
+
+        // Zero pages until the writes touch them
+        model->voxels = (uint8_t*) calloc((size_t) model->width * model->height * model->depth, 1);
+        result = model->voxels != NULL;
+    }
+
+    if(result)
+        jobs_parallel_for(rangeCount, 1, vox_gather_colors, &convert);
+
+    // Colors used by the model in palette order, the voxels take their rank
+    for(uint32_t m = 0, first = 0; m < scene->models.count && result; ++m)
+    {
+        VoxModel* model = &scene->models.items[m];
+
+        uint32_t used[8] = {0};
+        for(; first < rangeCount && convert.ranges[first].model == m; ++first)
+            for(uint32_t w = 0; w < 8; ++w)
+                used[w] |= convert.ranges[first].used[w];
+
+        model->colors[0]  = 0;
+        model->colorCount = 1;
+        for(uint32_t color = 1; color < 256; ++color)
+        {
+            if((used[color >> 5] & (1u << (color & 31u))) == 0)
+                continue;
+
+            convert.remaps[m][color] = (uint8_t) model->colorCount;
+            model->colors[model->colorCount++] = scene->palette[color];
+        }
+    }
+
+    if(result)
+        jobs_parallel_for(rangeCount, 1, vox_write_voxels, &convert);
+
+    // Entries outside the model or of color 0 are dropped
+    for(uint32_t m = 0, i = 0; m < scene->models.count && result; ++m)
+    {
+        VoxModel* model = &scene->models.items[m];
+
+        uint32_t written = 0;
+        for(; i < rangeCount && convert.ranges[i].model == m; ++i)
+            written += convert.ranges[i].written;
+
+        if(written != model->voxelCount)
+            log_error("Vox model %u: %u voxels outside of its %ux%ux%u size dropped", m, model->voxelCount - written,
+                model->sizeX, model->sizeY, model->sizeZ);
+
+        model->voxelCount = written;
+        model->xyzi = NULL;
+    }
+
+    free(convert.ranges);
+    free(convert.remaps);
+    return result;
+}
+
+static bool vox_build(VoxScene* scene, VoxGraph* graph)
+{
+    if(!vox_convert(scene))
+        return false;
+
+    int32_t identity[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    int32_t zero[3] = {0};
+
+    size_t budget = graph->nodes.count;
+    if(graph->nodes.count > 0)
+        vox_walk(scene, graph, 0, identity, zero, 0, &budget);
+    else
+    {
+        for(uint32_t m = 0; m < scene->models.count; ++m)
+            vox_add_instance(scene, m, identity, zero);
+    }
+
+    return true;
+}
+
+static void vox_graph_destroy(VoxGraph* graph)
+{
+    list_destroy(graph->nodes);
+    list_destroy(graph->links);
+    list_destroy(graph->hiddenLayers);
+}
+
+bool vox_parse(const uint8_t* data, size_t size, VoxScene* scene)
+{
+    *scene = (VoxScene) {0};
+
+    VoxGraph graph = {0};
+    bool result = vox_parse_chunks(data, size, scene, &graph) && vox_build(scene, &graph);
+
+    vox_graph_destroy(&graph);
+    if(!result)
+        vox_destroy(scene);
+    return result;
+}
+
+bool vox_load(const char* filepath, VoxScene* scene)
+{
+    const uint8_t* data;
+    size_t size;
+    if(!file_map(filepath, &data, &size))
+        return false;
+
+    bool result = vox_parse(data, size, scene);
+    file_unmap(data, size);
+
+    if(!result)
+        log_error("Vox file invalid: %s", filepath);
+    return result;
+}
+
+void vox_destroy(VoxScene* scene)
+{
+    for(size_t i = 0; i < scene->models.count; ++i)
+        free(scene->models.items[i].voxels);
+
+    list_destroy(scene->models);
+    list_destroy(scene->instances);
+    *scene = (VoxScene) {0};
+}
+
+// ##### Benchmark #####
+
+// Color of a voxel of the benchmark spheres, blocks of 16 voxels in one of the colors of the model
+static uint8_t vox_benchmark_color(uint32_t model, uint32_t x, uint32_t y, uint32_t z)
+{
+    uint32_t hash = (x >> 4) * 0x8DA6B343u ^ (y >> 4) * 0xD8163841u ^ (z >> 4) * 0xCB1AB31Fu ^ model * 0x9E3779B9u;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+
+    // Models use 8 to 200 colors spread over the palette
+    uint32_t colors = 8 + (model * 37) % 193;
+    return (uint8_t) (1 + (hash % colors) * 254 / colors);
+}
+
+static uint32_t vox_benchmark_palette_color(uint32_t i)
+{
+    return (i + 1) | (255 - i) << 8 | (i * 7 & 0xFFu) << 16 | 0xFF000000u;
+}
+
+static bool vox_benchmark_inside(uint32_t size, uint32_t x, uint32_t y, uint32_t z)
+{
+    int32_t center = (int32_t) size / 2, radius = (int32_t) size / 2 - 1;
+    int32_t dx = (int32_t) x - center, dy = (int32_t) y - center, dz = (int32_t) z - center;
+    return dx * dx + dy * dy + dz * dz < radius * radius;
+}
+
+static bool vox_write_u32(FILE* f, uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, f) == 1;
+}
+
+static bool vox_write_chunk_header(FILE* f, uint32_t id, uint32_t content, uint32_t children)
+{
+    return vox_write_u32(f, id) && vox_write_u32(f, content) && vox_write_u32(f, children);
+}
+
+static bool vox_write_string(FILE* f, const char* string)
+{
+    uint32_t size = (uint32_t) strlen(string);
+    return vox_write_u32(f, size) && fwrite(string, 1, size, f) == size;
+}
+
+static uint32_t vox_string_size(const char* string)
+{
+    return 4 + (uint32_t) strlen(string);
+}
+
+// Transform node 2 + 2 m above shape node 3 + 2 m of every model under the group 1, and one hidden transform of
+// model 0 the walk has to skip. The rotations cycle through a few valid ones
+static const uint8_t voxBenchmarkRotations[] = { 0x04, 0x11, 0x29, 0x28, 0x62 };
+
+static void vox_benchmark_frame(uint32_t model, char* rotation, char* translation)
+{
+    snprintf(rotation, 16, "%u", voxBenchmarkRotations[model % sizeof(voxBenchmarkRotations)]);
+    snprintf(translation, 48, "%d %d %d", (int) model * 300 - 600, (int) (model % 3) * 40, -(int) model * 7);
+}
+
+static uint32_t vox_benchmark_graph_size(uint32_t modelCount, uint32_t* chunkCount)
+{
+    char rotation[16], translation[48];
+
+    // nTRN 0, nGRP 1
+    uint32_t size = 12 + 4 + 4 + 16 + 4;
+    size += 12 + 4 + 4 + 4 + 4 * (modelCount + 1);
+    *chunkCount = 2;
+
+    for(uint32_t m = 0; m <= modelCount; ++m)
+    {
+        vox_benchmark_frame(m == modelCount ? 0 : m, rotation, translation);
+        bool hidden = m == modelCount;
+
+        // nTRN: id, dict, child, reserved, layer, frame count, frame dict
+        size += 12 + 4 + 4 + (hidden ? vox_string_size("_hidden") + vox_string_size("1") : 0) + 16 + 4 +
+            vox_string_size("_r") + vox_string_size(rotation) + vox_string_size("_t") + vox_string_size(translation);
+
+        // nSHP: id, dict, model count, model, dict
+        size += 12 + 4 + 4 + 4 + 4 + 4;
+        *chunkCount += 2;
+    }
+
+    return size;
+}
+
+static bool vox_benchmark_write_graph(FILE* f, uint32_t modelCount)
+{
+    char rotation[16], translation[48];
+
+    bool result = vox_write_chunk_header(f, VOX_ID('n', 'T', 'R', 'N'), 4 + 4 + 16 + 4, 0) &&
+        vox_write_u32(f, 0) && vox_write_u32(f, 0) && vox_write_u32(f, 1) && vox_write_u32(f, UINT32_MAX) &&
+        vox_write_u32(f, 0) && vox_write_u32(f, 1) && vox_write_u32(f, 0);
+
+    result = result && vox_write_chunk_header(f, VOX_ID('n', 'G', 'R', 'P'), 4 + 4 + 4 + 4 * (modelCount + 1), 0) &&
+        vox_write_u32(f, 1) && vox_write_u32(f, 0) && vox_write_u32(f, modelCount + 1);
+    for(uint32_t m = 0; m <= modelCount && result; ++m)
+        result = vox_write_u32(f, 2 + 2 * m);
+
+    for(uint32_t m = 0; m <= modelCount && result; ++m)
+    {
+        uint32_t model = m == modelCount ? 0 : m;
+        bool hidden = m == modelCount;
+        vox_benchmark_frame(model, rotation, translation);
+
+        uint32_t dictSize = 4 + (hidden ? vox_string_size("_hidden") + vox_string_size("1") : 0);
+        uint32_t frameSize = 4 + vox_string_size("_r") + vox_string_size(rotation) + vox_string_size("_t") +
+            vox_string_size(translation);
+
+        result = vox_write_chunk_header(f, VOX_ID('n', 'T', 'R', 'N'), 4 + dictSize + 16 + frameSize, 0) &&
+            vox_write_u32(f, 2 + 2 * m) && vox_write_u32(f, hidden ? 1 : 0);
+        if(hidden)
+            result = result && vox_write_string(f, "_hidden") && vox_write_string(f, "1");
+
+        result = result && vox_write_u32(f, 3 + 2 * m) && vox_write_u32(f, UINT32_MAX) && vox_write_u32(f, 0) &&
+            vox_write_u32(f, 1) && vox_write_u32(f, 2) && vox_write_string(f, "_r") && vox_write_string(f, rotation) &&
+            vox_write_string(f, "_t") && vox_write_string(f, translation);
+
+        result = result && vox_write_chunk_header(f, VOX_ID('n', 'S', 'H', 'P'), 4 + 4 + 4 + 4 + 4, 0) &&
+            vox_write_u32(f, 3 + 2 * m) && vox_write_u32(f, 0) && vox_write_u32(f, 1) && vox_write_u32(f, model) &&
+            vox_write_u32(f, 0);
+    }
+
+    return result;
+}
+
+// Spheres of size^3 filling about megabytes of XYZI entries, the default palette without RGBA on odd counts
+static bool vox_benchmark_write(const char* path, uint32_t modelCount, uint32_t size, uint32_t* voxelCounts)
+{
+    uint32_t totalCount = 0;
+    for(uint32_t m = 0; m < modelCount; ++m)
+    {
+        voxelCounts[m] = 0;
+        for(uint32_t z = 0; z < size; ++z)
+            for(uint32_t y = 0; y < size; ++y)
+                for(uint32_t x = 0; x < size; ++x)
+                    voxelCounts[m] += vox_benchmark_inside(size, x, y, z);
+        totalCount += voxelCounts[m];
+    }
+
+    FILE* f = fopen(path, "wb");
+    if(f == NULL)
+        return false;
+
+    static char buffer[1 << 20];
+    setvbuf(f, buffer, _IOFBF, sizeof(buffer));
+
+    bool palette = modelCount % 2 == 0;
+
+    uint32_t graphChunks;
+    uint64_t children = (uint64_t) modelCount * (12 + 12 + 12 + 4) + (uint64_t) totalCount * 4 +
+        (palette ? 12 + 1024 : 0) + vox_benchmark_graph_size(modelCount, &graphChunks);
+
+    bool result = children <= UINT32_MAX && vox_write_u32(f, VOX_ID('V', 'O', 'X', ' ')) && vox_write_u32(f, 200) &&
+        vox_write_chunk_header(f, VOX_ID('M', 'A', 'I', 'N'), 0, (uint32_t) children);
+
+    uint8_t* slice = (uint8_t*) malloc((size_t) size * size * 4);
+    result = result && slice != NULL;
+
+    for(uint32_t m = 0; m < modelCount && result; ++m)
+    {
+        result = vox_write_chunk_header(f, VOX_ID('S', 'I', 'Z', 'E'), 12, 0) && vox_write_u32(f, size) &&
+            vox_write_u32(f, size) && vox_write_u32(f, size) &&
+            vox_write_chunk_header(f, VOX_ID('X', 'Y', 'Z', 'I'), 4 + voxelCounts[m] * 4, 0) &&
+            vox_write_u32(f, voxelCounts[m]);
+
+        // The editor writes the lists in no particular order, z slices keep the writer simple
+        for(uint32_t z = 0; z < size && result; ++z)
+        {
+            size_t count = 0;
+            for(uint32_t y = 0; y < size; ++y)
+                for(uint32_t x = 0; x < size; ++x)
+                {
+                    if(!vox_benchmark_inside(size, x, y, z))
+                        continue;
+
+                    uint8_t* entry = &slice[count++ * 4];
+                    entry[0] = (uint8_t) x;
+                    entry[1] = (uint8_t) y;
+                    entry[2] = (uint8_t) z;
+                    entry[3] = vox_benchmark_color(m, x, y, z);
+                }
+
+            result = fwrite(slice, 4, count, f) == count;
+        }
+    }
+    free(slice);
+
+    if(palette && result)
+    {
+        // A gradient palette, entry i is color i + 1
+        result = vox_write_chunk_header(f, VOX_ID('R', 'G', 'B', 'A'), 1024, 0);
+        for(uint32_t i = 0; i < 256 && result; ++i)
+            result = vox_write_u32(f, vox_benchmark_palette_color(i));
+    }
+
+    result = result && vox_benchmark_write_graph(f, modelCount);
+    return fclose(f) == 0 && result;
+}
+
+// Mismatches of the voxels, palettes and instances against the generator
+static uint32_t vox_benchmark_check(const VoxScene* scene, uint32_t modelCount, uint32_t size,
+    const uint32_t* voxelCounts)
+{
+    uint32_t mismatches = 0;
+    if(scene->models.count != modelCount || scene->instances.count != modelCount)
+        return 1;
+
+    // Written on even model counts, its entry i is color i + 1
+    uint32_t palette[256];
+    vox_default_palette(palette);
+    for(uint32_t color = 1; color < 256; ++color)
+        mismatches += scene->palette[color] != (modelCount % 2 == 0 ? vox_benchmark_palette_color(color - 1) : palette[color]);
+
+    for(uint32_t m = 0; m < modelCount; ++m)
+    {
+        const VoxModel* model = &scene->models.items[m];
+        mismatches += model->voxelCount != voxelCounts[m];
+
+        // Model values back to file colors, then to the colors of the model
+        for(uint32_t z = 0; z < size; ++z)
+            for(uint32_t y = 0; y < size; ++y)
+                for(uint32_t x = 0; x < size; ++x)
+                {
+                    uint8_t value = model->voxels[x + z * model->width + (size - 1 - y) * (size_t) model->width * model->height];
+                    if(!vox_benchmark_inside(size, x, y, z))
+                    {
+                        mismatches += value != 0;
+                        continue;
+                    }
+
+                    mismatches += value == 0 || value >= model->colorCount ||
+                        model->colors[value] != scene->palette[vox_benchmark_color(m, x, y, z)];
+                }
+
+        // The center of the voxel 1,2,3 of the model through the file transform, then into the engine axes
+        const VoxInstance* instance = &scene->instances.items[m];
+
+        int32_t rotation[3][3], translation[3];
+        char rotationStr[16], translationStr[48];
+        vox_benchmark_frame(m, rotationStr, translationStr);
+        vox_decode_rotation((uint32_t) atoi(rotationStr), rotation);
+        vox_parse_ints((VoxString) { (const uint8_t*) translationStr, (uint32_t) strlen(translationStr) }, translation, 3);
+
+        float v[3] = { 1.5f - size / 2, 2.5f - size / 2, 3.5f - size / 2 };
+        float world[3];
+        for(uint32_t r = 0; r < 3; ++r)
+            world[r] = rotation[r][0] * v[0] + rotation[r][1] * v[1] + rotation[r][2] * v[2] + translation[r];
+        float expected[3] = { world[0], world[2], -world[1] };
+
+        float local[3] = { 1.5f, 3.5f, size - 2 - 1 + 0.5f };
+        for(uint32_t r = 0; r < 3; ++r)
+        {
+            float p = instance->transform[r][0] * local[0] + instance->transform[r][1] * local[1] +
+                instance->transform[r][2] * local[2] + instance->transform[r][3];
+            mismatches += instance->model != m || p != expected[r];
+        }
+    }
+
+    return mismatches;
+}
+
+bool vox_benchmark(uint32_t megabytes)
+{
+    // Full models of VOX_MAX_SIZE^3, about 35MB of entries each, smaller ones below it
+    uint32_t size = VOX_MAX_SIZE;
+    while(size > 16 && (uint64_t) size * size * size * 4 / 2 > (uint64_t) megabytes << 20)
+        size /= 2;
+
+    uint64_t modelBytes = (uint64_t) size * size * size * 2; // A sphere fills about half its cube, 4 bytes each
+    uint32_t modelCount = (uint32_t) (((uint64_t) megabytes << 20) / modelBytes);
+    modelCount = modelCount > 0 ? modelCount : 1;
+
+    char path[] = "/tmp/voxXXXXXX";
+    int file = mkstemp(path);
+    if(file < 0)
+    {
+        log_error("Vox benchmark failed to create a temporary file");
+        return false;
+    }
+    close(file);
+
+    uint32_t* voxelCounts = (uint32_t*) malloc(modelCount * sizeof(uint32_t));
+    bool result = voxelCounts != NULL && vox_benchmark_write(path, modelCount, size, voxelCounts);
+
+    char timeStr[64], sizeStr[64];
+    Timer t;
+
+    const uint8_t* data = NULL;
+    size_t fileSize = 0;
+    VoxScene scene = {0};
+    VoxGraph graph = {0};
+
+    double mapNs = 0.0, parseNs = 0.0, convertNs = 0.0;
+    if(result)
+    {
+        // Warm, the file was just written
+        timer_start(&t);
+        result = file_map(path, &data, &fileSize);
+        timer_stop(&t);
+        mapNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && vox_parse_chunks(data, fileSize, &scene, &graph);
+        timer_stop(&t);
+        parseNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && vox_build(&scene, &graph);
+        timer_stop(&t);
+        convertNs = timer_get_ns(&t);
+    }
+
+    uint32_t mismatches = result ? vox_benchmark_check(&scene, modelCount, size, voxelCounts) : 0;
+    if(result)
+    {
+        num_to_str(sizeStr, fileSize);
+        log_info("Vox benchmark, %u models of %u^3 and %zu instances in a %sB file:", modelCount, size,
+            scene.instances.count, sizeStr);
+
+        time_to_str(timeStr, mapNs);
+        log_info("    map                %s", timeStr);
+        time_to_str(timeStr, parseNs);
+        log_info("    chunks             %s", timeStr);
+        time_to_str(timeStr, convertNs);
+        log_info("    convert, %2u threads %s, %.0f MB/s of XYZI", jobs_thread_count(), timeStr,
+            fileSize / (convertNs * 1e-9) / 1e6);
+        time_to_str(timeStr, mapNs + parseNs + convertNs);
+        log_info("    load               %s, %.0f MB/s", timeStr, fileSize / ((mapNs + parseNs + convertNs) * 1e-9) / 1e6);
+    }
+
+    vox_graph_destroy(&graph);
+    vox_destroy(&scene);
+    if(data != NULL)
+        file_unmap(data, fileSize);
+
+    // The same bytes copied up front instead of paged in by the conversion
+    if(result)
+    {
+        char* copy = NULL;
+        size_t copySize;
+
+        timer_start(&t);
+        result = file_read_all(path, &copy, &copySize);
+        timer_stop(&t);
+        double readNs = timer_get_ns(&t);
+
+        timer_start(&t);
+        result = result && vox_parse((const uint8_t*) copy, copySize, &scene);
+        timer_stop(&t);
+        double loadNs = timer_get_ns(&t);
+
+        if(result)
+        {
+            mismatches += vox_benchmark_check(&scene, modelCount, size, voxelCounts);
+
+            time_to_str(timeStr, readNs);
+            time_to_str(sizeStr, readNs + loadNs);
+            log_info("    file_read_all      %s, then %s with the parse (%.0f MB/s)", timeStr, sizeStr,
+                copySize / ((readNs + loadNs) * 1e-9) / 1e6);
+        }
+
+        free(copy);
+        vox_destroy(&scene);
+    }
+
+    if(result)
+        log_info("    %u mismatches", mismatches);
+
+    free(voxelCounts);
+    unlink(path);
+    return result && mismatches == 0;
+}
+
+// ##### Benchmark #####
@@ -0,0 +1,67 @@
+#ifndef VOX_H_
+#define VOX_H_
+
+#include "core/list.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  MagicaVoxel .vox scenes. The file is mapped and its chunks walked in place: SIZE and
+ *  XYZI give the models, RGBA the palette (the default one without it), nTRN, nGRP and
+ *  nSHP the scene graph. The XYZI lists are never copied, they are read straight from the
+ *  map by the conversion once every chunk is parsed.
+ *
+ *  The conversion cuts the lists of every model in ranges spread over the job system: a
+ *  first pass gathers the colors each model uses, a second writes the dense volumes, the
+ *  colors remapped to 1..n of the palette of their model. Volumes use the engine axes, y
+ *  up: MagicaVoxel x, z, y, its y mirrored to keep the handedness.
+ *
+ *  Every shape node of the scene graph under visible transforms gives one instance per
+ *  model, its transform the product of the transforms above it, in voxels. Files without a
+ *  scene graph give one instance per model, placed as MagicaVoxel centers them.
+ */
+
+#define VOX_MAX_SIZE 256
+
+typedef struct {
+    uint32_t width, height, depth;
+    uint8_t* voxels;      // width * height * depth, x fastest, 0 empty, else an index into colors
+    uint32_t colors[256]; // RGBA8, R in the low byte, of every value of the model
+    uint32_t colorCount;  // Values used by the voxels + 1
+    uint32_t voxelCount;  // Non zero voxels
+
+    // XYZI list in the map, MagicaVoxel axes
+    const uint8_t* xyzi;
+    uint32_t       sizeX, sizeY, sizeZ;
+} VoxModel;
+
+typedef struct {
+    uint32_t model;
+    float    transform[3][4]; // Row major, volume voxels to scene voxels
+} VoxInstance;
+
+LIST_DEFINE(VoxModel, VoxModels);
+LIST_DEFINE(VoxInstance, VoxInstances);
+
+typedef struct {
+    VoxModels    models;
+    VoxInstances instances;
+    uint32_t     palette[256]; // Of the file, entry 0 unused
+} VoxScene;
+
+// Maps and parses the file, converts its models and unmaps it
+bool vox_load(const char* filepath, VoxScene* scene);
+
+// Parses and converts a file already in memory, data only has to outlive the call
+bool vox_parse(const uint8_t* data, size_t size, VoxScene* scene);
+
+void vox_destroy(VoxScene* scene);
+
+// Writes a scene of sphere models and a scene graph of about megabytes to a temporary file, then times its
+// load: the map and the chunk walk, the conversion over the job system, and file_read_all against the map.
+// Checks the voxels, palettes and transforms against the generator
+bool vox_benchmark(uint32_t megabytes);
+
+#endif // VOX_H_
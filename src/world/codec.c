@@ -0,0 +1,619 @@
+#include "codec.h"
+
+#include "world/world.h"
+#include "world/terrain.h"
+
+#include "core/jobs.h"
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CODEC_MIN_MATCH  4
+#define CODEC_MAX_OFFSET 65535
+#define CODEC_HASH_LOG2  14
+#define CODEC_HIGH_DEPTH 32
+
+// Bytes past the end of the LZ output the decoder may write with its 16 byte copies
+#define CODEC_SLACK 32
+
+typedef struct {
+    uint8_t  level;        // Stages applied, at most the level asked for
+    uint8_t  padding;
+    uint16_t paletteCount; // Values following the header, 0 for raw voxels
+    uint32_t runsSize;     // Bytes of the runs, the LZ output
+} CodecHeader;
+
+size_t codec_bound(size_t size)
+{
+    return sizeof(CodecHeader) + size;
+}
+
+static uint8_t* codec_write_varint(uint8_t* out, uint32_t value)
+{
+    while(value >= 0x80)
+    {
+        *out++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+// Run of the value at voxels[0], 8 bytes at a time
+static size_t codec_run_length(const uint8_t* voxels, size_t size)
+{
+    uint64_t pattern = voxels[0] * 0x0101010101010101ull;
+
+    size_t run = 1;
+    while(run + 8 <= size)
+    {
+        uint64_t word;
+        memcpy(&word, voxels + run, sizeof(word));
+
+        uint64_t diff = word ^ pattern;
+        if(diff != 0)
+            return run + __builtin_ctzll(diff) / 8;
+        run += 8;
+    }
+
+    while(run < size && voxels[run] == voxels[0])
+        ++run;
+    return run;
+}
+
+// Palette of the values in order of appearance then the runs, out holds 2 * size bytes
+static size_t codec_encode_runs(const uint8_t* voxels, size_t size, uint8_t* palette, uint32_t* paletteCount,
+    uint8_t* out)
+{
+    uint16_t indices[256];
+    memset(indices, 0xFF, sizeof(indices));
+    *paletteCount = 0;
+
+    uint8_t* start = out;
+    for(size_t i = 0; i < size;)
+    {
+        size_t run = codec_run_length(voxels + i, size - i);
+
+        uint8_t value = voxels[i];
+        if(indices[value] == 0xFFFF)
+        {
+            indices[value] = (uint16_t) *paletteCount;
+            palette[(*paletteCount)++] = value;
+        }
+
+        *out++ = (uint8_t) indices[value];
+        out = codec_write_varint(out, (uint32_t) (run - 1));
+        i += run;
+    }
+
+    return (size_t) (out - start);
+}
+
+static uint32_t codec_hash(const uint8_t* p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return (word * 2654435761u) >> (32 - CODEC_HASH_LOG2);
+}
+
+static size_t codec_match_length(const uint8_t* a, const uint8_t* b, size_t limit)
+{
+    size_t length = 0;
+    while(length + 8 <= limit)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + length, sizeof(x));
+        memcpy(&y, b + length, sizeof(y));
+        if(x != y)
+            return length + __builtin_ctzll(x ^ y) / 8;
+        length += 8;
+    }
+
+    while(length < limit && a[length] == b[length])
+        ++length;
+    return length;
+}
+
+static uint8_t* codec_write_length(uint8_t* out, size_t length)
+{
+    for(; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = (uint8_t) length;
+    return out;
+}
+
+static uint8_t* codec_write_sequence(uint8_t* out, const uint8_t* literals, size_t literalCount, size_t offset,
+    size_t matchLength)
+{
+    size_t matchCode = matchLength > 0 ? matchLength - CODEC_MIN_MATCH : 0;
+
+    *out++ = (uint8_t) ((literalCount < 15 ? literalCount : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+    if(literalCount >= 15)
+        out = codec_write_length(out, literalCount - 15);
+
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    // The last sequence is literals only
+    if(matchLength == 0)
+        return out;
+
+    *out++ = (uint8_t) offset;
+    *out++ = (uint8_t) (offset >> 8);
+    if(matchCode >= 15)
+        out = codec_write_length(out, matchCode - 15);
+    return out;
+}
+
+// 0 when the sequences don't fit in capacity bytes. chain holds size positions on CODEC_HIGH, NULL otherwise
+static size_t codec_encode_lz(const uint8_t* in, size_t size, uint8_t* out, size_t capacity, int32_t* chain)
+{
+    int32_t heads[1 << CODEC_HASH_LOG2];
+    memset(heads, 0xFF, sizeof(heads));
+
+    uint8_t* start = out;
+    uint8_t* end   = out + capacity;
+
+    size_t anchor = 0, i = 0;
+    while(i + CODEC_MIN_MATCH <= size)
+    {
+        uint32_t hash = codec_hash(in + i);
+
+        size_t bestLength = 0, bestOffset = 0;
+        int32_t candidate = heads[hash];
+        for(uint32_t depth = 0; candidate >= 0 && depth < (chain != NULL ? CODEC_HIGH_DEPTH : 1); ++depth)
+        {
+            size_t offset = i - (size_t) candidate;
+            if(offset > CODEC_MAX_OFFSET)
+                break;
+
+            size_t length = codec_match_length(in + candidate, in + i, size - i);
+            if(length > bestLength)
+            {
+                bestLength = length;
+                bestOffset = offset;
+            }
+
+            candidate = chain != NULL ? chain[candidate] : -1;
+        }
+
+        if(chain != NULL)
+            chain[i] = heads[hash];
+        heads[hash] = (int32_t) i;
+
+        if(bestLength < CODEC_MIN_MATCH)
+        {
+            ++i;
+            continue;
+        }
+
+        // Token, literals, their length and the match length past the nibbles, the offset
+        if((size_t) (end - out) < 1 + (i - anchor) + (i - anchor) / 255 + 2 + bestLength / 255 + 2)
+            return 0;
+        out = codec_write_sequence(out, in + anchor, i - anchor, bestOffset, bestLength);
+
+        // The positions inside the match are candidates of the following ones
+        size_t matchEnd = i + bestLength;
+        for(++i; i < matchEnd && i + CODEC_MIN_MATCH <= size; ++i)
+        {
+            uint32_t h = codec_hash(in + i);
+            if(chain != NULL)
+                chain[i] = heads[h];
+            heads[h] = (int32_t) i;
+        }
+
+        i      = matchEnd;
+        anchor = i;
+    }
+
+    if((size_t) (end - out) < 1 + (size - anchor) + (size - anchor) / 255 + 1)
+        return 0;
+    out = codec_write_sequence(out, in + anchor, size - anchor, 0, 0);
+
+    return (size_t) (out - start);
+}
+
+size_t codec_encode(const uint8_t* voxels, size_t size, CodecLevel level, uint8_t* data)
+{
+    CodecHeader header = {
+        .level = CODEC_RAW,
+    };
+
+    uint8_t* out  = data + sizeof(CodecHeader);
+    size_t   used = size;
+
+    uint8_t* runs  = level >= CODEC_RLE ? (uint8_t*) malloc(2 * size) : NULL;
+    int32_t* chain = level >= CODEC_HIGH ? (int32_t*) malloc(size * 2 * sizeof(int32_t)) : NULL;
+
+    uint8_t palette[256];
+    uint32_t paletteCount = 0;
+    size_t runsSize = runs != NULL ? codec_encode_runs(voxels, size, palette, &paletteCount, runs) : 0;
+
+    // Each stage has to beat the one before it, the output never grows past the raw voxels
+    if(runs != NULL && paletteCount + runsSize < used)
+    {
+        header.level        = CODEC_RLE;
+        header.paletteCount = (uint16_t) paletteCount;
+        header.runsSize     = (uint32_t) runsSize;
+        used = paletteCount + runsSize;
+
+        memcpy(out, palette, paletteCount);
+        memcpy(out + paletteCount, runs, runsSize);
+
+        if(level >= CODEC_FAST && (level < CODEC_HIGH || chain != NULL))
+        {
+            size_t lzSize = codec_encode_lz(runs, runsSize, out + paletteCount, used - paletteCount - 1, chain);
+            if(lzSize > 0)
+            {
+                header.level = level;
+                used = paletteCount + lzSize;
+            }
+            else // The runs were overwritten by the sequences that didn't fit
+                memcpy(out + paletteCount, runs, runsSize);
+        }
+    }
+    else
+        memcpy(out, voxels, size);
+
+    free(runs);
+    free(chain);
+
+    memcpy(data, &header, sizeof(header));
+    return sizeof(CodecHeader) + used;
+}
+
+static bool codec_read_length(const uint8_t** in, const uint8_t* end, size_t* length)
+{
+    uint8_t byte;
+    do
+    {
+        if(*in >= end)
+            return false;
+
+        byte = *(*in)++;
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+// Sequences of in into out, writes up to CODEC_SLACK bytes past outSize
+static bool codec_decode_lz(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize)
+{
+    const uint8_t* inEnd  = in + inSize;
+    uint8_t*       start  = out;
+    uint8_t*       outEnd = out + outSize;
+
+    while(in < inEnd)
+    {
+        uint8_t token = *in++;
+
+        size_t literalCount = token >> 4;
+        if(literalCount == 15 && !codec_read_length(&in, inEnd, &literalCount))
+            return false;
+
+        if(literalCount > (size_t) (inEnd - in) || literalCount > (size_t) (outEnd - out))
+            return false;
+
+        if((size_t) (inEnd - in) >= 16 && literalCount <= (size_t) (inEnd - in) - 16)
+        {
+            for(size_t i = 0; i < literalCount; i += 16)
+                memcpy(out + i, in + i, 16);
+        }
+        else
+            memcpy(out, in, literalCount);
+
+        in  += literalCount;
+        out += literalCount;
+
+        if(in == inEnd)
+            break;
+
+        if(inEnd - in < 2)
+            return false;
+
+        size_t offset = (size_t) in[0] | (size_t) in[1] << 8;
+        in += 2;
+
+        size_t matchLength = token & 15;
+        if(matchLength == 15 && !codec_read_length(&in, inEnd, &matchLength))
+            return false;
+        matchLength += CODEC_MIN_MATCH;
+
+        if(offset == 0 || offset > (size_t) (out - start) || matchLength > (size_t) (outEnd - out))
+            return false;
+
+        const uint8_t* match = out - offset;
+        if(offset >= 16)
+        {
+            for(size_t i = 0; i < matchLength; i += 16)
+                memcpy(out + i, match + i, 16);
+        }
+        else
+        {
+            for(size_t i = 0; i < matchLength; ++i)
+                out[i] = match[i];
+        }
+
+        out += matchLength;
+    }
+
+    return out == outEnd;
+}
+
+static bool codec_decode_runs(const uint8_t* in, size_t inSize, const uint8_t* palette, uint32_t paletteCount,
+    uint8_t* voxels, size_t voxelCount)
+{
+    const uint8_t* inEnd  = in + inSize;
+    uint8_t*       out    = voxels;
+    uint8_t*       outEnd = voxels + voxelCount;
+
+    while(in < inEnd)
+    {
+        uint8_t index = *in++;
+        if(index >= paletteCount)
+            return false;
+
+        size_t run = 0;
+        for(uint32_t shift = 0;; shift += 7)
+        {
+            if(in >= inEnd || shift > 28)
+                return false;
+
+            uint8_t byte = *in++;
+            run |= (size_t) (byte & 0x7F) << shift;
+            if((byte & 0x80) == 0)
+                break;
+        }
+        ++run;
+
+        if(run > (size_t) (outEnd - out))
+            return false;
+
+        // One 16 byte store for the short runs, the next run writes over the bytes past this one
+        if(run <= 16 && outEnd - out >= 16)
+            memset(out, palette[index], 16);
+        else
+            memset(out, palette[index], run);
+        out += run;
+    }
+
+    return out == outEnd;
+}
+
+bool codec_decode(const uint8_t* data, size_t size, uint8_t* voxels, size_t voxelCount)
+{
+    CodecHeader header;
+    if(size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    size -= sizeof(header);
+
+    if(header.level == CODEC_RAW)
+    {
+        if(size != voxelCount)
+            return false;
+
+        memcpy(voxels, data, voxelCount);
+        return true;
+    }
+
+    if(header.level >= CODEC_LEVEL_COUNT || header.paletteCount == 0 || header.paletteCount > 256 ||
+        header.paletteCount > size)
+        return false;
+
+    const uint8_t* palette = data;
+    data += header.paletteCount;
+    size -= header.paletteCount;
+
+    if(header.level == CODEC_RLE)
+        return header.runsSize == size &&
+            codec_decode_runs(data, size, palette, header.paletteCount, voxels, voxelCount);
+
+    // Runs take 2 bytes per voxel at most
+    if(header.runsSize > 2 * voxelCount)
+        return false;
+
+    uint8_t* runs = (uint8_t*) malloc(header.runsSize + CODEC_SLACK);
+    bool result = runs != NULL && codec_decode_lz(data, size, runs, header.runsSize) &&
+        codec_decode_runs(runs, header.runsSize, palette, header.paletteCount, voxels, voxelCount);
+
+    free(runs);
+    return result;
+}
+
+typedef enum {
+    CODEC_CHUNK_UNIFORM,     // One value
+    CODEC_CHUNK_SURFACE,     // Holds grass
+    CODEC_CHUNK_UNDERGROUND, // Stone, dirt and caves
+    CODEC_CHUNK_NOISE,       // Random values, the worst case
+    CODEC_CHUNK_TYPE_COUNT,
+} CodecChunkType;
+
+typedef struct {
+    uint8_t** encoded;
+    size_t*   sizes;
+    uint8_t** decoded;
+    atomic_uint failures;
+} CodecBenchmarkDecode;
+
+static void codec_benchmark_decode(uint32_t begin, uint32_t end, void* data)
+{
+    CodecBenchmarkDecode* decode = (CodecBenchmarkDecode*) data;
+    for(uint32_t i = begin; i < end; ++i)
+        if(!codec_decode(decode->encoded[i], decode->sizes[i], decode->decoded[i], WORLD_CHUNK_VOLUME))
+            atomic_fetch_add(&decode->failures, 1);
+}
+
+bool codec_benchmark(uint32_t chunkCount)
+{
+    Terrain terrain;
+    terrain_init(&terrain, 1337);
+
+    // Columns from the caves to the hills, the sky chunks are never stored
+    const uint32_t layers = 4;
+    uint32_t side = 1;
+    while(side * side * (layers + 1) < chunkCount)
+        ++side;
+
+    uint32_t terrainCount = side * side * layers;
+    chunkCount = terrainCount + side * side;
+
+    IVec3*    coords  = (IVec3*) malloc(terrainCount * sizeof(IVec3));
+    uint8_t** chunks  = (uint8_t**) calloc(chunkCount, sizeof(uint8_t*));
+    uint8_t** encoded = (uint8_t**) calloc(chunkCount, sizeof(uint8_t*));
+    uint8_t** decoded = (uint8_t**) calloc(chunkCount, sizeof(uint8_t*));
+    size_t*   sizes   = (size_t*) calloc(chunkCount, sizeof(size_t));
+    uint32_t* types   = (uint32_t*) calloc(chunkCount, sizeof(uint32_t));
+
+    bool result = coords != NULL && chunks != NULL && encoded != NULL && decoded != NULL && sizes != NULL &&
+        types != NULL;
+    for(uint32_t i = 0; i < chunkCount && result; ++i)
+    {
+        chunks[i]  = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+        decoded[i] = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+        encoded[i] = (uint8_t*) malloc(codec_bound(WORLD_CHUNK_VOLUME));
+        result = chunks[i] != NULL && decoded[i] != NULL && encoded[i] != NULL;
+
+        if(i < terrainCount)
+            coords[i] = (IVec3) { (int) (i % side), (int) (i / (side * side)) - (int) layers + 1,
+                (int) ((i / side) % side) };
+    }
+
+    result = result && terrain_generate_chunks(&terrain, coords, terrainCount, chunks);
+
+    uint32_t typeCounts[CODEC_CHUNK_TYPE_COUNT] = {0};
+    for(uint32_t i = 0; i < chunkCount && result; ++i)
+    {
+        uint8_t* voxels = chunks[i];
+        if(i >= terrainCount)
+        {
+            // A few values in no order, xorshift
+            uint32_t state = 0x9E3779B9u * (i + 1);
+            for(uint32_t v = 0; v < WORLD_CHUNK_VOLUME; ++v)
+            {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                voxels[v] = (uint8_t) (state % 5);
+            }
+            types[i] = CODEC_CHUNK_NOISE;
+        }
+        else if(codec_run_length(voxels, WORLD_CHUNK_VOLUME) == WORLD_CHUNK_VOLUME)
+            types[i] = CODEC_CHUNK_UNIFORM;
+        else if(memchr(voxels, TERRAIN_GRASS, WORLD_CHUNK_VOLUME) != NULL)
+            types[i] = CODEC_CHUNK_SURFACE;
+        else
+            types[i] = CODEC_CHUNK_UNDERGROUND;
+
+        ++typeCounts[types[i]];
+    }
+
+    const char* levelNames[] = { "raw", "rle", "fast", "high" };
+    const char* typeNames[]  = { "uniform", "surface", "underground", "noise" };
+
+    if(result)
+        log_info("Codec benchmark, %u chunks of %u^3, MB/s of voxels:", chunkCount, WORLD_CHUNK_SIZE);
+
+    char timeStr[64];
+    Timer t;
+
+    uint32_t mismatches = 0;
+    for(uint32_t level = CODEC_RAW; level < CODEC_LEVEL_COUNT && result; ++level)
+    {
+        size_t totalEncoded = 0;
+        for(uint32_t type = 0; type < CODEC_CHUNK_TYPE_COUNT; ++type)
+        {
+            if(typeCounts[type] == 0)
+                continue;
+
+            size_t typeEncoded = 0;
+
+            timer_start(&t);
+            for(uint32_t i = 0; i < chunkCount; ++i)
+            {
+                if(types[i] != type)
+                    continue;
+
+                sizes[i] = codec_encode(chunks[i], WORLD_CHUNK_VOLUME, (CodecLevel) level, encoded[i]);
+                typeEncoded += sizes[i];
+            }
+            timer_stop(&t);
+            double encodeNs = timer_get_ns(&t);
+
+            timer_start(&t);
+            for(uint32_t i = 0; i < chunkCount; ++i)
+                if(types[i] == type)
+                    mismatches += !codec_decode(encoded[i], sizes[i], decoded[i], WORLD_CHUNK_VOLUME);
+            timer_stop(&t);
+            double decodeNs = timer_get_ns(&t);
+
+            for(uint32_t i = 0; i < chunkCount; ++i)
+                if(types[i] == type)
+                    mismatches += memcmp(chunks[i], decoded[i], WORLD_CHUNK_VOLUME) != 0;
+
+            double bytes = (double) typeCounts[type] * WORLD_CHUNK_VOLUME;
+            log_info("    %-4s %-11s x%-4u ratio %7.1f, encode %6.0f MB/s, decode %6.0f MB/s", levelNames[level],
+                typeNames[type], typeCounts[type], bytes / typeEncoded, bytes / (encodeNs * 1e-9) / 1e6,
+                bytes / (decodeNs * 1e-9) / 1e6);
+
+            totalEncoded += typeEncoded;
+        }
+
+        // Every chunk of the level over the job system, as the loads decode them
+        CodecBenchmarkDecode decode = {
+            .encoded = encoded,
+            .sizes   = sizes,
+            .decoded = decoded,
+        };
+
+        for(uint32_t i = 0; i < chunkCount; ++i)
+            memset(decoded[i], 0xFF, WORLD_CHUNK_VOLUME);
+
+        timer_start(&t);
+        jobs_parallel_for(chunkCount, 4, codec_benchmark_decode, &decode);
+        timer_stop(&t);
+
+        mismatches += atomic_load(&decode.failures);
+        for(uint32_t i = 0; i < chunkCount; ++i)
+            mismatches += memcmp(chunks[i], decoded[i], WORLD_CHUNK_VOLUME) != 0;
+
+        double bytes = (double) chunkCount * WORLD_CHUNK_VOLUME;
+        time_to_str(timeStr, timer_get_ns(&t));
+        log_info("    %-4s all chunks, ratio %.1f, decoded on %u threads in %s (%.0f MB/s)", levelNames[level],
+            bytes / totalEncoded, jobs_thread_count(), timeStr, bytes / (timer_get_ns(&t) * 1e-9) / 1e6);
+    }
+
+    // Truncated and corrupted chunks fail or decode to some voxels, never past them. A truncated chunk
+    // that still decodes only lost an empty last sequence and has to give the same voxels
+    for(uint32_t i = 0; i < chunkCount && result; ++i)
+    {
+        size_t size = codec_encode(chunks[i], WORLD_CHUNK_VOLUME, CODEC_HIGH, encoded[i]);
+        mismatches += codec_decode(encoded[i], size - 1, decoded[i], WORLD_CHUNK_VOLUME) &&
+            memcmp(chunks[i], decoded[i], WORLD_CHUNK_VOLUME) != 0;
+
+        encoded[i][size / 2] ^= 0x5A;
+        codec_decode(encoded[i], size, decoded[i], WORLD_CHUNK_VOLUME);
+    }
+
+    if(result)
+        log_info("    %u mismatches", mismatches);
+
+    for(uint32_t i = 0; i < chunkCount; ++i)
+    {
+        free(chunks != NULL ? chunks[i] : NULL);
+        free(encoded != NULL ? encoded[i] : NULL);
+        free(decoded != NULL ? decoded[i] : NULL);
+    }
+
+    free(coords);
+    free(chunks);
+    free(encoded);
+    free(decoded);
+    free(sizes);
+    free(types);
+    return result && mismatches == 0;
+}
@@ -0,0 +1,44 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Compression of the stored chunks, in two stages. The runs: the distinct values of the
+ *  voxels go to a palette, then every run of one value is its palette index and its length
+ *  as a varint. The LZ: the runs are cut in sequences of literals and a match, a token of
+ *  two nibbles for their lengths, the literals, then a 16 bit offset back into the output,
+ *  the LZ4 block layout. Each stage is only kept when it shrinks the data, noise comes out
+ *  raw and the header says which stages were applied.
+ *
+ *  Decoding is built for throughput: runs are expanded with fixed 16 byte stores when they
+ *  are short and with memset otherwise, literals and matches at least 16 bytes back are
+ *  copied 16 bytes at a time, all of them plain stores the compiler turns into SIMD moves.
+ *  Every length and offset is checked against both buffers, a corrupted chunk fails
+ *  instead of writing out of bounds. Nothing is shared, any thread decodes any chunk.
+ */
+
+typedef enum {
+    CODEC_RAW,  // Voxels as they are
+    CODEC_RLE,  // Runs only
+    CODEC_FAST, // Runs then LZ, one match candidate per position
+    CODEC_HIGH, // Runs then LZ, the best of a chain of earlier candidates
+    CODEC_LEVEL_COUNT,
+} CodecLevel;
+
+// Encoded bytes of size voxels at most, on any level
+size_t codec_bound(size_t size);
+
+// Fills at most codec_bound(size) bytes of data, returns how many
+size_t codec_encode(const uint8_t* voxels, size_t size, CodecLevel level, uint8_t* data);
+
+// False when data doesn't decode to exactly voxelCount voxels
+bool codec_decode(const uint8_t* data, size_t size, uint8_t* voxels, size_t voxelCount);
+
+// Ratio, encode and decode MB/s of every level on terrain chunks sorted by type and on noise, then the
+// decode of all chunks spread over the job system. Checks every chunk decodes to its voxels
+bool codec_benchmark(uint32_t chunkCount);
+
+#endif // CODEC_H_
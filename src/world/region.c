@@ -0,0 +1,720 @@
+#include "region.h"
+
+#include "world/world.h"
+#include "world/terrain.h"
+
+#include "core/filesystem.h"
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define REGION_MAGIC   0x47525856u // "VXRG"
+#define REGION_VERSION 2u
+
+// Header sector then the entries, twice
+#define REGION_TABLE_SECTORS (1 + (REGION_CHUNKS * sizeof(RegionEntry) + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE)
+#define REGION_DATA_SECTOR   (2 * REGION_TABLE_SECTORS)
+
+// Sector pointed at by the committed table, by the working one
+#define REGION_SECTOR_COMMITTED 1u
+#define REGION_SECTOR_WORKING   2u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    uint32_t codec;
+    uint32_t padding;
+    uint64_t checksum; // Of the generation, the codec and the entries
+} RegionHeader;
+
+static uint64_t region_checksum(const RegionHeader* header, const RegionEntry* entries)
+{
+    // FNV-1a over 64 bit words, the entries are REGION_CHUNKS pairs of words
+    const uint64_t* words = (const uint64_t*) entries;
+
+    uint64_t hash = (0xCBF29CE484222325ull ^ header->generation) * 0x100000001B3ull;
+    hash = (hash ^ header->codec) * 0x100000001B3ull;
+    for(size_t i = 0; i < REGION_CHUNKS * sizeof(RegionEntry) / sizeof(uint64_t); ++i)
+        hash = (hash ^ words[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+// Valid table copy of the highest generation in the file data, -1 when neither copy is valid
+static int region_pick_table(const uint8_t* data, size_t size, RegionHeader* picked)
+{
+    int table = -1;
+    for(int copy = 0; copy < 2; ++copy)
+    {
+        size_t offset = (size_t) copy * REGION_TABLE_SECTORS * REGION_SECTOR_SIZE;
+        if(offset + REGION_TABLE_SECTORS * REGION_SECTOR_SIZE > size)
+            continue;
+
+        RegionHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+
+        const RegionEntry* entries = (const RegionEntry*) (data + offset + REGION_SECTOR_SIZE);
+        if(header.magic != REGION_MAGIC || header.version != REGION_VERSION || header.codec >= CODEC_LEVEL_COUNT ||
+            header.checksum != region_checksum(&header, entries))
+            continue;
+
+        if(table < 0 || header.generation > picked->generation)
+        {
+            table   = copy;
+            *picked = header;
+        }
+    }
+
+    return table;
+}
+
+static const RegionEntry* region_table_entries(const uint8_t* data, int table)
+{
+    return (const RegionEntry*) (data + ((size_t) table * REGION_TABLE_SECTORS + 1) * REGION_SECTOR_SIZE);
+}
+
+static uint32_t region_sector_count(uint32_t size)
+{
+    return (size + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE;
+}
+
+static bool region_stored(const RegionEntry* entry)
+{
+    return entry->sector != REGION_NO_SECTOR && entry->sector != REGION_EMPTY_SECTOR;
+}
+
+static bool region_write_all(int file, const void* data, size_t size, size_t offset)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    while(size > 0)
+    {
+        ssize_t written = pwrite(file, bytes, size, (off_t) offset);
+        if(written <= 0)
+        {
+            log_error("Region write of %zu bytes at %zu failed", size, offset);
+            return false;
+        }
+
+        bytes  += written;
+        offset += (size_t) written;
+        size   -= (size_t) written;
+    }
+    return true;
+}
+
+static bool region_map(Region* region)
+{
+    if(region->map != NULL)
+        munmap(region->map, region->mapSize);
+
+    region->mapSize = region->sectorCount * REGION_SECTOR_SIZE;
+    region->map = (uint8_t*) mmap(NULL, region->mapSize, PROT_READ, MAP_SHARED, region->file, 0);
+    if(region->map == MAP_FAILED)
+    {
+        log_error("Region map of %zu bytes failed", region->mapSize);
+        region->map = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Sector states of the whole file, the new sectors are free
+static bool region_reserve_sectors(Region* region, size_t sectorCount)
+{
+    if(sectorCount > region->sectorCapacity)
+    {
+        size_t capacity = region->sectorCapacity > 0 ? region->sectorCapacity : 1024;
+        while(capacity < sectorCount)
+            capacity *= 2;
+
+        uint8_t* sectors = (uint8_t*) realloc(region->sectors, capacity);
+        if(sectors == NULL)
+            return false;
+
+        memset(sectors + region->sectorCapacity, 0, capacity - region->sectorCapacity);
+        region->sectors        = sectors;
+        region->sectorCapacity = capacity;
+    }
+
+    region->sectorCount = sectorCount > region->sectorCount ? sectorCount : region->sectorCount;
+    return true;
+}
+
+static void region_mark(Region* region, const RegionEntry* entry, uint8_t bits, bool set)
+{
+    if(!region_stored(entry))
+        return;
+
+    for(uint32_t i = 0; i < region_sector_count(entry->size); ++i)
+    {
+        size_t sector = entry->sector + i;
+        region->sectors[sector] = set ? region->sectors[sector] | bits : region->sectors[sector] & ~bits;
+
+        if(region->sectors[sector] == 0 && sector < region->freeHint)
+            region->freeHint = sector;
+    }
+}
+
+// First run of count free sectors, the file grows when the run reaches its end
+static bool region_allocate(Region* region, uint32_t count, uint32_t* first)
+{
+    size_t run = 0, sector = region->freeHint;
+    for(; sector < region->sectorCount; ++sector)
+    {
+        if(region->sectors[sector] != 0)
+        {
+            run = 0;
+            continue;
+        }
+
+        if(++run == count)
+            break;
+    }
+
+    size_t start = sector < region->sectorCount ? sector + 1 - count : region->sectorCount - run;
+    size_t end   = start + count;
+    if(end > UINT32_MAX)
+    {
+        log_error("Region %d,%d,%d full", region->coords.x, region->coords.y, region->coords.z);
+        return false;
+    }
+
+    if(end > region->sectorCount)
+    {
+        if(ftruncate(region->file, (off_t) (end * REGION_SECTOR_SIZE)) != 0 || !region_reserve_sectors(region, end))
+        {
+            log_error("Region %d,%d,%d failed to grow to %zu sectors", region->coords.x, region->coords.y,
+                region->coords.z, end);
+            return false;
+        }
+    }
+
+    if(start == region->freeHint)
+        region->freeHint = end;
+
+    *first = (uint32_t) start;
+    return true;
+}
+
+static uint32_t region_chunk_index(const Region* region, IVec3 chunkCoords)
+{
+    uint32_t x = (uint32_t) (chunkCoords.x - region->coords.x * REGION_SIZE);
+    uint32_t y = (uint32_t) (chunkCoords.y - region->coords.y * REGION_SIZE);
+    uint32_t z = (uint32_t) (chunkCoords.z - region->coords.z * REGION_SIZE);
+    ASSERT(x < REGION_SIZE && y < REGION_SIZE && z < REGION_SIZE);
+
+    return x + y * REGION_SIZE + z * (REGION_SIZE * REGION_SIZE);
+}
+
+static int region_floor_div(int value)
+{
+    return (value >= 0 ? value : value - (REGION_SIZE - 1)) / REGION_SIZE;
+}
+
+IVec3 region_of_chunk(IVec3 chunkCoords)
+{
+    return (IVec3) { region_floor_div(chunkCoords.x), region_floor_div(chunkCoords.y), region_floor_div(chunkCoords.z) };
+}
+
+static void region_path(char* path, size_t size, const char* directory, IVec3 coords)
+{
+    snprintf(path, size, "%s/r.%d.%d.%d.vxr", directory, coords.x, coords.y, coords.z);
+}
+
+// Empty table of generation 1 in the first copy, an invalid second copy, flushed with the directory entry
+static bool region_create_file(int file, const char* directory)
+{
+    if(ftruncate(file, (off_t) REGION_DATA_SECTOR * REGION_SECTOR_SIZE) != 0)
+        return false;
+
+    RegionEntry* entries = (RegionEntry*) calloc(REGION_CHUNKS, sizeof(RegionEntry));
+    if(entries == NULL)
+        return false;
+
+    RegionHeader header = {
+        .magic      = REGION_MAGIC,
+        .version    = REGION_VERSION,
+        .generation = 1,
+        .codec      = REGION_DEFAULT_CODEC,
+    };
+    header.checksum = region_checksum(&header, entries);
+    free(entries);
+
+    if(!region_write_all(file, &header, sizeof(header), 0) || fsync(file) != 0)
+        return false;
+
+    int dir = open(directory, O_RDONLY);
+    if(dir < 0)
+        return false;
+
+    bool result = fsync(dir) == 0;
+    close(dir);
+    return result;
+}
+
+bool region_open(Region* region, const char* directory, IVec3 coords)
+{
+    *region = (Region) {
+        .file   = -1,
+        .coords = coords,
+    };
+
+    char path[1024];
+    region_path(path, sizeof(path), directory, coords);
+
+    region->file = open(path, O_RDWR | O_CREAT, 0644);
+    if(region->file < 0)
+    {
+        log_error("Region open failed: %s", path);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(region->file, &st) != 0 || (st.st_size == 0 && !region_create_file(region->file, directory)) ||
+        fstat(region->file, &st) != 0)
+    {
+        log_error("Region create failed: %s", path);
+        region_close(region);
+        return false;
+    }
+
+    region->entries = (RegionEntry*) malloc(REGION_CHUNKS * sizeof(RegionEntry));
+    if(region->entries == NULL || !region_reserve_sectors(region, (size_t) st.st_size / REGION_SECTOR_SIZE) ||
+        !region_map(region))
+    {
+        region_close(region);
+        return false;
+    }
+
+    RegionHeader header;
+    int table = region_pick_table(region->map, region->mapSize, &header);
+    if(table < 0)
+    {
+        log_error("Region without a valid table: %s", path);
+        region_close(region);
+        return false;
+    }
+
+    region->table      = (uint32_t) table;
+    region->generation = header.generation;
+    region->codec      = (CodecLevel) header.codec;
+    memcpy(region->entries, region_table_entries(region->map, table), REGION_CHUNKS * sizeof(RegionEntry));
+
+    // Both tables stay reserved
+    memset(region->sectors, REGION_SECTOR_COMMITTED | REGION_SECTOR_WORKING, REGION_DATA_SECTOR);
+    region->freeHint = REGION_DATA_SECTOR;
+
+    uint32_t dropped = 0;
+    for(uint32_t i = 0; i < REGION_CHUNKS; ++i)
+    {
+        RegionEntry* entry = &region->entries[i];
+        if(!region_stored(entry))
+            continue;
+
+        // A checksummed table past the end of the file, the file lost its tail
+        if(entry->sector < REGION_DATA_SECTOR ||
+            (size_t) entry->sector + region_sector_count(entry->size) > region->sectorCount)
+        {
+            *entry = (RegionEntry) { REGION_NO_SECTOR, 0 };
+            ++dropped;
+            continue;
+        }
+
+        region_mark(region, entry, REGION_SECTOR_COMMITTED | REGION_SECTOR_WORKING, true);
+    }
+
+    if(dropped > 0)
+    {
+        log_error("Region %s: %u chunks past the end of the file dropped", path, dropped);
+        region->dirty = true;
+    }
+
+    return true;
+}
+
+void region_close(Region* region)
+{
+    if(region->map != NULL)
+        munmap(region->map, region->mapSize);
+
+    if(region->file >= 0)
+        close(region->file);
+
+    free(region->entries);
+    free(region->sectors);
+    *region = (Region) { .file = -1 };
+}
+
+bool region_read_chunk(Region* region, IVec3 chunkCoords, const uint8_t** data, size_t* size)
+{
+    const RegionEntry* entry = &region->entries[region_chunk_index(region, chunkCoords)];
+    if(entry->sector == REGION_NO_SECTOR)
+        return false;
+
+    *data = NULL;
+    *size = 0;
+    if(entry->sector == REGION_EMPTY_SECTOR)
+        return true;
+
+    // Written since the map, the file grew
+    if(((size_t) entry->sector + region_sector_count(entry->size)) * REGION_SECTOR_SIZE > region->mapSize &&
+        !region_map(region))
+        return false;
+
+    *data = region->map + (size_t) entry->sector * REGION_SECTOR_SIZE;
+    *size = entry->size;
+    return true;
+}
+
+bool region_write_chunk(Region* region, IVec3 chunkCoords, const uint8_t* data, size_t size)
+{
+    RegionEntry* entry = &region->entries[region_chunk_index(region, chunkCoords)];
+
+    if(size > UINT32_MAX - REGION_SECTOR_SIZE)
+    {
+        log_error("Region chunk of %zu bytes too large", size);
+        return false;
+    }
+
+    // The committed sectors of the chunk stay untouched until the next commit stops pointing at them
+    region_mark(region, entry, REGION_SECTOR_WORKING, false);
+    region->dirty = true;
+
+    if(data == NULL || size == 0)
+    {
+        *entry = (RegionEntry) { REGION_EMPTY_SECTOR, 0 };
+        return true;
+    }
+
+    uint32_t first;
+    if(!region_allocate(region, region_sector_count((uint32_t) size), &first) ||
+        !region_write_all(region->file, data, size, (size_t) first * REGION_SECTOR_SIZE))
+    {
+        *entry = (RegionEntry) { REGION_NO_SECTOR, 0 };
+        return false;
+    }
+
+    *entry = (RegionEntry) { first, (uint32_t) size };
+    region_mark(region, entry, REGION_SECTOR_WORKING, true);
+    return true;
+}
+
+void region_set_codec(Region* region, CodecLevel codec)
+{
+    region->dirty = region->dirty || region->codec != codec;
+    region->codec = codec;
+}
+
+bool region_write_voxels(Region* region, IVec3 chunkCoords, const uint8_t* voxels)
+{
+    if(voxels == NULL)
+        return region_write_chunk(region, chunkCoords, NULL, 0);
+
+    uint8_t* data = (uint8_t*) malloc(codec_bound(WORLD_CHUNK_VOLUME));
+    if(data == NULL)
+        return false;
+
+    size_t size = codec_encode(voxels, WORLD_CHUNK_VOLUME, region->codec, data);
+    bool result = region_write_chunk(region, chunkCoords, data, size);
+
+    free(data);
+    return result;
+}
+
+bool region_read_voxels(Region* region, IVec3 chunkCoords, uint8_t* voxels)
+{
+    const uint8_t* data;
+    size_t size;
+    if(!region_read_chunk(region, chunkCoords, &data, &size))
+        return false;
+
+    if(data == NULL)
+    {
+        memset(voxels, 0, WORLD_CHUNK_VOLUME);
+        return true;
+    }
+
+    return codec_decode(data, size, voxels, WORLD_CHUNK_VOLUME);
+}
+
+bool region_commit(Region* region)
+{
+    if(!region->dirty)
+        return true;
+
+    // The chunk sectors reach the disk before a table points at them
+    if(fdatasync(region->file) != 0)
+    {
+        log_error("Region %d,%d,%d data flush failed", region->coords.x, region->coords.y, region->coords.z);
+        return false;
+    }
+
+    // Over the older copy, a torn write fails its checksum and the committed copy stays the one opened
+    uint32_t table = region->table ^ 1u;
+    RegionHeader header = {
+        .magic      = REGION_MAGIC,
+        .version    = REGION_VERSION,
+        .generation = region->generation + 1,
+        .codec      = region->codec,
+    };
+    header.checksum = region_checksum(&header, region->entries);
+
+    size_t offset = (size_t) table * REGION_TABLE_SECTORS * REGION_SECTOR_SIZE;
+    if(!region_write_all(region->file, region->entries, REGION_CHUNKS * sizeof(RegionEntry), offset + REGION_SECTOR_SIZE) ||
+        !region_write_all(region->file, &header, sizeof(header), offset) || fdatasync(region->file) != 0)
+    {
+        log_error("Region %d,%d,%d table write failed", region->coords.x, region->coords.y, region->coords.z);
+        return false;
+    }
+
+    region->table      = table;
+    region->generation = header.generation;
+    region->dirty      = false;
+
+    // The sectors only the previous table pointed at are free from now on
+    for(size_t sector = REGION_DATA_SECTOR; sector < region->sectorCount; ++sector)
+    {
+        region->sectors[sector] = (region->sectors[sector] & REGION_SECTOR_WORKING) ?
+            REGION_SECTOR_COMMITTED | REGION_SECTOR_WORKING : 0;
+
+        if(region->sectors[sector] == 0 && sector < region->freeHint)
+            region->freeHint = sector;
+    }
+
+    return true;
+}
+
+// Sum of the 64 bit words, cheap enough for the loads to stay bound by the memory and the disk
+static uint64_t region_touch(const uint8_t* data, size_t size)
+{
+    uint64_t sum = 0, word;
+    for(size_t i = 0; i + sizeof(word) <= size; i += sizeof(word))
+    {
+        memcpy(&word, data + i, sizeof(word));
+        sum += word;
+    }
+    return sum;
+}
+
+// Drops the clean pages of the file from the page cache, the next read comes from the disk
+static void region_evict(const char* path)
+{
+    int file = open(path, O_RDONLY);
+    if(file < 0)
+        return;
+
+    fdatasync(file);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+}
+
+// Every chunk of the region through the map, or through file_read_all and the table of the read copy
+static bool region_load(const char* directory, IVec3 coords, bool mapped, uint64_t* sum, size_t* bytes)
+{
+    *sum   = 0;
+    *bytes = 0;
+
+    if(mapped)
+    {
+        Region region;
+        if(!region_open(&region, directory, coords))
+            return false;
+
+        for(uint32_t i = 0; i < REGION_CHUNKS; ++i)
+        {
+            const RegionEntry* entry = &region.entries[i];
+            if(!region_stored(entry))
+                continue;
+
+            *sum   += region_touch(region.map + (size_t) entry->sector * REGION_SECTOR_SIZE, entry->size);
+            *bytes += entry->size;
+        }
+
+        region_close(&region);
+        return true;
+    }
+
+    char path[1024];
+    region_path(path, sizeof(path), directory, coords);
+
+    char* data;
+    size_t size;
+    if(!file_read_all(path, &data, &size))
+        return false;
+
+    RegionHeader header;
+    int table = region_pick_table((const uint8_t*) data, size, &header);
+    if(table >= 0)
+    {
+        const RegionEntry* entries = region_table_entries((const uint8_t*) data, table);
+        for(uint32_t i = 0; i < REGION_CHUNKS; ++i)
+        {
+            if(!region_stored(&entries[i]))
+                continue;
+
+            *sum   += region_touch((const uint8_t*) data + (size_t) entries[i].sector * REGION_SECTOR_SIZE,
+                entries[i].size);
+            *bytes += entries[i].size;
+        }
+    }
+
+    free(data);
+    return table >= 0;
+}
+
+bool region_benchmark(uint32_t chunkCount)
+{
+    char directory[] = "/tmp/regionXXXXXX";
+    if(mkdtemp(directory) == NULL)
+    {
+        log_error("Region benchmark failed to create a temporary directory");
+        return false;
+    }
+
+    Terrain terrain;
+    terrain_init(&terrain, 1337);
+
+    // Columns of 4 chunks around the surface, within the region 0,-1,0
+    const uint32_t layers = 4;
+    uint32_t side = 1;
+    while(side * side * layers < chunkCount && side < REGION_SIZE)
+        ++side;
+    chunkCount = side * side * layers;
+
+    IVec3* coords    = (IVec3*) malloc(chunkCount * sizeof(IVec3));
+    uint8_t** chunks = (uint8_t**) calloc(chunkCount, sizeof(uint8_t*));
+
+    bool result = coords != NULL && chunks != NULL;
+    for(uint32_t i = 0; i < chunkCount && result; ++i)
+    {
+        coords[i] = (IVec3) { (int) (i % side), (int) (i / (side * side)) - (int) layers, (int) ((i / side) % side) };
+        chunks[i] = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+        result = chunks[i] != NULL;
+    }
+
+    result = result && terrain_generate_chunks(&terrain, coords, chunkCount, chunks);
+
+    char path[1024];
+    IVec3 regionCoords = { 0, -1, 0 };
+    region_path(path, sizeof(path), directory, regionCoords);
+
+    char timeStr[64], sizeStr[64];
+    Timer t;
+
+    Region region;
+    uint64_t reference = 0;
+    if(result && region_open(&region, directory, regionCoords))
+    {
+        timer_start(&t);
+
+        for(uint32_t i = 0; i < chunkCount && result; ++i)
+        {
+            result = region_write_chunk(&region, coords[i], chunks[i], WORLD_CHUNK_VOLUME);
+            reference += region_touch(chunks[i], WORLD_CHUNK_VOLUME);
+        }
+        result = result && region_commit(&region);
+
+        timer_stop(&t);
+
+        num_to_str(sizeStr, region.sectorCount * REGION_SECTOR_SIZE);
+        time_to_str(timeStr, timer_get_ns(&t));
+        log_info("Region benchmark, %u chunks of %u^3 in a %sB file, written and committed in %s (%.0f MB/s):",
+            chunkCount, WORLD_CHUNK_SIZE, sizeStr, timeStr,
+            (double) chunkCount * WORLD_CHUNK_VOLUME / (timer_get_ns(&t) * 1e-9) / 1e6);
+
+        region_close(&region);
+    }
+    else
+        result = false;
+
+    const char* names[] = { "mmap, cached", "file_read_all, cached", "mmap, from disk", "file_read_all, from disk" };
+    for(uint32_t mode = 0; mode < 4 && result; ++mode)
+    {
+        bool mapped = (mode & 1) == 0;
+        bool cold   = mode >= 2;
+
+        uint64_t sum;
+        size_t bytes;
+
+        // Warm runs load once first, the timed one finds the file in the page cache
+        if(!cold)
+            result = region_load(directory, regionCoords, mapped, &sum, &bytes);
+        else
+            region_evict(path);
+
+        timer_start(&t);
+        result = result && region_load(directory, regionCoords, mapped, &sum, &bytes);
+        timer_stop(&t);
+
+        result = result && sum == reference;
+
+        time_to_str(timeStr, timer_get_ns(&t));
+        log_info("    %-24s %s, %.0f MB/s%s", names[mode], timeStr, bytes / (timer_get_ns(&t) * 1e-9) / 1e6,
+            sum == reference ? "" : ", voxels differ");
+    }
+
+    // A committed rewrite whose table copy is then torn, and a rewrite never committed, both reopen on the
+    // first commit
+    uint32_t mismatches = 0;
+    uint8_t* stone = result ? (uint8_t*) malloc(WORLD_CHUNK_VOLUME) : NULL;
+    result = stone != NULL;
+    if(result)
+        memset(stone, TERRAIN_STONE, WORLD_CHUNK_VOLUME);
+
+    if(result && region_open(&region, directory, regionCoords))
+    {
+        result = region_write_chunk(&region, coords[0], stone, WORLD_CHUNK_VOLUME) && region_commit(&region);
+
+        size_t torn = ((size_t) region.table * REGION_TABLE_SECTORS + 1) * REGION_SECTOR_SIZE;
+        region_close(&region);
+
+        int file = open(path, O_WRONLY);
+        result = result && file >= 0 && region_write_all(file, stone, REGION_SECTOR_SIZE, torn);
+        if(file >= 0)
+            close(file);
+    }
+    else
+        result = false;
+
+    if(result && region_open(&region, directory, regionCoords))
+    {
+        result = region_write_chunk(&region, coords[chunkCount - 1], stone, WORLD_CHUNK_VOLUME);
+        region_close(&region);
+    }
+    else
+        result = false;
+
+    if(result && region_open(&region, directory, regionCoords))
+    {
+        for(uint32_t i = 0; i < chunkCount; ++i)
+        {
+            const uint8_t* data;
+            size_t size;
+            mismatches += !region_read_chunk(&region, coords[i], &data, &size) || size != WORLD_CHUNK_VOLUME ||
+                memcmp(data, chunks[i], WORLD_CHUNK_VOLUME) != 0;
+        }
+
+        log_info("    torn table and uncommitted write, %u chunk mismatches after reopening generation %llu",
+            mismatches, (unsigned long long) region.generation);
+        region_close(&region);
+    }
+    else
+        result = false;
+
+    free(stone);
+    for(uint32_t i = 0; chunks != NULL && i < chunkCount; ++i)
+        free(chunks[i]);
+    free(coords);
+    free(chunks);
+
+    unlink(path);
+    rmdir(directory);
+    return result && mismatches == 0;
+}
@@ -0,0 +1,97 @@
+#ifndef REGION_H_
+#define REGION_H_
+
+#include "core/vec.h"
+
+#include "world/codec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  On disk storage of the world chunks: one file per REGION_SIZE^3 chunks, cut in
+ *  REGION_SECTOR_SIZE sectors. The file starts with two copies of the offset table, each a
+ *  header sector then one entry per chunk giving the first sector and the size of its data.
+ *  The file is mapped read only, a chunk is a pointer into the map, nothing is parsed or
+ *  copied to read it.
+ *
+ *  Writes never touch the sectors the committed table points at: a chunk written goes to
+ *  free sectors and only the working table sees it. region_commit flushes those sectors,
+ *  then writes the working table over the older copy with a higher generation and a
+ *  checksum, and flushes again. Opening picks the valid copy of the highest generation, a
+ *  crash at any point leaves the last commit or the one before it, never a mix.
+ *
+ *  The header also holds the codec level of the region, region_write_voxels compresses the
+ *  chunks with it. Every chunk records the stages it went through, changing the level only
+ *  affects the chunks written after it, the older ones still decode.
+ */
+
+#define REGION_SIZE_LOG2 5
+#define REGION_SIZE      (1 << REGION_SIZE_LOG2) // Chunks per axis
+#define REGION_CHUNKS    (REGION_SIZE * REGION_SIZE * REGION_SIZE)
+
+#define REGION_SECTOR_SIZE 4096
+
+#define REGION_DEFAULT_CODEC CODEC_FAST
+
+#define REGION_NO_SECTOR    0u         // Chunk never stored
+#define REGION_EMPTY_SECTOR UINT32_MAX // Stored chunk without any non zero voxel, it takes no sectors
+
+typedef struct {
+    uint32_t sector; // First sector of the data, REGION_NO_SECTOR or REGION_EMPTY_SECTOR
+    uint32_t size;   // Bytes
+} RegionEntry;
+
+typedef struct {
+    int   file;
+    IVec3 coords;
+
+    // Whole file, remapped when the writes grew it past the map
+    uint8_t* map;
+    size_t   mapSize;
+
+    RegionEntry* entries;     // Working table, read by region_read_chunk and written by the next commit
+    uint8_t*     sectors;     // REGION_SECTOR_* bits of every sector of the file
+    size_t       sectorCount;
+    size_t       sectorCapacity;
+    size_t       freeHint;    // No free sector before it
+
+    uint64_t   generation; // Of the committed table
+    uint32_t   table;      // Copy holding the committed table, the next commit writes the other one
+    CodecLevel codec;      // Of the chunks written from now on, stored by the next commit
+    bool       dirty;
+} Region;
+
+// Region holding the chunk at chunkCoords
+IVec3 region_of_chunk(IVec3 chunkCoords);
+
+// Opens or creates directory/r.x.y.z.vxr
+bool region_open(Region* region, const char* directory, IVec3 coords);
+
+// Writes since the last commit are dropped, their sectors are free again at the next open
+void region_close(Region* region);
+
+// False when the chunk was never stored. Empty chunks give NULL and 0, the others point into the map:
+// valid until the next call on the region
+bool region_read_chunk(Region* region, IVec3 chunkCoords, const uint8_t** data, size_t* size);
+
+// NULL or 0 bytes stores an empty chunk. Seen by region_read_chunk right away, on disk after region_commit
+bool region_write_chunk(Region* region, IVec3 chunkCoords, const uint8_t* data, size_t size);
+
+// Level of the chunks written from now on, saved with the next commit. New regions start with REGION_DEFAULT_CODEC
+void region_set_codec(Region* region, CodecLevel codec);
+
+// WORLD_CHUNK_VOLUME voxels compressed with the codec of the region, NULL stores an empty chunk
+bool region_write_voxels(Region* region, IVec3 chunkCoords, const uint8_t* voxels);
+
+// Decodes WORLD_CHUNK_VOLUME voxels, zeros for an empty chunk. False when the chunk was never stored or is corrupted
+bool region_read_voxels(Region* region, IVec3 chunkCoords, uint8_t* voxels);
+
+bool region_commit(Region* region);
+
+// Writes at least chunkCount terrain chunks to a temporary region, reads them back through the map and through
+// file_read_all, warm and with the file dropped from the page cache, then checks a torn commit falls back
+bool region_benchmark(uint32_t chunkCount);
+
+#endif // REGION_H_
@@ -0,0 +1,502 @@
+#include "stream.h"
+
+#include "core/timer.h"
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+typedef struct {
+    IVec3    coords;
+    uint32_t lastUsed;
+} StreamVictim;
+
+LIST_DEFINE(StreamVictim, StreamVictims);
+
+static void stream_heap_push(StreamRequests* heap, StreamRequest request)
+{
+    list_append(*heap, request);
+
+    size_t i = heap->count - 1;
+    while(i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if(heap->items[parent].priority <= heap->items[i].priority)
+            break;
+
+        StreamRequest temp = heap->items[parent];
+        heap->items[parent] = heap->items[i];
+        heap->items[i] = temp;
+        i = parent;
+    }
+}
+
+static StreamRequest stream_heap_pop(StreamRequests* heap)
+{
+    StreamRequest top = heap->items[0];
+    heap->items[0] = heap->items[--heap->count];
+
+    size_t i = 0;
+    for(;;)
+    {
+        size_t left = i * 2 + 1, right = left + 1, smallest = i;
+        if(left < heap->count && heap->items[left].priority < heap->items[smallest].priority)
+            smallest = left;
+        if(right < heap->count && heap->items[right].priority < heap->items[smallest].priority)
+            smallest = right;
+
+        if(smallest == i)
+            break;
+
+        StreamRequest temp = heap->items[smallest];
+        heap->items[smallest] = heap->items[i];
+        heap->items[i] = temp;
+        i = smallest;
+    }
+
+    return top;
+}
+
+static void stream_generate_job(void* data)
+{
+    StreamJob* job = (StreamJob*) data;
+
+    job->voxels = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+    if(job->voxels != NULL && !job->settings->generate(job->coords, job->voxels, job->settings->user))
+    {
+        free(job->voxels);
+        job->voxels = NULL;
+    }
+}
+
+// Past the count the job may still be touching its counter
+static bool stream_job_done(StreamJob* job)
+{
+    return atomic_load(&job->counter.count) == 0 && atomic_load(&job->counter.active) == 0;
+}
+
+bool stream_create(WorldStream* stream, World* world, const StreamSettings* settings)
+{
+    *stream = (WorldStream) {
+        .world    = world,
+        .settings = *settings,
+    };
+
+    if(stream->settings.evictRadius < stream->settings.loadRadius)
+        stream->settings.evictRadius = stream->settings.loadRadius;
+
+    return true;
+}
+
+void stream_destroy(WorldStream* stream)
+{
+    // The loading chunks never get their voxels now
+    for(size_t i = 0; i < stream->jobs.count; ++i)
+    {
+        StreamJob* job = stream->jobs.items[i];
+        jobs_wait(&job->counter);
+        free(job->voxels);
+        free(job);
+    }
+
+    list_destroy(stream->queue);
+    list_destroy(stream->jobs);
+    *stream = (WorldStream) {0};
+}
+
+// Distance in chunks between the chunk the camera is in and coords, the radii are whole chunk sets
+// that only change when the camera enters another chunk
+static float stream_distance(IVec3 center, IVec3 coords, Vec3* offset)
+{
+    *offset = (Vec3) {
+        (float) (coords.x - center.x),
+        (float) (coords.y - center.y),
+        (float) (coords.z - center.z),
+    };
+    return sqrtf(offset->x * offset->x + offset->y * offset->y + offset->z * offset->z);
+}
+
+static IVec3 stream_camera_chunk(const WorldStream* stream, const Vec3* position)
+{
+    float chunkSize = WORLD_CHUNK_SIZE * stream->world->scale;
+    return (IVec3) {
+        (int) floorf(position->x / chunkSize),
+        (int) floorf(position->y / chunkSize),
+        (int) floorf(position->z / chunkSize),
+    };
+}
+
+// Queues every missing chunk within the load radius, stamps the wanted ones and drops the ones past the evict radius
+static void stream_scan(WorldStream* stream, const Vec3* direction)
+{
+    World* world = stream->world;
+    float loadRadius = stream->settings.loadRadius, evictRadius = stream->settings.evictRadius;
+
+    ++stream->scan;
+    stream->queue.count = 0;
+
+    int reach = (int) ceilf(loadRadius);
+    for(int z = stream->center.z - reach; z <= stream->center.z + reach; ++z)
+        for(int y = stream->center.y - reach; y <= stream->center.y + reach; ++y)
+            for(int x = stream->center.x - reach; x <= stream->center.x + reach; ++x)
+            {
+                IVec3 coords = { x, y, z };
+
+                Vec3 offset;
+                float distance = stream_distance(stream->center, coords, &offset);
+                if(distance > loadRadius)
+                    continue;
+
+                Chunk* chunk = world_get(world, coords);
+                if(chunk != NULL)
+                {
+                    chunk->lastUsed = stream->scan;
+                    continue;
+                }
+
+                // Up to twice as far behind the camera as in front of it
+                float facing = distance > 1.0f ?
+                    (offset.x * direction->x + offset.y * direction->y + offset.z * direction->z) / distance : 1.0f;
+
+                StreamRequest request = {
+                    .coords   = coords,
+                    .priority = distance * (1.5f - 0.5f * facing),
+                };
+                stream_heap_push(&stream->queue, request);
+            }
+
+    // Collected first, removing moves the chunks of the table
+    StreamRequests far = {0};
+    for(size_t i = 0; i < world->slotCount; ++i)
+    {
+        if(world->slots[i].state == CHUNK_FREE)
+            continue;
+
+        Vec3 offset;
+        if(stream_distance(stream->center, world->slots[i].coords, &offset) <= evictRadius)
+            continue;
+
+        StreamRequest request = { .coords = world->slots[i].coords };
+        list_append(far, request);
+    }
+
+    for(size_t i = 0; i < far.count; ++i)
+        world_remove_chunk(world, far.items[i].coords);
+
+    stream->evicted += (uint32_t) far.count;
+    list_destroy(far);
+}
+
+static int stream_victim_compare(const void* a, const void* b)
+{
+    uint32_t lastA = ((const StreamVictim*) a)->lastUsed, lastB = ((const StreamVictim*) b)->lastUsed;
+    return lastA < lastB ? -1 : (lastA > lastB ? 1 : 0);
+}
+
+// Cached chunks holding voxels the last scan didn't want, least recently wanted first
+static void stream_collect_victims(const WorldStream* stream, StreamVictims* victims)
+{
+    const World* world = stream->world;
+    for(size_t i = 0; i < world->slotCount; ++i)
+    {
+        const Chunk* chunk = &world->slots[i];
+        if(chunk->state != CHUNK_LOADED || chunk->voxels == NULL || chunk->lastUsed == stream->scan)
+            continue;
+
+        StreamVictim victim = {
+            .coords   = chunk->coords,
+            .lastUsed = chunk->lastUsed,
+        };
+        list_append(*victims, victim);
+    }
+
+    if(victims->count > 1)
+        qsort(victims->items, victims->count, sizeof(StreamVictim), stream_victim_compare);
+}
+
+// Hands the most wanted chunks to the job system, a few per thread so the priorities stay fresh
+static void stream_dispatch(WorldStream* stream)
+{
+    World* world = stream->world;
+    size_t maxInFlight = jobs_thread_count() * 2;
+
+    StreamVictims victims = {0};
+    size_t nextVictim = 0;
+    bool collected = false;
+
+    while(stream->jobs.count < maxInFlight && stream->queue.count > 0)
+    {
+        StreamRequest request = stream_heap_pop(&stream->queue);
+        if(world_get(world, request.coords) != NULL)
+            continue;
+
+        // Every chunk on its way may hold voxels once added
+        while(world->memory + (stream->jobs.count + 1) * (size_t) WORLD_CHUNK_VOLUME > stream->settings.memoryBudget)
+        {
+            if(!collected)
+            {
+                stream_collect_victims(stream, &victims);
+                collected = true;
+            }
+
+            if(nextVictim == victims.count)
+                break;
+
+            world_remove_chunk(world, victims.items[nextVictim++].coords);
+            ++stream->evicted;
+        }
+
+        // Everything left is wanted, the request waits for the next scan
+        if(world->memory + (stream->jobs.count + 1) * (size_t) WORLD_CHUNK_VOLUME > stream->settings.memoryBudget)
+        {
+            stream_heap_push(&stream->queue, request);
+            break;
+        }
+
+        StreamJob* job = (StreamJob*) malloc(sizeof(StreamJob));
+        if(job == NULL)
+            break;
+
+        if(!world_reserve_chunk(world, request.coords))
+        {
+            free(job);
+            break;
+        }
+        world_get(world, request.coords)->lastUsed = stream->scan;
+
+        *job = (StreamJob) {
+            .coords   = request.coords,
+            .settings = &stream->settings,
+        };
+        list_append(stream->jobs, job);
+        jobs_run(stream_generate_job, job, &job->counter);
+    }
+
+    list_destroy(victims);
+}
+
+void stream_update(WorldStream* stream, const Vec3* position, const Vec3* direction)
+{
+    Timer t;
+    timer_start(&t);
+
+    stream->added   = 0;
+    stream->evicted = 0;
+
+    IVec3 center = stream_camera_chunk(stream, position);
+
+    // Priorities follow the view, a turn of more than ~25 degrees queues the chunks again
+    bool moved = center.x != stream->center.x || center.y != stream->center.y || center.z != stream->center.z;
+    bool turned = direction->x * stream->scanDirection.x + direction->y * stream->scanDirection.y +
+        direction->z * stream->scanDirection.z < 0.9f;
+
+    if(!stream->scanned || moved || turned)
+    {
+        stream->center        = center;
+        stream->scanDirection = *direction;
+        stream->scanned       = true;
+        stream_scan(stream, direction);
+    }
+
+    // Without workers nobody else runs the jobs, the oldest one is generated here
+    if(jobs_thread_count() == 1 && stream->jobs.count > 0)
+        jobs_wait(&stream->jobs.items[0]->counter);
+
+    // Finished chunks in dispatch order until the frame budget is spent, at least one so streaming never stalls
+    size_t kept = 0;
+    bool spent = false;
+    for(size_t i = 0; i < stream->jobs.count; ++i)
+    {
+        StreamJob* job = stream->jobs.items[i];
+        if(spent || !stream_job_done(job))
+        {
+            stream->jobs.items[kept++] = job;
+            continue;
+        }
+
+        // Evicted or generated twice while it was on its way
+        Chunk* chunk = world_get(stream->world, job->coords);
+        if(chunk == NULL || chunk->state != CHUNK_LOADING)
+            free(job->voxels);
+        else if(job->voxels == NULL)
+            world_remove_chunk(stream->world, job->coords);
+        else if(world_add_chunk(stream->world, job->coords, job->voxels))
+            ++stream->added;
+        free(job);
+
+        timer_stop(&t);
+        spent = timer_get_ns(&t) >= stream->settings.frameBudgetNs;
+    }
+    stream->jobs.count = kept;
+
+    stream_dispatch(stream);
+
+    timer_stop(&t);
+    stream->updateNs = timer_get_ns(&t);
+}
+
+bool stream_idle(const WorldStream* stream)
+{
+    return stream->queue.count == 0 && stream->jobs.count == 0;
+}
+
+// Thin layer of rolling hills around y = 0, the chunks above and below it are empty
+static bool stream_generate_hills(IVec3 coords, uint8_t* voxels, void* user)
+{
+    (void) user;
+
+    for(uint32_t z = 0; z < WORLD_CHUNK_SIZE; ++z)
+        for(uint32_t x = 0; x < WORLD_CHUNK_SIZE; ++x)
+        {
+            float wx = (float) (coords.x * WORLD_CHUNK_SIZE + (int) x);
+            float wz = (float) (coords.z * WORLD_CHUNK_SIZE + (int) z);
+            float height = 12.0f * sinf(wx * 0.031f) * cosf(wz * 0.027f);
+
+            for(uint32_t y = 0; y < WORLD_CHUNK_SIZE; ++y)
+            {
+                float wy = (float) (coords.y * WORLD_CHUNK_SIZE + (int) y);
+                voxels[x + y * WORLD_CHUNK_SIZE + z * (WORLD_CHUNK_SIZE * WORLD_CHUNK_SIZE)] =
+                    wy < height && wy > height - 24.0f ? 2 : 0;
+            }
+        }
+
+    return true;
+}
+
+// Mismatches between the settled world and the radii and budget around the camera
+static uint32_t stream_check_residency(const WorldStream* stream, const Vec3* position, size_t* wanted)
+{
+    const World* world = stream->world;
+
+    IVec3 center = stream_camera_chunk(stream, position);
+
+    uint32_t mismatches = 0;
+    *wanted = 0;
+
+    // Every chunk within the load radius is loaded
+    int reach = (int) ceilf(stream->settings.loadRadius);
+    for(int z = center.z - reach; z <= center.z + reach; ++z)
+        for(int y = center.y - reach; y <= center.y + reach; ++y)
+            for(int x = center.x - reach; x <= center.x + reach; ++x)
+            {
+                Vec3 offset;
+                if(stream_distance(center, (IVec3) { x, y, z }, &offset) > stream->settings.loadRadius)
+                    continue;
+
+                const Chunk* chunk = world_get(world, (IVec3) { x, y, z });
+                mismatches += chunk == NULL || chunk->state != CHUNK_LOADED;
+                *wanted += chunk != NULL && chunk->voxels != NULL;
+            }
+
+    // Nothing loading, nothing past the evict radius
+    for(size_t i = 0; i < world->slotCount; ++i)
+    {
+        const Chunk* chunk = &world->slots[i];
+        if(chunk->state == CHUNK_FREE)
+            continue;
+
+        Vec3 offset;
+        mismatches += chunk->state != CHUNK_LOADED ||
+            stream_distance(center, chunk->coords, &offset) > stream->settings.evictRadius;
+    }
+
+    return mismatches + (world->memory > stream->settings.memoryBudget);
+}
+
+// One flight along the path, returns the residency mismatches once settled
+static bool stream_fly(const StreamSettings* settings, const char* name, uint32_t* mismatches, size_t* wanted)
+{
+    char avgStr[64], maxStr[64];
+
+    World world;
+    if(!world_create_headless(&world, 0.2f))
+        return false;
+
+    WorldStream stream;
+    if(!stream_create(&stream, &world, settings))
+    {
+        world_destroy(&world);
+        return false;
+    }
+
+    // 60 fps at the boosted camera speed of camera_update, 2 * 3 units a second, turning slowly
+    const float dt = 1.0f / 60.0f, speed = 6.0f;
+    const uint32_t frames = 1200;
+
+    Vec3 position = {0}, direction = {0};
+    double totalNs = 0.0, maxNs = 0.0;
+    uint32_t added = 0, evicted = 0, overBudget = 0;
+
+    for(uint32_t frame = 0; frame < frames; ++frame)
+    {
+        float yaw = frame * dt * 0.4f;
+        direction = (Vec3) { cosf(yaw), -0.2f, sinf(yaw) };
+        float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+        direction = (Vec3) { direction.x / length, direction.y / length, direction.z / length };
+
+        position.x += direction.x * speed * dt;
+        position.z += direction.z * speed * dt;
+
+        stream_update(&stream, &position, &direction);
+
+        totalNs += stream.updateNs;
+        maxNs    = stream.updateNs > maxNs ? stream.updateNs : maxNs;
+        added   += stream.added;
+        evicted += stream.evicted;
+        overBudget += world.memory > settings->memoryBudget;
+
+        // Jobs get the rest of the frame
+        usleep(2000);
+    }
+
+    // Hovering until everything queued is in
+    for(uint32_t i = 0; i < 10000 && !stream_idle(&stream); ++i)
+    {
+        stream_update(&stream, &position, &direction);
+        added   += stream.added;
+        evicted += stream.evicted;
+        usleep(1000);
+    }
+
+    *mismatches = stream_check_residency(&stream, &position, wanted) + overBudget;
+
+    time_to_str(avgStr, totalNs / frames);
+    time_to_str(maxStr, maxNs);
+    log_info("    %-12s %u threads, %u chunks added, %u evicted, %zu resident bytes (budget %zu), update avg %s max %s, "
+        "%u residency mismatches", name, jobs_thread_count(), added, evicted, world.memory, settings->memoryBudget,
+        avgStr, maxStr, *mismatches);
+
+    stream_destroy(&stream);
+    world_destroy(&world);
+    return true;
+}
+
+bool stream_benchmark()
+{
+    StreamSettings settings = {
+        .loadRadius    = 6.0f,
+        .evictRadius   = 8.0f,
+        .memoryBudget  = (size_t) 256 << 20,
+        .frameBudgetNs = 2000000.0,
+        .generate      = stream_generate_hills,
+    };
+
+    log_info("Stream benchmark, load radius %.0f chunks, evict radius %.0f chunks, %.1f ms per frame:",
+        settings.loadRadius, settings.evictRadius, settings.frameBudgetNs * 1e-6);
+
+    uint32_t mismatches;
+    size_t wanted;
+    if(!stream_fly(&settings, "radius", &mismatches, &wanted))
+        return false;
+    bool result = mismatches == 0;
+
+    // Room for the wanted chunks and a few cached ones, the LRU eviction keeps the memory under the budget
+    settings.memoryBudget = (wanted + wanted / 4 + 16) * WORLD_CHUNK_VOLUME;
+    if(!stream_fly(&settings, "budget", &mismatches, &wanted))
+        return false;
+    result = result && mismatches == 0;
+
+    return result;
+}
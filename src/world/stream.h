@@ -0,0 +1,93 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "core/list.h"
+#include "core/jobs.h"
+#include "core/vec.h"
+
+#include "world/world.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Streams the chunks of a World around the camera. Every time the camera enters another
+ *  chunk or turns, the chunks within loadRadius missing from the world are queued in a
+ *  binary heap, nearest first and the ones in front of the camera before the ones behind.
+ *  The heap hands them to the job system, one job per chunk producing its voxels, and
+ *  stream_update polls the counters of the jobs to add the finished chunks to the world.
+ *
+ *  Chunks stay cached up to evictRadius, past it they are dropped. Over memoryBudget the
+ *  least recently wanted cached chunks go first, chunks within loadRadius are never evicted
+ *  to load another one. Every stream_update stops adding chunks once frameBudgetNs is spent,
+ *  the GPU upload of a chunk runs on the calling thread with the rest of the raytracer.
+ */
+
+// Fills the WORLD_CHUNK_VOLUME voxels of the chunk at coords, x fastest, called from the jobs
+typedef bool (*ChunkGenerator)(IVec3 coords, uint8_t* voxels, void* user);
+
+typedef struct {
+    float  loadRadius;    // In chunks
+    float  evictRadius;   // In chunks, at least loadRadius
+    size_t memoryBudget;  // Voxel bytes of the loaded chunks, World.memory
+    double frameBudgetNs; // Per stream_update
+
+    ChunkGenerator generate;
+    void*          user;
+} StreamSettings;
+
+typedef struct {
+    IVec3 coords;
+    float priority;
+} StreamRequest;
+
+// A chunk on its way, done once the counter is down to zero
+typedef struct {
+    IVec3                 coords;
+    uint8_t*              voxels; // NULL when the generation failed
+    const StreamSettings* settings;
+    JobCounter            counter;
+} StreamJob;
+
+LIST_DEFINE(StreamRequest, StreamRequests);
+LIST_DEFINE(StreamJob*, StreamJobs);
+
+typedef struct {
+    World*         world;
+    StreamSettings settings;
+
+    // Min heap on the priority
+    StreamRequests queue;
+
+    IVec3    center;
+    Vec3     scanDirection;
+    uint32_t scan; // Stamp of the last scan, given to every chunk it wanted
+    bool     scanned;
+
+    // Handed to the job system and not yet added, in dispatch order
+    StreamJobs jobs;
+
+    // Last stream_update
+    uint32_t added;
+    uint32_t evicted;
+    double   updateNs;
+} WorldStream;
+
+bool stream_create(WorldStream* stream, World* world, const StreamSettings* settings);
+
+// Waits for the jobs on their way, the chunks stay in the world
+void stream_destroy(WorldStream* stream);
+
+// Rescans around the camera when needed, evicts, hands new chunks to the job system and adds the finished ones
+// within the frame budget. position and direction are in world space
+void stream_update(WorldStream* stream, const Vec3* position, const Vec3* direction);
+
+// Whether nothing is queued or being generated
+bool stream_idle(const WorldStream* stream);
+
+// Flies a headless world along a camera path at the boosted camera speed, checks the residency against
+// the radii and the budget once streaming settles, logs the update times
+bool stream_benchmark();
+
+#endif // STREAM_H_
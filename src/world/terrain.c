@@ -0,0 +1,545 @@
+#include "terrain.h"
+
+#include "world/world.h"
+
+#include "core/timer.h"
+#include "core/jobs.h"
+#include "core/core.h"
+
+#include <stdatomic.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define TERRAIN_PRIME_X 0x8DA6B343u
+#define TERRAIN_PRIME_Y 0xD8163841u
+#define TERRAIN_PRIME_Z 0xCB1AB31Fu
+#define TERRAIN_PRIME_H 0x27D4EB2Du
+
+// Seeds of the octaves and of the two cave noises
+#define TERRAIN_SEED_STEP 0x9E3779B9u
+#define TERRAIN_SEED_CAVE 0x85EBCA6Bu
+
+#if defined(__SSE2__)
+
+#define TERRAIN_LANES 4
+
+typedef __m128  TerrainFloats;
+typedef __m128i TerrainInts;
+
+static TerrainFloats terrain_set(float v)                             { return _mm_set1_ps(v); }
+static TerrainFloats terrain_load(const float* v)                     { return _mm_loadu_ps(v); }
+static void          terrain_store(float* out, TerrainFloats v)       { _mm_storeu_ps(out, v); }
+static TerrainFloats terrain_add(TerrainFloats a, TerrainFloats b)    { return _mm_add_ps(a, b); }
+static TerrainFloats terrain_sub(TerrainFloats a, TerrainFloats b)    { return _mm_sub_ps(a, b); }
+static TerrainFloats terrain_mul(TerrainFloats a, TerrainFloats b)    { return _mm_mul_ps(a, b); }
+static TerrainInts   terrain_seti(uint32_t v)                         { return _mm_set1_epi32((int) v); }
+static TerrainInts   terrain_addi(TerrainInts a, TerrainInts b)       { return _mm_add_epi32(a, b); }
+static TerrainInts   terrain_xori(TerrainInts a, TerrainInts b)       { return _mm_xor_si128(a, b); }
+static TerrainInts   terrain_shli(TerrainInts a, int b)               { return _mm_slli_epi32(a, b); }
+static TerrainInts   terrain_shri(TerrainInts a, int b)               { return _mm_srli_epi32(a, b); }
+
+static TerrainInts terrain_muli(TerrainInts a, TerrainInts b)
+{
+    // No 32 bit mullo before SSE4.1, the even and odd lanes through the 64 bit products
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Integer part and floor of v
+static TerrainInts terrain_floor(TerrainFloats v, TerrainFloats* floored)
+{
+    TerrainInts   i = _mm_cvttps_epi32(v);
+    TerrainFloats f = _mm_cvtepi32_ps(i);
+
+    // Truncation rounds the negative ones up, one less where it did
+    TerrainFloats up = _mm_cmpgt_ps(f, v);
+    *floored = _mm_sub_ps(f, _mm_and_ps(up, _mm_set1_ps(1.0f)));
+    return _mm_add_epi32(i, _mm_castps_si128(up));
+}
+
+// v with its sign flipped where bit 31 of sign is set
+static TerrainFloats terrain_flip(TerrainFloats v, TerrainInts sign)
+{
+    return _mm_xor_ps(v, _mm_castsi128_ps(_mm_and_si128(sign, _mm_set1_epi32((int) 0x80000000u))));
+}
+
+#else
+
+#define TERRAIN_LANES 1
+
+typedef float    TerrainFloats;
+typedef uint32_t TerrainInts;
+
+static TerrainFloats terrain_set(float v)                             { return v; }
+static TerrainFloats terrain_load(const float* v)                     { return *v; }
+static void          terrain_store(float* out, TerrainFloats v)       { *out = v; }
+static TerrainFloats terrain_add(TerrainFloats a, TerrainFloats b)    { return a + b; }
+static TerrainFloats terrain_sub(TerrainFloats a, TerrainFloats b)    { return a - b; }
+static TerrainFloats terrain_mul(TerrainFloats a, TerrainFloats b)    { return a * b; }
+static TerrainInts   terrain_seti(uint32_t v)                         { return v; }
+static TerrainInts   terrain_addi(TerrainInts a, TerrainInts b)       { return a + b; }
+static TerrainInts   terrain_xori(TerrainInts a, TerrainInts b)       { return a ^ b; }
+static TerrainInts   terrain_shli(TerrainInts a, int b)               { return a << b; }
+static TerrainInts   terrain_shri(TerrainInts a, int b)               { return a >> b; }
+static TerrainInts   terrain_muli(TerrainInts a, TerrainInts b)       { return a * b; }
+
+static TerrainInts terrain_floor(TerrainFloats v, TerrainFloats* floored)
+{
+    *floored = floorf(v);
+    return (uint32_t) (int32_t) *floored;
+}
+
+static TerrainFloats terrain_flip(TerrainFloats v, TerrainInts sign)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits ^= sign & 0x80000000u;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+#endif
+
+typedef struct {
+    const Terrain* terrain;
+    IVec3          origin;
+    uint32_t       width, height, depth;
+    uint8_t*       voxels;
+
+    const IVec3* coords;
+    uint8_t**    chunks;
+
+    atomic_bool failed;
+} TerrainJob;
+
+static TerrainFloats terrain_fade(TerrainFloats t)
+{
+    // t^3 (t (6t - 15) + 10)
+    TerrainFloats inner = terrain_add(terrain_mul(t, terrain_sub(terrain_mul(t, terrain_set(6.0f)), terrain_set(15.0f))),
+        terrain_set(10.0f));
+    return terrain_mul(terrain_mul(terrain_mul(t, t), t), inner);
+}
+
+static TerrainFloats terrain_lerp(TerrainFloats a, TerrainFloats b, TerrainFloats t)
+{
+    return terrain_add(a, terrain_mul(t, terrain_sub(b, a)));
+}
+
+static TerrainInts terrain_hash(TerrainInts h)
+{
+    h = terrain_muli(h, terrain_seti(TERRAIN_PRIME_H));
+    return terrain_xori(h, terrain_shri(h, 15));
+}
+
+// Dot with one of the diagonal gradients, picked by the low bits of the hash
+static TerrainFloats terrain_gradient2(TerrainInts h, TerrainFloats x, TerrainFloats z)
+{
+    return terrain_add(terrain_flip(x, terrain_shli(h, 31)), terrain_flip(z, terrain_shli(h, 30)));
+}
+
+static TerrainFloats terrain_gradient3(TerrainInts h, TerrainFloats x, TerrainFloats y, TerrainFloats z)
+{
+    TerrainFloats xy = terrain_add(terrain_flip(x, terrain_shli(h, 31)), terrain_flip(y, terrain_shli(h, 30)));
+    return terrain_add(xy, terrain_flip(z, terrain_shli(h, 29)));
+}
+
+static TerrainFloats terrain_noise2(TerrainFloats x, TerrainFloats z, uint32_t seed)
+{
+    TerrainFloats fx, fz;
+    TerrainInts ix = terrain_floor(x, &fx), iz = terrain_floor(z, &fz);
+    fx = terrain_sub(x, fx);
+    fz = terrain_sub(z, fz);
+
+    // The hashes of the next cells are the products of the next coordinates, one prime further
+    TerrainInts px0 = terrain_muli(ix, terrain_seti(TERRAIN_PRIME_X));
+    TerrainInts px1 = terrain_addi(px0, terrain_seti(TERRAIN_PRIME_X));
+    TerrainInts pz  = terrain_muli(iz, terrain_seti(TERRAIN_PRIME_Z));
+    TerrainInts pz0 = terrain_xori(pz, terrain_seti(seed));
+    TerrainInts pz1 = terrain_xori(terrain_addi(pz, terrain_seti(TERRAIN_PRIME_Z)), terrain_seti(seed));
+
+    TerrainFloats one = terrain_set(1.0f);
+    TerrainFloats fx1 = terrain_sub(fx, one), fz1 = terrain_sub(fz, one);
+
+    TerrainFloats n00 = terrain_gradient2(terrain_hash(terrain_xori(px0, pz0)), fx,  fz);
+    TerrainFloats n10 = terrain_gradient2(terrain_hash(terrain_xori(px1, pz0)), fx1, fz);
+    TerrainFloats n01 = terrain_gradient2(terrain_hash(terrain_xori(px0, pz1)), fx,  fz1);
+    TerrainFloats n11 = terrain_gradient2(terrain_hash(terrain_xori(px1, pz1)), fx1, fz1);
+
+    TerrainFloats u = terrain_fade(fx), v = terrain_fade(fz);
+    return terrain_lerp(terrain_lerp(n00, n10, u), terrain_lerp(n01, n11, u), v);
+}
+
+static TerrainFloats terrain_noise3(TerrainFloats x, TerrainFloats y, TerrainFloats z, uint32_t seed)
+{
+    TerrainFloats fx, fy, fz;
+    TerrainInts ix = terrain_floor(x, &fx), iy = terrain_floor(y, &fy), iz = terrain_floor(z, &fz);
+    fx = terrain_sub(x, fx);
+    fy = terrain_sub(y, fy);
+    fz = terrain_sub(z, fz);
+
+    TerrainInts px0 = terrain_muli(ix, terrain_seti(TERRAIN_PRIME_X));
+    TerrainInts px1 = terrain_addi(px0, terrain_seti(TERRAIN_PRIME_X));
+    TerrainInts py0 = terrain_muli(iy, terrain_seti(TERRAIN_PRIME_Y));
+    TerrainInts py1 = terrain_addi(py0, terrain_seti(TERRAIN_PRIME_Y));
+    TerrainInts pz  = terrain_muli(iz, terrain_seti(TERRAIN_PRIME_Z));
+    TerrainInts pz0 = terrain_xori(pz, terrain_seti(seed));
+    TerrainInts pz1 = terrain_xori(terrain_addi(pz, terrain_seti(TERRAIN_PRIME_Z)), terrain_seti(seed));
+
+    TerrainFloats one = terrain_set(1.0f);
+    TerrainFloats fx1 = terrain_sub(fx, one), fy1 = terrain_sub(fy, one), fz1 = terrain_sub(fz, one);
+
+    TerrainInts p00 = terrain_xori(py0, pz0), p10 = terrain_xori(py1, pz0);
+    TerrainInts p01 = terrain_xori(py0, pz1), p11 = terrain_xori(py1, pz1);
+
+    TerrainFloats n000 = terrain_gradient3(terrain_hash(terrain_xori(px0, p00)), fx,  fy,  fz);
+    TerrainFloats n100 = terrain_gradient3(terrain_hash(terrain_xori(px1, p00)), fx1, fy,  fz);
+    TerrainFloats n010 = terrain_gradient3(terrain_hash(terrain_xori(px0, p10)), fx,  fy1, fz);
+    TerrainFloats n110 = terrain_gradient3(terrain_hash(terrain_xori(px1, p10)), fx1, fy1, fz);
+    TerrainFloats n001 = terrain_gradient3(terrain_hash(terrain_xori(px0, p01)), fx,  fy,  fz1);
+    TerrainFloats n101 = terrain_gradient3(terrain_hash(terrain_xori(px1, p01)), fx1, fy,  fz1);
+    TerrainFloats n011 = terrain_gradient3(terrain_hash(terrain_xori(px0, p11)), fx,  fy1, fz1);
+    TerrainFloats n111 = terrain_gradient3(terrain_hash(terrain_xori(px1, p11)), fx1, fy1, fz1);
+
+    TerrainFloats u = terrain_fade(fx), v = terrain_fade(fy), w = terrain_fade(fz);
+    TerrainFloats n0 = terrain_lerp(terrain_lerp(n000, n100, u), terrain_lerp(n010, n110, u), v);
+    TerrainFloats n1 = terrain_lerp(terrain_lerp(n001, n101, u), terrain_lerp(n011, n111, u), v);
+    return terrain_lerp(n0, n1, w);
+}
+
+static TerrainFloats terrain_fbm2(const Terrain* terrain, TerrainFloats x, TerrainFloats z)
+{
+    TerrainFloats sum = terrain_set(0.0f);
+    float amplitude = 1.0f, frequency = terrain->frequency, total = 0.0f;
+    uint32_t seed = terrain->seed;
+
+    for(uint32_t octave = 0; octave < terrain->octaves; ++octave)
+    {
+        TerrainFloats f = terrain_set(frequency);
+        TerrainFloats n = terrain_noise2(terrain_mul(x, f), terrain_mul(z, f), seed);
+        sum = terrain_add(sum, terrain_mul(n, terrain_set(amplitude)));
+
+        total     += amplitude;
+        amplitude *= terrain->gain;
+        frequency *= terrain->lacunarity;
+        seed      += TERRAIN_SEED_STEP;
+    }
+
+    return terrain_mul(sum, terrain_set(1.0f / total));
+}
+
+// Surface heights of the columns x0 .. x0 + count at z, count a multiple of the lanes
+static void terrain_heights(const Terrain* terrain, int x0, int z, uint32_t count, float* heights)
+{
+    float xs[TERRAIN_LANES];
+    for(uint32_t x = 0; x < count; x += TERRAIN_LANES)
+    {
+        for(uint32_t lane = 0; lane < TERRAIN_LANES; ++lane)
+            xs[lane] = (float) (x0 + (int) (x + lane));
+
+        TerrainFloats h = terrain_fbm2(terrain, terrain_load(xs), terrain_set((float) z));
+        terrain_store(&heights[x], terrain_add(terrain_set(terrain->baseHeight), terrain_mul(h,
+            terrain_set(terrain->amplitude))));
+    }
+}
+
+static uint32_t terrain_row_count(uint32_t width)
+{
+    return (width + TERRAIN_LANES - 1) & ~(uint32_t) (TERRAIN_LANES - 1);
+}
+
+// Slices [zBegin, zEnd) of the region, heights holds a row of columns rounded up to the lanes
+static void terrain_fill(const Terrain* terrain, IVec3 origin, uint32_t width, uint32_t height, uint32_t zBegin,
+    uint32_t zEnd, uint8_t* voxels, float* heights)
+{
+    uint32_t rowCount = terrain_row_count(width);
+    float caveRadius2 = terrain->caveRadius * terrain->caveRadius;
+
+    float xs[TERRAIN_LANES], caveA[TERRAIN_LANES], caveB[TERRAIN_LANES];
+
+    for(uint32_t z = zBegin; z < zEnd; ++z)
+    {
+        int wz = origin.z + (int) z;
+        terrain_heights(terrain, origin.x, wz, rowCount, heights);
+
+        float rowMax = heights[0];
+        for(uint32_t x = 1; x < width; ++x)
+            rowMax = heights[x] > rowMax ? heights[x] : rowMax;
+
+        uint8_t* slice = voxels + (size_t) z * width * height;
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            float wy = (float) (origin.y + (int) y);
+            uint8_t* row = slice + (size_t) y * width;
+
+            // Above every column of the row or below the world
+            if(wy >= rowMax || wy < terrain->bottom)
+            {
+                memset(row, 0, width);
+                continue;
+            }
+
+            bool caves = rowMax - wy >= terrain->caveMinDepth;
+            TerrainFloats cy = terrain_set(wy * terrain->caveFrequency);
+            TerrainFloats cz = terrain_set((float) wz * terrain->caveFrequency);
+
+            for(uint32_t x = 0; x < rowCount; x += TERRAIN_LANES)
+            {
+                if(caves)
+                {
+                    for(uint32_t lane = 0; lane < TERRAIN_LANES; ++lane)
+                        xs[lane] = (float) (origin.x + (int) (x + lane)) * terrain->caveFrequency;
+
+                    TerrainFloats cx = terrain_load(xs);
+                    terrain_store(caveA, terrain_noise3(cx, cy, cz, terrain->seed ^ TERRAIN_SEED_CAVE));
+                    terrain_store(caveB, terrain_noise3(cx, cy, cz, terrain->seed ^ (TERRAIN_SEED_CAVE * 2)));
+                }
+
+                for(uint32_t lane = 0; lane < TERRAIN_LANES && x + lane < width; ++lane)
+                {
+                    float below = heights[x + lane] - wy;
+
+                    uint8_t value = 0;
+                    if(below <= 0.0f)
+                        value = 0;
+                    else if(caves && below >= terrain->caveMinDepth &&
+                        caveA[lane] * caveA[lane] + caveB[lane] * caveB[lane] < caveRadius2)
+                        value = 0;
+                    else if(below <= 1.0f)
+                        value = TERRAIN_GRASS;
+                    else if(below <= terrain->dirtDepth)
+                        value = TERRAIN_DIRT;
+                    else
+                        value = wy < terrain->deepHeight ? TERRAIN_DEEP_STONE : TERRAIN_STONE;
+
+                    row[x + lane] = value;
+                }
+            }
+        }
+    }
+}
+
+void terrain_init(Terrain* terrain, uint32_t seed)
+{
+    *terrain = (Terrain) {
+        .seed          = seed,
+        .baseHeight    = 0.0f,
+        .amplitude     = 28.0f,
+        .frequency     = 1.0f / 160.0f,
+        .octaves       = 5,
+        .lacunarity    = 2.0f,
+        .gain          = 0.5f,
+        .caveFrequency = 1.0f / 40.0f,
+        .caveRadius    = 0.09f,
+        .caveMinDepth  = 4.0f,
+        .dirtDepth     = 4.0f,
+        .deepHeight    = -48.0f,
+        .bottom        = -96.0f,
+    };
+}
+
+static void terrain_region_range(uint32_t begin, uint32_t end, void* data)
+{
+    TerrainJob* job = (TerrainJob*) data;
+
+    float* heights = (float*) malloc(terrain_row_count(job->width) * sizeof(float));
+    if(heights == NULL)
+    {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    terrain_fill(job->terrain, job->origin, job->width, job->height, begin, end, job->voxels, heights);
+    free(heights);
+}
+
+bool terrain_generate(const Terrain* terrain, IVec3 origin, uint32_t width, uint32_t height, uint32_t depth,
+    uint8_t* voxels)
+{
+    TerrainJob job = {
+        .terrain = terrain,
+        .origin  = origin,
+        .width   = width,
+        .height  = height,
+        .depth   = depth,
+        .voxels  = voxels,
+    };
+    atomic_init(&job.failed, false);
+
+    jobs_parallel_for(depth, 1, terrain_region_range, &job);
+    return !atomic_load(&job.failed);
+}
+
+bool terrain_generate_chunk(IVec3 coords, uint8_t* voxels, void* terrain)
+{
+    float heights[WORLD_CHUNK_SIZE];
+
+    IVec3 origin = { coords.x * WORLD_CHUNK_SIZE, coords.y * WORLD_CHUNK_SIZE, coords.z * WORLD_CHUNK_SIZE };
+    terrain_fill((const Terrain*) terrain, origin, WORLD_CHUNK_SIZE, WORLD_CHUNK_SIZE, 0, WORLD_CHUNK_SIZE, voxels,
+        heights);
+    return true;
+}
+
+static void terrain_chunks_range(uint32_t begin, uint32_t end, void* data)
+{
+    TerrainJob* job = (TerrainJob*) data;
+    for(uint32_t i = begin; i < end; ++i)
+        if(!terrain_generate_chunk(job->coords[i], job->chunks[i], (void*) job->terrain))
+            atomic_store(&job->failed, true);
+}
+
+bool terrain_generate_chunks(const Terrain* terrain, const IVec3* coords, uint32_t count, uint8_t** voxels)
+{
+    TerrainJob job = {
+        .terrain = terrain,
+        .coords  = coords,
+        .chunks  = voxels,
+    };
+    atomic_init(&job.failed, false);
+
+    jobs_parallel_for(count, 1, terrain_chunks_range, &job);
+    return !atomic_load(&job.failed);
+}
+
+static uint64_t terrain_hash_voxels(uint64_t hash, const uint8_t* voxels, size_t size)
+{
+    // FNV-1a
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ voxels[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+bool terrain_benchmark(uint32_t chunkCount)
+{
+    char timeStr[64];
+    Timer t;
+
+    Terrain terrain;
+    terrain_init(&terrain, 1337);
+
+    // Four layers of chunks from y = -64 up to y = 64, the grid at least 2 chunks wide for the region check
+    const uint32_t layers = 4;
+    uint32_t side = (uint32_t) ceilf(sqrtf((float) chunkCount / layers));
+    side = side < 2 ? 2 : side;
+    chunkCount = side * side * layers;
+
+    IVec3* coords    = (IVec3*) malloc(chunkCount * sizeof(IVec3));
+    uint8_t** chunks = (uint8_t**) calloc(chunkCount, sizeof(uint8_t*));
+    uint8_t* region  = (uint8_t*) malloc(8 * WORLD_CHUNK_VOLUME);
+
+    bool result = coords != NULL && chunks != NULL && region != NULL;
+    for(uint32_t i = 0; i < chunkCount && result; ++i)
+    {
+        coords[i] = (IVec3) { (int) (i % side), (int) (i / (side * side)) - 2, (int) ((i / side) % side) };
+        chunks[i] = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+        result = chunks[i] != NULL;
+    }
+
+    if(!result)
+    {
+        for(uint32_t i = 0; chunks != NULL && i < chunkCount; ++i)
+            free(chunks[i]);
+        free(coords);
+        free(chunks);
+        free(region);
+        return false;
+    }
+
+    bool pooled = jobs_thread_count() > 1;
+    uint32_t poolThreads = jobs_thread_count();
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t maxThreads = cores > 0 ? (uint32_t) cores : 1;
+    if(maxThreads > JOBS_MAX_THREADS)
+        maxThreads = JOBS_MAX_THREADS;
+
+    log_info("Terrain benchmark, %u chunks of %u^3, %u lanes:", chunkCount, WORLD_CHUNK_SIZE, TERRAIN_LANES);
+
+    uint64_t reference = 0;
+    double singleNs = 0.0;
+    for(uint32_t threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads)
+    {
+        jobs_destroy();
+        if(!jobs_init(threads))
+        {
+            result = false;
+            break;
+        }
+
+        timer_start(&t);
+        result = terrain_generate_chunks(&terrain, coords, chunkCount, chunks) && result;
+        timer_stop(&t);
+
+        uint64_t hash = 0xCBF29CE484222325ull;
+        size_t solid = 0;
+        for(uint32_t i = 0; i < chunkCount; ++i)
+        {
+            hash = terrain_hash_voxels(hash, chunks[i], WORLD_CHUNK_VOLUME);
+            for(uint32_t v = 0; v < WORLD_CHUNK_VOLUME; ++v)
+                solid += chunks[i][v] != 0;
+        }
+
+        double ns = timer_get_ns(&t);
+        if(threads == 1)
+        {
+            reference = hash;
+            singleNs  = ns;
+        }
+
+        bool deterministic = hash == reference;
+        result = result && deterministic;
+
+        time_to_str(timeStr, ns);
+        log_info("    %2u threads %s, %.0f chunks/s, %.2fx, %.1f%% solid%s", threads, timeStr,
+            chunkCount / (ns * 1e-9), singleNs / ns, 100.0 * solid / ((double) chunkCount * WORLD_CHUNK_VOLUME),
+            deterministic ? "" : ", differs from 1 thread");
+
+        if(threads == maxThreads)
+            break;
+    }
+
+    // A 2x2x2 chunk region generated at once, split in slices, against the chunks it covers
+    const uint32_t regionSize = 2 * WORLD_CHUNK_SIZE;
+    uint32_t seams = 0;
+    if(result && terrain_generate(&terrain, (IVec3) { 0, -2 * WORLD_CHUNK_SIZE, 0 }, regionSize, regionSize,
+        regionSize, region))
+    {
+        for(uint32_t i = 0; i < chunkCount; ++i)
+        {
+            if(coords[i].x > 1 || coords[i].y > -1 || coords[i].z > 1)
+                continue;
+
+            for(uint32_t z = 0; z < WORLD_CHUNK_SIZE; ++z)
+                for(uint32_t y = 0; y < WORLD_CHUNK_SIZE; ++y)
+                    for(uint32_t x = 0; x < WORLD_CHUNK_SIZE; ++x)
+                    {
+                        uint32_t rx = coords[i].x * WORLD_CHUNK_SIZE + x;
+                        uint32_t ry = (coords[i].y + 2) * WORLD_CHUNK_SIZE + y;
+                        uint32_t rz = coords[i].z * WORLD_CHUNK_SIZE + z;
+
+                        seams += region[rx + ry * regionSize + (size_t) rz * regionSize * regionSize] !=
+                            chunks[i][x + y * WORLD_CHUNK_SIZE + z * (WORLD_CHUNK_SIZE * WORLD_CHUNK_SIZE)];
+                    }
+        }
+
+        log_info("    region %u^3 against its chunks, %u mismatches", regionSize, seams);
+    }
+    else
+        result = false;
+
+    for(uint32_t i = 0; i < chunkCount; ++i)
+        free(chunks[i]);
+    free(coords);
+    free(chunks);
+    free(region);
+
+    jobs_destroy();
+    return (!pooled || jobs_init(poolThreads)) && result && seams == 0;
+}
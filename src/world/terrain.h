@@ -0,0 +1,64 @@
+#ifndef TERRAIN_H_
+#define TERRAIN_H_
+
+#include "core/vec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *  Procedural terrain: an fBm heightmap of 2D gradient noise, noodle caves where two 3D
+ *  gradient noises are both close to zero, and layers of grass, dirt, stone and deep stone
+ *  below the surface. The lattice gradients come from an integer hash of the cell and the
+ *  seed, no permutation table, so the same seed gives the same voxels on any thread in any
+ *  order and chunks generated apart meet without seams.
+ *
+ *  The noise runs 4 lanes wide along x with SSE2 when the compiler targets it, scalar
+ *  otherwise, both through the same lane functions. Voxels are written x fastest, then y,
+ *  then z, the layout of raytracing_add_volume_geometry and of the world chunks.
+ */
+
+#define TERRAIN_GRASS      3
+#define TERRAIN_DIRT       2
+#define TERRAIN_STONE      1
+#define TERRAIN_DEEP_STONE 4
+
+typedef struct {
+    uint32_t seed;
+
+    // Heightmap, in voxels
+    float    baseHeight;
+    float    amplitude;
+    float    frequency;
+    uint32_t octaves;
+    float    lacunarity;
+    float    gain;
+
+    // Caves where both cave noises are within caveRadius of zero, at least caveMinDepth below the surface
+    float caveFrequency;
+    float caveRadius;
+    float caveMinDepth;
+
+    float dirtDepth;
+    float deepHeight; // Deep stone below it
+    float bottom;     // Nothing below it
+} Terrain;
+
+// Rolling hills around y = 0 with caves down to y = -96
+void terrain_init(Terrain* terrain, uint32_t seed);
+
+// Fills width x height x depth voxels starting at the world voxel origin, slices of z spread over the job system
+bool terrain_generate(const Terrain* terrain, IVec3 origin, uint32_t width, uint32_t height, uint32_t depth,
+    uint8_t* voxels);
+
+// WORLD_CHUNK_VOLUME voxels of the chunk at coords on the calling thread, a ChunkGenerator with the terrain as user
+bool terrain_generate_chunk(IVec3 coords, uint8_t* voxels, void* terrain);
+
+// One chunk per job, voxels[i] of WORLD_CHUNK_VOLUME for coords[i]
+bool terrain_generate_chunks(const Terrain* terrain, const IVec3* coords, uint32_t count, uint8_t** voxels);
+
+// Chunks per second of a grid of chunkCount surface chunks over 1 to every thread, checks every thread count
+// gives the same voxels and that a region across chunks matches them. Restarts the job system at every count
+bool terrain_benchmark(uint32_t chunkCount);
+
+#endif // TERRAIN_H_
@@ -0,0 +1,392 @@
+#include "world.h"
+#include "region.h"
+
+#include "core/jobs.h"
+#include "core/core.h"
+
+#include "voxel/bounds.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WORLD_MIN_SLOTS 64
+
+static uint32_t world_hash(IVec3 coords)
+{
+    uint32_t hash = (uint32_t) coords.x * 0x8DA6B343u ^ (uint32_t) coords.y * 0xD8163841u ^
+        (uint32_t) coords.z * 0xCB1AB31Fu;
+
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static bool world_grow_slots(World* world)
+{
+    size_t slotCount = world->slotCount > 0 ? world->slotCount * 2 : WORLD_MIN_SLOTS;
+
+    Chunk* slots = (Chunk*) calloc(slotCount, sizeof(Chunk));
+    if(slots == NULL)
+        return false;
+
+    for(size_t i = 0; i < world->slotCount; ++i)
+    {
+        if(world->slots[i].state == CHUNK_FREE)
+            continue;
+
+        size_t slot = world->slots[i].hash & (slotCount - 1);
+        while(slots[slot].state != CHUNK_FREE)
+            slot = (slot + 1) & (slotCount - 1);
+
+        slots[slot] = world->slots[i];
+    }
+
+    free(world->slots);
+    world->slots     = slots;
+    world->slotCount = slotCount;
+    return true;
+}
+
+// Slot of the chunk at coords, or the free slot where it goes
+static bool world_lookup(const World* world, IVec3 coords, uint32_t hash, size_t* slot)
+{
+    *slot = hash & (world->slotCount - 1);
+
+    while(world->slots[*slot].state != CHUNK_FREE)
+    {
+        const Chunk* chunk = &world->slots[*slot];
+        if(chunk->hash == hash && chunk->coords.x == coords.x && chunk->coords.y == coords.y &&
+            chunk->coords.z == coords.z)
+            return true;
+
+        *slot = (*slot + 1) & (world->slotCount - 1);
+    }
+
+    return false;
+}
+
+static bool world_upload_chunk(World* world, Chunk* chunk)
+{
+    chunk->volume   = WORLD_NO_VOLUME;
+    chunk->instance = 0;
+
+    // Empty chunks are only remembered as loaded
+    uint32_t min[3], max[3];
+    if(!bounds_scan(chunk->voxels, WORLD_CHUNK_SIZE, WORLD_CHUNK_SIZE, WORLD_CHUNK_SIZE, min, max))
+    {
+        free(chunk->voxels);
+        chunk->voxels = NULL;
+        return true;
+    }
+
+    world->memory += WORLD_CHUNK_VOLUME;
+    if(!world->upload)
+        return true;
+
+    if(!raytracing_create_volume(WORLD_CHUNK_SIZE, WORLD_CHUNK_SIZE, WORLD_CHUNK_SIZE, chunk->voxels,
+        world->backend, world->bounds, &chunk->volume))
+        return false;
+
+    Vec3 p = {
+        (float) chunk->coords.x * WORLD_CHUNK_SIZE,
+        (float) chunk->coords.y * WORLD_CHUNK_SIZE,
+        (float) chunk->coords.z * WORLD_CHUNK_SIZE,
+    };
+
+    Mat4 transform;
+    mat4_identity(&transform);
+    mat4_scale(&transform, &(Vec3){ world->scale, world->scale, world->scale });
+    mat4_translate(&transform, &p, &transform);
+
+    VkTransformMatrixKHR outTransform;
+    mat4_to_vk_transform(&transform, &outTransform);
+
+    chunk->instance = raytracing_instance_index(raytracing_add_volume_instance(chunk->volume, &outTransform));
+    return true;
+}
+
+static void world_release_chunk(World* world, Chunk* chunk)
+{
+    if(chunk->volume != WORLD_NO_VOLUME)
+    {
+        raytracing_remove_instance(chunk->instance);
+        raytracing_remove_volume(chunk->volume);
+    }
+
+    if(chunk->voxels != NULL)
+        world->memory -= WORLD_CHUNK_VOLUME;
+
+    free(chunk->voxels);
+    chunk->voxels = NULL;
+    chunk->volume = WORLD_NO_VOLUME;
+}
+
+bool world_create(World* world, float scale, VolumeBackend backend, VolumeBounds bounds)
+{
+    *world = (World) {
+        .scale   = scale,
+        .backend = backend,
+        .bounds  = bounds,
+        .upload  = true,
+    };
+
+    if(backend == VOLUME_BACKEND_DAG)
+    {
+        log_error("World chunks can't use DAG volumes, they are never removed");
+        return false;
+    }
+
+    return world_grow_slots(world);
+}
+
+bool world_create_headless(World* world, float scale)
+{
+    *world = (World) {
+        .scale = scale,
+    };
+
+    return world_grow_slots(world);
+}
+
+void world_destroy(World* world)
+{
+    for(size_t i = 0; i < world->slotCount; ++i)
+        if(world->slots[i].state != CHUNK_FREE)
+            free(world->slots[i].voxels);
+
+    free(world->slots);
+    *world = (World) {0};
+}
+
+Chunk* world_get(const World* world, IVec3 coords)
+{
+    size_t slot;
+    if(!world_lookup(world, coords, world_hash(coords), &slot))
+        return NULL;
+
+    return &world->slots[slot];
+}
+
+// Slot of the chunk at coords, a new loading one when there is none
+static bool world_insert(World* world, IVec3 coords, size_t* slot, bool* found)
+{
+    // At most half full, the probes stay short
+    if((world->slotUsed + 1) * 2 > world->slotCount && !world_grow_slots(world))
+        return false;
+
+    uint32_t hash = world_hash(coords);
+
+    *found = world_lookup(world, coords, hash, slot);
+    if(*found)
+        return true;
+
+    world->slots[*slot] = (Chunk) {
+        .coords = coords,
+        .hash   = hash,
+        .state  = CHUNK_LOADING,
+        .volume = WORLD_NO_VOLUME,
+    };
+    ++world->slotUsed;
+    return true;
+}
+
+bool world_reserve_chunk(World* world, IVec3 coords)
+{
+    size_t slot;
+    bool found;
+    return world_insert(world, coords, &slot, &found) && !found;
+}
+
+bool world_add_chunk(World* world, IVec3 coords, uint8_t* voxels)
+{
+    size_t slot;
+    bool found;
+    if(!world_insert(world, coords, &slot, &found))
+    {
+        free(voxels);
+        return false;
+    }
+
+    Chunk* chunk = &world->slots[slot];
+    world_release_chunk(world, chunk);
+
+    chunk->state  = CHUNK_LOADED;
+    chunk->voxels = voxels;
+
+    if(world_upload_chunk(world, chunk))
+        return true;
+
+    // Volume left as WORLD_NO_VOLUME, dropping the chunk only frees its voxels
+    world_remove_chunk(world, coords);
+    return false;
+}
+
+bool world_remove_chunk(World* world, IVec3 coords)
+{
+    size_t slot;
+    if(!world_lookup(world, coords, world_hash(coords), &slot))
+        return false;
+
+    world_release_chunk(world, &world->slots[slot]);
+    world->slots[slot].state = CHUNK_FREE;
+    --world->slotUsed;
+
+    // Backward shift: every following chunk of the cluster that may live in the hole moves into it,
+    // no tombstones are left behind for the lookups to walk over
+    size_t mask = world->slotCount - 1;
+    size_t hole = slot;
+    for(size_t next = (hole + 1) & mask; world->slots[next].state != CHUNK_FREE; next = (next + 1) & mask)
+    {
+        size_t home = world->slots[next].hash & mask;
+
+        // Stays when its home lies cyclically in (hole, next]
+        bool stays = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if(stays)
+            continue;
+
+        world->slots[hole] = world->slots[next];
+        world->slots[next].state = CHUNK_FREE;
+        hole = next;
+    }
+
+    return true;
+}
+
+bool world_save(const World* world, const char* directory)
+{
+    IVec3* regions = (IVec3*) malloc(world->slotUsed * sizeof(IVec3) + 1);
+    if(regions == NULL)
+        return false;
+
+    size_t regionCount = 0;
+    for(size_t i = 0; i < world->slotCount; ++i)
+    {
+        const Chunk* chunk = &world->slots[i];
+        if(chunk->state != CHUNK_LOADED)
+            continue;
+
+        IVec3 coords = region_of_chunk(chunk->coords);
+
+        size_t r = 0;
+        while(r < regionCount && memcmp(&regions[r], &coords, sizeof(IVec3)) != 0)
+            ++r;
+
+        if(r == regionCount)
+            regions[regionCount++] = coords;
+    }
+
+    bool result = true;
+    for(size_t r = 0; r < regionCount && result; ++r)
+    {
+        Region region;
+        if(!region_open(&region, directory, regions[r]))
+        {
+            result = false;
+            break;
+        }
+
+        for(size_t i = 0; i < world->slotCount && result; ++i)
+        {
+            const Chunk* chunk = &world->slots[i];
+            if(chunk->state != CHUNK_LOADED)
+                continue;
+
+            IVec3 coords = region_of_chunk(chunk->coords);
+            if(memcmp(&regions[r], &coords, sizeof(IVec3)) != 0)
+                continue;
+
+            result = region_write_voxels(&region, chunk->coords, chunk->voxels);
+        }
+
+        result = result && region_commit(&region);
+        region_close(&region);
+    }
+
+    free(regions);
+    return result;
+}
+
+typedef struct {
+    IVec3          coords;
+    const uint8_t* data;
+    size_t         size;
+    uint8_t*       voxels;
+} WorldLoadChunk;
+
+static void world_decode_chunks(uint32_t begin, uint32_t end, void* data)
+{
+    WorldLoadChunk* chunks = (WorldLoadChunk*) data;
+    for(uint32_t i = begin; i < end; ++i)
+    {
+        WorldLoadChunk* chunk = &chunks[i];
+        if(chunk->data == NULL)
+            memset(chunk->voxels, 0, WORLD_CHUNK_VOLUME);
+        else if(!codec_decode(chunk->data, chunk->size, chunk->voxels, WORLD_CHUNK_VOLUME))
+        {
+            free(chunk->voxels);
+            chunk->voxels = NULL;
+        }
+    }
+}
+
+bool world_load_region(World* world, const char* directory, IVec3 regionCoords)
+{
+    Region region;
+    if(!region_open(&region, directory, regionCoords))
+        return false;
+
+    WorldLoadChunk* chunks = (WorldLoadChunk*) malloc(REGION_CHUNKS * sizeof(WorldLoadChunk));
+    if(chunks == NULL)
+    {
+        region_close(&region);
+        return false;
+    }
+
+    // Nothing is written to the region, the map never moves and every pointer stays valid
+    bool result = true;
+    uint32_t count = 0;
+    for(int z = 0; z < REGION_SIZE && result; ++z)
+        for(int y = 0; y < REGION_SIZE && result; ++y)
+            for(int x = 0; x < REGION_SIZE && result; ++x)
+            {
+                WorldLoadChunk* chunk = &chunks[count];
+                chunk->coords = (IVec3) {
+                    regionCoords.x * REGION_SIZE + x,
+                    regionCoords.y * REGION_SIZE + y,
+                    regionCoords.z * REGION_SIZE + z,
+                };
+
+                if(!region_read_chunk(&region, chunk->coords, &chunk->data, &chunk->size))
+                    continue;
+
+                chunk->voxels = (uint8_t*) malloc(WORLD_CHUNK_VOLUME);
+                result = chunk->voxels != NULL;
+                count += result;
+            }
+
+    // Decoded on the job system, the chunks are added in order on this thread
+    if(result)
+        jobs_parallel_for(count, 4, world_decode_chunks, chunks);
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(!result)
+        {
+            free(chunks[i].voxels);
+            continue;
+        }
+
+        if(chunks[i].voxels == NULL)
+        {
+            log_error("Region chunk %d,%d,%d corrupted", chunks[i].coords.x, chunks[i].coords.y, chunks[i].coords.z);
+            continue;
+        }
+
+        result = world_add_chunk(world, chunks[i].coords, chunks[i].voxels);
+    }
+
+    free(chunks);
+    region_close(&region);
+    return result;
+}
@@ -0,0 +1,88 @@
+#ifndef WORLD_H_
+#define WORLD_H_
+
+#include "core/vec.h"
+
+#include "render/raytracing.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ *  Voxel world cut in WORLD_CHUNK_SIZE^3 chunks keyed by their integer coordinates. The chunks
+ *  live in an open addressing table, linear probing with backward shift deletion, so lookups,
+ *  inserts and removes stay O(1) and chunks come and go while the world is rendered.
+ *
+ *  Every chunk owns its voxels, its raytracing volume with its BLAS and the TLAS instance placing
+ *  it at coords * WORLD_CHUNK_SIZE * scale. Adding or removing one touches its own volume and
+ *  instance slots only, see raytracing_create_volume and raytracing_remove_volume. Chunks without
+ *  any non zero voxel keep neither voxels nor volume. A chunk can be reserved while its voxels
+ *  are still being produced, see world/stream.h.
+ *
+ *  Chunk pointers are only valid until the next world_add_chunk or world_remove_chunk.
+ */
+
+#define WORLD_CHUNK_SIZE   32
+#define WORLD_CHUNK_VOLUME (WORLD_CHUNK_SIZE * WORLD_CHUNK_SIZE * WORLD_CHUNK_SIZE)
+
+#define WORLD_NO_VOLUME UINT32_MAX
+
+typedef enum {
+    CHUNK_FREE,    // Free slot of the table
+    CHUNK_LOADING, // Reserved, its voxels are on their way
+    CHUNK_LOADED,
+} ChunkState;
+
+typedef struct {
+    IVec3      coords;
+    uint32_t   hash;
+    ChunkState state;
+    uint8_t*   voxels;   // WORLD_CHUNK_VOLUME, x fastest. NULL when every voxel is zero
+    uint32_t   volume;   // objIndex of its raytracing volume, WORLD_NO_VOLUME without voxels
+    uint32_t   instance;
+    uint32_t   lastUsed; // Stamp of the last time it was wanted, for the LRU eviction of the streaming
+} Chunk;
+
+typedef struct {
+    Chunk* slots;
+    size_t slotCount;
+    size_t slotUsed;
+
+    size_t memory; // Voxel bytes of the loaded chunks
+
+    float         scale;
+    VolumeBackend backend;
+    VolumeBounds  bounds;
+    bool          upload; // False keeps the chunks on the host, without volumes
+} World;
+
+// DAG volumes share their nodes and can't be removed, the other backends can
+bool world_create(World* world, float scale, VolumeBackend backend, VolumeBounds bounds);
+
+// Host only world for the tools and the headless simulations, nothing reaches the raytracer
+bool world_create_headless(World* world, float scale);
+
+// Frees the voxels and the table, the volumes and instances are left to raytracing_destroy
+void world_destroy(World* world);
+
+// NULL when there is no chunk at coords, loaded or loading
+Chunk* world_get(const World* world, IVec3 coords);
+
+// Loading chunk at coords until world_add_chunk fills it, false when a chunk is already there
+bool world_reserve_chunk(World* world, IVec3 coords);
+
+// Takes ownership of the malloc'd voxels, replaces the chunk already at coords
+bool world_add_chunk(World* world, IVec3 coords, uint8_t* voxels);
+
+// Frees the voxels, removes the instance and the volume. False when there is no chunk at coords
+bool world_remove_chunk(World* world, IVec3 coords);
+
+// Writes and commits every loaded chunk to the region files of directory with their codecs, see world/region.h
+bool world_save(const World* world, const char* directory);
+
+// Adds every chunk stored in the region at regionCoords, replacing the chunks already there. The chunks are
+// decoded over the job system
+bool world_load_region(World* world, const char* directory, IVec3 regionCoords);
+
+#endif // WORLD_H_